@@ -6,10 +6,19 @@
 #include <memory.h>  // bzero
 
 #include <stdio.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "tables.h"
 
+// AES_EncipherLanes uses the AES instructions (AES-NI) when the CPU has
+// them; defining CIPH_NO_SIMD leaves only the portable code
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(CIPH_NO_SIMD)
+#define AES_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 // number of 32 bit words in the state == 16 bytes
 #define Nb 4
 // number of 32 bit words in the key: one of 4, 6, 8 == 16, 24, 32 bytes
@@ -23,6 +32,8 @@
 #define STATE_NROWS 4
 #define STATE_NCOLS Nb
 #define STATE_SIZE (STATE_NROWS * STATE_NCOLS)
+// size in bytes of the largest key schedule (Nk == 8, i.e., a 256 bit key)
+#define AES_MAX_SCHEDULE_SIZE (4 * Nb * (GET_Nr(8) + 1))
 
 // irriducible polynomial in GF(2^8)
 #define IPOLY 0X1b
@@ -65,6 +76,48 @@ void AES_Decipher(byte input[], byte key[], size_t Nk, byte output[]);
 void AES_InvShiftRows(byte state[]);
 void AES_InvMixColumns(byte state[]);
 
+// an expanded key schedule. generating the schedule costs more than
+// enciphering a single block, so bulk operations should build one
+// context per key and reuse it for every block
+typedef struct {
+    size_t Nk;
+    byte schedule[AES_MAX_SCHEDULE_SIZE];
+} AES_KeyCtx;
+
+void AES_InitKeyCtx(AES_KeyCtx* ctx, byte key[], size_t Nk);
+void AES_EncipherBlock(const AES_KeyCtx* ctx, const byte input[], byte output[]);
+void AES_DecipherBlock(const AES_KeyCtx* ctx, const byte input[], byte output[]);
+// transforms nBlocks consecutive blocks of input into output. input and
+// output may be the same buffer
+void AES_EncipherBlocks(const AES_KeyCtx* ctx, const byte input[], size_t nBlocks, byte output[]);
+void AES_DecipherBlocks(const AES_KeyCtx* ctx, const byte input[], size_t nBlocks, byte output[]);
+
+// max number of blocks of AES_EncipherLanes
+#define AES_MAX_LANES 8
+// implementations of AES_EncipherLanes besides the portable one
+#define AES_AESNI 0x1
+
+// enciphers n (at most AES_MAX_LANES) independent blocks in place,
+// block i under ctxs[i]. with AES-NI, the rounds of all the blocks are
+// interleaved, so they run about as fast as a single block
+void AES_EncipherLanes(const AES_KeyCtx* const ctxs[], byte blocks[], size_t n);
+// returns the AES_* implementations the CPU supports
+unsigned AES_Supported(void);
+// restricts the implementations in use to mask (e.g., 0 for the
+// portable one only, for testing). returns those now in use
+unsigned AES_Use(unsigned mask);
+
+// internal helpers
+void AES_Detect(void);
+#ifdef AES_X86
+void AES_EncipherLanesNi(const AES_KeyCtx* const ctxs[], byte blocks[], size_t n);
+#endif
+
+// implementations supported and in use, set once by AES_Detect
+unsigned AES_supported = 0;
+unsigned AES_used = 0;
+pthread_once_t AES_detectOnce = PTHREAD_ONCE_INIT;
+
 // helper functions:
 // byte AES_MultiplyBytes(byte a, byte b);
 // byte AES_AddBytes(byte a, byte b);
@@ -150,14 +203,25 @@ void AES_Rcon_i(size_t i, byte result[]) {
 }
 
 void AES_Encipher(byte input[], byte key[], size_t Nk, byte output[]) {
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, Nk);
+    AES_EncipherBlock(&ctx, input, output);
+}
+
+void AES_InitKeyCtx(AES_KeyCtx* ctx, byte key[], size_t Nk) {
+    ctx->Nk = Nk;
+    AES_GenerateKeySchedule(key, Nk, ctx->schedule);
+}
+
+void AES_EncipherBlock(const AES_KeyCtx* ctx, const byte input[], byte output[]) {
+    size_t Nk = ctx->Nk;
+    // the round functions take non-const arrays, but never write
+    // to the round keys
+    byte* schedule = (byte*) ctx->schedule;
     byte state[STATE_SIZE];
     // copy input into the state
     memcpy(state, input, STATE_SIZE);
 
-    // create key schedule
-    byte schedule[4 * Nb * (GET_Nr(Nk) + 1)];
-    AES_GenerateKeySchedule(key, Nk, schedule);
-
     AES_AddRoundKey(state, schedule);
 
     for (size_t i = 1; i < GET_Nr(Nk); i++) {
@@ -174,6 +238,82 @@ void AES_Encipher(byte input[], byte key[], size_t Nk, byte output[]) {
     memcpy(output, state, STATE_NROWS * STATE_NCOLS);
 }
 
+void AES_EncipherBlocks(const AES_KeyCtx* ctx, const byte input[], size_t nBlocks, byte output[]) {
+    for (size_t i = 0; i < nBlocks; i++) {
+        AES_EncipherBlock(ctx, input + i * STATE_SIZE, output + i * STATE_SIZE);
+    }
+}
+
+void AES_Detect(void) {
+#ifdef AES_X86
+    unsigned a, b, c, d;
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES) && (c & bit_SSE2)) {
+        AES_supported |= AES_AESNI;
+    }
+#endif
+    AES_used = AES_supported;
+}
+
+unsigned AES_Supported(void) {
+    pthread_once(&AES_detectOnce, AES_Detect);
+    return AES_supported;
+}
+
+unsigned AES_Use(unsigned mask) {
+    AES_used = AES_Supported() & mask;
+    return AES_used;
+}
+
+void AES_EncipherLanes(const AES_KeyCtx* const ctxs[], byte blocks[], size_t n) {
+    pthread_once(&AES_detectOnce, AES_Detect);
+#ifdef AES_X86
+    if (AES_used & AES_AESNI) {
+        AES_EncipherLanesNi(ctxs, blocks, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        AES_EncipherBlock(ctxs[i], blocks + i * STATE_SIZE, blocks + i * STATE_SIZE);
+    }
+}
+
+#ifdef AES_X86
+__attribute__((target("aes,sse2")))
+void AES_EncipherLanesNi(const AES_KeyCtx* const ctxs[], byte blocks[], size_t n) {
+    // the schedule holds the round keys in the byte order of the state,
+    // which is the order aesenc takes them in
+    __m128i state[AES_MAX_LANES];
+    size_t nRounds[AES_MAX_LANES];
+    size_t minRounds = GET_Nr(8), maxRounds = 0;
+    for (size_t i = 0; i < n; i++) {
+        nRounds[i] = GET_Nr(ctxs[i]->Nk);
+        minRounds = (nRounds[i] < minRounds) ? nRounds[i] : minRounds;
+        maxRounds = (nRounds[i] > maxRounds) ? nRounds[i] : maxRounds;
+        state[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (blocks + i * STATE_SIZE)),
+                                 _mm_loadu_si128((const __m128i*) ctxs[i]->schedule));
+    }
+    // the rounds every block has, without branches so they overlap
+    for (size_t r = 1; r < minRounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            state[i] = _mm_aesenc_si128(state[i], _mm_loadu_si128((const __m128i*) (ctxs[i]->schedule + r * STATE_SIZE)));
+        }
+    }
+    for (size_t r = minRounds; r <= maxRounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            __m128i roundKey = _mm_loadu_si128((const __m128i*) (ctxs[i]->schedule + r * STATE_SIZE));
+            if (r < nRounds[i]) {
+                state[i] = _mm_aesenc_si128(state[i], roundKey);
+            } else if (r == nRounds[i]) {
+                state[i] = _mm_aesenclast_si128(state[i], roundKey);
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        _mm_storeu_si128((__m128i*) (blocks + i * STATE_SIZE), state[i]);
+    }
+}
+#endif
+
 void AES_ShiftRows(byte state[]) {
     for (size_t r = 1; r < STATE_NROWS; r++) {
         for (size_t i = 0; i < r; i++) {
@@ -232,14 +372,18 @@ void AES_AddRoundKey(byte state[], byte roundKey[]) {
 // inverse functions
 
 void AES_Decipher(byte input[], byte key[], size_t Nk, byte output[]) {
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, Nk);
+    AES_DecipherBlock(&ctx, input, output);
+}
+
+void AES_DecipherBlock(const AES_KeyCtx* ctx, const byte input[], byte output[]) {
+    size_t Nk = ctx->Nk;
+    byte* schedule = (byte*) ctx->schedule;
     byte state[STATE_NROWS * STATE_NCOLS];
     // copy input into the state
     memcpy(state, input, STATE_NROWS * STATE_NCOLS);
 
-    // create key schedule
-    byte schedule[4 * Nb * (GET_Nr(Nk) + 1)];
-    AES_GenerateKeySchedule(key, Nk, schedule);
-
     AES_AddRoundKey(state, &(schedule[STATE_NROWS * STATE_NCOLS * GET_Nr(Nk)]));
 
 
@@ -258,6 +402,12 @@ void AES_Decipher(byte input[], byte key[], size_t Nk, byte output[]) {
     memcpy(output, state, STATE_NROWS * STATE_NCOLS);
 }
 
+void AES_DecipherBlocks(const AES_KeyCtx* ctx, const byte input[], size_t nBlocks, byte output[]) {
+    for (size_t i = 0; i < nBlocks; i++) {
+        AES_DecipherBlock(ctx, input + i * STATE_SIZE, output + i * STATE_SIZE);
+    }
+}
+
 void AES_InvShiftRows(byte state[]) {
     // TODO: optimize
     for (size_t r = 1; r < STATE_NROWS; r++) {
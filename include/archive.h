@@ -0,0 +1,641 @@
+#ifndef CC_ARCHIVE_H_
+#define CC_ARCHIVE_H_
+
+// packs a directory tree into a single chunked container (see
+// container.h) with CRYPT_HDR_ARCHIVE set in its header. the contents of
+// the files are concatenated, so many small files share chunks and the
+// cipher runs over whole chunks instead of one padded range per file.
+//
+// the plaintext of an archive is laid out as:
+//     the contents of every member, back to back
+//     the index: for each member, a Crypt_MemberEntry followed by the
+//                member's name and a NUL byte
+//     Crypt_ArchiveFooter
+//
+// the index is enciphered like the rest of the plaintext, so names and
+// sizes are not visible without the key. to extract one member, only
+// the chunks holding the footer, the index and that member are read and
+// deciphered (chunks are located with Crypt_IndexChunks).
+//
+// member names are paths relative to the packed directory, separated by
+// '/'. only regular files are packed; directories are recreated from
+// the names of their members, and other file types (e.g., symbolic
+// links) are skipped.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "container.h"
+
+typedef struct {
+    uint64_t offset;  // offset of the member's first byte in the plaintext
+    uint64_t size;
+    int64_t mtime;  // seconds since the epoch
+    uint32_t mode;  // permission bits
+    uint32_t nameLen;  // followed by nameLen bytes of name and a NUL byte
+} Crypt_MemberEntry;
+
+typedef struct {
+    uint64_t nMembers;
+    uint64_t indexSize;  // bytes of index right before the footer
+} Crypt_ArchiveFooter;
+
+typedef struct {
+    Crypt_MemberEntry entry;
+    const char* name;  // points into the archive's index
+} Crypt_Member;
+
+typedef struct {
+    FILE* file;
+    AES_KeyCtx ctx;
+    uint32_t chunkSize;
+    bool compress;
+    // plaintext waiting to fill the current chunk
+    byte* raw;
+    size_t nRaw;
+    byte* payload;
+    uint64_t rawSize;  // plaintext bytes written so far
+    // the index, written after the last member
+    byte* index;
+    size_t nIndex, capIndex;
+    uint64_t nMembers;
+} Crypt_ArchiveWriter;
+
+typedef struct {
+    FILE* file;
+    AES_KeyCtx ctx;
+    Crypt_ChunkIndex chunks;
+    byte* payload;
+    byte* scratch;
+    // the most recently deciphered chunk
+    size_t cached;
+    const byte* data;
+    byte* index;
+    Crypt_Member* members;
+    size_t nMembers;
+} Crypt_Archive;
+
+// packs the regular files under dirIn into the archive fnameOut. flags
+// may contain CRYPT_HDR_COMPRESSED
+Crypt_Error_t Crypt_Pack(const char* dirIn, const char* fnameKey, const char* fnameOut, uint16_t flags);
+// extracts the member named member (or every member if it is NULL) from
+// the archive fnameIn into the directory dirOut
+Crypt_Error_t Crypt_Unpack(const char* fnameIn, const char* fnameKey, const char* dirOut, const char* member);
+
+Crypt_Error_t Crypt_ArchiveWriterOpen(Crypt_ArchiveWriter* w, const char* fname, const char* fnameKey, uint16_t flags);
+Crypt_Error_t Crypt_ArchiveWriteData(Crypt_ArchiveWriter* w, const byte data[], size_t nBytes);
+// adds the file at path as a member named name
+Crypt_Error_t Crypt_ArchiveAddFile(Crypt_ArchiveWriter* w, const char* path, const char* name);
+// adds the files under the directory at path, naming them prefix/...
+Crypt_Error_t Crypt_ArchiveAddDir(Crypt_ArchiveWriter* w, const char* path, const char* prefix);
+// writes the index and the footer, and closes the archive. err is the
+// result of the writes so far; if it is not CRYPT_E_SUCCESS, the archive
+// is only closed
+Crypt_Error_t Crypt_ArchiveWriterClose(Crypt_ArchiveWriter* w, Crypt_Error_t err);
+
+// reads the chunk headers and the member index of an archive
+Crypt_Error_t Crypt_ArchiveOpen(Crypt_Archive* a, const char* fname, const char* fnameKey);
+void Crypt_ArchiveClose(Crypt_Archive* a);
+// returns the member called name, or NULL if there is none
+const Crypt_Member* Crypt_ArchiveFind(const Crypt_Archive* a, const char* name);
+// copies nBytes of plaintext starting at offset into buf
+Crypt_Error_t Crypt_ArchiveRead(Crypt_Archive* a, uint64_t offset, byte buf[], size_t nBytes);
+// writes the contents of member to fnameOut and restores its mode and mtime
+Crypt_Error_t Crypt_ArchiveExtract(Crypt_Archive* a, const Crypt_Member* member, const char* fnameOut);
+
+// internal helpers
+// deciphers the chunk holding offset and points *data at offset within
+// it; *nAvail is the number of bytes from there to the end of the chunk
+Crypt_Error_t Crypt_ArchiveLocate(Crypt_Archive* a, uint64_t offset, const byte** data, size_t* nAvail);
+// flushes the current chunk if it is full (or if it is not empty and
+// force is true)
+Crypt_Error_t Crypt_ArchiveFlush(Crypt_ArchiveWriter* w, bool force);
+// returns a malloc'd "dir/name" (or a copy of name if dir is empty)
+char* Crypt_JoinPath(const char* dir, const char* name);
+// true if name is relative and has no "." or ".." components, so
+// extracting it cannot write outside the output directory
+bool Crypt_IsSafeName(const char* name);
+// creates the directories leading up to the last component of path
+Crypt_Error_t Crypt_MakeParents(const char* path, size_t nSkip);
+
+char* Crypt_JoinPath(const char* dir, const char* name) {
+    size_t dirLen = strlen(dir);
+    size_t nameLen = strlen(name);
+    char* path = (char*) malloc(dirLen + nameLen + 2);
+    if (!path) {
+        return NULL;
+    }
+    if (dirLen == 0) {
+        memcpy(path, name, nameLen + 1);
+        return path;
+    }
+    memcpy(path, dir, dirLen);
+    path[dirLen] = '/';
+    memcpy(path + dirLen + 1, name, nameLen + 1);
+    return path;
+}
+
+bool Crypt_IsSafeName(const char* name) {
+    if (name[0] == '\0' || name[0] == '/') {
+        return false;
+    }
+    const char* component = name;
+    for (;;) {
+        const char* end = strchr(component, '/');
+        size_t len = (end) ? (size_t) (end - component) : strlen(component);
+        if (len == 0 || (len == 1 && component[0] == '.') ||
+            (len == 2 && component[0] == '.' && component[1] == '.')) {
+            return false;
+        }
+        if (!end) {
+            return true;
+        }
+        component = end + 1;
+    }
+}
+
+Crypt_Error_t Crypt_MakeParents(const char* path, size_t nSkip) {
+    // the first nSkip bytes (the output directory) must already exist
+    char* dir = strdup(path);
+    if (!dir) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    for (char* slash = strchr(dir + nSkip + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            err = CRYPT_E_IO;
+            break;
+        }
+        *slash = '/';
+    }
+    free(dir);
+    return err;
+}
+
+Crypt_Error_t Crypt_ArchiveWriterOpen(Crypt_ArchiveWriter* w, const char* fname, const char* fnameKey, uint16_t flags) {
+    memset(w, 0, sizeof(Crypt_ArchiveWriter));
+    // before the archive is created
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_InitKeyCtx(&w->ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+    w->chunkSize = CRYPT_CHUNK_SIZE;
+    w->compress = flags & CRYPT_HDR_COMPRESSED;
+
+    Crypt_Header hdr;
+    memset(&hdr, 0, sizeof(Crypt_Header));
+    memcpy(hdr.magic, CRYPT_MAGIC, CRYPT_MAGIC_SIZE);
+    hdr.version = CRYPT_CONTAINER_VERSION;
+    // archives are written without a tree
+    hdr.flags = (uint16_t) ((flags & ~CRYPT_HDR_MERKLE) | CRYPT_HDR_ARCHIVE);
+    hdr.chunkSize = w->chunkSize;
+    hdr.keySize = (uint8_t) keySize;
+
+    w->raw = (byte*) malloc(w->chunkSize);
+    w->payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(w->chunkSize));
+    if (!w->raw || !w->payload) {
+        free(w->raw);
+        free(w->payload);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    w->file = fopen(fname, "wb");
+    if (!w->file || fwrite(&hdr, sizeof(Crypt_Header), 1, w->file) != 1) {
+        if (w->file) {
+            fclose(w->file);
+        }
+        free(w->raw);
+        free(w->payload);
+        return CRYPT_E_IO;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_ArchiveFlush(Crypt_ArchiveWriter* w, bool force) {
+    if (w->nRaw == w->chunkSize || (force && w->nRaw > 0)) {
+        Crypt_Error_t err = Crypt_WriteChunk(w->file, &w->ctx, w->raw, w->nRaw, w->compress, w->payload, NULL);
+        w->nRaw = 0;
+        return err;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_ArchiveWriteData(Crypt_ArchiveWriter* w, const byte data[], size_t nBytes) {
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    while (err == CRYPT_E_SUCCESS && nBytes > 0) {
+        size_t n = MIN(nBytes, w->chunkSize - w->nRaw);
+        memcpy(w->raw + w->nRaw, data, n);
+        w->nRaw += n;
+        w->rawSize += n;
+        data += n;
+        nBytes -= n;
+        err = Crypt_ArchiveFlush(w, false);
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_ArchiveAddFile(Crypt_ArchiveWriter* w, const char* path, const char* name) {
+    FILE* file = fopen(path, "rb");
+    struct stat st;
+    if (!file || fstat(fileno(file), &st) != 0) {
+        if (file) {
+            fclose(file);
+        }
+        return CRYPT_E_IO;
+    }
+
+    Crypt_MemberEntry entry;
+    memset(&entry, 0, sizeof(Crypt_MemberEntry));
+    entry.offset = w->rawSize;
+    entry.mtime = (int64_t) st.st_mtime;
+    entry.mode = (uint32_t) (st.st_mode & 07777);
+    entry.nameLen = (uint32_t) strlen(name);
+
+    // read straight into the chunk buffer, so the file's bytes are
+    // copied once on their way to the cipher
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    while (err == CRYPT_E_SUCCESS) {
+        size_t nRead = fread(w->raw + w->nRaw, sizeof(byte), w->chunkSize - w->nRaw, file);
+        if (nRead == 0) {
+            if (ferror(file)) {
+                err = CRYPT_E_IO;
+            }
+            break;
+        }
+        w->nRaw += nRead;
+        w->rawSize += nRead;
+        entry.size += nRead;
+        err = Crypt_ArchiveFlush(w, false);
+    }
+    fclose(file);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+
+    size_t nEntry = sizeof(Crypt_MemberEntry) + entry.nameLen + 1;
+    if (w->nIndex + nEntry > w->capIndex) {
+        size_t capacity = (w->capIndex) ? w->capIndex : CRYPT_CP_BUF_SIZE;
+        while (capacity < w->nIndex + nEntry) {
+            capacity *= 2;
+        }
+        byte* index = (byte*) realloc(w->index, capacity);
+        if (!index) {
+            return CRYPT_E_MEMORY_ALLOCATION;
+        }
+        w->index = index;
+        w->capIndex = capacity;
+    }
+    memcpy(w->index + w->nIndex, &entry, sizeof(Crypt_MemberEntry));
+    memcpy(w->index + w->nIndex + sizeof(Crypt_MemberEntry), name, entry.nameLen + 1);
+    w->nIndex += nEntry;
+    w->nMembers++;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_ArchiveAddDir(Crypt_ArchiveWriter* w, const char* path, const char* prefix) {
+    // sorted, so packing the same tree twice gives the same archive
+    struct dirent** entries;
+    int nEntries = scandir(path, &entries, NULL, alphasort);
+    if (nEntries < 0) {
+        return CRYPT_E_IO;
+    }
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    for (int i = 0; i < nEntries; i++) {
+        const char* dname = entries[i]->d_name;
+        if (err != CRYPT_E_SUCCESS || strcmp(dname, ".") == 0 || strcmp(dname, "..") == 0) {
+            continue;
+        }
+        char* childPath = Crypt_JoinPath(path, dname);
+        char* childName = Crypt_JoinPath(prefix, dname);
+        struct stat st;
+        if (!childPath || !childName) {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+        } else if (lstat(childPath, &st) != 0) {
+            err = CRYPT_E_IO;
+        } else if (S_ISDIR(st.st_mode)) {
+            err = Crypt_ArchiveAddDir(w, childPath, childName);
+        } else if (S_ISREG(st.st_mode)) {
+            err = Crypt_ArchiveAddFile(w, childPath, childName);
+        }
+        free(childPath);
+        free(childName);
+    }
+
+    for (int i = 0; i < nEntries; i++) {
+        free(entries[i]);
+    }
+    free(entries);
+    return err;
+}
+
+Crypt_Error_t Crypt_ArchiveWriterClose(Crypt_ArchiveWriter* w, Crypt_Error_t err) {
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_ArchiveWriteData(w, w->index, w->nIndex);
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        Crypt_ArchiveFooter footer;
+        footer.nMembers = w->nMembers;
+        footer.indexSize = w->nIndex;
+        err = Crypt_ArchiveWriteData(w, (const byte*) &footer, sizeof(Crypt_ArchiveFooter));
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_ArchiveFlush(w, true);
+    }
+    if (fclose(w->file) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    free(w->raw);
+    free(w->payload);
+    free(w->index);
+    return err;
+}
+
+Crypt_Error_t Crypt_Pack(const char* dirIn, const char* fnameKey, const char* fnameOut, uint16_t flags) {
+    struct stat st;
+    if (stat(dirIn, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return CRYPT_E_ARGUMENT;
+    }
+    Crypt_ArchiveWriter w;
+    Crypt_Error_t err = Crypt_ArchiveWriterOpen(&w, fnameOut, fnameKey, flags);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    err = Crypt_ArchiveAddDir(&w, dirIn, "");
+    return Crypt_ArchiveWriterClose(&w, err);
+}
+
+Crypt_Error_t Crypt_ArchiveLocate(Crypt_Archive* a, uint64_t offset, const byte** data, size_t* nAvail) {
+    if (offset >= a->chunks.rawSize) {
+        return CRYPT_E_FORMAT;
+    }
+
+    // binary search for the last chunk starting at or before offset,
+    // unless it is the chunk deciphered last
+    size_t i = a->cached;
+    if (i >= a->chunks.nChunks || offset < a->chunks.chunks[i].rawOffset ||
+        offset >= a->chunks.chunks[i].rawOffset + a->chunks.chunks[i].hdr.rawSize) {
+        size_t lo = 0, hi = a->chunks.nChunks;
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (a->chunks.chunks[mid].rawOffset <= offset) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        i = lo;
+    }
+
+    const Crypt_ChunkInfo* info = &a->chunks.chunks[i];
+    if (i != a->cached) {
+        if (info->hdr.flags & CRYPT_CHUNK_HOLE) {
+            // archives are never sparse
+            return CRYPT_E_FORMAT;
+        }
+        a->cached = CRYPT_EOF;
+        size_t storedSize = CRYPT_STORED_SIZE(info->hdr.dataSize);
+        if (fseeko(a->file, info->offset + (off_t) sizeof(Crypt_ChunkHeader), SEEK_SET) != 0 ||
+            fread(a->payload, sizeof(byte), storedSize, a->file) != storedSize) {
+            return CRYPT_E_FORMAT;
+        }
+        Crypt_Error_t err = Crypt_DecipherChunk(&a->ctx, &info->hdr, a->chunks.hdr.chunkSize,
+                                                a->payload, a->scratch, &a->data);
+        if (err != CRYPT_E_SUCCESS) {
+            return err;
+        }
+        a->cached = i;
+    }
+
+    size_t begin = (size_t) (offset - info->rawOffset);
+    *data = a->data + begin;
+    *nAvail = info->hdr.rawSize - begin;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_ArchiveRead(Crypt_Archive* a, uint64_t offset, byte buf[], size_t nBytes) {
+    while (nBytes > 0) {
+        const byte* data;
+        size_t nAvail;
+        Crypt_Error_t err = Crypt_ArchiveLocate(a, offset, &data, &nAvail);
+        if (err != CRYPT_E_SUCCESS) {
+            return err;
+        }
+        size_t n = MIN(nBytes, nAvail);
+        memcpy(buf, data, n);
+        buf += n;
+        offset += n;
+        nBytes -= n;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_ArchiveOpen(Crypt_Archive* a, const char* fname, const char* fnameKey) {
+    memset(a, 0, sizeof(Crypt_Archive));
+    a->cached = CRYPT_EOF;
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_InitKeyCtx(&a->ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    a->file = fopen(fname, "rb");
+    if (!a->file) {
+        return CRYPT_E_IO;
+    }
+
+    err = Crypt_IndexChunks(a->file, &a->chunks);
+    if (err != CRYPT_E_SUCCESS) {
+        fclose(a->file);
+        return err;
+    }
+    if (!(a->chunks.hdr.flags & CRYPT_HDR_ARCHIVE)) {
+        err = CRYPT_E_FORMAT;
+    } else {
+        err = Crypt_ContainerKey(&a->chunks.hdr, &a->ctx, keySize, &a->ctx);
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        a->payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(a->chunks.hdr.chunkSize));
+        a->scratch = (byte*) malloc(a->chunks.hdr.chunkSize);
+        if (!a->payload || !a->scratch) {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+        }
+    }
+
+    Crypt_ArchiveFooter footer;
+    uint64_t rawSize = a->chunks.rawSize;
+    if (err == CRYPT_E_SUCCESS) {
+        err = (rawSize < sizeof(Crypt_ArchiveFooter)) ? CRYPT_E_FORMAT :
+              Crypt_ArchiveRead(a, rawSize - sizeof(Crypt_ArchiveFooter), (byte*) &footer, sizeof(Crypt_ArchiveFooter));
+    }
+    uint64_t indexOffset = 0;
+    if (err == CRYPT_E_SUCCESS) {
+        if (footer.indexSize > rawSize - sizeof(Crypt_ArchiveFooter) ||
+            footer.nMembers > footer.indexSize / sizeof(Crypt_MemberEntry)) {
+            err = CRYPT_E_FORMAT;
+        } else {
+            indexOffset = rawSize - sizeof(Crypt_ArchiveFooter) - footer.indexSize;
+            // one extra byte, so a name at the very end is still terminated
+            a->index = (byte*) malloc(footer.indexSize + 1);
+            a->members = (Crypt_Member*) malloc((footer.nMembers ? footer.nMembers : 1) * sizeof(Crypt_Member));
+            if (!a->index || !a->members) {
+                err = CRYPT_E_MEMORY_ALLOCATION;
+            } else {
+                a->index[footer.indexSize] = '\0';
+                err = Crypt_ArchiveRead(a, indexOffset, a->index, footer.indexSize);
+            }
+        }
+    }
+
+    // parse and check every entry
+    size_t pos = 0;
+    for (uint64_t i = 0; err == CRYPT_E_SUCCESS && i < footer.nMembers; i++) {
+        Crypt_Member* member = &a->members[i];
+        if (footer.indexSize - pos < sizeof(Crypt_MemberEntry)) {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        memcpy(&member->entry, a->index + pos, sizeof(Crypt_MemberEntry));
+        pos += sizeof(Crypt_MemberEntry);
+        const Crypt_MemberEntry* entry = &member->entry;
+        if (entry->nameLen >= footer.indexSize - pos || a->index[pos + entry->nameLen] != '\0' ||
+            entry->size > indexOffset || entry->offset > indexOffset - entry->size) {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        member->name = (const char*) a->index + pos;
+        pos += entry->nameLen + 1;
+        a->nMembers++;
+    }
+
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_ArchiveClose(a);
+    }
+    return err;
+}
+
+void Crypt_ArchiveClose(Crypt_Archive* a) {
+    if (a->file) {
+        fclose(a->file);
+    }
+    Crypt_FreeIndex(&a->chunks);
+    free(a->payload);
+    free(a->scratch);
+    free(a->index);
+    free(a->members);
+    memset(a, 0, sizeof(Crypt_Archive));
+}
+
+const Crypt_Member* Crypt_ArchiveFind(const Crypt_Archive* a, const char* name) {
+    for (size_t i = 0; i < a->nMembers; i++) {
+        if (strcmp(a->members[i].name, name) == 0) {
+            return &a->members[i];
+        }
+    }
+    return NULL;
+}
+
+Crypt_Error_t Crypt_ArchiveExtract(Crypt_Archive* a, const Crypt_Member* member, const char* fnameOut) {
+    FILE* fileOut = fopen(fnameOut, "wb");
+    if (!fileOut) {
+        return CRYPT_E_IO;
+    }
+
+    // write straight from the deciphered chunks
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    uint64_t offset = member->entry.offset;
+    uint64_t end = offset + member->entry.size;
+    while (err == CRYPT_E_SUCCESS && offset < end) {
+        const byte* data;
+        size_t nAvail;
+        err = Crypt_ArchiveLocate(a, offset, &data, &nAvail);
+        if (err != CRYPT_E_SUCCESS) {
+            break;
+        }
+        size_t n = (size_t) MIN((uint64_t) nAvail, end - offset);
+        if (fwrite(data, sizeof(byte), n, fileOut) != n) {
+            err = CRYPT_E_IO;
+        }
+        offset += n;
+    }
+
+    if (err == CRYPT_E_SUCCESS && fflush(fileOut) != 0) {
+        err = CRYPT_E_IO;
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        // a failure to restore the metadata does not lose data
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = (time_t) member->entry.mtime;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        fchmod(fileno(fileOut), (mode_t) member->entry.mode);
+        futimens(fileno(fileOut), times);
+    }
+    if (fclose(fileOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_Unpack(const char* fnameIn, const char* fnameKey, const char* dirOut, const char* member) {
+    Crypt_Archive a;
+    Crypt_Error_t err = Crypt_ArchiveOpen(&a, fnameIn, fnameKey);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    if (mkdir(dirOut, 0755) != 0 && errno != EEXIST) {
+        Crypt_ArchiveClose(&a);
+        return CRYPT_E_IO;
+    }
+
+    const Crypt_Member* only = NULL;
+    if (member) {
+        only = Crypt_ArchiveFind(&a, member);
+        if (!only) {
+            err = CRYPT_E_ARGUMENT;
+        }
+    }
+
+    // members are stored in order, so extracting all of them reads the
+    // archive sequentially and deciphers each chunk once
+    for (size_t i = 0; err == CRYPT_E_SUCCESS && i < a.nMembers; i++) {
+        const Crypt_Member* m = &a.members[i];
+        if (only && m != only) {
+            continue;
+        }
+        if (!Crypt_IsSafeName(m->name)) {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        char* path = Crypt_JoinPath(dirOut, m->name);
+        if (!path) {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+            break;
+        }
+        err = Crypt_MakeParents(path, strlen(dirOut));
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_ArchiveExtract(&a, m, path);
+        }
+        free(path);
+    }
+
+    Crypt_ArchiveClose(&a);
+    return err;
+}
+
+#endif  // CC_ARCHIVE_H_
@@ -0,0 +1,740 @@
+#ifndef CC_BATCH_H_
+#define CC_BATCH_H_
+
+// runs many encipher / decipher jobs in one process on a work-stealing
+// pool (see pool.h), so starting a process and loading a key is paid
+// once per batch instead of once per file.
+//
+// manifest lines have the form
+//     operation input-file output-file key-file [first-byte last-byte]
+// where operation is encipher or decipher and the range means the same
+// as the -r option of the command-line utility. fields are separated by
+// whitespace (so file names cannot contain spaces); blank lines and
+// lines starting with '#' are ignored.
+//
+// the output of a job is the same as that of Crypt_EncipherRange or
+// Crypt_DecipherRange (containers are deciphered with
+// Crypt_DecipherChunked). a job works out where every byte of its
+// output goes, writes the padded final block, and splits the rest (the
+// bytes before the range, the range, and the bytes after it) into parts
+// of at most CRYPT_BATCH_PART_SIZE bytes that are read and written with
+// pread / pwrite. the parts of a large file are pushed onto the worker's
+// own deque, where idle workers can steal them, so one large file at the
+// end of a batch does not leave the other workers idle.
+//
+// jobs added with Crypt_BatchAddRekey (see Crypt_Rekey) re-encipher a file
+// under a new key in the same way: each part is deciphered with the
+// old key and enciphered with the new one in memory, and the padded
+// final block is deciphered and enciphered again with the pad keys.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "container.h"
+#include "pool.h"
+#include "xxhash.h"
+
+// max number of bytes in a part of a job (must be a multiple of STATE_SIZE)
+#define CRYPT_BATCH_PART_SIZE (16 * CRYPT_CHUNK_SIZE)
+// initial number of slots in the key table (must be a power of 2)
+#define CRYPT_KEY_TABLE_INIT_SIZE 16
+
+typedef enum {
+    CRYPT_OP_ENCIPHER,
+    CRYPT_OP_DECIPHER,
+    CRYPT_OP_REKEY
+} Crypt_Op_t;
+
+typedef enum {
+    CRYPT_PART_COPY,
+    CRYPT_PART_ENCIPHER,
+    CRYPT_PART_DECIPHER,
+    CRYPT_PART_REKEY
+} Crypt_PartKind_t;
+
+typedef struct {
+    char* fname;
+    size_t keySize;
+    AES_KeyCtx ctx;
+    AES_KeyCtx padCtx;  // for the padded final block (see CRYPT_PAD_NK)
+    Crypt_Error_t err;  // set if the key file could not be loaded
+} Crypt_BatchKey;
+
+struct Crypt_Job;
+struct Crypt_Batch;
+
+typedef struct {
+    struct Crypt_Job* job;
+    Crypt_PartKind_t kind;
+    off_t inOffset, outOffset;
+    size_t nBytes;
+} Crypt_JobPart;
+
+typedef struct Crypt_Job {
+    Crypt_Op_t op;
+    char* fnameIn;
+    char* fnameOut;
+    const Crypt_BatchKey* key;
+    const Crypt_BatchKey* newKey;  // only for CRYPT_OP_REKEY
+    size_t firstByte, lastByte;
+    size_t line;  // line of the manifest (0 if added directly)
+    bool skip;  // set before the run to leave the job out (see state.h)
+    Crypt_Error_t err;
+    // state of a running job
+    struct Crypt_Batch* batch;
+    int fdIn, fdOut;
+    Crypt_JobPart* parts;
+    size_t nParts, nDone;
+} Crypt_Job;
+
+typedef struct Crypt_Batch {
+    Crypt_Job* jobs;
+    size_t nJobs, capJobs;
+    // every distinct key file is loaded once. keys are allocated one by
+    // one, so they stay in place while more are added
+    Crypt_BatchKey** keys;
+    size_t nKeys, capKeys;
+    // open addressing table of key index + 1 by file name (0 is empty)
+    size_t* keyTable;
+    size_t keyTableSize;
+    Crypt_Pool* pool;
+    pthread_mutex_t lock;  // protects the part counts of running jobs
+} Crypt_Batch;
+
+void Crypt_BatchInit(Crypt_Batch* batch);
+void Crypt_BatchFree(Crypt_Batch* batch);
+// adds a job. the key file is loaded the first time it is seen; a key
+// that cannot be loaded fails the jobs that use it, not the batch
+Crypt_Error_t Crypt_BatchAdd(Crypt_Batch* batch, Crypt_Op_t op,
+                             const char* fnameIn, const char* fnameOut, const char* fnameKey,
+                             size_t firstByte, size_t lastByte, size_t line);
+// adds a job that re-enciphers the enciphered range of fnameIn (given
+// in plaintext bytes, as for deciphering) from the key in fnameKey to
+// the one in fnameNewKey
+Crypt_Error_t Crypt_BatchAddRekey(Crypt_Batch* batch,
+                                  const char* fnameIn, const char* fnameOut,
+                                  const char* fnameKey, const char* fnameNewKey,
+                                  size_t firstByte, size_t lastByte);
+// re-enciphers fnameIn into fnameOut under the key in fnameNewKey as a
+// batch of one job on nWorkers threads (see Crypt_BatchAddRekey).
+// returns CRYPT_E_ARGUMENT if fnameOut is the input file itself
+Crypt_Error_t Crypt_Rekey(const char* fnameIn, const char* fnameKey, const char* fnameNewKey,
+                          const char* fnameOut, size_t firstByte, size_t lastByte, size_t nWorkers);
+// adds the jobs of a manifest. on CRYPT_E_FORMAT, *errLine is the
+// line that could not be parsed
+Crypt_Error_t Crypt_BatchParse(Crypt_Batch* batch, FILE* manifest, size_t* errLine);
+// runs every job that is not marked skip on nWorkers threads. the
+// result of each job is left in batch->jobs[i].err
+Crypt_Error_t Crypt_BatchRun(Crypt_Batch* batch, size_t nWorkers);
+// writes one line per job: manifest line, status (0 on success, the
+// Crypt_Error_t otherwise), operation, input, output, and message.
+// returns the number of jobs that failed
+size_t Crypt_BatchReport(const Crypt_Batch* batch, FILE* out);
+
+// internal helpers
+// returns the key loaded from fname in *key, loading it if needed
+Crypt_Error_t Crypt_BatchFindKey(Crypt_Batch* batch, const char* fname, const Crypt_BatchKey** key);
+Crypt_Error_t Crypt_LoadKey(Crypt_BatchKey* key);
+Crypt_Error_t Crypt_PreadFull(int fd, byte buf[], size_t nBytes, off_t offset);
+Crypt_Error_t Crypt_PwriteFull(int fd, const byte buf[], size_t nBytes, off_t offset);
+// runs a job. jobs are normally started by Crypt_BatchRun, but a job
+// may also be set up by hand with fdIn / fdOut already open (fnameIn /
+// fnameOut are then unused) and started directly; if batch->pool is
+// NULL, it runs to completion on the calling thread. the descriptors
+// are closed when the job ends
+void Crypt_JobStart(void* arg);
+// deciphers or re-enciphers a container as a single task
+Crypt_Error_t Crypt_JobContainer(Crypt_Job* job);
+void Crypt_JobRunPart(void* arg);
+void Crypt_JobFinishPart(Crypt_Job* job, Crypt_Error_t err);
+void Crypt_JobEnd(Crypt_Job* job);
+// splits the region [inOffset, inOffset + nBytes) into parts
+size_t Crypt_JobSplit(Crypt_Job* job, size_t nParts, Crypt_PartKind_t kind,
+                      off_t inOffset, off_t outOffset, size_t nBytes);
+
+const char* const Crypt_opNames[] = {"encipher", "decipher", "rekey"};
+
+void Crypt_BatchInit(Crypt_Batch* batch) {
+    memset(batch, 0, sizeof(Crypt_Batch));
+    pthread_mutex_init(&batch->lock, NULL);
+}
+
+void Crypt_BatchFree(Crypt_Batch* batch) {
+    for (size_t i = 0; i < batch->nJobs; i++) {
+        free(batch->jobs[i].fnameIn);
+        free(batch->jobs[i].fnameOut);
+    }
+    for (size_t i = 0; i < batch->nKeys; i++) {
+        free(batch->keys[i]->fname);
+        free(batch->keys[i]);
+    }
+    free(batch->jobs);
+    free(batch->keys);
+    free(batch->keyTable);
+    pthread_mutex_destroy(&batch->lock);
+}
+
+Crypt_Error_t Crypt_LoadKey(Crypt_BatchKey* key) {
+    byte keyData[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(key->fname, keyData, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    key->keySize = keySize;
+    AES_InitKeyCtx(&key->ctx, keyData, NK_BYTES_TO_WORDS(keySize));
+    AES_InitKeyCtx(&key->padCtx, keyData, CRYPT_PAD_NK);
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_BatchFindKey(Crypt_Batch* batch, const char* fname, const Crypt_BatchKey** found) {
+    // keep the table at most half full
+    if (2 * (batch->nKeys + 1) > batch->keyTableSize) {
+        size_t size = (batch->keyTableSize) ? 2 * batch->keyTableSize : CRYPT_KEY_TABLE_INIT_SIZE;
+        size_t* table = (size_t*) calloc(size, sizeof(size_t));
+        if (!table) {
+            return CRYPT_E_MEMORY_ALLOCATION;
+        }
+        for (size_t i = 0; i < batch->nKeys; i++) {
+            const char* name = batch->keys[i]->fname;
+            size_t slot = XXH_Hash64((const byte*) name, strlen(name), 0) & (size - 1);
+            while (table[slot]) {
+                slot = (slot + 1) & (size - 1);
+            }
+            table[slot] = i + 1;
+        }
+        free(batch->keyTable);
+        batch->keyTable = table;
+        batch->keyTableSize = size;
+    }
+
+    size_t slot = XXH_Hash64((const byte*) fname, strlen(fname), 0) & (batch->keyTableSize - 1);
+    while (batch->keyTable[slot]) {
+        size_t i = batch->keyTable[slot] - 1;
+        if (strcmp(batch->keys[i]->fname, fname) == 0) {
+            *found = batch->keys[i];
+            return CRYPT_E_SUCCESS;
+        }
+        slot = (slot + 1) & (batch->keyTableSize - 1);
+    }
+
+    // first use of this key file
+    if (batch->nKeys == batch->capKeys) {
+        size_t capacity = (batch->capKeys) ? 2 * batch->capKeys : CRYPT_KEY_TABLE_INIT_SIZE;
+        Crypt_BatchKey** keys = (Crypt_BatchKey**) realloc(batch->keys, capacity * sizeof(Crypt_BatchKey*));
+        if (!keys) {
+            return CRYPT_E_MEMORY_ALLOCATION;
+        }
+        batch->keys = keys;
+        batch->capKeys = capacity;
+    }
+    Crypt_BatchKey* key = (Crypt_BatchKey*) calloc(1, sizeof(Crypt_BatchKey));
+    if (key) {
+        key->fname = strdup(fname);
+    }
+    if (!key || !key->fname) {
+        free(key);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    key->err = Crypt_LoadKey(key);
+
+    batch->keys[batch->nKeys] = key;
+    batch->keyTable[slot] = batch->nKeys + 1;
+    batch->nKeys++;
+    *found = key;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_BatchAdd(Crypt_Batch* batch, Crypt_Op_t op,
+                             const char* fnameIn, const char* fnameOut, const char* fnameKey,
+                             size_t firstByte, size_t lastByte, size_t line) {
+    if (firstByte > lastByte) {
+        return CRYPT_E_ARGUMENT;
+    }
+    if (batch->nJobs == batch->capJobs) {
+        size_t capacity = (batch->capJobs) ? 2 * batch->capJobs : 64;
+        Crypt_Job* jobs = (Crypt_Job*) realloc(batch->jobs, capacity * sizeof(Crypt_Job));
+        if (!jobs) {
+            return CRYPT_E_MEMORY_ALLOCATION;
+        }
+        batch->jobs = jobs;
+        batch->capJobs = capacity;
+    }
+
+    Crypt_Job* job = &batch->jobs[batch->nJobs];
+    memset(job, 0, sizeof(Crypt_Job));
+    job->op = op;
+    job->firstByte = firstByte;
+    job->lastByte = lastByte;
+    job->line = line;
+    job->fdIn = job->fdOut = -1;
+    job->fnameIn = strdup(fnameIn);
+    job->fnameOut = strdup(fnameOut);
+    Crypt_Error_t err = (job->fnameIn && job->fnameOut) ? CRYPT_E_SUCCESS : CRYPT_E_MEMORY_ALLOCATION;
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_BatchFindKey(batch, fnameKey, &job->key);
+    }
+    if (err != CRYPT_E_SUCCESS) {
+        free(job->fnameIn);
+        free(job->fnameOut);
+        return err;
+    }
+    batch->nJobs++;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_BatchAddRekey(Crypt_Batch* batch,
+                                  const char* fnameIn, const char* fnameOut,
+                                  const char* fnameKey, const char* fnameNewKey,
+                                  size_t firstByte, size_t lastByte) {
+    Crypt_Error_t err = Crypt_BatchAdd(batch, CRYPT_OP_REKEY, fnameIn, fnameOut, fnameKey, firstByte, lastByte, 0);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    Crypt_Job* job = &batch->jobs[batch->nJobs - 1];
+    err = Crypt_BatchFindKey(batch, fnameNewKey, &job->newKey);
+    if (err != CRYPT_E_SUCCESS) {
+        free(job->fnameIn);
+        free(job->fnameOut);
+        batch->nJobs--;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_BatchParse(Crypt_Batch* batch, FILE* manifest, size_t* errLine) {
+    char* line = NULL;
+    size_t capacity = 0;
+    size_t lineNo = 0;
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+
+    while (err == CRYPT_E_SUCCESS && getline(&line, &capacity, manifest) >= 0) {
+        lineNo++;
+        // one more field than a valid line can have, to detect extra fields
+        char* fields[7];
+        size_t nFields = 0;
+        char* save;
+        for (char* field = strtok_r(line, " \t\r\n", &save); field && nFields < 7;
+             field = strtok_r(NULL, " \t\r\n", &save)) {
+            fields[nFields++] = field;
+        }
+        if (nFields == 0 || fields[0][0] == '#') {
+            continue;
+        }
+
+        Crypt_Op_t op;
+        if (strcmp(fields[0], "encipher") == 0) {
+            op = CRYPT_OP_ENCIPHER;
+        } else if (strcmp(fields[0], "decipher") == 0) {
+            op = CRYPT_OP_DECIPHER;
+        } else {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        if (nFields != 4 && nFields != 6) {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+
+        size_t range[2] = {CRYPT_SOF, CRYPT_EOF};
+        for (size_t i = 0; nFields == 6 && i < 2; i++) {
+            char* end;
+            errno = 0;
+            unsigned long long value = strtoull(fields[4 + i], &end, 10);
+            if (errno != 0 || *end != '\0' || fields[4 + i][0] == '-') {
+                err = CRYPT_E_FORMAT;
+            }
+            range[i] = (size_t) value;
+        }
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_BatchAdd(batch, op, fields[1], fields[2], fields[3], range[0], range[1], lineNo);
+            if (err == CRYPT_E_ARGUMENT) {
+                // an inverted range is a problem with the manifest
+                err = CRYPT_E_FORMAT;
+            }
+        }
+    }
+
+    free(line);
+    if (err == CRYPT_E_SUCCESS && ferror(manifest)) {
+        err = CRYPT_E_IO;
+    }
+    if (errLine) {
+        *errLine = (err == CRYPT_E_SUCCESS) ? 0 : lineNo;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_PreadFull(int fd, byte buf[], size_t nBytes, off_t offset) {
+    while (nBytes > 0) {
+        ssize_t n = pread(fd, buf, nBytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            // an error, or the file shrank while the job was running
+            return CRYPT_E_IO;
+        }
+        buf += n;
+        nBytes -= (size_t) n;
+        offset += n;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_PwriteFull(int fd, const byte buf[], size_t nBytes, off_t offset) {
+    while (nBytes > 0) {
+        ssize_t n = pwrite(fd, buf, nBytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            return CRYPT_E_IO;
+        }
+        buf += n;
+        nBytes -= (size_t) n;
+        offset += n;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+size_t Crypt_JobSplit(Crypt_Job* job, size_t nParts, Crypt_PartKind_t kind,
+                      off_t inOffset, off_t outOffset, size_t nBytes) {
+    // with job->parts == NULL, only counts the parts
+    for (size_t offset = 0; offset < nBytes; offset += CRYPT_BATCH_PART_SIZE) {
+        if (job->parts) {
+            Crypt_JobPart* part = &job->parts[nParts];
+            part->job = job;
+            part->kind = kind;
+            part->inOffset = inOffset + (off_t) offset;
+            part->outOffset = outOffset + (off_t) offset;
+            part->nBytes = MIN((size_t) CRYPT_BATCH_PART_SIZE, nBytes - offset);
+        }
+        nParts++;
+    }
+    return nParts;
+}
+
+void Crypt_JobEnd(Crypt_Job* job) {
+    if (job->fdOut >= 0 && close(job->fdOut) != 0 && job->err == CRYPT_E_SUCCESS) {
+        job->err = CRYPT_E_IO;
+    }
+    if (job->fdIn >= 0) {
+        close(job->fdIn);
+    }
+    job->fdIn = job->fdOut = -1;
+    free(job->parts);
+    job->parts = NULL;
+}
+
+void Crypt_JobFinishPart(Crypt_Job* job, Crypt_Error_t err) {
+    Crypt_Batch* batch = job->batch;
+    pthread_mutex_lock(&batch->lock);
+    if (err != CRYPT_E_SUCCESS && job->err == CRYPT_E_SUCCESS) {
+        job->err = err;
+    }
+    bool last = ++job->nDone == job->nParts;
+    pthread_mutex_unlock(&batch->lock);
+    if (last) {
+        Crypt_JobEnd(job);
+    }
+}
+
+void Crypt_JobRunPart(void* arg) {
+    Crypt_JobPart* part = (Crypt_JobPart*) arg;
+    Crypt_Job* job = part->job;
+    const Crypt_BatchKey* key = job->key;
+
+    byte* buf = (byte*) malloc(part->nBytes);
+    Crypt_Error_t err = (buf) ? CRYPT_E_SUCCESS : CRYPT_E_MEMORY_ALLOCATION;
+    if (err == CRYPT_E_SUCCESS) {
+        CRYPT_TRACE_BEGIN(traceRead);
+        err = Crypt_PreadFull(job->fdIn, buf, part->nBytes, part->inOffset);
+        CRYPT_TRACE_END(traceRead, CRYPT_SPAN_READ);
+    }
+    CRYPT_TRACE_BEGIN(traceCipher);
+    if (err == CRYPT_E_SUCCESS && part->kind == CRYPT_PART_ENCIPHER) {
+        AES_EncipherBlocks(&key->ctx, buf, part->nBytes / STATE_SIZE, buf);
+    } else if (err == CRYPT_E_SUCCESS && part->kind == CRYPT_PART_DECIPHER) {
+        AES_DecipherBlocks(&key->ctx, buf, part->nBytes / STATE_SIZE, buf);
+    } else if (err == CRYPT_E_SUCCESS && part->kind == CRYPT_PART_REKEY) {
+        // a chunk at a time, so the plaintext is still in cache when it
+        // is enciphered again
+        for (size_t offset = 0; offset < part->nBytes; offset += CRYPT_CHUNK_SIZE) {
+            size_t nBlocks = MIN((size_t) CRYPT_CHUNK_SIZE, part->nBytes - offset) / STATE_SIZE;
+            AES_DecipherBlocks(&key->ctx, buf + offset, nBlocks, buf + offset);
+            AES_EncipherBlocks(&job->newKey->ctx, buf + offset, nBlocks, buf + offset);
+        }
+    }
+    if (part->kind != CRYPT_PART_COPY) {
+        CRYPT_TRACE_END(traceCipher, CRYPT_SPAN_CIPHER);
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        CRYPT_TRACE_BEGIN(traceWrite);
+        err = Crypt_PwriteFull(job->fdOut, buf, part->nBytes, part->outOffset);
+        CRYPT_TRACE_END(traceWrite, CRYPT_SPAN_WRITE);
+    }
+    free(buf);
+    Crypt_JobFinishPart(job, err);
+}
+
+Crypt_Error_t Crypt_JobContainer(Crypt_Job* job) {
+    // the job's descriptors are closed by Crypt_JobEnd, so the streams
+    // work on duplicates
+    if (job->fdOut < 0) {
+        job->fdOut = open(job->fnameOut, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    int fdIn = (job->fdOut >= 0) ? dup(job->fdIn) : -1;
+    int fdOut = (fdIn >= 0) ? dup(job->fdOut) : -1;
+    FILE* fileIn = (fdIn >= 0) ? fdopen(fdIn, "rb") : NULL;
+    FILE* fileOut = (fdOut >= 0) ? fdopen(fdOut, "wb") : NULL;
+    Crypt_Error_t err = CRYPT_E_IO;
+    if (fileIn && fileOut && job->op == CRYPT_OP_REKEY) {
+        // the whole container is re-enciphered, so a range makes no sense
+        err = (job->firstByte == CRYPT_SOF && job->lastByte == CRYPT_EOF)
+                  ? Crypt_RekeyChunkedFile(fileIn, &job->key->ctx, job->key->keySize,
+                                           &job->newKey->ctx, job->newKey->keySize, fileOut)
+                  : CRYPT_E_ARGUMENT;
+    } else if (fileIn && fileOut) {
+        err = Crypt_DecipherChunkedFile(fileIn, &job->key->ctx, job->key->keySize, fileOut,
+                                        job->firstByte, job->lastByte, 0, 1);
+        // the chunks before a forged one were written already, so
+        // the output is removed (see Crypt_OpenOutput)
+        struct stat st;
+        if (err == CRYPT_E_INTEGRITY && fstat(job->fdOut, &st) == 0 && S_ISREG(st.st_mode)) {
+            unlink(job->fnameOut);
+        }
+    }
+
+    if (fileIn) {
+        fclose(fileIn);
+    } else if (fdIn >= 0) {
+        close(fdIn);
+    }
+    if (fileOut) {
+        if (fclose(fileOut) != 0 && err == CRYPT_E_SUCCESS) {
+            err = CRYPT_E_IO;
+        }
+    } else if (fdOut >= 0) {
+        close(fdOut);
+    }
+    return err;
+}
+
+void Crypt_JobStart(void* arg) {
+    Crypt_Job* job = (Crypt_Job*) arg;
+    const Crypt_BatchKey* key = job->key;
+    const Crypt_BatchKey* newKey = job->newKey;
+    if (key->err != CRYPT_E_SUCCESS || (newKey && newKey->err != CRYPT_E_SUCCESS)) {
+        job->err = (key->err != CRYPT_E_SUCCESS) ? key->err : newKey->err;
+        Crypt_JobEnd(job);
+        return;
+    }
+
+    struct stat st;
+    if (job->fdIn < 0) {
+        job->fdIn = open(job->fnameIn, O_RDONLY);
+    }
+    if (job->fdIn < 0 || fstat(job->fdIn, &st) != 0) {
+        job->err = CRYPT_E_IO;
+        Crypt_JobEnd(job);
+        return;
+    }
+    if (job->op != CRYPT_OP_ENCIPHER && Crypt_IsContainerFd(job->fdIn)) {
+        // containers are small enough per chunk that splitting them is
+        // not worth it here; they run as a single task
+        job->err = Crypt_JobContainer(job);
+        Crypt_JobEnd(job);
+        return;
+    }
+    size_t fsize = (size_t) st.st_size;
+    size_t firstByte = job->firstByte;
+    size_t lastByte = job->lastByte;
+
+    // the final block and where it goes, the size of the output, and the
+    // offset of the bytes after the range in the output
+    byte finalBlock[STATE_SIZE];
+    size_t nFinal = 0;
+    size_t nRange = 0;  // bytes of the range transformed by the parts
+    off_t finalOffset = 0, suffixOffset = 0;
+    size_t outSize = 0;
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+
+    if (job->op == CRYPT_OP_ENCIPHER) {
+        // see Crypt_EncipherRange
+        lastByte = MIN(lastByte, fsize);
+        if (firstByte > lastByte) {
+            err = CRYPT_E_ARGUMENT;
+        } else {
+            nRange = ((lastByte - firstByte) / STATE_SIZE) * STATE_SIZE;
+            size_t nTail = lastByte - firstByte - nRange;
+            byte nPad = (byte) (STATE_SIZE - nTail);
+            byte plaintext[STATE_SIZE];
+            err = Crypt_PreadFull(job->fdIn, plaintext, nTail, (off_t) (firstByte + nRange));
+            for (size_t i = nTail; i < STATE_SIZE; i++) {
+                plaintext[i] = nPad;
+            }
+            AES_EncipherBlock(&key->padCtx, plaintext, finalBlock);
+            nFinal = STATE_SIZE;
+            finalOffset = (off_t) (firstByte + nRange);
+            suffixOffset = (off_t) (lastByte + nPad);
+            outSize = fsize + nPad;
+        }
+    } else {
+        // see Crypt_DecipherRange. the range is given in plaintext bytes,
+        // as on the command line
+        if (lastByte != CRYPT_EOF) {
+            lastByte = CRYPT_CALC_ENDPT(firstByte, lastByte);
+        }
+        lastByte = MIN(lastByte, fsize);
+        if (firstByte >= lastByte || (lastByte - firstByte) % STATE_SIZE != 0) {
+            err = CRYPT_E_FORMAT;
+        } else {
+            nRange = lastByte - firstByte - STATE_SIZE;
+            byte ciphertext[STATE_SIZE];
+            err = Crypt_PreadFull(job->fdIn, ciphertext, STATE_SIZE, (off_t) (firstByte + nRange));
+            AES_DecipherBlock(&key->padCtx, ciphertext, finalBlock);
+            byte padByte = finalBlock[STATE_SIZE - 1];
+            // every enciphered range ends in 1 to STATE_SIZE bytes of padding
+            if (err == CRYPT_E_SUCCESS && (padByte == 0 || padByte > STATE_SIZE)) {
+                err = CRYPT_E_FORMAT;
+            }
+            finalOffset = (off_t) (firstByte + nRange);
+            if (job->op == CRYPT_OP_REKEY) {
+                // the padding stays the same, so the layout of the
+                // file does not change
+                AES_EncipherBlock(&newKey->padCtx, finalBlock, finalBlock);
+                nFinal = STATE_SIZE;
+                suffixOffset = (off_t) lastByte;
+                outSize = fsize;
+            } else {
+                nFinal = STATE_SIZE - padByte;
+                suffixOffset = (off_t) (lastByte - padByte);
+                outSize = fsize - padByte;
+            }
+        }
+    }
+
+    // the output is created at its final size, so parts can be written
+    // in any order
+    if (err == CRYPT_E_SUCCESS) {
+        if (job->fdOut < 0) {
+            job->fdOut = open(job->fnameOut, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (job->fdOut < 0 || ftruncate(job->fdOut, (off_t) outSize) != 0) {
+            err = CRYPT_E_IO;
+        }
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_PwriteFull(job->fdOut, finalBlock, nFinal, finalOffset);
+    }
+
+    Crypt_PartKind_t kind = (job->op == CRYPT_OP_ENCIPHER) ? CRYPT_PART_ENCIPHER :
+                            (job->op == CRYPT_OP_DECIPHER) ? CRYPT_PART_DECIPHER : CRYPT_PART_REKEY;
+    size_t nParts = 0;
+    for (int pass = 0; err == CRYPT_E_SUCCESS && pass < 2; pass++) {
+        // the first pass counts the parts, the second fills them in
+        if (pass == 1) {
+            job->parts = (Crypt_JobPart*) malloc(nParts * sizeof(Crypt_JobPart));
+            if (!job->parts) {
+                err = CRYPT_E_MEMORY_ALLOCATION;
+                break;
+            }
+        }
+        nParts = Crypt_JobSplit(job, 0, CRYPT_PART_COPY, 0, 0, firstByte);
+        nParts = Crypt_JobSplit(job, nParts, kind, (off_t) firstByte, (off_t) firstByte, nRange);
+        nParts = Crypt_JobSplit(job, nParts, CRYPT_PART_COPY, (off_t) lastByte, suffixOffset, fsize - lastByte);
+        if (nParts == 0) {
+            break;
+        }
+    }
+    if (err != CRYPT_E_SUCCESS || nParts == 0) {
+        job->err = err;
+        Crypt_JobEnd(job);
+        return;
+    }
+
+    // the other parts go onto this worker's deque for whoever is idle;
+    // this worker carries on with the first one. without a pool, every
+    // part runs here
+    job->nParts = nParts;
+    job->nDone = 0;
+    for (size_t i = 1; i < nParts; i++) {
+        if (!job->batch->pool ||
+            Crypt_PoolSubmit(job->batch->pool, Crypt_JobRunPart, &job->parts[i]) != CRYPT_E_SUCCESS) {
+            Crypt_JobRunPart(&job->parts[i]);
+        }
+    }
+    Crypt_JobRunPart(&job->parts[0]);
+}
+
+Crypt_Error_t Crypt_BatchRun(Crypt_Batch* batch, size_t nWorkers) {
+    batch->pool = Crypt_PoolNew(nWorkers);
+    if (!batch->pool) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    for (size_t i = 0; i < batch->nJobs; i++) {
+        Crypt_Job* job = &batch->jobs[i];
+        job->batch = batch;
+        job->err = CRYPT_E_SUCCESS;
+        if (job->skip) {
+            continue;
+        }
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_PoolSubmit(batch->pool, Crypt_JobStart, job);
+        }
+        if (err != CRYPT_E_SUCCESS) {
+            job->err = err;
+        }
+    }
+    Crypt_PoolFree(batch->pool);
+    batch->pool = NULL;
+    return err;
+}
+
+Crypt_Error_t Crypt_Rekey(const char* fnameIn, const char* fnameKey, const char* fnameNewKey,
+                          const char* fnameOut, size_t firstByte, size_t lastByte, size_t nWorkers) {
+    // the output is truncated before the input is read
+    struct stat stIn, stOut;
+    if (stat(fnameIn, &stIn) != 0) {
+        return CRYPT_E_IO;
+    }
+    if (stat(fnameOut, &stOut) == 0 && stIn.st_dev == stOut.st_dev && stIn.st_ino == stOut.st_ino) {
+        return CRYPT_E_ARGUMENT;
+    }
+
+    Crypt_Batch batch;
+    Crypt_BatchInit(&batch);
+    Crypt_Error_t err = Crypt_BatchAddRekey(&batch, fnameIn, fnameOut, fnameKey, fnameNewKey, firstByte, lastByte);
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_BatchRun(&batch, nWorkers);
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = batch.jobs[0].err;
+    }
+    Crypt_BatchFree(&batch);
+    return err;
+}
+
+size_t Crypt_BatchReport(const Crypt_Batch* batch, FILE* out) {
+    size_t nFailed = 0;
+    for (size_t i = 0; i < batch->nJobs; i++) {
+        const Crypt_Job* job = &batch->jobs[i];
+        fprintf(out, "%zu\t%d\t%s\t%s\t%s\t%s\n", job->line, (int) job->err,
+                Crypt_opNames[job->op],
+                job->fnameIn, job->fnameOut,
+                (job->skip) ? "skipped, unchanged since the last run" : Crypt_eDesc[job->err].msg);
+        if (job->err != CRYPT_E_SUCCESS) {
+            nFailed++;
+        }
+    }
+    return nFailed;
+}
+
+#endif  // CC_BATCH_H_
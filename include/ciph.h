@@ -5,10 +5,14 @@
 // from 'crypt' to 'ciph', so some symbols may still have the former
 // project name prefix
 
-#include <stdlib.h>  // for arc4random
+#include <stdlib.h>
 
 // #include "bigint.h"
 #include "aes.h"
+#include "drbg.h"
+#include "sha256.h"
+#include "stats.h"
+#include "trace.h"
 
 #define MIN(a, b) ((a < b) ? a : b)
 // indicates the last byte of the file
@@ -19,6 +23,16 @@
 #define CRYPT_MAX_KEY_SIZE 32
 // buf size for copying file contents directly
 #define CRYPT_CP_BUF_SIZE 1024
+// buf size for transforming a range (must be a multiple of STATE_SIZE)
+#define CRYPT_TRANSFORM_BUF_SIZE (16 * 1024)
+// number of bytes in a chunk, the unit of caching and bulk
+// transformation (must be a multiple of STATE_SIZE)
+#define CRYPT_CHUNK_SIZE (64 * 1024)
+// the padded final block of a range is always enciphered with the
+// first 128 bits of the key (i.e., Nk == 4), regardless of the key size.
+// anything that reads or writes the final block must use this value
+// to stay compatible with files produced by Crypt_EncipherRange
+#define CRYPT_PAD_NK 4
 
 // calculate the last enciphered byte from a range of plaintext bytes.
 // essentially, deciphering requires a range that is a multiple of STATE_SIZE,
@@ -28,7 +42,42 @@
 // padding
 #define CRYPT_CALC_ENDPT(b, e) (e + (STATE_SIZE - ((e - b) % STATE_SIZE)))
 
-typedef void (*Crypt_AESFn)(byte input[], byte key[], size_t Nk, byte output[]);
+// AES_EncipherBlocks or AES_DecipherBlocks
+typedef void (*Crypt_AESBlocksFn)(const AES_KeyCtx* ctx, const byte input[], size_t nBlocks, byte output[]);
+
+typedef enum {
+    CRYPT_E_SUCCESS,
+    CRYPT_E_IO,  // a file could not be opened, read or written
+    CRYPT_E_FORMAT,  // the input is malformed or has an unsupported format
+    CRYPT_E_MEMORY_ALLOCATION,  // memory allocation error
+    CRYPT_E_ARGUMENT,  // an argument is out of range or inconsistent
+    CRYPT_E_INTEGRITY  // the input failed authentication (see merkle.h)
+} Crypt_Error_t;
+
+typedef struct {
+    Crypt_Error_t eCode;
+    const char* msg;
+} Crypt_ErrorDesc_t;
+
+Crypt_ErrorDesc_t Crypt_eDesc[] = {
+    { CRYPT_E_SUCCESS, "operation successful" },
+    { CRYPT_E_IO, "a file could not be opened, read or written" },
+    { CRYPT_E_FORMAT, "the input file is malformed or has an unsupported format" },
+    { CRYPT_E_MEMORY_ALLOCATION, "memory allocation failed" },
+    { CRYPT_E_ARGUMENT, "an argument was out of range or inconsistent" },
+    { CRYPT_E_INTEGRITY, "the input failed authentication; it was modified or damaged" }
+};
+
+void Crypt_PrintError(Crypt_Error_t code) {
+    fprintf(stderr, "%s\n", Crypt_eDesc[code].msg);
+}
+
+// SHA-256 digests of the whole plaintext and ciphertext files of an
+// operation
+typedef struct {
+    byte plaintext[SHA256_DIGEST_SIZE];
+    byte ciphertext[SHA256_DIGEST_SIZE];
+} Crypt_Digests;
 
 void Crypt_EncipherRange(const char* fnameIn,
                          const char* fnameKey,
@@ -42,51 +91,152 @@ void Crypt_DecipherRange(const char* fnameIn,
                          size_t firstByte,
                          size_t lastByte);
 
-// performs the cryptographic operation on the input file
-// with the given parameters
-void Crypt_Transform(FILE* fileIn, FILE* fileOut, size_t nBlocks, Crypt_AESFn aesfn, byte key[], size_t keySize);
-// copies nBytes bytes from fileIn to fileOut
-void Crypt_CopyFile(FILE* fileIn, FILE* fileOut, size_t nBytes);
+// the same as Crypt_EncipherRange and Crypt_DecipherRange, and if
+// digests is not NULL also hashes the input and output files from the
+// buffers the cipher works on, so neither file is read again. returns
+// CRYPT_E_IO if a file cannot be opened, the error of Crypt_LoadKeyFile
+// for a bad key, and CRYPT_E_FORMAT for a range that does not decipher;
+// digests are only set on success
+Crypt_Error_t Crypt_EncipherRangeDigests(const char* fnameIn,
+                                         const char* fnameKey,
+                                         const char* fnameOut,
+                                         size_t firstByte,
+                                         size_t lastByte,
+                                         Crypt_Digests* digests);
+
+Crypt_Error_t Crypt_DecipherRangeDigests(const char* fnameIn,
+                                         const char* fnameKey,
+                                         const char* fnameOut,
+                                         size_t firstByte,
+                                         size_t lastByte,
+                                         Crypt_Digests* digests);
+
+// writes digests as a JSON object, naming the plaintext and ciphertext
+// files
+void Crypt_PrintDigests(FILE* file, const char* fnamePlain, const char* fnameCipher, const Crypt_Digests* digests);
+
+// transforms nBlocks blocks of the input file with fn under the
+// expanded key ctx. the bytes read and written are added to hashIn and
+// hashOut, unless they are NULL
+void Crypt_Transform(FILE* fileIn, FILE* fileOut, size_t nBlocks, Crypt_AESBlocksFn fn, const AES_KeyCtx* ctx,
+                     SHA256_Ctx* hashIn, SHA256_Ctx* hashOut);
+// copies nBytes bytes from fileIn to fileOut, adding them to hashIn and
+// hashOut as for Crypt_Transform
+void Crypt_CopyFile(FILE* fileIn, FILE* fileOut, size_t nBytes, SHA256_Ctx* hashIn, SHA256_Ctx* hashOut);
 
 // returns number of bytes in the file (i.e., the size of the key)
 size_t Crypt_KeyFromFile(const char* fname, byte key[]);
+// reads a key file like Crypt_KeyFromFile, but checks the size it
+// stores before reading the key: it must be 16, 24 or 32 bytes, and
+// the file must hold exactly that many. returns CRYPT_E_IO if the file
+// cannot be opened, and CRYPT_E_FORMAT if it holds no valid key
+Crypt_Error_t Crypt_LoadKeyFile(const char* fname, byte key[], size_t* keySize);
 // NOTE: the first sizeof(size_t) bytes of the file store keySize
-void Crypt_GenerateKeyFile(const char* fname, size_t keySize);
+Crypt_Error_t Crypt_GenerateKeyFile(const char* fname, size_t keySize);
+// writes a key file holding the given key
+Crypt_Error_t Crypt_WriteKeyFile(const char* fname, const byte key[], size_t keySize);
+// derives a key of SHA256_DIGEST_SIZE bytes for the purpose named by
+// label from the key of ctx, with HMAC-SHA256 over the raw key bytes
+// (HKDF-Expand with the key as the PRK). nothing about the derived key
+// can be learnt from ciphertexts under ctx, nor the other way around
+void Crypt_SubKey(const AES_KeyCtx* ctx, const char* label, byte out[]);
+
+// internal helpers
+// adds nBytes of data to the digests, unless they are NULL
+void Crypt_DigestUpdate(SHA256_Ctx* hash, SHA256_Ctx* hash2, const byte data[], size_t nBytes);
+// writes a string as a JSON string literal
+void Crypt_PrintJsonString(FILE* file, const char* str);
+
+void Crypt_DigestUpdate(SHA256_Ctx* hash, SHA256_Ctx* hash2, const byte data[], size_t nBytes) {
+    if (hash) {
+        SHA256_Update(hash, data, nBytes);
+    }
+    if (hash2) {
+        SHA256_Update(hash2, data, nBytes);
+    }
+}
 
 void Crypt_EncipherRange(const char* fnameIn,
                          const char* fnameKey,
                          const char* fnameOut,
                          size_t firstByte,
                          size_t lastByte) {
+    Crypt_EncipherRangeDigests(fnameIn, fnameKey, fnameOut, firstByte, lastByte, NULL);
+}
+
+void Crypt_DecipherRange(const char* fnameIn,
+                         const char* fnameKey,
+                         const char* fnameOut,
+                         size_t firstByte,
+                         size_t lastByte) {
+    Crypt_DecipherRangeDigests(fnameIn, fnameKey, fnameOut, firstByte, lastByte, NULL);
+}
+
+Crypt_Error_t Crypt_EncipherRangeDigests(const char* fnameIn,
+                                         const char* fnameKey,
+                                         const char* fnameOut,
+                                         size_t firstByte,
+                                         size_t lastByte,
+                                         Crypt_Digests* digests) {
+    // the bytes outside the range are the same in both files
+    SHA256_Ctx hashPlain, hashCipher;
+    SHA256_Ctx* plain = digests ? &hashPlain : NULL;
+    SHA256_Ctx* cipher = digests ? &hashCipher : NULL;
+    if (digests) {
+        SHA256_Init(plain);
+        SHA256_Init(cipher);
+    }
+
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_StatsMark mark = Crypt_PhaseBegin();
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    Crypt_PhaseEnd(CRYPT_PHASE_KEY, mark, keySize);
+
     FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
 
     // get the size of the file
     fseek(fileIn, 0L, SEEK_END);
-    off_t fsize = ftell(fileIn);
+    size_t fsize = ftell(fileIn);
     // rewind to the first byte
     // fseek(fileIn, firstByte, SEEK_SET);
     rewind(fileIn);
     // if the given lastByte is out of range, just encrypt to the end of the file
     lastByte = MIN(lastByte, fsize);
-
-    byte key[CRYPT_MAX_KEY_SIZE];
-    size_t keySize = Crypt_KeyFromFile(fnameKey, key);
+    if (firstByte > lastByte) {
+        fclose(fileIn);
+        return CRYPT_E_ARGUMENT;
+    }
 
     FILE* fileOut = fopen(fnameOut, "wb");
+    if (!fileOut) {
+        fclose(fileIn);
+        return CRYPT_E_IO;
+    }
     size_t nBlocks = (lastByte - firstByte) / STATE_SIZE;
     // number of pad bytes required to align last block to a length STATE_SIZE bytes
     // if the range is a multiple of STATE_SIZE, we pad an extra STATE_SIZE bytes
     // to the end, each with value STATE_SIZE
     byte nPad = STATE_SIZE - ((lastByte - firstByte) % STATE_SIZE);
 
-    Crypt_CopyFile(fileIn, fileOut, firstByte);
+    Crypt_CopyFile(fileIn, fileOut, firstByte, plain, cipher);
 
     // encipher the range of bytes (except the last one which will be padded below)
-    Crypt_Transform(fileIn, fileOut, nBlocks, AES_Encipher, key, keySize);
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    Crypt_Transform(fileIn, fileOut, nBlocks, AES_EncipherBlocks, &ctx, plain, cipher);
+    memset(&ctx, 0, sizeof(ctx));
 
     // pad the final block
     byte  plaintext[STATE_SIZE];
     byte ciphertext[STATE_SIZE];
+    mark = Crypt_PhaseBegin();
 
     // pad the final block
     // NOTE: if STATE_SIZE - nPad == 0, then fread returns 0 and does nothing (see fread spec)
@@ -96,22 +246,54 @@ void Crypt_EncipherRange(const char* fnameIn,
         plaintext[i] = nPad;
     }
 
-    AES_Encipher(plaintext, key, 4, ciphertext);
+    AES_Encipher(plaintext, key, CRYPT_PAD_NK, ciphertext);
     fwrite(ciphertext, sizeof(byte), STATE_SIZE, fileOut);
+    Crypt_DigestUpdate(plain, NULL, plaintext, STATE_SIZE - nPad);
+    Crypt_DigestUpdate(cipher, NULL, ciphertext, STATE_SIZE);
+    Crypt_PhaseEnd(CRYPT_PHASE_PAD, mark, STATE_SIZE);
 
     // copy any remaining bytes after the range
-    Crypt_CopyFile(fileIn, fileOut, fsize - lastByte);
+    Crypt_CopyFile(fileIn, fileOut, fsize - lastByte, plain, cipher);
 
+    memset(key, 0, sizeof(key));
     fclose(fileIn);
-    fclose(fileOut);
+    if (fclose(fileOut) != 0) {
+        return CRYPT_E_IO;
+    }
+    if (digests) {
+        SHA256_Final(plain, digests->plaintext);
+        SHA256_Final(cipher, digests->ciphertext);
+    }
+    return CRYPT_E_SUCCESS;
 }
 
-void Crypt_DecipherRange(const char* fnameIn,
-                         const char* fnameKey,
-                         const char* fnameOut,
-                         size_t firstByte,
-                         size_t lastByte) {
+Crypt_Error_t Crypt_DecipherRangeDigests(const char* fnameIn,
+                                         const char* fnameKey,
+                                         const char* fnameOut,
+                                         size_t firstByte,
+                                         size_t lastByte,
+                                         Crypt_Digests* digests) {
+    SHA256_Ctx hashPlain, hashCipher;
+    SHA256_Ctx* plain = digests ? &hashPlain : NULL;
+    SHA256_Ctx* cipher = digests ? &hashCipher : NULL;
+    if (digests) {
+        SHA256_Init(plain);
+        SHA256_Init(cipher);
+    }
+
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_StatsMark mark = Crypt_PhaseBegin();
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    Crypt_PhaseEnd(CRYPT_PHASE_KEY, mark, keySize);
+
     FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
 
     // get the size of the file
     fseek(fileIn, 0L, SEEK_END);
@@ -121,65 +303,105 @@ void Crypt_DecipherRange(const char* fnameIn,
     // if the given lastByte is out of range, just encrypt to the end of the file
     lastByte = MIN(lastByte, fsize);
 
-    // PRE: we assert the range MUST be a multiple of STATE_SIZE
-    if ((lastByte - firstByte) % STATE_SIZE != 0) {
+    // PRE: we assert the range MUST be a nonempty multiple of STATE_SIZE
+    if (firstByte >= lastByte || (lastByte - firstByte) % STATE_SIZE != 0) {
         // not a multiple of the state_size
         fprintf(stderr, "Decipher error: the range %zu to %zu is not" \
-                         "a multiple of the block size %d.\n",
+                         " a multiple of the block size %d.\n",
                          firstByte, lastByte, STATE_SIZE);
         fclose(fileIn);
-        return;
+        return CRYPT_E_FORMAT;
     }
 
-    byte key[CRYPT_MAX_KEY_SIZE];
-    size_t keySize = Crypt_KeyFromFile(fnameKey, key);
-
     FILE* fileOut = fopen(fnameOut, "wb");
+    if (!fileOut) {
+        fclose(fileIn);
+        return CRYPT_E_IO;
+    }
     size_t nBlocks = (lastByte - firstByte) / STATE_SIZE;
 
     // copy the bytes before the range
-    Crypt_CopyFile(fileIn, fileOut, firstByte);
+    Crypt_CopyFile(fileIn, fileOut, firstByte, cipher, plain);
 
     // decipher the range (the final block with padding will be delt with below)
     // check for nBlocks > 1, since we subtract 1 from nBlocks.
     // this could cause underflow if nBlocks == 1 or 0
-    for (size_t i = 0; nBlocks > 1 && i < nBlocks - 1; i++) {
-        byte ciphertext[STATE_SIZE];
-        byte  decrypted[STATE_SIZE];
-
-        fread(ciphertext, sizeof(byte), STATE_SIZE, fileIn);
-        AES_Decipher(ciphertext, key, NK_BYTES_TO_WORDS(keySize), decrypted);
-        fwrite(decrypted, sizeof(byte), STATE_SIZE, fileOut);
-    }
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    Crypt_Transform(fileIn, fileOut, (nBlocks > 1) ? nBlocks - 1 : 0, AES_DecipherBlocks, &ctx, cipher, plain);
+    memset(&ctx, 0, sizeof(ctx));
 
     // decipher the last block (by removing padding)
     byte ciphertext[STATE_SIZE];
     byte  decrypted[STATE_SIZE];
+    mark = Crypt_PhaseBegin();
 
     fread(ciphertext, sizeof(byte), STATE_SIZE, fileIn);
-    AES_Decipher(ciphertext, key, 4, decrypted);
+    AES_Decipher(ciphertext, key, CRYPT_PAD_NK, decrypted);
 
     // remove the padding present in the final state_size bytes of the file
     // there will by padByte bytes with value padByte
     byte padByte = decrypted[STATE_SIZE - 1];
-    if (padByte > STATE_SIZE) {
+    if (padByte == 0 || padByte > STATE_SIZE) {
         fprintf(stderr, "Decipher error: encountered malformed padding" \
                         " sequence. Encountered a padding sequence of"  \
-                        " size %d that exceeds the block size %d.\n",
+                        " size %d outside 1 to the block size %d.\n",
                         padByte, STATE_SIZE);
+        memset(key, 0, sizeof(key));
         fclose(fileIn);
         fclose(fileOut);
-        return;
+        return CRYPT_E_FORMAT;
     }
 
     // write the non-padding bytes to the output
     fwrite(decrypted, sizeof(byte), STATE_SIZE - padByte, fileOut);
+    Crypt_DigestUpdate(cipher, NULL, ciphertext, STATE_SIZE);
+    Crypt_DigestUpdate(plain, NULL, decrypted, STATE_SIZE - padByte);
+    Crypt_PhaseEnd(CRYPT_PHASE_PAD, mark, STATE_SIZE);
 
     // copy the remaining bytes after the range
-    Crypt_CopyFile(fileIn, fileOut, fsize - lastByte);
+    Crypt_CopyFile(fileIn, fileOut, fsize - lastByte, cipher, plain);
 
+    memset(key, 0, sizeof(key));
     fclose(fileIn);
-    fclose(fileOut);
+    if (fclose(fileOut) != 0) {
+        return CRYPT_E_IO;
+    }
+    if (digests) {
+        SHA256_Final(plain, digests->plaintext);
+        SHA256_Final(cipher, digests->ciphertext);
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_PrintJsonString(FILE* file, const char* str) {
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(file, "\\%c", *str);
+        } else if ((unsigned char) *str < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned) *str);
+        } else {
+            fputc(*str, file);
+        }
+    }
+    fputc('"', file);
+}
+
+void Crypt_PrintDigests(FILE* file, const char* fnamePlain, const char* fnameCipher, const Crypt_Digests* digests) {
+    const char* names[] = {fnamePlain, fnameCipher};
+    const byte* hashes[] = {digests->plaintext, digests->ciphertext};
+    fprintf(file, "{");
+    for (size_t i = 0; i < 2; i++) {
+        fprintf(file, "%s\"%s\": {\"file\": ", (i == 0) ? "" : ", ", (i == 0) ? "plaintext" : "ciphertext");
+        Crypt_PrintJsonString(file, names[i]);
+        fprintf(file, ", \"sha256\": \"");
+        for (size_t j = 0; j < SHA256_DIGEST_SIZE; j++) {
+            fprintf(file, "%02x", hashes[i][j]);
+        }
+        fprintf(file, "\"}");
+    }
+    fprintf(file, "}\n");
 }
 
 size_t Crypt_KeyFromFile(const char* fname, byte key[]) {
@@ -197,42 +419,112 @@ size_t Crypt_KeyFromFile(const char* fname, byte key[]) {
     return keySize;
 }
 
-void Crypt_GenerateKeyFile(const char* fname, size_t keySize) {
+Crypt_Error_t Crypt_LoadKeyFile(const char* fname, byte key[], size_t* keySize) {
+    FILE* fileKey = fopen(fname, "rb");
+    if (!fileKey) {
+        return CRYPT_E_IO;
+    }
+    size_t size = 0;
+    byte extra;
+    bool valid = fread(&size, sizeof(size_t), 1, fileKey) == 1 &&
+                 (size == 16 || size == 24 || size == 32) &&
+                 fread(key, sizeof(byte), size, fileKey) == size &&
+                 fread(&extra, sizeof(byte), 1, fileKey) == 0;
+    fclose(fileKey);
+    if (!valid) {
+        memset(key, 0, CRYPT_MAX_KEY_SIZE);
+        return CRYPT_E_FORMAT;
+    }
+    *keySize = size;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_GenerateKeyFile(const char* fname, size_t keySize) {
+    byte key[CRYPT_MAX_KEY_SIZE];
+    if (!Crypt_RandomBytes(key, keySize)) {
+        return CRYPT_E_IO;
+    }
+    Crypt_Error_t err = Crypt_WriteKeyFile(fname, key, keySize);
+    memset(key, 0, sizeof(key));
+    return err;
+}
+
+Crypt_Error_t Crypt_WriteKeyFile(const char* fname, const byte key[], size_t keySize) {
     FILE* fileKey = fopen(fname, "wb");
+    if (!fileKey) {
+        return CRYPT_E_IO;
+    }
 
     fwrite(&keySize, sizeof(size_t), 1, fileKey);
-
-    byte key[CRYPT_MAX_KEY_SIZE];
-    arc4random_buf(key, keySize);
     fwrite(key, sizeof(byte), keySize, fileKey);
 
-    fclose(fileKey);
+    return (fclose(fileKey) == 0) ? CRYPT_E_SUCCESS : CRYPT_E_IO;
 }
 
-void Crypt_Transform(FILE* fileIn, FILE* fileOut, size_t nBlocks, Crypt_AESFn aesfn, byte key[], size_t keySize) {
-    byte  plaintext[STATE_SIZE];
-    byte ciphertext[STATE_SIZE];
+void Crypt_SubKey(const AES_KeyCtx* ctx, const char* label, byte out[]) {
+    // the key schedule starts with the raw key
+    const byte counter = 0x01;
+    SHA256_HmacCtx hmac;
+    SHA256_HmacInit(&hmac, ctx->schedule, 4 * ctx->Nk);
+    SHA256_HmacUpdate(&hmac, (const byte*) label, strlen(label));
+    SHA256_HmacUpdate(&hmac, &counter, 1);
+    SHA256_HmacFinal(&hmac, out);
+    memset(&hmac, 0, sizeof(hmac));
+}
 
-    for (size_t i = 0; i < nBlocks; i++) {
-        fread(plaintext, sizeof(byte), STATE_SIZE, fileIn);
-        aesfn(plaintext, key, NK_BYTES_TO_WORDS(keySize), ciphertext);
-        fwrite(ciphertext, sizeof(byte), STATE_SIZE, fileOut);
+void Crypt_Transform(FILE* fileIn, FILE* fileOut, size_t nBlocks, Crypt_AESBlocksFn fn, const AES_KeyCtx* ctx,
+                     SHA256_Ctx* hashIn, SHA256_Ctx* hashOut) {
+    byte  plaintext[CRYPT_TRANSFORM_BUF_SIZE];
+    byte ciphertext[CRYPT_TRANSFORM_BUF_SIZE];
+
+    // a buffer at a time, so the cipher gets its own phase and span
+    // apart from the stdio calls (and digests) around it
+    for (size_t i = 0; i < nBlocks;) {
+        size_t n = MIN(nBlocks - i, (size_t) (CRYPT_TRANSFORM_BUF_SIZE / STATE_SIZE));
+        size_t nBytes = n * STATE_SIZE;
+
+        Crypt_StatsMark mark = Crypt_PhaseBegin();
+        CRYPT_TRACE_BEGIN(traceRead);
+        fread(plaintext, sizeof(byte), nBytes, fileIn);
+        Crypt_DigestUpdate(hashIn, NULL, plaintext, nBytes);
+        CRYPT_TRACE_END(traceRead, CRYPT_SPAN_READ);
+        Crypt_PhaseEnd(CRYPT_PHASE_READ, mark, nBytes);
+
+        mark = Crypt_PhaseBegin();
+        CRYPT_TRACE_BEGIN(traceCipher);
+        fn(ctx, plaintext, n, ciphertext);
+        CRYPT_TRACE_END(traceCipher, CRYPT_SPAN_CIPHER);
+        Crypt_PhaseEnd(CRYPT_PHASE_CIPHER, mark, nBytes);
+
+        mark = Crypt_PhaseBegin();
+        CRYPT_TRACE_BEGIN(traceWrite);
+        fwrite(ciphertext, sizeof(byte), nBytes, fileOut);
+        Crypt_DigestUpdate(hashOut, NULL, ciphertext, nBytes);
+        CRYPT_TRACE_END(traceWrite, CRYPT_SPAN_WRITE);
+        Crypt_PhaseEnd(CRYPT_PHASE_WRITE, mark, nBytes);
+        i += n;
     }
 }
 
-void Crypt_CopyFile(FILE* fileIn, FILE* fileOut, size_t nBytes) {
+void Crypt_CopyFile(FILE* fileIn, FILE* fileOut, size_t nBytes, SHA256_Ctx* hashIn, SHA256_Ctx* hashOut) {
     // assume: fileIn contains at least nBytes
     byte buf[CRYPT_CP_BUF_SIZE];
+    Crypt_StatsMark mark = Crypt_PhaseBegin();
+    CRYPT_TRACE_BEGIN(trace);
     size_t nCopiedBytes = 0;
     size_t nRounds = nBytes / CRYPT_CP_BUF_SIZE;
     for (size_t i = 0; i < nRounds; i++) {
         size_t nReadBytes = fread(buf, sizeof(byte), CRYPT_CP_BUF_SIZE, fileIn);
         fwrite(buf, sizeof(byte), nReadBytes, fileOut);
+        Crypt_DigestUpdate(hashIn, hashOut, buf, nReadBytes);
         nCopiedBytes += nReadBytes;
     }
     size_t nRemainingBytes = nBytes - nCopiedBytes;
     size_t nReadBytes = fread(buf, sizeof(byte), nRemainingBytes, fileIn);
     fwrite(buf, sizeof(byte), nReadBytes, fileOut);
+    Crypt_DigestUpdate(hashIn, hashOut, buf, nReadBytes);
+    CRYPT_TRACE_END(trace, CRYPT_SPAN_COPY);
+    Crypt_PhaseEnd(CRYPT_PHASE_COPY, mark, nCopiedBytes + nReadBytes);
 }
 
 #endif  // CC_CIPH_H_
\ No newline at end of file
@@ -0,0 +1,479 @@
+#ifndef CC_CIPHASYNC_HPP_
+#define CC_CIPHASYNC_HPP_
+
+// a coroutine API for enciphering and deciphering files without
+// blocking the caller (needs C++20; with older standards this header is
+// empty):
+//
+//     ciph::executor ex(4);
+//     Crypt_Error_t err = co_await ciph::encrypt_file(ex, "a.txt", "key.ciphkey", "a.ciph");
+//
+// the executor runs coroutines and AES work on a thread pool (see
+// pool.h). encrypt_file and decrypt_file move onto the pool as soon as
+// they are awaited, so the awaiting thread (e.g., an event loop) is free
+// until they finish. each file is transformed in CIPH_ASYNC_CHUNK_SIZE
+// chunks: the AES work of a chunk is handed to the pool as a task, and
+// the file job reads the next chunk while it runs, then writes the
+// result. a job that waits for its AES task gives up its thread, so
+// many concurrent jobs share a few threads. the awaiting coroutine is
+// resumed on a pool thread.
+//
+// the files are the same as those of encipher (see stream.h). reads and
+// writes are plain blocking calls on the pool threads.
+//
+// task<T> is a lazy coroutine that starts when it is awaited. when_all
+// runs several at once, and sync_wait blocks until one finishes, for
+// code outside coroutines (e.g., tests).
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+extern "C" {
+    #include "ciph.h"
+    #include "pool.h"
+    #include "stream.h"
+}
+
+// size of the chunks of a file job, a multiple of STATE_SIZE
+#define CIPH_ASYNC_CHUNK_SIZE (16 * CRYPT_CHUNK_SIZE)
+
+namespace ciph {
+
+// runs coroutines and tasks on a Crypt_Pool
+class executor {
+public:
+    explicit executor(size_t nWorkers) : pool_(Crypt_PoolNew(nWorkers)) {
+        if (!pool_) {
+            throw std::bad_alloc();
+        }
+    }
+
+    // waits for everything that was posted
+    ~executor() {
+        Crypt_PoolFree(pool_);
+    }
+
+    executor(const executor&) = delete;
+    executor& operator=(const executor&) = delete;
+
+    // runs fn(arg) on the pool, or here if it cannot be queued
+    void post(Crypt_TaskFn fn, void* arg) {
+        if (Crypt_PoolSubmit(pool_, fn, arg) != CRYPT_E_SUCCESS) {
+            fn(arg);
+        }
+    }
+
+    void post(std::coroutine_handle<> h) {
+        post(resume, h.address());
+    }
+
+    // co_await ex.schedule() continues the coroutine on the pool
+    auto schedule() {
+        struct awaiter {
+            executor* ex;
+            bool await_ready() const noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> h) {
+                ex->post(h);
+            }
+            void await_resume() const noexcept {}
+        };
+        return awaiter{this};
+    }
+
+    // returns once everything that was posted has finished
+    void wait() {
+        Crypt_PoolWait(pool_);
+    }
+
+private:
+    static void resume(void* address) {
+        std::coroutine_handle<>::from_address(address).resume();
+    }
+
+    Crypt_Pool* pool_;
+};
+
+template <typename T>
+class task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        task get_return_object() {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        // resumes the awaiting coroutine
+        struct final_awaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                std::coroutine_handle<> c = h.promise().continuation;
+                return c ? c : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+        final_awaiter final_suspend() noexcept {
+            return {};
+        }
+        void return_value(T v) {
+            value.emplace(std::move(v));
+        }
+        void unhandled_exception() {
+            error = std::current_exception();
+        }
+    };
+
+    task(task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (h_) {
+                h_.destroy();
+            }
+            h_ = std::exchange(other.h_, nullptr);
+        }
+        return *this;
+    }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+        h_.promise().continuation = c;
+        return h_;
+    }
+    T await_resume() {
+        if (h_.promise().error) {
+            std::rethrow_exception(h_.promise().error);
+        }
+        return std::move(*h_.promise().value);
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+// a coroutine that starts at once and frees itself when it ends
+struct detached {
+    struct promise_type {
+        detached get_return_object() {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+// the results of when_all, and the tasks still running (plus one until
+// all of them were started)
+template <typename T>
+struct join_state {
+    std::vector<std::optional<T>> results;
+    std::vector<std::exception_ptr> errors;
+    std::atomic<size_t> remaining;
+    std::coroutine_handle<> parent;
+};
+
+template <typename T>
+detached join_one(task<T>& t, size_t i, join_state<T>& state) {
+    try {
+        state.results[i].emplace(co_await t);
+    } catch (...) {
+        state.errors[i] = std::current_exception();
+    }
+    if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        state.parent.resume();
+    }
+}
+
+template <typename T>
+struct sync_state {
+    std::mutex lock;
+    std::condition_variable done;
+    bool finished = false;
+    std::optional<T> result;
+    std::exception_ptr error;
+};
+
+template <typename T>
+detached sync_one(task<T>& t, sync_state<T>& state) {
+    try {
+        state.result.emplace(co_await t);
+    } catch (...) {
+        state.error = std::current_exception();
+    }
+    // notified under the lock, since the waiter frees state once it
+    // sees finished
+    std::lock_guard<std::mutex> guard(state.lock);
+    state.finished = true;
+    state.done.notify_one();
+}
+
+// a function run on the executor; co_await waits for its result
+template <typename F>
+class offloaded {
+public:
+    offloaded(executor& ex, F fn) : fn_(std::move(fn)), state_(RUNNING) {
+        ex.post(run, this);
+    }
+    // the function uses this object, so it must finish first
+    ~offloaded() {
+        std::unique_lock<std::mutex> guard(lock_);
+        done_.wait(guard, [this] { return finished_; });
+    }
+    offloaded(const offloaded&) = delete;
+    offloaded& operator=(const offloaded&) = delete;
+
+    bool await_ready() const noexcept {
+        return state_.load(std::memory_order_acquire) == DONE;
+    }
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        waiter_ = h;
+        int expected = RUNNING;
+        // false if the function finished in the meantime
+        return state_.compare_exchange_strong(expected, WAITING, std::memory_order_acq_rel);
+    }
+    decltype(std::declval<F&>()()) await_resume() {
+        return std::move(result_);
+    }
+
+private:
+    enum { RUNNING, WAITING, DONE };
+
+    static void run(void* arg) {
+        offloaded* self = (offloaded*) arg;
+        self->result_ = self->fn_();
+        std::unique_lock<std::mutex> guard(self->lock_);
+        self->finished_ = true;
+        if (self->state_.exchange(DONE, std::memory_order_acq_rel) == WAITING) {
+            // the waiter continues on this thread, and may destroy
+            // this object before resume returns
+            guard.unlock();
+            self->waiter_.resume();
+            return;
+        }
+        // notified under the lock, since the owner frees this object
+        // once it sees finished_
+        self->done_.notify_one();
+    }
+
+    F fn_;
+    decltype(std::declval<F&>()()) result_;
+    std::atomic<int> state_;
+    std::coroutine_handle<> waiter_;
+    std::mutex lock_;
+    std::condition_variable done_;
+    bool finished_ = false;
+};
+
+inline bool read_full(int fd, byte buf[], size_t n, size_t* nRead) {
+    *nRead = 0;
+    while (*nRead < n) {
+        ssize_t r = read(fd, buf + *nRead, n - *nRead);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            return false;
+        }
+        if (r == 0) {
+            break;
+        }
+        *nRead += r;
+    }
+    return true;
+}
+
+inline bool write_full(int fd, const byte buf[], size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+        buf += w;
+        n -= w;
+    }
+    return true;
+}
+
+inline task<Crypt_Error_t> transform_file(executor& ex, std::string fnameIn, std::string fnameKey,
+                                          std::string fnameOut, bool encipher) {
+    co_await ex.schedule();
+
+    // the key is checked before the output is created
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey.c_str(), key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        co_return err;
+    }
+    Crypt_StreamCtx ctx;
+    Crypt_Init(&ctx, key, keySize, encipher);
+    memset(key, 0, sizeof(key));
+
+    int fdIn = open(fnameIn.c_str(), O_RDONLY);
+    if (fdIn < 0) {
+        co_return CRYPT_E_IO;
+    }
+    int fdOut = open(fnameOut.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fdOut < 0) {
+        close(fdIn);
+        co_return CRYPT_E_IO;
+    }
+
+    // the next chunk is read into one buffer while the other is
+    // transformed
+    std::vector<byte> in[2] = {std::vector<byte>(CIPH_ASYNC_CHUNK_SIZE), std::vector<byte>(CIPH_ASYNC_CHUNK_SIZE)};
+    std::vector<byte> out(CIPH_ASYNC_CHUNK_SIZE + STATE_SIZE);
+    size_t n, k = 0;
+    if (!read_full(fdIn, in[0].data(), CIPH_ASYNC_CHUNK_SIZE, &n)) {
+        err = CRYPT_E_IO;
+    }
+    while (err == CRYPT_E_SUCCESS && n > 0) {
+        const byte* chunk = in[k].data();
+        auto update = [&ctx, &out, chunk, n] {
+            return Crypt_Update(&ctx, chunk, n, out.data());
+        };
+        size_t nOut, nNext;
+        {
+            offloaded<decltype(update)> op(ex, update);
+            if (!read_full(fdIn, in[1 - k].data(), CIPH_ASYNC_CHUNK_SIZE, &nNext)) {
+                err = CRYPT_E_IO;
+            }
+            nOut = co_await op;
+        }
+        if (err == CRYPT_E_SUCCESS && !write_full(fdOut, out.data(), nOut)) {
+            err = CRYPT_E_IO;
+        }
+        n = nNext;
+        k = 1 - k;
+    }
+
+    size_t nOut = 0;
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_Final(&ctx, out.data(), &nOut);
+    }
+    memset(&ctx, 0, sizeof(ctx));
+    if (err == CRYPT_E_SUCCESS && !write_full(fdOut, out.data(), nOut)) {
+        err = CRYPT_E_IO;
+    }
+    close(fdIn);
+    if (close(fdOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    co_return err;
+}
+
+}  // namespace detail
+
+// enciphers fnameIn into fnameOut with the key in fnameKey, like
+// encipher over the whole file
+inline task<Crypt_Error_t> encrypt_file(executor& ex, std::string fnameIn, std::string fnameKey, std::string fnameOut) {
+    return detail::transform_file(ex, std::move(fnameIn), std::move(fnameKey), std::move(fnameOut), true);
+}
+
+// deciphers what encrypt_file (or encipher) wrote. returns
+// CRYPT_E_FORMAT if the input is truncated or malformed
+inline task<Crypt_Error_t> decrypt_file(executor& ex, std::string fnameIn, std::string fnameKey, std::string fnameOut) {
+    return detail::transform_file(ex, std::move(fnameIn), std::move(fnameKey), std::move(fnameOut), false);
+}
+
+// runs all the tasks at once and returns their results in order. if any
+// of them throws, the first exception is rethrown once all have finished
+template <typename T>
+task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+    detail::join_state<T> state;
+    state.results.resize(tasks.size());
+    state.errors.resize(tasks.size());
+    state.remaining.store(tasks.size() + 1);
+
+    struct start_all {
+        std::vector<task<T>>& tasks;
+        detail::join_state<T>& state;
+        bool await_ready() const noexcept {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> h) {
+            state.parent = h;
+            for (size_t i = 0; i < tasks.size(); i++) {
+                detail::join_one(tasks[i], i, state);
+            }
+            // stays suspended unless every task already finished
+            return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+        void await_resume() const noexcept {}
+    };
+    co_await start_all{tasks, state};
+
+    std::vector<T> results;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if (state.errors[i]) {
+            std::rethrow_exception(state.errors[i]);
+        }
+        results.push_back(std::move(*state.results[i]));
+    }
+    co_return results;
+}
+
+// runs t and blocks until it finishes
+template <typename T>
+T sync_wait(task<T> t) {
+    detail::sync_state<T> state;
+    detail::sync_one(t, state);
+    std::unique_lock<std::mutex> guard(state.lock);
+    state.done.wait(guard, [&state] { return state.finished; });
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+    return std::move(*state.result);
+}
+
+}  // namespace ciph
+
+#endif  // __cplusplus >= 202002L
+
+#endif  // CC_CIPHASYNC_HPP_
@@ -0,0 +1,316 @@
+#ifndef CC_CIPHSTREAM_HPP_
+#define CC_CIPHSTREAM_HPP_
+
+// iostreams over enciphered files, for C++ code that already writes to
+// and reads from streams:
+//
+//     ciph_ostream out("data.ciph", "key128.ciphkey");
+//     out << data;
+//     out.close();
+//     ciph_istream in("data.ciph", "key128.ciphkey");
+//     in >> data;
+//
+// the files are the same as those of encipher (see stream.h), so either
+// side may be the command-line utility. ciph_streambuf keeps a large
+// buffer of plaintext and transforms all of it at once when it is full
+// (overflow) or empty (underflow), never a character at a time; writes
+// of at least a buffer's worth skip the buffer. the streams and their
+// buffer can be moved but not copied.
+//
+// a ciphertext that is cut short or has bad padding makes the reading
+// stream bad (underflow throws, which sets badbit). closing a writing
+// stream writes the padded final block; a stream that is destroyed
+// without being closed is closed then, without reporting errors.
+
+#include <cstdio>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+    #include "ciph.h"
+    #include "stream.h"
+}
+
+// default size of the plaintext buffer
+#define CIPH_STREAM_BUF_SIZE (1 << 20)
+
+class ciph_streambuf : public std::streambuf {
+public:
+    ciph_streambuf() : file_(NULL), encipher_(false), finished_(true), bufSize_(0) {
+        memset(&ctx_, 0, sizeof(ctx_));
+    }
+
+    // enciphers everything written into file, or deciphers file for
+    // reading (if encipher is false). the buffer owns file
+    ciph_streambuf(FILE* file, const byte key[], size_t keySize, bool encipher,
+                   size_t bufSize = CIPH_STREAM_BUF_SIZE)
+        : file_(file), encipher_(encipher), finished_(false), bufSize_(bufSize),
+          plain_(bufSize + STATE_SIZE), cipher_(bufSize + STATE_SIZE) {
+        Crypt_Init(&ctx_, key, keySize, encipher);
+        // the buffers here are the only ones
+        setvbuf(file_, NULL, _IONBF, 0);
+        if (encipher_) {
+            setp(plain_.data(), plain_.data() + bufSize_);
+        } else {
+            setg(plain_.data(), plain_.data(), plain_.data());
+        }
+    }
+
+    // the buffers are moved, not copied, so the pointers into them stay
+    // valid
+    ciph_streambuf(ciph_streambuf&& other)
+        : std::streambuf(other), file_(other.file_), encipher_(other.encipher_), finished_(other.finished_),
+          bufSize_(other.bufSize_), plain_(std::move(other.plain_)), cipher_(std::move(other.cipher_)), ctx_(other.ctx_) {
+        other.release();
+    }
+
+    ciph_streambuf& operator=(ciph_streambuf&& other) {
+        if (this != &other) {
+            close();
+            std::streambuf::operator=(other);
+            file_ = other.file_;
+            encipher_ = other.encipher_;
+            finished_ = other.finished_;
+            bufSize_ = other.bufSize_;
+            plain_ = std::move(other.plain_);
+            cipher_ = std::move(other.cipher_);
+            ctx_ = other.ctx_;
+            other.release();
+        }
+        return *this;
+    }
+
+    ciph_streambuf(const ciph_streambuf&) = delete;
+    ciph_streambuf& operator=(const ciph_streambuf&) = delete;
+
+    ~ciph_streambuf() {
+        close();
+    }
+
+    bool is_open() const {
+        return file_ != NULL;
+    }
+
+    // writes out the rest of an enciphered file and closes it. returns
+    // false if anything failed
+    bool close() {
+        if (!file_) {
+            return true;
+        }
+        bool ok = true;
+        if (encipher_) {
+            ok = flush();
+            size_t nOut;
+            Crypt_Final(&ctx_, (byte*) cipher_.data(), &nOut);
+            ok = ok && fwrite(cipher_.data(), 1, nOut, file_) == nOut;
+        }
+        memset(&ctx_, 0, sizeof(ctx_));
+        ok = (fclose(file_) == 0) && ok;
+        file_ = NULL;
+        setp(NULL, NULL);
+        setg(NULL, NULL, NULL);
+        return ok;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!file_ || !encipher_ || !flush()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        if (!file_ || !encipher_) {
+            return 0;
+        }
+        if (n < epptr() - pptr()) {
+            memcpy(pptr(), s, n);
+            pbump((int) n);
+            return n;
+        }
+        // large writes are enciphered straight from s, a buffer's worth
+        // at a time
+        if (!flush()) {
+            return 0;
+        }
+        std::streamsize nDone = 0;
+        while (n - nDone >= (std::streamsize) bufSize_) {
+            if (!write((const byte*) s + nDone, bufSize_)) {
+                return nDone;
+            }
+            nDone += bufSize_;
+        }
+        memcpy(pptr(), s + nDone, n - nDone);
+        pbump((int) (n - nDone));
+        return n;
+    }
+
+    int sync() override {
+        if (file_ && encipher_) {
+            return (flush() && fflush(file_) == 0) ? 0 : -1;
+        }
+        return 0;
+    }
+
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        while (file_ && !encipher_ && !finished_) {
+            size_t nIn = fread(cipher_.data(), 1, bufSize_, file_);
+            size_t nOut;
+            if (nIn > 0) {
+                // plain_ has room for the input and a block held back
+                nOut = Crypt_Update(&ctx_, (const byte*) cipher_.data(), nIn, (byte*) plain_.data());
+            } else {
+                finished_ = true;
+                if (ferror(file_) || Crypt_Final(&ctx_, (byte*) plain_.data(), &nOut) != CRYPT_E_SUCCESS) {
+                    throw std::ios_base::failure("ciph_streambuf: the ciphertext is truncated or malformed");
+                }
+            }
+            if (nOut > 0) {
+                setg(plain_.data(), plain_.data(), plain_.data() + nOut);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+        return traits_type::eof();
+    }
+
+private:
+    // enciphers and writes the buffered plaintext
+    bool flush() {
+        size_t n = pptr() - pbase();
+        setp(plain_.data(), plain_.data() + bufSize_);
+        return write((const byte*) plain_.data(), n);
+    }
+
+    bool write(const byte data[], size_t n) {
+        size_t nOut = Crypt_Update(&ctx_, data, n, (byte*) cipher_.data());
+        return fwrite(cipher_.data(), 1, nOut, file_) == nOut;
+    }
+
+    // leaves a moved-from buffer closed
+    void release() {
+        file_ = NULL;
+        finished_ = true;
+        memset(&ctx_, 0, sizeof(ctx_));
+        setp(NULL, NULL);
+        setg(NULL, NULL, NULL);
+    }
+
+    FILE* file_;
+    bool encipher_;
+    bool finished_;  // the end of the ciphertext was deciphered
+    size_t bufSize_;
+    std::vector<char> plain_;
+    std::vector<char> cipher_;
+    Crypt_StreamCtx ctx_;
+};
+
+// opens fname for ciph_streambuf with the key in fnameKey, or returns
+// an empty buffer if either cannot be read. the key is checked before
+// fname is created
+inline ciph_streambuf ciph_open(const std::string& fname, const std::string& fnameKey, bool encipher, size_t bufSize) {
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    if (Crypt_LoadKeyFile(fnameKey.c_str(), key, &keySize) != CRYPT_E_SUCCESS) {
+        return ciph_streambuf();
+    }
+    FILE* file = fopen(fname.c_str(), encipher ? "wb" : "rb");
+    if (!file) {
+        memset(key, 0, sizeof(key));
+        return ciph_streambuf();
+    }
+    ciph_streambuf buf(file, key, keySize, encipher, bufSize);
+    memset(key, 0, sizeof(key));
+    return buf;
+}
+
+// enciphers everything written to it into a file
+class ciph_ostream : public std::ostream {
+public:
+    ciph_ostream(const std::string& fname, const std::string& fnameKey, size_t bufSize = CIPH_STREAM_BUF_SIZE)
+        : std::ostream(NULL), buf_(ciph_open(fname, fnameKey, true, bufSize)) {
+        init(&buf_);
+        if (!buf_.is_open()) {
+            setstate(std::ios_base::failbit);
+        }
+    }
+
+    ciph_ostream(ciph_ostream&& other) : std::ostream(std::move(other)), buf_(std::move(other.buf_)) {
+        set_rdbuf(&buf_);
+    }
+
+    ciph_ostream& operator=(ciph_ostream&& other) {
+        std::ostream::operator=(std::move(other));
+        buf_ = std::move(other.buf_);
+        return *this;
+    }
+
+    ciph_streambuf* rdbuf() const {
+        return const_cast<ciph_streambuf*>(&buf_);
+    }
+
+    bool is_open() const {
+        return buf_.is_open();
+    }
+
+    // writes the padded final block and closes the file
+    void close() {
+        if (!buf_.close()) {
+            setstate(std::ios_base::failbit);
+        }
+    }
+
+private:
+    ciph_streambuf buf_;
+};
+
+// reads the deciphered contents of a file
+class ciph_istream : public std::istream {
+public:
+    ciph_istream(const std::string& fname, const std::string& fnameKey, size_t bufSize = CIPH_STREAM_BUF_SIZE)
+        : std::istream(NULL), buf_(ciph_open(fname, fnameKey, false, bufSize)) {
+        init(&buf_);
+        if (!buf_.is_open()) {
+            setstate(std::ios_base::failbit);
+        }
+    }
+
+    ciph_istream(ciph_istream&& other) : std::istream(std::move(other)), buf_(std::move(other.buf_)) {
+        set_rdbuf(&buf_);
+    }
+
+    ciph_istream& operator=(ciph_istream&& other) {
+        std::istream::operator=(std::move(other));
+        buf_ = std::move(other.buf_);
+        return *this;
+    }
+
+    ciph_streambuf* rdbuf() const {
+        return const_cast<ciph_streambuf*>(&buf_);
+    }
+
+    bool is_open() const {
+        return buf_.is_open();
+    }
+
+    void close() {
+        buf_.close();
+    }
+
+private:
+    ciph_streambuf buf_;
+};
+
+#endif  // CC_CIPHSTREAM_HPP_
@@ -0,0 +1,1183 @@
+#ifndef CC_CONTAINER_H_
+#define CC_CONTAINER_H_
+
+// a chunked file format for enciphered data. unlike the output of
+// Crypt_EncipherRange, the whole input is split into chunks of at most
+// chunkSize bytes that are transformed independently, so a range of the
+// original file can be deciphered without touching the other chunks.
+//
+// layout:
+//     Crypt_Header
+//     for each chunk:
+//         Crypt_ChunkHeader (not enciphered)
+//         payload: dataSize bytes (optionally compressed), zero padded to
+//                  a multiple of STATE_SIZE and enciphered block by block
+//
+// the chunk headers record the size of each payload, so the offsets of
+// all chunks can be found by hopping from header to header
+// (see Crypt_IndexChunks) without deciphering anything.
+//
+// when enciphering sparse files, holes found with SEEK_DATA / SEEK_HOLE
+// are recorded as hole chunks: a chunk header with no payload whose
+// rawSize is the length of the hole (which may exceed chunkSize).
+// deciphering recreates them as holes in the output when it can seek.
+//
+// with CRYPT_HDR_MERKLE, the last chunk is a tree chunk holding a Merkle
+// tree of tags over all the other chunks (see merkle.h). deciphering
+// checks each chunk it reads against the tree, so a range is
+// authenticated without reading the rest of the container. the root tag
+// is kept in the header, which is written again once the tree is known,
+// so enciphering with a tree needs a seekable output. the tag is keyed,
+// so it cannot be rebuilt without the key. it binds the rest of the
+// header (see Crypt_TreeBound), so the flags cannot be changed either.
+// a tree that was cut off together with CRYPT_HDR_MERKLE is caught by
+// asking for the flag (see Crypt_DecipherChunkedRequire). deciphering
+// to a file by name writes under a temporary name that only replaces
+// the output once every chunk was authenticated (see Crypt_OpenOutput).
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>  // for lseek(), ftruncate(), pread(), pwrite()
+
+#include "ciph.h"
+#include "keywrap.h"
+#include "lz.h"
+#include "merkle.h"
+#include "pool.h"
+#include "xxhash.h"
+
+#define CRYPT_MAGIC "CIPH"
+#define CRYPT_MAGIC_SIZE 4
+#define CRYPT_CONTAINER_VERSION 1
+// upper bound accepted for the chunk size of a container
+#define CRYPT_MAX_CHUNK_SIZE (64 * 1024 * 1024)
+// upper bound for the length of a single hole chunk
+#define CRYPT_MAX_HOLE_SIZE ((size_t) 1 << 31)
+
+// header flags
+#define CRYPT_HDR_COMPRESSED 0x0001  // chunks were compressed when possible
+#define CRYPT_HDR_SPARSE 0x0002  // holes in the input were kept as hole chunks
+#define CRYPT_HDR_ARCHIVE 0x0004  // the plaintext is an archive of several files (see archive.h)
+#define CRYPT_HDR_KEYID 0x0008  // keyId names the key in a keyring (see keyring.h)
+#define CRYPT_HDR_WRAPPED 0x0010  // chunks use the data key in wrappedKey (see envelope.h)
+#define CRYPT_HDR_MERKLE 0x0020  // a tree chunk authenticates the chunks
+
+// max size of a wrapped data key (a 256-bit key, see keywrap.h)
+#define CRYPT_WRAPPED_KEY_SIZE (CRYPT_MAX_KEY_SIZE + CRYPT_KEYWRAP_IV_SIZE)
+
+// chunk flags
+#define CRYPT_CHUNK_LZ 0x0001  // payload is compressed with LZ_Compress
+#define CRYPT_CHUNK_HOLE 0x0002  // rawSize zero bytes with no payload
+#define CRYPT_CHUNK_TREE 0x0004  // the Merkle tree: dataSize bytes, not enciphered
+#define CRYPT_CHUNK_SUM 0x0008  // reserved holds Crypt_ChunkSum of the stored payload
+#define CRYPT_CHUNK_BATCH 0x0010  // the first chunk of a single write to a log (see log.h)
+
+// size of a payload of n bytes once padded to whole blocks
+#define CRYPT_STORED_SIZE(n) ((((n) + STATE_SIZE - 1) / STATE_SIZE) * STATE_SIZE)
+// size of a buffer that can hold any stored payload of a chunk
+#define CRYPT_PAYLOAD_BUF_SIZE(chunkSize) CRYPT_STORED_SIZE(LZ_BOUND(chunkSize))
+
+// NOTE: headers are written as-is, so containers use the byte order
+// of the machine that wrote them (like the key size in key files)
+typedef struct {
+    char magic[CRYPT_MAGIC_SIZE];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t chunkSize;  // max number of plaintext bytes per chunk
+    uint8_t keySize;  // key size in bytes
+    uint8_t reserved[3];
+    uint64_t keyId;  // only meaningful if flags has CRYPT_HDR_KEYID
+    // with CRYPT_HDR_WRAPPED, the data key of keySize bytes wrapped
+    // under the key the container is opened with
+    uint8_t wrappedKey[CRYPT_WRAPPED_KEY_SIZE];
+    // with CRYPT_HDR_MERKLE, the root tag of the tree (see merkle.h)
+    uint8_t root[CRYPT_MERKLE_TAG_SIZE];
+} Crypt_Header;
+
+typedef struct {
+    uint32_t rawSize;  // number of plaintext bytes in the chunk
+    uint32_t dataSize;  // number of payload bytes before padding
+    uint32_t flags;
+    uint32_t reserved;
+} Crypt_ChunkHeader;
+
+typedef struct {
+    off_t offset;  // offset of the chunk header in the file
+    size_t rawOffset;  // offset of the chunk's first byte in the plaintext
+    Crypt_ChunkHeader hdr;
+} Crypt_ChunkInfo;
+
+typedef struct {
+    Crypt_Header hdr;
+    size_t nChunks;
+    Crypt_ChunkInfo* chunks;
+    size_t rawSize;  // size of the plaintext
+    off_t treeOffset;  // offset of the tree chunk header (0 if none)
+} Crypt_ChunkIndex;
+
+// returns true if the file starts with a container header
+bool Crypt_IsContainer(const char* fname);
+bool Crypt_IsContainerFd(int fd);
+// reads and validates the header at the current position of file
+Crypt_Error_t Crypt_ReadHeader(FILE* file, Crypt_Header* hdr);
+// fills in a header for a new container
+void Crypt_InitHeader(Crypt_Header* hdr, size_t keySize, uint16_t flags);
+// sets *dataCtx to the schedule the chunks of a container with header
+// hdr are enciphered with, given the key (of keySize bytes) that the
+// container is opened with: the key itself, or the data key it unwraps.
+// returns CRYPT_E_ARGUMENT if the key does not fit the container. ctx
+// and dataCtx may be the same
+Crypt_Error_t Crypt_ContainerKey(const Crypt_Header* hdr, const AES_KeyCtx* ctx, size_t keySize, AES_KeyCtx* dataCtx);
+// generates a data key of hdr->keySize bytes, wraps it with kek into
+// hdr and sets *dataCtx to its schedule (see envelope.h). returns
+// CRYPT_E_IO if no random key could be generated
+Crypt_Error_t Crypt_SealHeader(Crypt_Header* hdr, const AES_KeyCtx* kek, AES_KeyCtx* dataCtx);
+// reads the header and every chunk header of the file
+Crypt_Error_t Crypt_IndexChunks(FILE* file, Crypt_ChunkIndex* index);
+void Crypt_FreeIndex(Crypt_ChunkIndex* index);
+// reads the Merkle tree of an indexed container into *tree (to be
+// freed) and checks its root tag with dataCtx. returns
+// CRYPT_E_INTEGRITY if it fails
+Crypt_Error_t Crypt_LoadTree(FILE* file, const Crypt_ChunkIndex* index, const AES_KeyCtx* dataCtx, byte** tree);
+// checks chunk i against a loaded tree, given its stored payload
+Crypt_Error_t Crypt_CheckChunk(const byte tree[],
+                               const Crypt_ChunkIndex* index,
+                               const byte macKey[],
+                               size_t i,
+                               const byte payload[]);
+// appends the tree of the chunks added to m, for the container with
+// header hdr, as a tree chunk. its root tag is set in hdr, which is
+// then written again at hdrOffset in fileOut
+Crypt_Error_t Crypt_WriteTree(FILE* fileOut, Crypt_Merkle* m, Crypt_Header* hdr, off_t hdrOffset);
+// sets *bound to the part of hdr that the root tag of a tree binds:
+// everything but the root tag itself, and the key wrapping and the
+// keyring key, which rotating the master key rewrites in place (see
+// envelope.h)
+void Crypt_TreeBound(const Crypt_Header* hdr, Crypt_Header* bound);
+
+// compresses (if compress is true and it pays off) and enciphers rawSize
+// bytes of raw into payload, which must hold
+// CRYPT_PAYLOAD_BUF_SIZE(rawSize) bytes. fills in chdr
+void Crypt_EncipherChunk(const AES_KeyCtx* ctx,
+                         const byte raw[],
+                         size_t rawSize,
+                         bool compress,
+                         Crypt_ChunkHeader* chdr,
+                         byte payload[]);
+// deciphers the stored payload in place and points *data at the
+// chunk's plaintext: either the payload itself or, if the chunk is
+// compressed, scratch (which must hold chunkSize bytes)
+Crypt_Error_t Crypt_DecipherChunk(const AES_KeyCtx* ctx,
+                                  const Crypt_ChunkHeader* chdr,
+                                  size_t chunkSize,
+                                  byte payload[],
+                                  byte scratch[],
+                                  const byte** data);
+
+// a checksum of a stored payload, to catch torn writes (not an
+// authenticator; see merkle.h for that)
+uint32_t Crypt_ChunkSum(const byte payload[], size_t storedSize);
+
+// enciphers rawSize bytes of raw and appends the chunk to fileOut,
+// using payload as scratch space (see Crypt_EncipherChunk). the chunk
+// is added to tree unless it is NULL
+Crypt_Error_t Crypt_WriteChunk(FILE* fileOut,
+                               const AES_KeyCtx* ctx,
+                               const byte raw[],
+                               size_t rawSize,
+                               bool compress,
+                               byte payload[],
+                               Crypt_Merkle* tree);
+// appends hole chunks covering nBytes zero bytes to fileOut (and tree)
+Crypt_Error_t Crypt_WriteHole(FILE* fileOut, size_t nBytes, Crypt_Merkle* tree);
+// writes nBytes zero bytes to fileOut, as a hole if the file is seekable.
+// sets *pending if the file must still be extended to its final size
+Crypt_Error_t Crypt_SkipHole(FILE* fileOut, size_t nBytes, bool* pending);
+
+// enciphers the whole input file into a container. if flags contains
+// CRYPT_HDR_SPARSE, holes in the input are stored as hole chunks
+Crypt_Error_t Crypt_EncipherChunked(const char* fnameIn,
+                                    const char* fnameKey,
+                                    const char* fnameOut,
+                                    uint16_t flags);
+// the same on open files: writes hdr (see Crypt_InitHeader) and
+// enciphers the chunks with ctx, followed by their tree if hdr has
+// CRYPT_HDR_MERKLE. the files are left open
+Crypt_Error_t Crypt_EncipherChunkedFile(FILE* fileIn,
+                                        const AES_KeyCtx* ctx,
+                                        const Crypt_Header* hdr,
+                                        FILE* fileOut);
+// deciphers bytes firstByte to lastByte of the original file from a
+// container, writing only that range to the output. only the chunks
+// overlapping the range are read (and, with a tree, authenticated)
+Crypt_Error_t Crypt_DecipherChunked(const char* fnameIn,
+                                    const char* fnameKey,
+                                    const char* fnameOut,
+                                    size_t firstByte,
+                                    size_t lastByte);
+// the same, but returns CRYPT_E_INTEGRITY before writing anything if
+// the header lacks any of the flags in required (e.g., CRYPT_HDR_MERKLE
+// for a container that must be authenticated). the chunks are
+// deciphered on nWorkers threads if the output is a regular file
+Crypt_Error_t Crypt_DecipherChunkedRequire(const char* fnameIn,
+                                           const char* fnameKey,
+                                           const char* fnameOut,
+                                           size_t firstByte,
+                                           size_t lastByte,
+                                           uint16_t required,
+                                           size_t nWorkers);
+// the same on open files, with an expanded key of keySize bytes. if
+// the container has a wrapped data key, the key unwraps it. the files
+// are left open, with fileOut positioned after the range
+Crypt_Error_t Crypt_DecipherChunkedFile(FILE* fileIn,
+                                        const AES_KeyCtx* ctx,
+                                        size_t keySize,
+                                        FILE* fileOut,
+                                        size_t firstByte,
+                                        size_t lastByte,
+                                        uint16_t required,
+                                        size_t nWorkers);
+// re-enciphers a container opened with oldCtx (of oldKeySize bytes)
+// under newCtx, chunk by chunk: each payload is deciphered and
+// enciphered again in memory, so compressed chunks stay compressed and
+// no plaintext is written anywhere. a wrapped container gets a new
+// data key wrapped under newCtx, and a tree is checked and rebuilt
+// under the new key. the files are left open
+Crypt_Error_t Crypt_RekeyChunkedFile(FILE* fileIn,
+                                     const AES_KeyCtx* oldCtx,
+                                     size_t oldKeySize,
+                                     const AES_KeyCtx* newCtx,
+                                     size_t newKeySize,
+                                     FILE* fileOut);
+
+// opens the output of a decipher by name. a regular file (or a new
+// one) is written under a temporary name next to it, set in *fnameTmp,
+// so nothing appears under fnameOut before the whole range was
+// authenticated. other outputs (pipes, terminals) are written directly
+FILE* Crypt_OpenOutput(const char* fnameOut, char** fnameTmp);
+// closes an output opened with Crypt_OpenOutput, moving it over
+// fnameOut if err is CRYPT_E_SUCCESS and removing it otherwise. returns
+// err, or CRYPT_E_IO if closing or renaming fails
+Crypt_Error_t Crypt_CloseOutput(FILE* fileOut, const char* fnameOut, char* fnameTmp, Crypt_Error_t err);
+
+// internal helpers
+// number of runs per worker when deciphering in parallel, so a slow
+// run does not hold up the rest
+#define CRYPT_DECIPHER_RUNS_PER_WORKER 4
+
+typedef struct Crypt_Decipherer Crypt_Decipherer;
+
+typedef struct {
+    Crypt_Decipherer* d;
+    size_t first, last;  // chunks first to last - 1
+} Crypt_DecipherRun;
+
+struct Crypt_Decipherer {
+    int fdIn, fdOut;
+    off_t base;  // offset of firstByte in the output
+    size_t firstByte, lastByte;
+    const Crypt_ChunkIndex* index;
+    const AES_KeyCtx* ctx;
+    const byte* tree;  // NULL without a tree
+    const byte* macKey;
+    pthread_mutex_t lock;
+    Crypt_Error_t err;  // the first error of any run
+};
+
+// deciphers and writes out the chunks of a run with pread() / pwrite()
+void Crypt_DecipherRunChunks(void* arg);
+// deciphers chunks first to last - 1 of d on nWorkers threads
+Crypt_Error_t Crypt_DecipherParallel(Crypt_Decipherer* d, size_t first, size_t last, size_t nWorkers);
+
+bool Crypt_IsContainer(const char* fname) {
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        return false;
+    }
+    char magic[CRYPT_MAGIC_SIZE];
+    bool ret = fread(magic, sizeof(char), CRYPT_MAGIC_SIZE, file) == CRYPT_MAGIC_SIZE &&
+               memcmp(magic, CRYPT_MAGIC, CRYPT_MAGIC_SIZE) == 0;
+    fclose(file);
+    return ret;
+}
+
+bool Crypt_IsContainerFd(int fd) {
+    char magic[CRYPT_MAGIC_SIZE];
+    return pread(fd, magic, CRYPT_MAGIC_SIZE, 0) == CRYPT_MAGIC_SIZE &&
+           memcmp(magic, CRYPT_MAGIC, CRYPT_MAGIC_SIZE) == 0;
+}
+
+Crypt_Error_t Crypt_ReadHeader(FILE* file, Crypt_Header* hdr) {
+    if (fread(hdr, sizeof(Crypt_Header), 1, file) != 1) {
+        return CRYPT_E_FORMAT;
+    }
+    if (memcmp(hdr->magic, CRYPT_MAGIC, CRYPT_MAGIC_SIZE) != 0 ||
+        hdr->version != CRYPT_CONTAINER_VERSION ||
+        hdr->chunkSize == 0 || hdr->chunkSize > CRYPT_MAX_CHUNK_SIZE ||
+        hdr->chunkSize % STATE_SIZE != 0) {
+        return CRYPT_E_FORMAT;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_IndexChunks(FILE* file, Crypt_ChunkIndex* index) {
+    memset(index, 0, sizeof(Crypt_ChunkIndex));
+    rewind(file);
+    Crypt_Error_t err = Crypt_ReadHeader(file, &index->hdr);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+
+    size_t capacity = 0;
+    off_t offset = (off_t) sizeof(Crypt_Header);
+    Crypt_ChunkHeader chdr;
+    while (fread(&chdr, sizeof(Crypt_ChunkHeader), 1, file) == 1) {
+        if (chdr.flags & CRYPT_CHUNK_TREE) {
+            // the tree comes last and covers every chunk before it
+            if (!(index->hdr.flags & CRYPT_HDR_MERKLE) || chdr.dataSize != Crypt_MerkleSize(index->nChunks)) {
+                Crypt_FreeIndex(index);
+                return CRYPT_E_FORMAT;
+            }
+            index->treeOffset = offset;
+            break;
+        }
+        bool isHole = chdr.flags & CRYPT_CHUNK_HOLE;
+        if (chdr.rawSize == 0 || (isHole && chdr.dataSize != 0) ||
+            (!isHole && chdr.rawSize > index->hdr.chunkSize) ||
+            chdr.dataSize > LZ_BOUND(index->hdr.chunkSize) ||
+            (!(chdr.flags & (CRYPT_CHUNK_LZ | CRYPT_CHUNK_HOLE)) && chdr.dataSize != chdr.rawSize)) {
+            Crypt_FreeIndex(index);
+            return CRYPT_E_FORMAT;
+        }
+
+        if (index->nChunks == capacity) {
+            capacity = (capacity) ? 2 * capacity : 64;
+            Crypt_ChunkInfo* chunks = (Crypt_ChunkInfo*) realloc(index->chunks, capacity * sizeof(Crypt_ChunkInfo));
+            if (!chunks) {
+                Crypt_FreeIndex(index);
+                return CRYPT_E_MEMORY_ALLOCATION;
+            }
+            index->chunks = chunks;
+        }
+
+        Crypt_ChunkInfo* info = &index->chunks[index->nChunks++];
+        info->offset = offset;
+        info->rawOffset = index->rawSize;
+        info->hdr = chdr;
+        index->rawSize += chdr.rawSize;
+
+        // skip over the payload to the next chunk header
+        offset += (off_t) (sizeof(Crypt_ChunkHeader) + CRYPT_STORED_SIZE(chdr.dataSize));
+        if (fseeko(file, offset, SEEK_SET) != 0) {
+            Crypt_FreeIndex(index);
+            return CRYPT_E_IO;
+        }
+    }
+    if ((index->hdr.flags & CRYPT_HDR_MERKLE) && index->treeOffset == 0) {
+        // cut off
+        Crypt_FreeIndex(index);
+        return CRYPT_E_INTEGRITY;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_FreeIndex(Crypt_ChunkIndex* index) {
+    free(index->chunks);
+    index->chunks = NULL;
+    index->nChunks = 0;
+}
+
+Crypt_Error_t Crypt_LoadTree(FILE* file, const Crypt_ChunkIndex* index, const AES_KeyCtx* dataCtx, byte** tree) {
+    size_t treeSize = Crypt_MerkleSize(index->nChunks);
+    *tree = (byte*) malloc(treeSize);
+    if (!*tree) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    byte macKey[CRYPT_MERKLE_KEY_SIZE];
+    Crypt_MerkleKey(dataCtx, macKey);
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (fseeko(file, index->treeOffset + (off_t) sizeof(Crypt_ChunkHeader), SEEK_SET) != 0 ||
+        fread(*tree, sizeof(byte), treeSize, file) != treeSize) {
+        err = CRYPT_E_FORMAT;
+    } else {
+        Crypt_Header bound;
+        Crypt_TreeBound(&index->hdr, &bound);
+        if (!Crypt_MerkleCheckRoot(macKey, *tree, index->nChunks, &bound, sizeof(Crypt_Header), index->hdr.root)) {
+            err = CRYPT_E_INTEGRITY;
+        }
+    }
+    memset(macKey, 0, sizeof(macKey));
+    if (err != CRYPT_E_SUCCESS) {
+        free(*tree);
+        *tree = NULL;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_CheckChunk(const byte tree[],
+                               const Crypt_ChunkIndex* index,
+                               const byte macKey[],
+                               size_t i,
+                               const byte payload[]) {
+    const Crypt_ChunkHeader* chdr = &index->chunks[i].hdr;
+    byte tag[CRYPT_MERKLE_TAG_SIZE];
+    Crypt_MerkleLeaf(macKey, i, chdr, sizeof(Crypt_ChunkHeader), payload, CRYPT_STORED_SIZE(chdr->dataSize), tag);
+    return Crypt_MerkleCheckLeaf(tree, index->nChunks, i, tag) ? CRYPT_E_SUCCESS : CRYPT_E_INTEGRITY;
+}
+
+void Crypt_TreeBound(const Crypt_Header* hdr, Crypt_Header* bound) {
+    *bound = *hdr;
+    bound->flags &= (uint16_t) ~CRYPT_HDR_KEYID;
+    bound->keyId = 0;
+    memset(bound->wrappedKey, 0, sizeof(bound->wrappedKey));
+    memset(bound->root, 0, sizeof(bound->root));
+}
+
+Crypt_Error_t Crypt_WriteTree(FILE* fileOut, Crypt_Merkle* m, Crypt_Header* hdr, off_t hdrOffset) {
+    Crypt_Header bound;
+    Crypt_TreeBound(hdr, &bound);
+    Crypt_Error_t err = Crypt_MerkleFinish(m, &bound, sizeof(Crypt_Header));
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    Crypt_ChunkHeader chdr;
+    memset(&chdr, 0, sizeof(Crypt_ChunkHeader));
+    chdr.dataSize = (uint32_t) Crypt_MerkleSize(m->nLeaves);
+    chdr.flags = CRYPT_CHUNK_TREE;
+    if (fwrite(&chdr, sizeof(Crypt_ChunkHeader), 1, fileOut) != 1 ||
+        fwrite(m->leaves, sizeof(byte), chdr.dataSize, fileOut) != chdr.dataSize) {
+        return CRYPT_E_IO;
+    }
+
+    memcpy(hdr->root, m->root, sizeof(hdr->root));
+    off_t end = ftello(fileOut);
+    if (end < 0 || fseeko(fileOut, hdrOffset, SEEK_SET) != 0 ||
+        fwrite(hdr, sizeof(Crypt_Header), 1, fileOut) != 1 ||
+        fseeko(fileOut, end, SEEK_SET) != 0) {
+        return CRYPT_E_IO;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+uint32_t Crypt_ChunkSum(const byte payload[], size_t storedSize) {
+    return (uint32_t) XXH_Hash64(payload, storedSize, 0);
+}
+
+void Crypt_EncipherChunk(const AES_KeyCtx* ctx,
+                         const byte raw[],
+                         size_t rawSize,
+                         bool compress,
+                         Crypt_ChunkHeader* chdr,
+                         byte payload[]) {
+    memset(chdr, 0, sizeof(Crypt_ChunkHeader));
+    chdr->rawSize = (uint32_t) rawSize;
+
+    size_t dataSize = 0;
+    if (compress) {
+        // only keep the compressed form if it saves at least one block
+        size_t limit = (rawSize > STATE_SIZE) ? CRYPT_STORED_SIZE(rawSize) - STATE_SIZE : 0;
+        dataSize = LZ_Compress(raw, rawSize, payload, limit);
+    }
+    if (dataSize) {
+        chdr->flags |= CRYPT_CHUNK_LZ;
+    } else {
+        memcpy(payload, raw, rawSize);
+        dataSize = rawSize;
+    }
+    chdr->dataSize = (uint32_t) dataSize;
+
+    size_t storedSize = CRYPT_STORED_SIZE(dataSize);
+    memset(payload + dataSize, 0, storedSize - dataSize);
+    AES_EncipherBlocks(ctx, payload, storedSize / STATE_SIZE, payload);
+}
+
+Crypt_Error_t Crypt_DecipherChunk(const AES_KeyCtx* ctx,
+                                  const Crypt_ChunkHeader* chdr,
+                                  size_t chunkSize,
+                                  byte payload[],
+                                  byte scratch[],
+                                  const byte** data) {
+    AES_DecipherBlocks(ctx, payload, CRYPT_STORED_SIZE(chdr->dataSize) / STATE_SIZE, payload);
+    if (!(chdr->flags & CRYPT_CHUNK_LZ)) {
+        *data = payload;
+        return CRYPT_E_SUCCESS;
+    }
+    if (LZ_Decompress(payload, chdr->dataSize, scratch, chunkSize) != chdr->rawSize) {
+        return CRYPT_E_FORMAT;
+    }
+    *data = scratch;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_WriteChunk(FILE* fileOut,
+                               const AES_KeyCtx* ctx,
+                               const byte raw[],
+                               size_t rawSize,
+                               bool compress,
+                               byte payload[],
+                               Crypt_Merkle* tree) {
+    Crypt_ChunkHeader chdr;
+    Crypt_EncipherChunk(ctx, raw, rawSize, compress, &chdr, payload);
+    size_t storedSize = CRYPT_STORED_SIZE(chdr.dataSize);
+    if (fwrite(&chdr, sizeof(Crypt_ChunkHeader), 1, fileOut) != 1 ||
+        fwrite(payload, sizeof(byte), storedSize, fileOut) != storedSize) {
+        return CRYPT_E_IO;
+    }
+    return tree ? Crypt_MerkleAdd(tree, &chdr, sizeof(Crypt_ChunkHeader), payload, storedSize) : CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_WriteHole(FILE* fileOut, size_t nBytes, Crypt_Merkle* tree) {
+    while (nBytes > 0) {
+        Crypt_ChunkHeader chdr;
+        memset(&chdr, 0, sizeof(Crypt_ChunkHeader));
+        chdr.rawSize = (uint32_t) MIN(nBytes, CRYPT_MAX_HOLE_SIZE);
+        chdr.flags = CRYPT_CHUNK_HOLE;
+        if (fwrite(&chdr, sizeof(Crypt_ChunkHeader), 1, fileOut) != 1) {
+            return CRYPT_E_IO;
+        }
+        if (tree && Crypt_MerkleAdd(tree, &chdr, sizeof(Crypt_ChunkHeader), NULL, 0) != CRYPT_E_SUCCESS) {
+            return CRYPT_E_MEMORY_ALLOCATION;
+        }
+        nBytes -= chdr.rawSize;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_SkipHole(FILE* fileOut, size_t nBytes, bool* pending) {
+    if (fseeko(fileOut, (off_t) nBytes, SEEK_CUR) == 0) {
+        // the bytes skipped over only exist once something is written
+        // after them, or the file is truncated to its final size
+        *pending = true;
+        return CRYPT_E_SUCCESS;
+    }
+    // not seekable (e.g., a pipe), so write the zeros out
+    byte zeros[CRYPT_CP_BUF_SIZE];
+    memset(zeros, 0, sizeof(zeros));
+    while (nBytes > 0) {
+        size_t n = MIN(nBytes, sizeof(zeros));
+        if (fwrite(zeros, sizeof(byte), n, fileOut) != n) {
+            return CRYPT_E_IO;
+        }
+        nBytes -= n;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_EncipherChunked(const char* fnameIn,
+                                    const char* fnameKey,
+                                    const char* fnameOut,
+                                    uint16_t flags) {
+    // before the output is created
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
+    FILE* fileOut = fopen(fnameOut, "wb");
+    if (!fileOut) {
+        fclose(fileIn);
+        return CRYPT_E_IO;
+    }
+
+    Crypt_Header hdr;
+    Crypt_InitHeader(&hdr, keySize, (uint16_t) (flags & ~(CRYPT_HDR_KEYID | CRYPT_HDR_WRAPPED)));
+    err = Crypt_EncipherChunkedFile(fileIn, &ctx, &hdr, fileOut);
+    fclose(fileIn);
+    if (fclose(fileOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+void Crypt_InitHeader(Crypt_Header* hdr, size_t keySize, uint16_t flags) {
+    memset(hdr, 0, sizeof(Crypt_Header));
+    memcpy(hdr->magic, CRYPT_MAGIC, CRYPT_MAGIC_SIZE);
+    hdr->version = CRYPT_CONTAINER_VERSION;
+    hdr->flags = flags;
+    hdr->chunkSize = CRYPT_CHUNK_SIZE;
+    hdr->keySize = (uint8_t) keySize;
+}
+
+Crypt_Error_t Crypt_ContainerKey(const Crypt_Header* hdr, const AES_KeyCtx* ctx, size_t keySize, AES_KeyCtx* dataCtx) {
+    if (!(hdr->flags & CRYPT_HDR_WRAPPED)) {
+        if (keySize != hdr->keySize) {
+            return CRYPT_E_ARGUMENT;
+        }
+        *dataCtx = *ctx;
+        return CRYPT_E_SUCCESS;
+    }
+
+    // a wrong key fails the integrity check of the key wrap
+    byte dataKey[CRYPT_MAX_KEY_SIZE];
+    if ((hdr->keySize != 16 && hdr->keySize != 24 && hdr->keySize != 32) ||
+        Crypt_KeyUnwrap(ctx, hdr->wrappedKey, hdr->keySize, dataKey) != CRYPT_E_SUCCESS) {
+        return CRYPT_E_ARGUMENT;
+    }
+    AES_InitKeyCtx(dataCtx, dataKey, NK_BYTES_TO_WORDS(hdr->keySize));
+    memset(dataKey, 0, sizeof(dataKey));
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_SealHeader(Crypt_Header* hdr, const AES_KeyCtx* kek, AES_KeyCtx* dataCtx) {
+    byte dataKey[CRYPT_MAX_KEY_SIZE];
+    if (!Crypt_RandomBytes(dataKey, hdr->keySize)) {
+        return CRYPT_E_IO;
+    }
+    Crypt_KeyWrap(kek, dataKey, hdr->keySize, hdr->wrappedKey);
+    AES_InitKeyCtx(dataCtx, dataKey, NK_BYTES_TO_WORDS(hdr->keySize));
+    memset(dataKey, 0, sizeof(dataKey));
+    hdr->flags |= CRYPT_HDR_WRAPPED;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_EncipherChunkedFile(FILE* fileIn,
+                                        const AES_KeyCtx* ctx,
+                                        const Crypt_Header* hdrIn,
+                                        FILE* fileOut) {
+    Crypt_Header hdr = *hdrIn;
+    uint16_t flags = hdr.flags;
+    bool compress = flags & CRYPT_HDR_COMPRESSED;
+    Crypt_Merkle m;
+    memset(&m, 0, sizeof(Crypt_Merkle));
+    Crypt_Merkle* tree = NULL;
+    if (flags & CRYPT_HDR_MERKLE) {
+        Crypt_MerkleInit(&m, ctx);
+        tree = &m;
+    }
+
+    byte* raw = (byte*) malloc(hdr.chunkSize);
+    byte* payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(hdr.chunkSize));
+    // the header is written again with the root tag of the tree
+    off_t hdrOffset = ftello(fileOut);
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (!raw || !payload) {
+        err = CRYPT_E_MEMORY_ALLOCATION;
+    } else if (tree && hdrOffset < 0) {
+        err = CRYPT_E_ARGUMENT;
+    } else if (fwrite(&hdr, sizeof(Crypt_Header), 1, fileOut) != 1) {
+        err = CRYPT_E_IO;
+    }
+
+    struct stat st;
+    if (err == CRYPT_E_SUCCESS && (flags & CRYPT_HDR_SPARSE) &&
+        fstat(fileno(fileIn), &st) == 0 && S_ISREG(st.st_mode)) {
+        // alternate between holes and data regions. if the file system
+        // cannot report holes, the whole file is one data region
+        int fd = fileno(fileIn);
+        off_t fsize = st.st_size;
+        off_t pos = 0;
+        while (err == CRYPT_E_SUCCESS && pos < fsize) {
+            off_t dataStart = lseek(fd, pos, SEEK_DATA);
+            if (dataStart < 0) {
+                // ENXIO: there is no data after pos
+                dataStart = (errno == ENXIO) ? fsize : pos;
+            }
+            if (dataStart > pos) {
+                err = Crypt_WriteHole(fileOut, (size_t) (dataStart - pos), tree);
+                pos = dataStart;
+                continue;
+            }
+
+            off_t dataEnd = lseek(fd, pos, SEEK_HOLE);
+            if (dataEnd < 0 || dataEnd > fsize) {
+                dataEnd = fsize;
+            }
+            fseeko(fileIn, pos, SEEK_SET);
+            while (err == CRYPT_E_SUCCESS && pos < dataEnd) {
+                size_t n = MIN((size_t) (dataEnd - pos), (size_t) hdr.chunkSize);
+                if (fread(raw, sizeof(byte), n, fileIn) != n) {
+                    err = CRYPT_E_IO;
+                    break;
+                }
+                err = Crypt_WriteChunk(fileOut, ctx, raw, n, compress, payload, tree);
+                pos += (off_t) n;
+            }
+        }
+    } else {
+        while (err == CRYPT_E_SUCCESS) {
+            size_t nRead = fread(raw, sizeof(byte), hdr.chunkSize, fileIn);
+            if (nRead == 0) {
+                if (ferror(fileIn)) {
+                    err = CRYPT_E_IO;
+                }
+                break;
+            }
+            err = Crypt_WriteChunk(fileOut, ctx, raw, nRead, compress, payload, tree);
+        }
+    }
+    if (err == CRYPT_E_SUCCESS && tree) {
+        err = Crypt_WriteTree(fileOut, tree, &hdr, hdrOffset);
+    }
+
+    free(raw);
+    free(payload);
+    Crypt_MerkleFree(&m);
+    if (err == CRYPT_E_SUCCESS && fflush(fileOut) != 0) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_DecipherChunked(const char* fnameIn,
+                                    const char* fnameKey,
+                                    const char* fnameOut,
+                                    size_t firstByte,
+                                    size_t lastByte) {
+    return Crypt_DecipherChunkedRequire(fnameIn, fnameKey, fnameOut, firstByte, lastByte, 0, 1);
+}
+
+Crypt_Error_t Crypt_DecipherChunkedRequire(const char* fnameIn,
+                                           const char* fnameKey,
+                                           const char* fnameOut,
+                                           size_t firstByte,
+                                           size_t lastByte,
+                                           uint16_t required,
+                                           size_t nWorkers) {
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
+    char* fnameTmp;
+    FILE* fileOut = Crypt_OpenOutput(fnameOut, &fnameTmp);
+    if (!fileOut) {
+        fclose(fileIn);
+        return CRYPT_E_IO;
+    }
+
+    err = Crypt_DecipherChunkedFile(fileIn, &ctx, keySize, fileOut, firstByte, lastByte, required, nWorkers);
+    fclose(fileIn);
+    return Crypt_CloseOutput(fileOut, fnameOut, fnameTmp, err);
+}
+
+FILE* Crypt_OpenOutput(const char* fnameOut, char** fnameTmp) {
+    *fnameTmp = NULL;
+    struct stat st;
+    bool exists = stat(fnameOut, &st) == 0;
+    if (exists && !S_ISREG(st.st_mode)) {
+        // cannot be taken back anyway
+        return fopen(fnameOut, "wb");
+    }
+
+    // a random name rather than mkstemp(), so a new output gets the
+    // usual permissions (0666 less the umask) and not 0600
+    size_t nameLen = strlen(fnameOut);
+    char* fname = (char*) malloc(nameLen + 10);
+    int fd = -1;
+    for (int attempt = 0; fname && fd < 0 && attempt < 16; attempt++) {
+        byte suffix[4];
+        if (!Crypt_RandomBytes(suffix, sizeof(suffix))) {
+            break;
+        }
+        snprintf(fname, nameLen + 10, "%s.%02x%02x%02x%02x", fnameOut, suffix[0], suffix[1], suffix[2], suffix[3]);
+        fd = open(fname, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0 && errno != EEXIST) {
+            break;
+        }
+    }
+    FILE* file = NULL;
+    if (fd >= 0 && (!exists || fchmod(fd, st.st_mode & 07777) == 0)) {
+        file = fdopen(fd, "wb");
+    }
+    if (!file) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(fname);
+        }
+        free(fname);
+        return NULL;
+    }
+    *fnameTmp = fname;
+    return file;
+}
+
+Crypt_Error_t Crypt_CloseOutput(FILE* fileOut, const char* fnameOut, char* fnameTmp, Crypt_Error_t err) {
+    if (fclose(fileOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    if (fnameTmp) {
+        if (err == CRYPT_E_SUCCESS && rename(fnameTmp, fnameOut) != 0) {
+            err = CRYPT_E_IO;
+        }
+        if (err != CRYPT_E_SUCCESS) {
+            unlink(fnameTmp);
+        }
+        free(fnameTmp);
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_DecipherChunkedFile(FILE* fileIn,
+                                        const AES_KeyCtx* ctx,
+                                        size_t keySize,
+                                        FILE* fileOut,
+                                        size_t firstByte,
+                                        size_t lastByte,
+                                        uint16_t required,
+                                        size_t nWorkers) {
+    Crypt_ChunkIndex index;
+    Crypt_Error_t err = Crypt_IndexChunks(fileIn, &index);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    if ((index.hdr.flags & required) != required) {
+        // e.g., the flag of a tree was cleared and the tree cut off
+        Crypt_FreeIndex(&index);
+        return CRYPT_E_INTEGRITY;
+    }
+    AES_KeyCtx dataCtx;
+    err = Crypt_ContainerKey(&index.hdr, ctx, keySize, &dataCtx);
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_FreeIndex(&index);
+        return err;
+    }
+    ctx = &dataCtx;
+    byte* tree = NULL;
+    byte macKey[CRYPT_MERKLE_KEY_SIZE];
+    if (index.hdr.flags & CRYPT_HDR_MERKLE) {
+        err = Crypt_LoadTree(fileIn, &index, ctx, &tree);
+        Crypt_MerkleKey(ctx, macKey);
+    }
+
+    // if the given lastByte is out of range, just decipher to the end of the file
+    lastByte = MIN(lastByte, index.rawSize);
+
+    // true while the output has been seeked past its end
+    bool pending = false;
+    byte* payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(index.hdr.chunkSize));
+    byte* scratch = (byte*) malloc(index.hdr.chunkSize);
+    if (err == CRYPT_E_SUCCESS && (!payload || !scratch)) {
+        err = CRYPT_E_MEMORY_ALLOCATION;
+    }
+
+    // the chunks overlapping the range
+    size_t first = 0, last = 0;
+    for (size_t i = 0; i < index.nChunks; i++) {
+        const Crypt_ChunkInfo* info = &index.chunks[i];
+        if (info->rawOffset + info->hdr.rawSize <= firstByte) {
+            first = i + 1;
+        }
+        if (info->rawOffset < lastByte) {
+            last = i + 1;
+        }
+    }
+
+    // chunks can be written out of order only with pwrite()
+    struct stat st;
+    off_t base = -1;
+    if (err == CRYPT_E_SUCCESS && nWorkers > 1 && last > first + 1 &&
+        fflush(fileOut) == 0 && fstat(fileno(fileOut), &st) == 0 && S_ISREG(st.st_mode)) {
+        base = ftello(fileOut);
+    }
+
+    if (base >= 0) {
+        Crypt_Decipherer d;
+        memset(&d, 0, sizeof(Crypt_Decipherer));
+        d.fdIn = fileno(fileIn);
+        d.fdOut = fileno(fileOut);
+        d.base = base;
+        d.firstByte = firstByte;
+        d.lastByte = lastByte;
+        d.index = &index;
+        d.ctx = ctx;
+        d.tree = tree;
+        d.macKey = macKey;
+        err = Crypt_DecipherParallel(&d, first, last, nWorkers);
+
+        // the output may end with a hole, so extend it to its full size
+        off_t end = base + (off_t) (lastByte - MIN(firstByte, lastByte));
+        if (err == CRYPT_E_SUCCESS &&
+            ((fstat(d.fdOut, &st) == 0 && st.st_size < end && ftruncate(d.fdOut, end) != 0) ||
+             fseeko(fileOut, end, SEEK_SET) != 0)) {
+            err = CRYPT_E_IO;
+        }
+    } else {
+        for (size_t i = 0; err == CRYPT_E_SUCCESS && i < index.nChunks; i++) {
+            const Crypt_ChunkInfo* info = &index.chunks[i];
+            size_t chunkEnd = info->rawOffset + info->hdr.rawSize;
+            if (chunkEnd <= firstByte || info->rawOffset >= lastByte) {
+                // the chunk does not overlap the range
+                continue;
+            }
+
+            // the part of the chunk inside the range
+            size_t begin = (firstByte > info->rawOffset) ? firstByte - info->rawOffset : 0;
+            size_t end = MIN(chunkEnd, lastByte) - info->rawOffset;
+
+            if (info->hdr.flags & CRYPT_CHUNK_HOLE) {
+                err = tree ? Crypt_CheckChunk(tree, &index, macKey, i, NULL) : CRYPT_E_SUCCESS;
+                if (err == CRYPT_E_SUCCESS) {
+                    err = Crypt_SkipHole(fileOut, end - begin, &pending);
+                }
+                continue;
+            }
+
+            size_t storedSize = CRYPT_STORED_SIZE(info->hdr.dataSize);
+            fseeko(fileIn, info->offset + (off_t) sizeof(Crypt_ChunkHeader), SEEK_SET);
+            if (fread(payload, sizeof(byte), storedSize, fileIn) != storedSize) {
+                err = CRYPT_E_FORMAT;
+                break;
+            }
+            if (tree) {
+                // before anything of the chunk is written out
+                err = Crypt_CheckChunk(tree, &index, macKey, i, payload);
+                if (err != CRYPT_E_SUCCESS) {
+                    break;
+                }
+            }
+
+            const byte* data;
+            err = Crypt_DecipherChunk(ctx, &info->hdr, index.hdr.chunkSize, payload, scratch, &data);
+            if (err != CRYPT_E_SUCCESS) {
+                break;
+            }
+
+            if (fwrite(data + begin, sizeof(byte), end - begin, fileOut) != end - begin) {
+                err = CRYPT_E_IO;
+            }
+            pending = false;
+        }
+
+        if (err == CRYPT_E_SUCCESS && pending) {
+            // the output ends with a hole, so extend it to its full size
+            if (fflush(fileOut) != 0 || ftruncate(fileno(fileOut), ftello(fileOut)) != 0) {
+                err = CRYPT_E_IO;
+            }
+        }
+    }
+    if (err == CRYPT_E_SUCCESS && fflush(fileOut) != 0) {
+        err = CRYPT_E_IO;
+    }
+
+    free(payload);
+    free(scratch);
+    free(tree);
+    memset(macKey, 0, sizeof(macKey));
+    Crypt_FreeIndex(&index);
+    return err;
+}
+
+void Crypt_DecipherRunChunks(void* arg) {
+    Crypt_DecipherRun* run = (Crypt_DecipherRun*) arg;
+    Crypt_Decipherer* d = run->d;
+    size_t chunkSize = d->index->hdr.chunkSize;
+    byte* payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(chunkSize));
+    byte* scratch = (byte*) malloc(chunkSize);
+    Crypt_Error_t err = (payload && scratch) ? CRYPT_E_SUCCESS : CRYPT_E_MEMORY_ALLOCATION;
+    for (size_t i = run->first; err == CRYPT_E_SUCCESS && i < run->last; i++) {
+        const Crypt_ChunkInfo* info = &d->index->chunks[i];
+        size_t chunkEnd = info->rawOffset + info->hdr.rawSize;
+        size_t begin = (d->firstByte > info->rawOffset) ? d->firstByte - info->rawOffset : 0;
+        size_t end = MIN(chunkEnd, d->lastByte) - info->rawOffset;
+
+        if (info->hdr.flags & CRYPT_CHUNK_HOLE) {
+            // nothing to write; the output is extended at the end
+            err = d->tree ? Crypt_CheckChunk(d->tree, d->index, d->macKey, i, NULL) : CRYPT_E_SUCCESS;
+            continue;
+        }
+
+        size_t storedSize = CRYPT_STORED_SIZE(info->hdr.dataSize);
+        CRYPT_TRACE_BEGIN(traceRead);
+        ssize_t nRead = pread(d->fdIn, payload, storedSize, info->offset + (off_t) sizeof(Crypt_ChunkHeader));
+        CRYPT_TRACE_END(traceRead, CRYPT_SPAN_READ);
+        if (nRead != (ssize_t) storedSize) {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        const byte* data;
+        CRYPT_TRACE_BEGIN(traceCipher);
+        // before anything of the chunk is written out
+        err = d->tree ? Crypt_CheckChunk(d->tree, d->index, d->macKey, i, payload) : CRYPT_E_SUCCESS;
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_DecipherChunk(d->ctx, &info->hdr, chunkSize, payload, scratch, &data);
+        }
+        CRYPT_TRACE_END(traceCipher, CRYPT_SPAN_CIPHER);
+        if (err != CRYPT_E_SUCCESS) {
+            break;
+        }
+
+        off_t offset = d->base + (off_t) (info->rawOffset + begin - d->firstByte);
+        CRYPT_TRACE_BEGIN(traceWrite);
+        ssize_t nWritten = pwrite(d->fdOut, data + begin, end - begin, offset);
+        CRYPT_TRACE_END(traceWrite, CRYPT_SPAN_WRITE);
+        if (nWritten != (ssize_t) (end - begin)) {
+            err = CRYPT_E_IO;
+        }
+    }
+    free(payload);
+    free(scratch);
+
+    pthread_mutex_lock(&d->lock);
+    if (d->err == CRYPT_E_SUCCESS) {
+        d->err = err;
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
+Crypt_Error_t Crypt_DecipherParallel(Crypt_Decipherer* d, size_t first, size_t last, size_t nWorkers) {
+    // runs of about equal numbers of stored bytes
+    size_t nRuns = MIN(last - first, nWorkers * CRYPT_DECIPHER_RUNS_PER_WORKER);
+    Crypt_DecipherRun* runs = (Crypt_DecipherRun*) calloc(nRuns, sizeof(Crypt_DecipherRun));
+    if (!runs) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    size_t totalSize = 0;
+    for (size_t i = first; i < last; i++) {
+        totalSize += CRYPT_STORED_SIZE(d->index->chunks[i].hdr.dataSize) + sizeof(Crypt_ChunkHeader);
+    }
+    size_t nUsed = 0;
+    for (size_t i = first, size = 0; i < last; i++) {
+        if (nUsed == 0 || size >= totalSize / nRuns * nUsed) {
+            runs[nUsed].d = d;
+            runs[nUsed].first = i;
+            nUsed++;
+        }
+        runs[nUsed - 1].last = i + 1;
+        size += CRYPT_STORED_SIZE(d->index->chunks[i].hdr.dataSize) + sizeof(Crypt_ChunkHeader);
+    }
+
+    pthread_mutex_init(&d->lock, NULL);
+    Crypt_Pool* pool = Crypt_PoolNew(MIN(nWorkers, nUsed));
+    for (size_t i = 0; i < nUsed; i++) {
+        if (!pool || Crypt_PoolSubmit(pool, Crypt_DecipherRunChunks, &runs[i]) != CRYPT_E_SUCCESS) {
+            // deciphered here instead
+            Crypt_DecipherRunChunks(&runs[i]);
+        }
+    }
+    if (pool) {
+        Crypt_PoolFree(pool);
+    }
+    pthread_mutex_destroy(&d->lock);
+    free(runs);
+    return d->err;
+}
+
+Crypt_Error_t Crypt_RekeyChunkedFile(FILE* fileIn,
+                                     const AES_KeyCtx* oldCtx,
+                                     size_t oldKeySize,
+                                     const AES_KeyCtx* newCtx,
+                                     size_t newKeySize,
+                                     FILE* fileOut) {
+    Crypt_ChunkIndex index;
+    Crypt_Error_t err = Crypt_IndexChunks(fileIn, &index);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx oldDataCtx, newDataCtx;
+    err = Crypt_ContainerKey(&index.hdr, oldCtx, oldKeySize, &oldDataCtx);
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_FreeIndex(&index);
+        return err;
+    }
+
+    // the new key is a key file, so the container no longer names a
+    // keyring key
+    Crypt_Header hdr = index.hdr;
+    hdr.flags &= (uint16_t) ~CRYPT_HDR_KEYID;
+    hdr.keyId = 0;
+    hdr.keySize = (uint8_t) newKeySize;
+    if (hdr.flags & CRYPT_HDR_WRAPPED) {
+        err = Crypt_SealHeader(&hdr, newCtx, &newDataCtx);
+    } else {
+        newDataCtx = *newCtx;
+    }
+
+    // the old tree is checked chunk by chunk, and the new one is built
+    // as the chunks are written
+    byte* tree = NULL;
+    byte macKey[CRYPT_MERKLE_KEY_SIZE];
+    Crypt_Merkle m;
+    memset(&m, 0, sizeof(Crypt_Merkle));
+    if (err == CRYPT_E_SUCCESS && (hdr.flags & CRYPT_HDR_MERKLE)) {
+        Crypt_MerkleInit(&m, &newDataCtx);
+        err = Crypt_LoadTree(fileIn, &index, &oldDataCtx, &tree);
+        Crypt_MerkleKey(&oldDataCtx, macKey);
+    }
+
+    byte* payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(index.hdr.chunkSize));
+    if (err == CRYPT_E_SUCCESS && !payload) {
+        err = CRYPT_E_MEMORY_ALLOCATION;
+    }
+    off_t hdrOffset = ftello(fileOut);
+    if (err == CRYPT_E_SUCCESS && tree && hdrOffset < 0) {
+        err = CRYPT_E_ARGUMENT;
+    }
+    if (err == CRYPT_E_SUCCESS && fwrite(&hdr, sizeof(Crypt_Header), 1, fileOut) != 1) {
+        err = CRYPT_E_IO;
+    }
+
+    for (size_t i = 0; err == CRYPT_E_SUCCESS && i < index.nChunks; i++) {
+        const Crypt_ChunkInfo* info = &index.chunks[i];
+        size_t storedSize = CRYPT_STORED_SIZE(info->hdr.dataSize);
+        if (storedSize > 0) {
+            fseeko(fileIn, info->offset + (off_t) sizeof(Crypt_ChunkHeader), SEEK_SET);
+            if (fread(payload, sizeof(byte), storedSize, fileIn) != storedSize) {
+                err = CRYPT_E_FORMAT;
+                break;
+            }
+        }
+        if (tree) {
+            err = Crypt_CheckChunk(tree, &index, macKey, i, payload);
+            if (err != CRYPT_E_SUCCESS) {
+                break;
+            }
+        }
+        if (storedSize > 0) {
+            AES_DecipherBlocks(&oldDataCtx, payload, storedSize / STATE_SIZE, payload);
+            AES_EncipherBlocks(&newDataCtx, payload, storedSize / STATE_SIZE, payload);
+        }
+        Crypt_ChunkHeader chdr = info->hdr;
+        if (chdr.flags & CRYPT_CHUNK_SUM) {
+            chdr.reserved = Crypt_ChunkSum(payload, storedSize);
+        }
+        if (fwrite(&chdr, sizeof(Crypt_ChunkHeader), 1, fileOut) != 1 ||
+            fwrite(payload, sizeof(byte), storedSize, fileOut) != storedSize) {
+            err = CRYPT_E_IO;
+        }
+        if (err == CRYPT_E_SUCCESS && tree) {
+            err = Crypt_MerkleAdd(&m, &chdr, sizeof(Crypt_ChunkHeader), payload, storedSize);
+        }
+    }
+    if (err == CRYPT_E_SUCCESS && tree) {
+        err = Crypt_WriteTree(fileOut, &m, &hdr, hdrOffset);
+    }
+    if (err == CRYPT_E_SUCCESS && fflush(fileOut) != 0) {
+        err = CRYPT_E_IO;
+    }
+
+    free(payload);
+    free(tree);
+    Crypt_MerkleFree(&m);
+    memset(macKey, 0, sizeof(macKey));
+    memset(&oldDataCtx, 0, sizeof(oldDataCtx));
+    memset(&newDataCtx, 0, sizeof(newDataCtx));
+    Crypt_FreeIndex(&index);
+    return err;
+}
+
+#endif  // CC_CONTAINER_H_
@@ -0,0 +1,180 @@
+#ifndef CC_DRBG_H_
+#define CC_DRBG_H_
+
+// CTR_DRBG (NIST SP 800-90A) with AES-256 and no derivation function.
+// the generator is seeded from the kernel with getrandom and produces
+// random bytes by enciphering successive counter blocks, so output runs
+// at the speed of AES_EncipherBlocks and only a reseed costs a system
+// call.
+//
+// Crypt_RandomBytes keeps one generator per thread, so threads never
+// contend for it. after a fork, the child reseeds before it next uses
+// its generator, so it does not repeat the output of its parent.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "aes.h"
+
+// size in bytes of the generator's key
+#define CRYPT_DRBG_KEY_SIZE 32
+// size in bytes of the seed material: a key and a counter block
+#define CRYPT_DRBG_SEED_SIZE (CRYPT_DRBG_KEY_SIZE + STATE_SIZE)
+// max number of bytes per request (SP 800-90A allows 2^19 bits)
+#define CRYPT_DRBG_MAX_REQUEST (64 * 1024)
+// number of requests between reseeds (SP 800-90A allows 2^48)
+#define CRYPT_DRBG_RESEED_INTERVAL ((uint64_t) 1 << 20)
+
+typedef struct {
+    AES_KeyCtx ctx;
+    byte v[STATE_SIZE];  // the counter block
+    uint64_t reseedCounter;  // 0 until the generator is instantiated
+    unsigned forkGen;  // Crypt_drbgForkGen when last seeded
+} Crypt_Drbg;
+
+// fills buf with nBytes random bytes from the calling thread's
+// generator, seeding it first if needed. returns false if the kernel
+// could not supply entropy
+bool Crypt_RandomBytes(byte buf[], size_t nBytes);
+
+// instantiates drbg from CRYPT_DRBG_SEED_SIZE bytes of seed material
+void Crypt_DrbgInstantiate(Crypt_Drbg* drbg, const byte seed[]);
+// mixes CRYPT_DRBG_SEED_SIZE bytes of seed material into drbg
+void Crypt_DrbgReseed(Crypt_Drbg* drbg, const byte seed[]);
+// instantiates or reseeds drbg from getrandom. returns false if the
+// kernel could not supply entropy
+bool Crypt_DrbgSeed(Crypt_Drbg* drbg);
+// writes nBytes (at most CRYPT_DRBG_MAX_REQUEST) of output to out, as a
+// single request. the caller checks drbg->reseedCounter
+void Crypt_DrbgGenerate(Crypt_Drbg* drbg, byte out[], size_t nBytes);
+
+// internal helpers
+// the update function of SP 800-90A: derives a new key and counter
+// block, mixing in CRYPT_DRBG_SEED_SIZE bytes of data (zeros if NULL)
+void Crypt_DrbgUpdate(Crypt_Drbg* drbg, const byte data[]);
+// increments the counter block as a 128-bit big-endian integer
+void Crypt_DrbgIncrement(byte v[]);
+void Crypt_DrbgOnFork(void);
+void Crypt_DrbgWatchFork(void);
+
+// bumped in the child after every fork, which invalidates the state of
+// every generator inherited from the parent
+unsigned Crypt_drbgForkGen = 0;
+pthread_once_t Crypt_drbgForkOnce = PTHREAD_ONCE_INIT;
+static __thread Crypt_Drbg Crypt_threadDrbg;
+
+void Crypt_DrbgIncrement(byte v[]) {
+    for (size_t i = STATE_SIZE; i-- > 0;) {
+        if (++v[i] != 0) {
+            break;
+        }
+    }
+}
+
+void Crypt_DrbgUpdate(Crypt_Drbg* drbg, const byte data[]) {
+    byte temp[CRYPT_DRBG_SEED_SIZE];
+    for (size_t i = 0; i < CRYPT_DRBG_SEED_SIZE; i += STATE_SIZE) {
+        Crypt_DrbgIncrement(drbg->v);
+        memcpy(temp + i, drbg->v, STATE_SIZE);
+    }
+    AES_EncipherBlocks(&drbg->ctx, temp, CRYPT_DRBG_SEED_SIZE / STATE_SIZE, temp);
+    for (size_t i = 0; data && i < CRYPT_DRBG_SEED_SIZE; i++) {
+        temp[i] ^= data[i];
+    }
+    AES_InitKeyCtx(&drbg->ctx, temp, NK_BYTES_TO_WORDS(CRYPT_DRBG_KEY_SIZE));
+    memcpy(drbg->v, temp + CRYPT_DRBG_KEY_SIZE, STATE_SIZE);
+    memset(temp, 0, sizeof(temp));
+}
+
+void Crypt_DrbgInstantiate(Crypt_Drbg* drbg, const byte seed[]) {
+    byte key[CRYPT_DRBG_KEY_SIZE];
+    memset(key, 0, sizeof(key));
+    AES_InitKeyCtx(&drbg->ctx, key, NK_BYTES_TO_WORDS(CRYPT_DRBG_KEY_SIZE));
+    memset(drbg->v, 0, STATE_SIZE);
+    Crypt_DrbgUpdate(drbg, seed);
+    drbg->reseedCounter = 1;
+}
+
+void Crypt_DrbgReseed(Crypt_Drbg* drbg, const byte seed[]) {
+    Crypt_DrbgUpdate(drbg, seed);
+    drbg->reseedCounter = 1;
+}
+
+bool Crypt_DrbgSeed(Crypt_Drbg* drbg) {
+    byte seed[CRYPT_DRBG_SEED_SIZE];
+    size_t nRead = 0;
+    while (nRead < CRYPT_DRBG_SEED_SIZE) {
+        ssize_t n = getrandom(seed + nRead, CRYPT_DRBG_SEED_SIZE - nRead, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            return false;
+        }
+        nRead += (size_t) n;
+    }
+
+    if (drbg->reseedCounter == 0) {
+        Crypt_DrbgInstantiate(drbg, seed);
+    } else {
+        Crypt_DrbgReseed(drbg, seed);
+    }
+    drbg->forkGen = Crypt_drbgForkGen;
+    memset(seed, 0, sizeof(seed));
+    return true;
+}
+
+void Crypt_DrbgGenerate(Crypt_Drbg* drbg, byte out[], size_t nBytes) {
+    // the counter blocks are written straight into the output and
+    // enciphered in place
+    size_t nBlocks = nBytes / STATE_SIZE;
+    for (size_t i = 0; i < nBlocks; i++) {
+        Crypt_DrbgIncrement(drbg->v);
+        memcpy(out + i * STATE_SIZE, drbg->v, STATE_SIZE);
+    }
+    AES_EncipherBlocks(&drbg->ctx, out, nBlocks, out);
+
+    size_t nTail = nBytes % STATE_SIZE;
+    if (nTail) {
+        byte block[STATE_SIZE];
+        Crypt_DrbgIncrement(drbg->v);
+        AES_EncipherBlock(&drbg->ctx, drbg->v, block);
+        memcpy(out + nBlocks * STATE_SIZE, block, nTail);
+        memset(block, 0, sizeof(block));
+    }
+
+    // so the output cannot be recovered from the state afterwards
+    Crypt_DrbgUpdate(drbg, NULL);
+    drbg->reseedCounter++;
+}
+
+void Crypt_DrbgOnFork(void) {
+    Crypt_drbgForkGen++;
+}
+
+void Crypt_DrbgWatchFork(void) {
+    pthread_atfork(NULL, NULL, Crypt_DrbgOnFork);
+}
+
+bool Crypt_RandomBytes(byte buf[], size_t nBytes) {
+    pthread_once(&Crypt_drbgForkOnce, Crypt_DrbgWatchFork);
+    Crypt_Drbg* drbg = &Crypt_threadDrbg;
+    while (nBytes > 0) {
+        if (drbg->reseedCounter == 0 || drbg->reseedCounter > CRYPT_DRBG_RESEED_INTERVAL ||
+            drbg->forkGen != Crypt_drbgForkGen) {
+            if (!Crypt_DrbgSeed(drbg)) {
+                return false;
+            }
+        }
+        size_t n = (nBytes < CRYPT_DRBG_MAX_REQUEST) ? nBytes : CRYPT_DRBG_MAX_REQUEST;
+        Crypt_DrbgGenerate(drbg, buf, n);
+        buf += n;
+        nBytes -= n;
+    }
+    return true;
+}
+
+#endif  // CC_DRBG_H_
@@ -0,0 +1,221 @@
+#ifndef CC_ENVELOPE_H_
+#define CC_ENVELOPE_H_
+
+// envelope encryption of chunked containers. the chunks of the
+// container are enciphered with a random data key, which is stored in
+// the header wrapped (see keywrap.h) under a master key from a key file
+// or a keyring (CRYPT_HDR_WRAPPED). deciphering with the master key
+// works like deciphering any container (see Crypt_ContainerKey).
+//
+// rotating the master key of a container only rewraps the data key:
+// the header is rewritten in place and the chunks are left alone, so
+// the cost does not depend on the size of the container. the header is
+// a single write of sizeof(Crypt_Header) bytes at offset 0, synced before returning.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ciph.h"
+#include "container.h"
+#include "keyring.h"
+#include "keywrap.h"
+
+// enciphers the whole input file into a container under a new data key
+// wrapped with the key in fnameKey. flags are as for Crypt_EncipherChunked
+Crypt_Error_t Crypt_EncipherEnvelope(const char* fnameIn,
+                                     const char* fnameKey,
+                                     const char* fnameOut,
+                                     uint16_t flags);
+// the same with the master key keyId of a keyring, which is recorded in
+// the header so deciphering finds it (see Crypt_DecipherChunkedKeyring)
+Crypt_Error_t Crypt_EncipherEnvelopeKeyring(const char* fnameIn,
+                                            Crypt_Keyring* kr,
+                                            uint64_t keyId,
+                                            const char* fnameOut,
+                                            uint16_t flags);
+
+// rewraps the data key of the container fname from the master key in
+// fnameOldKey to the one in fnameNewKey. returns CRYPT_E_ARGUMENT if
+// the old key does not unwrap it, and CRYPT_E_FORMAT if the container
+// has no wrapped key
+Crypt_Error_t Crypt_Rotate(const char* fname, const char* fnameOldKey, const char* fnameNewKey);
+// the same from the keyring key named in the header to newKeyId
+Crypt_Error_t Crypt_RotateKeyring(const char* fname, Crypt_Keyring* kr, uint64_t newKeyId);
+
+// internal helpers
+// unwraps the data key of hdr with oldKek and wraps it with newKek
+Crypt_Error_t Crypt_RewrapHeader(Crypt_Header* hdr, const AES_KeyCtx* oldKek, const AES_KeyCtx* newKek);
+// opens fname for a rotation and reads its header
+Crypt_Error_t Crypt_RotateOpen(const char* fname, FILE** file, Crypt_Header* hdr);
+// writes the header back, syncs and closes the file
+Crypt_Error_t Crypt_RotateClose(FILE* file, const Crypt_Header* hdr, Crypt_Error_t err);
+// enciphers fnameIn into fnameOut under a sealed header
+Crypt_Error_t Crypt_EncipherSealed(const char* fnameIn, const AES_KeyCtx* kek, Crypt_Header* hdr,
+                                   const char* fnameOut);
+
+Crypt_Error_t Crypt_RewrapHeader(Crypt_Header* hdr, const AES_KeyCtx* oldKek, const AES_KeyCtx* newKek) {
+    if (!(hdr->flags & CRYPT_HDR_WRAPPED) ||
+        (hdr->keySize != 16 && hdr->keySize != 24 && hdr->keySize != 32)) {
+        return CRYPT_E_FORMAT;
+    }
+    byte dataKey[CRYPT_MAX_KEY_SIZE];
+    if (Crypt_KeyUnwrap(oldKek, hdr->wrappedKey, hdr->keySize, dataKey) != CRYPT_E_SUCCESS) {
+        return CRYPT_E_ARGUMENT;
+    }
+    Crypt_KeyWrap(newKek, dataKey, hdr->keySize, hdr->wrappedKey);
+    memset(dataKey, 0, sizeof(dataKey));
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_EncipherSealed(const char* fnameIn, const AES_KeyCtx* kek, Crypt_Header* hdr,
+                                   const char* fnameOut) {
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
+    FILE* fileOut = fopen(fnameOut, "wb");
+    if (!fileOut) {
+        fclose(fileIn);
+        return CRYPT_E_IO;
+    }
+
+    AES_KeyCtx dataCtx;
+    Crypt_Error_t err = Crypt_SealHeader(hdr, kek, &dataCtx);
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_EncipherChunkedFile(fileIn, &dataCtx, hdr, fileOut);
+    }
+    memset(&dataCtx, 0, sizeof(dataCtx));
+    fclose(fileIn);
+    if (fclose(fileOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_EncipherEnvelope(const char* fnameIn,
+                                     const char* fnameKey,
+                                     const char* fnameOut,
+                                     uint16_t flags) {
+    // the data key has the size of the master key
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx kek;
+    AES_InitKeyCtx(&kek, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    Crypt_Header hdr;
+    Crypt_InitHeader(&hdr, keySize, (uint16_t) (flags & ~CRYPT_HDR_KEYID));
+    return Crypt_EncipherSealed(fnameIn, &kek, &hdr, fnameOut);
+}
+
+Crypt_Error_t Crypt_EncipherEnvelopeKeyring(const char* fnameIn,
+                                            Crypt_Keyring* kr,
+                                            uint64_t keyId,
+                                            const char* fnameOut,
+                                            uint16_t flags) {
+    const Crypt_KeyringKey* key;
+    Crypt_Error_t err = Crypt_KeyringGetKey(kr, keyId, &key);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    Crypt_Header hdr;
+    Crypt_InitHeader(&hdr, key->keySize, (uint16_t) (flags | CRYPT_HDR_KEYID));
+    hdr.keyId = keyId;
+    return Crypt_EncipherSealed(fnameIn, &key->ctx, &hdr, fnameOut);
+}
+
+Crypt_Error_t Crypt_RotateOpen(const char* fname, FILE** file, Crypt_Header* hdr) {
+    *file = fopen(fname, "r+b");
+    if (!*file) {
+        return CRYPT_E_IO;
+    }
+    Crypt_Error_t err = Crypt_ReadHeader(*file, hdr);
+    if (err == CRYPT_E_SUCCESS && !(hdr->flags & CRYPT_HDR_WRAPPED)) {
+        err = CRYPT_E_FORMAT;
+    }
+    if (err != CRYPT_E_SUCCESS) {
+        fclose(*file);
+        *file = NULL;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_RotateClose(FILE* file, const Crypt_Header* hdr, Crypt_Error_t err) {
+    if (err == CRYPT_E_SUCCESS &&
+        (fseeko(file, 0, SEEK_SET) != 0 ||
+         fwrite(hdr, sizeof(Crypt_Header), 1, file) != 1 ||
+         fflush(file) != 0 || fdatasync(fileno(file)) != 0)) {
+        err = CRYPT_E_IO;
+    }
+    if (fclose(file) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_Rotate(const char* fname, const char* fnameOldKey, const char* fnameNewKey) {
+    // both keys are checked before the container is opened for writing
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    AES_KeyCtx oldKek, newKek;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameOldKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_InitKeyCtx(&oldKek, key, NK_BYTES_TO_WORDS(keySize));
+    err = Crypt_LoadKeyFile(fnameNewKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        memset(&oldKek, 0, sizeof(oldKek));
+        return err;
+    }
+    AES_InitKeyCtx(&newKek, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    FILE* file;
+    Crypt_Header hdr;
+    err = Crypt_RotateOpen(fname, &file, &hdr);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+
+    // a container that named a keyring key is now under a key file
+    hdr.flags &= (uint16_t) ~CRYPT_HDR_KEYID;
+    hdr.keyId = 0;
+    err = Crypt_RewrapHeader(&hdr, &oldKek, &newKek);
+    return Crypt_RotateClose(file, &hdr, err);
+}
+
+Crypt_Error_t Crypt_RotateKeyring(const char* fname, Crypt_Keyring* kr, uint64_t newKeyId) {
+    FILE* file;
+    Crypt_Header hdr;
+    Crypt_Error_t err = Crypt_RotateOpen(fname, &file, &hdr);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+
+    const Crypt_KeyringKey* oldKey = NULL;
+    const Crypt_KeyringKey* newKey = NULL;
+    if (!(hdr.flags & CRYPT_HDR_KEYID)) {
+        // wrapped under a key file
+        err = CRYPT_E_ARGUMENT;
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_KeyringGetKey(kr, hdr.keyId, &oldKey);
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_KeyringGetKey(kr, newKeyId, &newKey);
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_RewrapHeader(&hdr, &oldKey->ctx, &newKey->ctx);
+        hdr.keyId = newKeyId;
+    }
+    return Crypt_RotateClose(file, &hdr, err);
+}
+
+#endif  // CC_ENVELOPE_H_
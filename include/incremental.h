@@ -0,0 +1,299 @@
+#ifndef CC_INCREMENTAL_H_
+#define CC_INCREMENTAL_H_
+
+// incremental re-encryption of a whole file. the result is identical to
+// Crypt_EncipherRange(fnameIn, fnameKey, fnameOut, CRYPT_SOF, CRYPT_EOF),
+// but only the chunks whose plaintext changed since the last update are
+// enciphered and written.
+//
+// a manifest next to the ciphertext (fnameOut + CRYPT_MANIFEST_EXT)
+// stores the XXH64 of every plaintext chunk. chunks cover the full
+// blocks of the file; the final (padded) block is always rewritten,
+// since it is a single block and changes whenever the size does.
+//
+// the manifest is only trusted if the ciphertext has the size it
+// recorded and the key check value matches; otherwise every chunk is
+// rewritten. before the first chunk is patched, the old manifest is
+// invalidated on disk (see Crypt_InvalidateManifest), and the
+// ciphertext is synced before the new manifest replaces it, so a crash
+// can cause extra work but not a stale chunk.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "xxhash.h"
+
+#define CRYPT_MANIFEST_EXT ".ciphman"
+#define CRYPT_MANIFEST_MAGIC "CMAN"
+
+typedef struct {
+    char magic[4];
+    uint32_t chunkSize;
+    uint64_t plainSize;  // size of the plaintext when the manifest was written
+    uint64_t keyCheck;  // identifies the key (see Crypt_KeyCheck)
+    uint64_t nChunks;
+    // followed by nChunks uint64_t hashes
+} Crypt_ManifestHeader;
+
+typedef struct {
+    size_t nChunks;  // chunks in the plaintext
+    size_t nChanged;  // chunks enciphered and written
+    size_t nBytesWritten;
+} Crypt_UpdateStats;
+
+// brings fnameOut up to date with fnameIn. stats may be NULL
+Crypt_Error_t Crypt_EncipherIncremental(const char* fnameIn,
+                                        const char* fnameKey,
+                                        const char* fnameOut,
+                                        Crypt_UpdateStats* stats);
+
+// returns a value that identifies a key schedule without revealing the key
+// (the first 8 bytes of the all-zero block enciphered with it)
+uint64_t Crypt_KeyCheck(const AES_KeyCtx* ctx);
+// reads the hashes of the manifest into *hashes (malloc'd, may be NULL if
+// there are no chunks). returns CRYPT_E_FORMAT if the manifest is missing
+// or unusable
+Crypt_Error_t Crypt_ReadManifest(const char* fname, Crypt_ManifestHeader* hdr, uint64_t** hashes);
+Crypt_Error_t Crypt_WriteManifest(const char* fname, const Crypt_ManifestHeader* hdr, const uint64_t hashes[]);
+// clears the magic of the manifest in fname (if there is one) and syncs
+// it, so it is not trusted if the update is interrupted
+Crypt_Error_t Crypt_InvalidateManifest(const char* fname);
+
+uint64_t Crypt_KeyCheck(const AES_KeyCtx* ctx) {
+    byte zeros[STATE_SIZE] = {0};
+    byte check[STATE_SIZE];
+    AES_EncipherBlock(ctx, zeros, check);
+    uint64_t ret;
+    memcpy(&ret, check, sizeof(ret));
+    return ret;
+}
+
+Crypt_Error_t Crypt_ReadManifest(const char* fname, Crypt_ManifestHeader* hdr, uint64_t** hashes) {
+    *hashes = NULL;
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        return CRYPT_E_FORMAT;
+    }
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (fread(hdr, sizeof(Crypt_ManifestHeader), 1, file) != 1 ||
+        memcmp(hdr->magic, CRYPT_MANIFEST_MAGIC, 4) != 0) {
+        err = CRYPT_E_FORMAT;
+    } else if (hdr->nChunks) {
+        *hashes = (uint64_t*) malloc(hdr->nChunks * sizeof(uint64_t));
+        if (!*hashes) {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+        } else if (fread(*hashes, sizeof(uint64_t), hdr->nChunks, file) != hdr->nChunks) {
+            err = CRYPT_E_FORMAT;
+        }
+    }
+
+    fclose(file);
+    if (err != CRYPT_E_SUCCESS) {
+        free(*hashes);
+        *hashes = NULL;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_WriteManifest(const char* fname, const Crypt_ManifestHeader* hdr, const uint64_t hashes[]) {
+    // write a new file and rename it over the old one, so the manifest
+    // is always either the old or the new version
+    size_t nameLen = strlen(fname);
+    char* fnameTmp = (char*) malloc(nameLen + 5);
+    if (!fnameTmp) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    memcpy(fnameTmp, fname, nameLen);
+    memcpy(fnameTmp + nameLen, ".tmp", 5);
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    FILE* file = fopen(fnameTmp, "wb");
+    if (!file) {
+        err = CRYPT_E_IO;
+    } else {
+        if (fwrite(hdr, sizeof(Crypt_ManifestHeader), 1, file) != 1 ||
+            fwrite(hashes, sizeof(uint64_t), hdr->nChunks, file) != hdr->nChunks ||
+            fflush(file) != 0 || fdatasync(fileno(file)) != 0) {
+            err = CRYPT_E_IO;
+        }
+        if (fclose(file) != 0) {
+            err = CRYPT_E_IO;
+        }
+        if (err == CRYPT_E_SUCCESS && rename(fnameTmp, fname) != 0) {
+            err = CRYPT_E_IO;
+        }
+    }
+    if (err != CRYPT_E_SUCCESS) {
+        remove(fnameTmp);
+    }
+    free(fnameTmp);
+    return err;
+}
+
+Crypt_Error_t Crypt_InvalidateManifest(const char* fname) {
+    int fd = open(fname, O_WRONLY);
+    if (fd < 0) {
+        return (errno == ENOENT) ? CRYPT_E_SUCCESS : CRYPT_E_IO;
+    }
+    char magic[4] = {0};
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (pwrite(fd, magic, sizeof(magic), 0) != (ssize_t) sizeof(magic) || fdatasync(fd) != 0) {
+        err = CRYPT_E_IO;
+    }
+    close(fd);
+    return err;
+}
+
+Crypt_Error_t Crypt_EncipherIncremental(const char* fnameIn,
+                                        const char* fnameKey,
+                                        const char* fnameOut,
+                                        Crypt_UpdateStats* stats) {
+    Crypt_UpdateStats localStats;
+    if (!stats) {
+        stats = &localStats;
+    }
+    memset(stats, 0, sizeof(Crypt_UpdateStats));
+
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx ctx, padCtx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    AES_InitKeyCtx(&padCtx, key, CRYPT_PAD_NK);
+    memset(key, 0, sizeof(key));
+
+    int fdIn = open(fnameIn, O_RDONLY);
+    if (fdIn < 0) {
+        return CRYPT_E_IO;
+    }
+    struct stat st;
+    if (fstat(fdIn, &st) != 0) {
+        close(fdIn);
+        return CRYPT_E_IO;
+    }
+    size_t plainSize = (size_t) st.st_size;
+
+    // the full blocks are split into chunks; the rest of the file goes
+    // into the padded final block
+    size_t fullSize = (plainSize / STATE_SIZE) * STATE_SIZE;
+    size_t cipherSize = fullSize + STATE_SIZE;
+    size_t nChunks = (fullSize + CRYPT_CHUNK_SIZE - 1) / CRYPT_CHUNK_SIZE;
+
+    size_t nameLen = strlen(fnameOut);
+    char* fnameManifest = (char*) malloc(nameLen + sizeof(CRYPT_MANIFEST_EXT));
+    uint64_t* hashes = (uint64_t*) malloc((nChunks ? nChunks : 1) * sizeof(uint64_t));
+    byte* buf = (byte*) malloc(CRYPT_CHUNK_SIZE);
+    if (!fnameManifest || !hashes || !buf) {
+        free(fnameManifest);
+        free(hashes);
+        free(buf);
+        close(fdIn);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    memcpy(fnameManifest, fnameOut, nameLen);
+    memcpy(fnameManifest + nameLen, CRYPT_MANIFEST_EXT, sizeof(CRYPT_MANIFEST_EXT));
+
+    Crypt_ManifestHeader hdr;
+    uint64_t* oldHashes = NULL;
+    size_t nOldChunks = 0;
+    int fdOut = open(fnameOut, O_RDWR | O_CREAT, 0644);
+    err = (fdOut < 0) ? CRYPT_E_IO : CRYPT_E_SUCCESS;
+    if (err == CRYPT_E_SUCCESS &&
+        Crypt_ReadManifest(fnameManifest, &hdr, &oldHashes) == CRYPT_E_SUCCESS &&
+        fstat(fdOut, &st) == 0 &&
+        hdr.chunkSize == CRYPT_CHUNK_SIZE &&
+        hdr.keyCheck == Crypt_KeyCheck(&ctx) &&
+        (size_t) st.st_size == (hdr.plainSize / STATE_SIZE) * STATE_SIZE + STATE_SIZE) {
+        nOldChunks = hdr.nChunks;
+    }
+
+    // true once the old manifest can no longer be trusted
+    bool invalidated = false;
+    for (size_t i = 0; err == CRYPT_E_SUCCESS && i < nChunks; i++) {
+        size_t offset = i * CRYPT_CHUNK_SIZE;
+        size_t n = MIN((size_t) CRYPT_CHUNK_SIZE, fullSize - offset);
+        if (pread(fdIn, buf, n, (off_t) offset) != (ssize_t) n) {
+            err = CRYPT_E_IO;
+            break;
+        }
+
+        // the hash covers the chunk's length, so a chunk that grew or
+        // shrank never matches its old hash
+        hashes[i] = XXH_Hash64(buf, n, 0);
+        if (i < nOldChunks && hashes[i] == oldHashes[i]) {
+            continue;
+        }
+
+        if (!invalidated) {
+            err = Crypt_InvalidateManifest(fnameManifest);
+            invalidated = true;
+            if (err != CRYPT_E_SUCCESS) {
+                break;
+            }
+        }
+        AES_EncipherBlocks(&ctx, buf, n / STATE_SIZE, buf);
+        if (pwrite(fdOut, buf, n, (off_t) offset) != (ssize_t) n) {
+            err = CRYPT_E_IO;
+            break;
+        }
+        stats->nChanged++;
+        stats->nBytesWritten += n;
+    }
+    stats->nChunks = nChunks;
+
+    if (err == CRYPT_E_SUCCESS) {
+        // the padded final block (see Crypt_EncipherRange)
+        byte plaintext[STATE_SIZE];
+        byte ciphertext[STATE_SIZE];
+        byte nPad = (byte) (STATE_SIZE - (plainSize - fullSize));
+        size_t nTail = STATE_SIZE - nPad;
+        if (pread(fdIn, plaintext, nTail, (off_t) fullSize) != (ssize_t) nTail) {
+            err = CRYPT_E_IO;
+        } else {
+            for (size_t i = nTail; i < STATE_SIZE; i++) {
+                plaintext[i] = nPad;
+            }
+            AES_EncipherBlock(&padCtx, plaintext, ciphertext);
+            if (pwrite(fdOut, ciphertext, STATE_SIZE, (off_t) fullSize) != STATE_SIZE ||
+                ftruncate(fdOut, (off_t) cipherSize) != 0 ||
+                fdatasync(fdOut) != 0) {
+                err = CRYPT_E_IO;
+            }
+            stats->nBytesWritten += STATE_SIZE;
+        }
+    }
+
+    if (err == CRYPT_E_SUCCESS) {
+        memset(&hdr, 0, sizeof(Crypt_ManifestHeader));
+        memcpy(hdr.magic, CRYPT_MANIFEST_MAGIC, 4);
+        hdr.chunkSize = CRYPT_CHUNK_SIZE;
+        hdr.plainSize = plainSize;
+        hdr.keyCheck = Crypt_KeyCheck(&ctx);
+        hdr.nChunks = nChunks;
+        err = Crypt_WriteManifest(fnameManifest, &hdr, hashes);
+    }
+
+    if (fdOut >= 0) {
+        close(fdOut);
+    }
+    close(fdIn);
+    free(oldHashes);
+    free(fnameManifest);
+    free(hashes);
+    free(buf);
+    return err;
+}
+
+#endif  // CC_INCREMENTAL_H_
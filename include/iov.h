@@ -0,0 +1,127 @@
+#ifndef CC_IOV_H_
+#define CC_IOV_H_
+
+// enciphers or deciphers data held in scatter/gather lists (struct
+// iovec, as for readv and writev), so fragmented buffers need not be
+// copied into one before transforming them. like Crypt_Transform, the
+// data is transformed block by block under a single key.
+//
+// the input and output lists may be fragmented differently. where the
+// current input and output fragments both have whole blocks left, they
+// are transformed in one call straight from one to the other; a block
+// that straddles a fragment boundary on either side is gathered into a
+// block buffer, transformed and scattered. the lists may describe the
+// same bytes (in place), or bytes that do not overlap.
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "aes.h"
+#include "ciph.h"
+
+// transforms the bytes of the inCnt fragments of in with fn and ctx,
+// writing them to the fragments of out in order. returns
+// CRYPT_E_ARGUMENT (and transforms nothing) unless the input is a whole
+// number of blocks and out has room for it
+Crypt_Error_t Crypt_TransformV(const AES_KeyCtx* ctx,
+                               Crypt_AESBlocksFn fn,
+                               const struct iovec* in,
+                               int inCnt,
+                               const struct iovec* out,
+                               int outCnt);
+
+// internal helpers
+// returns the number of bytes in the cnt fragments of iov
+size_t Crypt_IovSize(const struct iovec* iov, int cnt);
+// a position in a list of fragments
+typedef struct {
+    const struct iovec* iov;
+    int cnt;
+    int i;  // the current fragment
+    size_t offset;  // into the current fragment
+} Crypt_IovCursor;
+// moves the cursor to the next fragment with bytes left, if any
+void Crypt_IovSkipEmpty(Crypt_IovCursor* c);
+// copies nBytes bytes between buf and the fragments at the cursor,
+// moving it along
+void Crypt_IovGather(Crypt_IovCursor* c, byte buf[], size_t nBytes);
+void Crypt_IovScatter(Crypt_IovCursor* c, const byte buf[], size_t nBytes);
+
+size_t Crypt_IovSize(const struct iovec* iov, int cnt) {
+    size_t nBytes = 0;
+    for (int i = 0; i < cnt; i++) {
+        nBytes += iov[i].iov_len;
+    }
+    return nBytes;
+}
+
+void Crypt_IovSkipEmpty(Crypt_IovCursor* c) {
+    while (c->i < c->cnt && c->offset == c->iov[c->i].iov_len) {
+        c->i++;
+        c->offset = 0;
+    }
+}
+
+void Crypt_IovGather(Crypt_IovCursor* c, byte buf[], size_t nBytes) {
+    while (nBytes > 0) {
+        Crypt_IovSkipEmpty(c);
+        size_t n = MIN(nBytes, c->iov[c->i].iov_len - c->offset);
+        memcpy(buf, (const byte*) c->iov[c->i].iov_base + c->offset, n);
+        c->offset += n;
+        buf += n;
+        nBytes -= n;
+    }
+}
+
+void Crypt_IovScatter(Crypt_IovCursor* c, const byte buf[], size_t nBytes) {
+    while (nBytes > 0) {
+        Crypt_IovSkipEmpty(c);
+        size_t n = MIN(nBytes, c->iov[c->i].iov_len - c->offset);
+        memcpy((byte*) c->iov[c->i].iov_base + c->offset, buf, n);
+        c->offset += n;
+        buf += n;
+        nBytes -= n;
+    }
+}
+
+Crypt_Error_t Crypt_TransformV(const AES_KeyCtx* ctx,
+                               Crypt_AESBlocksFn fn,
+                               const struct iovec* in,
+                               int inCnt,
+                               const struct iovec* out,
+                               int outCnt) {
+    size_t nBytes = Crypt_IovSize(in, inCnt);
+    if (nBytes % STATE_SIZE != 0 || Crypt_IovSize(out, outCnt) < nBytes) {
+        return CRYPT_E_ARGUMENT;
+    }
+
+    Crypt_IovCursor src = {in, inCnt, 0, 0};
+    Crypt_IovCursor dst = {out, outCnt, 0, 0};
+    byte block[STATE_SIZE];
+    while (nBytes > 0) {
+        Crypt_IovSkipEmpty(&src);
+        Crypt_IovSkipEmpty(&dst);
+        size_t nSrc = src.iov[src.i].iov_len - src.offset;
+        size_t nDst = dst.iov[dst.i].iov_len - dst.offset;
+        size_t nBlocks = MIN(nSrc, nDst) / STATE_SIZE;
+        if (nBlocks > 0) {
+            // whole blocks on both sides
+            fn(ctx, (const byte*) src.iov[src.i].iov_base + src.offset, nBlocks,
+               (byte*) dst.iov[dst.i].iov_base + dst.offset);
+            src.offset += nBlocks * STATE_SIZE;
+            dst.offset += nBlocks * STATE_SIZE;
+            nBytes -= nBlocks * STATE_SIZE;
+        } else {
+            // a block that straddles a fragment boundary
+            Crypt_IovGather(&src, block, STATE_SIZE);
+            fn(ctx, block, 1, block);
+            Crypt_IovScatter(&dst, block, STATE_SIZE);
+            nBytes -= STATE_SIZE;
+        }
+    }
+    memset(block, 0, sizeof(block));
+    return CRYPT_E_SUCCESS;
+}
+
+#endif  // CC_IOV_H_
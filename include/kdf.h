@@ -0,0 +1,357 @@
+#ifndef CC_KDF_H_
+#define CC_KDF_H_
+
+// password-based key derivation: PBKDF2-HMAC-SHA256 (RFC 8018) and
+// scrypt (RFC 7914). the salt and cost of a derivation are kept in a
+// small parameters file next to the key, so the same passphrase
+// derives the same key again later.
+//
+// PBKDF2 is a chain of HMACs, so it cannot be spread over threads;
+// each iteration is reduced to two runs of the compression function
+// on precomputed states. the p lanes of scrypt are independent, so
+// they run on a pool of up to nThreads workers, each with its own
+// 128 * r * N byte table, and the cost in wall time is divided by the
+// number of workers.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ciph.h"
+#include "pool.h"
+#include "sha256.h"
+
+#define CRYPT_KDF_MAGIC "CKDF"
+#define CRYPT_KDF_VERSION 1
+#define CRYPT_KDF_SALT_SIZE 16
+// default costs, about half a second of work on one core
+#define CRYPT_PBKDF2_ITERATIONS 600000
+#define CRYPT_SCRYPT_N (1 << 15)
+#define CRYPT_SCRYPT_R 8
+#define CRYPT_SCRYPT_P 4
+
+typedef enum {
+    CRYPT_KDF_PBKDF2 = 1,
+    CRYPT_KDF_SCRYPT = 2
+} Crypt_Kdf_t;
+
+// NOTE: written as-is, like container headers
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t kdf;  // a Crypt_Kdf_t
+    uint32_t r, p;  // scrypt only
+    uint64_t cost;  // iterations for PBKDF2, N for scrypt
+    uint8_t salt[CRYPT_KDF_SALT_SIZE];
+} Crypt_KdfParams;
+
+// derives outSize bytes from a passphrase with PBKDF2-HMAC-SHA256
+void Crypt_Pbkdf2(const byte pass[], size_t passSize, const byte salt[], size_t saltSize,
+                  uint64_t iterations, byte out[], size_t outSize);
+// derives outSize bytes with scrypt, running the p lanes on up to
+// nThreads threads. returns CRYPT_E_ARGUMENT if N is not a power of 2
+// greater than 1 or the parameters are too large
+Crypt_Error_t Crypt_Scrypt(const byte pass[], size_t passSize, const byte salt[], size_t saltSize,
+                           uint64_t N, uint32_t r, uint32_t p, byte out[], size_t outSize, size_t nThreads);
+
+// fills in the default parameters of kdf with a new random salt
+Crypt_Error_t Crypt_KdfInitParams(Crypt_KdfParams* params, Crypt_Kdf_t kdf);
+Crypt_Error_t Crypt_KdfLoadParams(const char* fname, Crypt_KdfParams* params);
+Crypt_Error_t Crypt_KdfSaveParams(const char* fname, const Crypt_KdfParams* params);
+// derives a key of keySize bytes from the passphrase
+Crypt_Error_t Crypt_DeriveKey(const Crypt_KdfParams* params, const char* pass, size_t passSize,
+                              byte key[], size_t keySize, size_t nThreads);
+// the same, written to a key file like Crypt_GenerateKeyFile
+Crypt_Error_t Crypt_DeriveKeyFile(const char* fname, size_t keySize, const Crypt_KdfParams* params,
+                                  const char* pass, size_t passSize, size_t nThreads);
+
+// internal helpers
+typedef struct {
+    uint32_t* block;  // the 32 * r words of a lane
+    uint64_t N;
+    uint32_t r;
+    Crypt_Error_t err;
+} Crypt_ScryptLane;
+
+void Crypt_Salsa208(uint32_t b[]);
+// mixes the 2 * r 64-byte blocks of in into out
+void Crypt_BlockMix(const uint32_t in[], uint32_t out[], uint32_t r);
+// the sequential memory-hard function of scrypt, on one lane
+void Crypt_ROMix(void* arg);
+
+void Crypt_Pbkdf2(const byte pass[], size_t passSize, const byte salt[], size_t saltSize,
+                  uint64_t iterations, byte out[], size_t outSize) {
+    SHA256_HmacCtx base;
+    SHA256_HmacInit(&base, pass, passSize);
+
+    // after the first iteration the message is always one digest, so
+    // the padded block is built once and hashed from the saved states
+    byte block[SHA256_BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+    block[SHA256_DIGEST_SIZE] = 0x80;
+    uint64_t nBits = (SHA256_BLOCK_SIZE + SHA256_DIGEST_SIZE) * 8;
+    for (size_t i = 0; i < 8; i++) {
+        block[SHA256_BLOCK_SIZE - 1 - i] = (byte) (nBits >> (8 * i));
+    }
+
+    for (uint32_t n = 1; outSize > 0; n++) {
+        byte index[4];
+        SHA256_Store32(index, n);
+        SHA256_HmacCtx ctx = base;
+        SHA256_HmacUpdate(&ctx, salt, saltSize);
+        SHA256_HmacUpdate(&ctx, index, sizeof(index));
+        SHA256_HmacFinal(&ctx, block);
+
+        byte t[SHA256_DIGEST_SIZE];
+        memcpy(t, block, SHA256_DIGEST_SIZE);
+        for (uint64_t i = 1; i < iterations; i++) {
+            uint32_t h[8];
+            memcpy(h, base.inner.h, sizeof(h));
+            SHA256_Compress(h, block, 1);
+            for (size_t j = 0; j < 8; j++) {
+                SHA256_Store32(block + 4 * j, h[j]);
+            }
+            memcpy(h, base.outer.h, sizeof(h));
+            SHA256_Compress(h, block, 1);
+            for (size_t j = 0; j < 8; j++) {
+                SHA256_Store32(block + 4 * j, h[j]);
+            }
+            for (size_t j = 0; j < SHA256_DIGEST_SIZE; j++) {
+                t[j] ^= block[j];
+            }
+        }
+
+        size_t nOut = MIN(outSize, (size_t) SHA256_DIGEST_SIZE);
+        memcpy(out, t, nOut);
+        out += nOut;
+        outSize -= nOut;
+        memset(t, 0, sizeof(t));
+    }
+    memset(block, 0, sizeof(block));
+    memset(&base, 0, sizeof(base));
+}
+
+void Crypt_Salsa208(uint32_t b[]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+#define CRYPT_SALSA_R(a, n) (((a) << (n)) | ((a) >> (32 - (n))))
+    for (size_t i = 0; i < 8; i += 2) {
+        // columns
+        x[4] ^= CRYPT_SALSA_R(x[0] + x[12], 7);
+        x[8] ^= CRYPT_SALSA_R(x[4] + x[0], 9);
+        x[12] ^= CRYPT_SALSA_R(x[8] + x[4], 13);
+        x[0] ^= CRYPT_SALSA_R(x[12] + x[8], 18);
+        x[9] ^= CRYPT_SALSA_R(x[5] + x[1], 7);
+        x[13] ^= CRYPT_SALSA_R(x[9] + x[5], 9);
+        x[1] ^= CRYPT_SALSA_R(x[13] + x[9], 13);
+        x[5] ^= CRYPT_SALSA_R(x[1] + x[13], 18);
+        x[14] ^= CRYPT_SALSA_R(x[10] + x[6], 7);
+        x[2] ^= CRYPT_SALSA_R(x[14] + x[10], 9);
+        x[6] ^= CRYPT_SALSA_R(x[2] + x[14], 13);
+        x[10] ^= CRYPT_SALSA_R(x[6] + x[2], 18);
+        x[3] ^= CRYPT_SALSA_R(x[15] + x[11], 7);
+        x[7] ^= CRYPT_SALSA_R(x[3] + x[15], 9);
+        x[11] ^= CRYPT_SALSA_R(x[7] + x[3], 13);
+        x[15] ^= CRYPT_SALSA_R(x[11] + x[7], 18);
+        // rows
+        x[1] ^= CRYPT_SALSA_R(x[0] + x[3], 7);
+        x[2] ^= CRYPT_SALSA_R(x[1] + x[0], 9);
+        x[3] ^= CRYPT_SALSA_R(x[2] + x[1], 13);
+        x[0] ^= CRYPT_SALSA_R(x[3] + x[2], 18);
+        x[6] ^= CRYPT_SALSA_R(x[5] + x[4], 7);
+        x[7] ^= CRYPT_SALSA_R(x[6] + x[5], 9);
+        x[4] ^= CRYPT_SALSA_R(x[7] + x[6], 13);
+        x[5] ^= CRYPT_SALSA_R(x[4] + x[7], 18);
+        x[11] ^= CRYPT_SALSA_R(x[10] + x[9], 7);
+        x[8] ^= CRYPT_SALSA_R(x[11] + x[10], 9);
+        x[9] ^= CRYPT_SALSA_R(x[8] + x[11], 13);
+        x[10] ^= CRYPT_SALSA_R(x[9] + x[8], 18);
+        x[12] ^= CRYPT_SALSA_R(x[15] + x[14], 7);
+        x[13] ^= CRYPT_SALSA_R(x[12] + x[15], 9);
+        x[14] ^= CRYPT_SALSA_R(x[13] + x[12], 13);
+        x[15] ^= CRYPT_SALSA_R(x[14] + x[13], 18);
+    }
+#undef CRYPT_SALSA_R
+    for (size_t i = 0; i < 16; i++) {
+        b[i] += x[i];
+    }
+}
+
+void Crypt_BlockMix(const uint32_t in[], uint32_t out[], uint32_t r) {
+    // the even blocks go to the first half of out, the odd ones to the second
+    uint32_t x[16];
+    memcpy(x, in + (2 * r - 1) * 16, sizeof(x));
+    for (size_t i = 0; i < 2 * r; i++) {
+        for (size_t j = 0; j < 16; j++) {
+            x[j] ^= in[i * 16 + j];
+        }
+        Crypt_Salsa208(x);
+        memcpy(out + ((i % 2) * r + i / 2) * 16, x, sizeof(x));
+    }
+}
+
+void Crypt_ROMix(void* arg) {
+    Crypt_ScryptLane* lane = (Crypt_ScryptLane*) arg;
+    size_t nWords = 32 * (size_t) lane->r;
+    uint32_t* v = (uint32_t*) malloc(lane->N * nWords * sizeof(uint32_t));
+    uint32_t* y = (uint32_t*) malloc(nWords * sizeof(uint32_t));
+    if (!v || !y) {
+        free(v);
+        free(y);
+        lane->err = CRYPT_E_MEMORY_ALLOCATION;
+        return;
+    }
+
+    uint32_t* x = lane->block;
+    for (uint64_t i = 0; i < lane->N; i++) {
+        memcpy(v + i * nWords, x, nWords * sizeof(uint32_t));
+        Crypt_BlockMix(x, y, lane->r);
+        memcpy(x, y, nWords * sizeof(uint32_t));
+    }
+    for (uint64_t i = 0; i < lane->N; i++) {
+        // integerify: the first word of the last 64-byte block
+        uint64_t j = (((uint64_t) x[nWords - 15] << 32) | x[nWords - 16]) & (lane->N - 1);
+        const uint32_t* vj = v + j * nWords;
+        for (size_t k = 0; k < nWords; k++) {
+            x[k] ^= vj[k];
+        }
+        Crypt_BlockMix(x, y, lane->r);
+        memcpy(x, y, nWords * sizeof(uint32_t));
+    }
+
+    memset(v, 0, lane->N * nWords * sizeof(uint32_t));
+    memset(y, 0, nWords * sizeof(uint32_t));
+    free(v);
+    free(y);
+    lane->err = CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_Scrypt(const byte pass[], size_t passSize, const byte salt[], size_t saltSize,
+                           uint64_t N, uint32_t r, uint32_t p, byte out[], size_t outSize, size_t nThreads) {
+    // the table of a lane must fit in memory (RFC 7914 also bounds r * p)
+    if (N < 2 || (N & (N - 1)) != 0 || r == 0 || p == 0 ||
+        (uint64_t) r * p >= ((uint64_t) 1 << 30) ||
+        N > SIZE_MAX / (128 * (uint64_t) r)) {
+        return CRYPT_E_ARGUMENT;
+    }
+
+    size_t blockSize = 128 * (size_t) r;
+    byte* b = (byte*) malloc(p * blockSize);
+    uint32_t* words = (uint32_t*) malloc(p * blockSize);
+    Crypt_ScryptLane* lanes = (Crypt_ScryptLane*) calloc(p, sizeof(Crypt_ScryptLane));
+    Crypt_Pool* pool = (b && words && lanes) ? Crypt_PoolNew(MIN(nThreads, (size_t) p)) : NULL;
+    if (!pool) {
+        free(b);
+        free(words);
+        free(lanes);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+
+    // Salsa20/8 works on little-endian words
+    Crypt_Pbkdf2(pass, passSize, salt, saltSize, 1, b, p * blockSize);
+    for (size_t i = 0; i < p * blockSize / 4; i++) {
+        words[i] = (uint32_t) b[4 * i] | ((uint32_t) b[4 * i + 1] << 8) |
+                   ((uint32_t) b[4 * i + 2] << 16) | ((uint32_t) b[4 * i + 3] << 24);
+    }
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    for (size_t i = 0; i < p; i++) {
+        lanes[i].block = words + i * blockSize / 4;
+        lanes[i].N = N;
+        lanes[i].r = r;
+        if (Crypt_PoolSubmit(pool, Crypt_ROMix, &lanes[i]) != CRYPT_E_SUCCESS) {
+            Crypt_ROMix(&lanes[i]);
+        }
+    }
+    Crypt_PoolFree(pool);
+    for (size_t i = 0; i < p; i++) {
+        if (lanes[i].err != CRYPT_E_SUCCESS) {
+            err = lanes[i].err;
+        }
+    }
+
+    if (err == CRYPT_E_SUCCESS) {
+        for (size_t i = 0; i < p * blockSize / 4; i++) {
+            for (size_t k = 0; k < 4; k++) {
+                b[4 * i + k] = (byte) (words[i] >> (8 * k));
+            }
+        }
+        Crypt_Pbkdf2(pass, passSize, b, p * blockSize, 1, out, outSize);
+    }
+
+    memset(b, 0, p * blockSize);
+    memset(words, 0, p * blockSize);
+    free(b);
+    free(words);
+    free(lanes);
+    return err;
+}
+
+Crypt_Error_t Crypt_KdfInitParams(Crypt_KdfParams* params, Crypt_Kdf_t kdf) {
+    memset(params, 0, sizeof(Crypt_KdfParams));
+    memcpy(params->magic, CRYPT_KDF_MAGIC, sizeof(params->magic));
+    params->version = CRYPT_KDF_VERSION;
+    params->kdf = (uint16_t) kdf;
+    if (kdf == CRYPT_KDF_SCRYPT) {
+        params->cost = CRYPT_SCRYPT_N;
+        params->r = CRYPT_SCRYPT_R;
+        params->p = CRYPT_SCRYPT_P;
+    } else {
+        params->cost = CRYPT_PBKDF2_ITERATIONS;
+    }
+    return Crypt_RandomBytes(params->salt, CRYPT_KDF_SALT_SIZE) ? CRYPT_E_SUCCESS : CRYPT_E_IO;
+}
+
+Crypt_Error_t Crypt_KdfLoadParams(const char* fname, Crypt_KdfParams* params) {
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        return CRYPT_E_IO;
+    }
+    bool valid = fread(params, sizeof(Crypt_KdfParams), 1, file) == 1 &&
+                 memcmp(params->magic, CRYPT_KDF_MAGIC, sizeof(params->magic)) == 0 &&
+                 params->version == CRYPT_KDF_VERSION &&
+                 (params->kdf == CRYPT_KDF_PBKDF2 || params->kdf == CRYPT_KDF_SCRYPT) &&
+                 params->cost > 0;
+    fclose(file);
+    return valid ? CRYPT_E_SUCCESS : CRYPT_E_FORMAT;
+}
+
+Crypt_Error_t Crypt_KdfSaveParams(const char* fname, const Crypt_KdfParams* params) {
+    FILE* file = fopen(fname, "wb");
+    if (!file) {
+        return CRYPT_E_IO;
+    }
+    bool ok = fwrite(params, sizeof(Crypt_KdfParams), 1, file) == 1;
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    return ok ? CRYPT_E_SUCCESS : CRYPT_E_IO;
+}
+
+Crypt_Error_t Crypt_DeriveKey(const Crypt_KdfParams* params, const char* pass, size_t passSize,
+                              byte key[], size_t keySize, size_t nThreads) {
+    if (params->kdf == CRYPT_KDF_SCRYPT) {
+        return Crypt_Scrypt((const byte*) pass, passSize, params->salt, CRYPT_KDF_SALT_SIZE,
+                            params->cost, params->r, params->p, key, keySize, nThreads);
+    }
+    Crypt_Pbkdf2((const byte*) pass, passSize, params->salt, CRYPT_KDF_SALT_SIZE, params->cost, key, keySize);
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_DeriveKeyFile(const char* fname, size_t keySize, const Crypt_KdfParams* params,
+                                  const char* pass, size_t passSize, size_t nThreads) {
+    if (keySize != 16 && keySize != 24 && keySize != 32) {
+        return CRYPT_E_ARGUMENT;
+    }
+    byte key[CRYPT_MAX_KEY_SIZE];
+    Crypt_Error_t err = Crypt_DeriveKey(params, pass, passSize, key, keySize, nThreads);
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_WriteKeyFile(fname, key, keySize);
+    }
+    memset(key, 0, sizeof(key));
+    return err;
+}
+
+#endif  // CC_KDF_H_
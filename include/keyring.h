@@ -0,0 +1,483 @@
+#ifndef CC_KEYRING_H_
+#define CC_KEYRING_H_
+
+// a keyring holds many keys in one file, each named by a 64-bit key id.
+// the file is memory-mapped and has a hash table from key id to entry,
+// so finding a key costs one probe sequence regardless of how many keys
+// the keyring holds, and opening it does not read the keys:
+//
+//     Crypt_KeyringHeader
+//     tableSize uint32_t slots: entry index + 1, or 0 if empty
+//     nKeys Crypt_KeyringEntry
+//
+// slots are found by linear probing from XXH64(keyId) & (tableSize - 1).
+// key schedules are expanded the first time a key is used and kept
+// until the keyring is closed.
+//
+// containers enciphered with a key from a keyring record its id in the
+// header (CRYPT_HDR_KEYID), so deciphering picks the key by itself.
+//
+// keyrings are only written by Crypt_KeyringAdd / Crypt_KeyringImport,
+// which rewrite the whole file and rename it over the old one, so a
+// keyring that is open keeps its (old) contents. writers hold an
+// exclusive flock() on fname + CRYPT_KEYRING_LOCK_EXT from reading the
+// old keyring until the new one is in place, so concurrent adds do not
+// lose each other's keys.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>  // for flock()
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "container.h"
+#include "xxhash.h"
+
+#define CRYPT_KEYRING_MAGIC "CKRG"
+#define CRYPT_KEYRING_VERSION 1
+#define CRYPT_KEYRING_LOCK_EXT ".lock"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nKeys;
+    uint32_t tableSize;  // a power of 2, at least twice nKeys
+} Crypt_KeyringHeader;
+
+typedef struct {
+    uint64_t keyId;
+    uint8_t keySize;  // key size in bytes
+    uint8_t reserved[7];
+    byte key[CRYPT_MAX_KEY_SIZE];
+} Crypt_KeyringEntry;
+
+typedef struct {
+    uint64_t keyId;
+    size_t keySize;
+    AES_KeyCtx ctx;
+    AES_KeyCtx padCtx;  // for the padded final block (see CRYPT_PAD_NK)
+} Crypt_KeyringKey;
+
+typedef struct {
+    const byte* map;
+    size_t mapSize;
+    const Crypt_KeyringHeader* hdr;
+    const uint32_t* table;
+    const Crypt_KeyringEntry* entries;
+    // expanded schedules by entry index (NULL until first used)
+    Crypt_KeyringKey** keys;
+    pthread_mutex_t lock;  // protects keys
+} Crypt_Keyring;
+
+// maps the keyring. a missing file is an empty keyring. on failure,
+// there is nothing to close
+Crypt_Error_t Crypt_KeyringOpen(Crypt_Keyring* kr, const char* fname);
+void Crypt_KeyringClose(Crypt_Keyring* kr);
+// returns the entry of keyId, or NULL if the keyring does not have it
+const Crypt_KeyringEntry* Crypt_KeyringFind(const Crypt_Keyring* kr, uint64_t keyId);
+// points *key at the expanded schedules of keyId, which stay valid
+// until the keyring is closed. returns CRYPT_E_ARGUMENT if the keyring
+// does not have the key. safe to call from several threads
+Crypt_Error_t Crypt_KeyringGetKey(Crypt_Keyring* kr, uint64_t keyId, const Crypt_KeyringKey** key);
+
+// generates a new key of keySize bytes for each of the nIds key ids and
+// adds them to the keyring fname, creating it if needed. fails with
+// CRYPT_E_ARGUMENT if any id is already taken
+Crypt_Error_t Crypt_KeyringAdd(const char* fname, const uint64_t keyIds[], size_t nIds, size_t keySize);
+// adds the key in the key file fnameKey as keyId
+Crypt_Error_t Crypt_KeyringImport(const char* fname, uint64_t keyId, const char* fnameKey);
+
+// the same as Crypt_EncipherChunked / Crypt_DecipherChunkedRequire with
+// a key from a keyring. deciphering takes the key id from the header
+// and runs on nWorkers threads
+Crypt_Error_t Crypt_EncipherChunkedKeyring(const char* fnameIn,
+                                           Crypt_Keyring* kr,
+                                           uint64_t keyId,
+                                           const char* fnameOut,
+                                           uint16_t flags);
+Crypt_Error_t Crypt_DecipherChunkedKeyring(const char* fnameIn,
+                                           Crypt_Keyring* kr,
+                                           const char* fnameOut,
+                                           size_t firstByte,
+                                           size_t lastByte,
+                                           uint16_t required,
+                                           size_t nWorkers);
+
+// internal helpers
+// writes the entries as a new keyring, replacing fname
+Crypt_Error_t Crypt_KeyringWrite(const char* fname, const Crypt_KeyringEntry entries[], size_t nEntries);
+// adds the new entries to those already in fname
+Crypt_Error_t Crypt_KeyringMerge(const char* fname, const Crypt_KeyringEntry entries[], size_t nEntries);
+// takes the write lock of the keyring fname. returns the descriptor to
+// close to release it, or -1 on failure
+int Crypt_KeyringLock(const char* fname);
+size_t Crypt_KeyringSlot(uint64_t keyId, size_t tableSize);
+
+size_t Crypt_KeyringSlot(uint64_t keyId, size_t tableSize) {
+    return (size_t) XXH_Hash64((const byte*) &keyId, sizeof(keyId), 0) & (tableSize - 1);
+}
+
+Crypt_Error_t Crypt_KeyringOpen(Crypt_Keyring* kr, const char* fname) {
+    memset(kr, 0, sizeof(Crypt_Keyring));
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0 && errno == ENOENT) {
+        pthread_mutex_init(&kr->lock, NULL);
+        return CRYPT_E_SUCCESS;
+    } else if (fd < 0) {
+        return CRYPT_E_IO;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return CRYPT_E_IO;
+    }
+    if ((size_t) st.st_size < sizeof(Crypt_KeyringHeader)) {
+        close(fd);
+        return CRYPT_E_FORMAT;
+    }
+    void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return CRYPT_E_IO;
+    }
+    kr->map = (const byte*) map;
+    kr->mapSize = (size_t) st.st_size;
+    kr->hdr = (const Crypt_KeyringHeader*) map;
+
+    // everything an id lookup touches is checked here, so lookups need
+    // no checks of their own
+    const Crypt_KeyringHeader* hdr = kr->hdr;
+    size_t tableBytes = (size_t) hdr->tableSize * sizeof(uint32_t);
+    size_t entriesOffset = sizeof(Crypt_KeyringHeader) + tableBytes;
+    bool valid = memcmp(hdr->magic, CRYPT_KEYRING_MAGIC, 4) == 0 &&
+                 hdr->version == CRYPT_KEYRING_VERSION &&
+                 hdr->tableSize != 0 && (hdr->tableSize & (hdr->tableSize - 1)) == 0 &&
+                 (size_t) hdr->nKeys < hdr->tableSize &&
+                 kr->mapSize == entriesOffset + (size_t) hdr->nKeys * sizeof(Crypt_KeyringEntry);
+    if (valid) {
+        kr->table = (const uint32_t*) (kr->map + sizeof(Crypt_KeyringHeader));
+        kr->entries = (const Crypt_KeyringEntry*) (kr->map + entriesOffset);
+        // one used slot per key leaves an empty slot to end every probe
+        size_t nUsed = 0;
+        for (size_t i = 0; valid && i < hdr->tableSize; i++) {
+            valid = kr->table[i] <= hdr->nKeys;
+            nUsed += kr->table[i] != 0;
+        }
+        valid = valid && nUsed == hdr->nKeys;
+        for (size_t i = 0; valid && i < hdr->nKeys; i++) {
+            size_t keySize = kr->entries[i].keySize;
+            valid = keySize == 16 || keySize == 24 || keySize == 32;
+        }
+    }
+    if (valid) {
+        kr->keys = (Crypt_KeyringKey**) calloc(hdr->nKeys ? hdr->nKeys : 1, sizeof(Crypt_KeyringKey*));
+    }
+    if (!valid || !kr->keys) {
+        munmap(map, kr->mapSize);
+        memset(kr, 0, sizeof(Crypt_Keyring));
+        return valid ? CRYPT_E_MEMORY_ALLOCATION : CRYPT_E_FORMAT;
+    }
+    pthread_mutex_init(&kr->lock, NULL);
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_KeyringClose(Crypt_Keyring* kr) {
+    if (kr->keys) {
+        for (size_t i = 0; i < kr->hdr->nKeys; i++) {
+            if (kr->keys[i]) {
+                // schedules are as secret as the keys
+                memset(kr->keys[i], 0, sizeof(Crypt_KeyringKey));
+                free(kr->keys[i]);
+            }
+        }
+        free(kr->keys);
+    }
+    if (kr->map) {
+        munmap((void*) kr->map, kr->mapSize);
+    }
+    pthread_mutex_destroy(&kr->lock);
+    kr->map = NULL;
+    kr->hdr = NULL;
+    kr->keys = NULL;
+}
+
+const Crypt_KeyringEntry* Crypt_KeyringFind(const Crypt_Keyring* kr, uint64_t keyId) {
+    if (!kr->table) {
+        return NULL;
+    }
+    size_t mask = kr->hdr->tableSize - 1;
+    // Crypt_KeyringOpen checked that the table is never full, so the
+    // probe ends at an empty slot
+    for (size_t slot = Crypt_KeyringSlot(keyId, kr->hdr->tableSize); kr->table[slot]; slot = (slot + 1) & mask) {
+        const Crypt_KeyringEntry* entry = &kr->entries[kr->table[slot] - 1];
+        if (entry->keyId == keyId) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+Crypt_Error_t Crypt_KeyringGetKey(Crypt_Keyring* kr, uint64_t keyId, const Crypt_KeyringKey** key) {
+    const Crypt_KeyringEntry* entry = Crypt_KeyringFind(kr, keyId);
+    if (!entry) {
+        return CRYPT_E_ARGUMENT;
+    }
+    size_t index = (size_t) (entry - kr->entries);
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    pthread_mutex_lock(&kr->lock);
+    if (!kr->keys[index]) {
+        Crypt_KeyringKey* k = (Crypt_KeyringKey*) malloc(sizeof(Crypt_KeyringKey));
+        if (k) {
+            byte keyBytes[CRYPT_MAX_KEY_SIZE];
+            memcpy(keyBytes, entry->key, CRYPT_MAX_KEY_SIZE);
+            k->keyId = keyId;
+            k->keySize = entry->keySize;
+            AES_InitKeyCtx(&k->ctx, keyBytes, NK_BYTES_TO_WORDS(k->keySize));
+            AES_InitKeyCtx(&k->padCtx, keyBytes, CRYPT_PAD_NK);
+            memset(keyBytes, 0, sizeof(keyBytes));
+            kr->keys[index] = k;
+        } else {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+        }
+    }
+    *key = kr->keys[index];
+    pthread_mutex_unlock(&kr->lock);
+    return err;
+}
+
+Crypt_Error_t Crypt_KeyringWrite(const char* fname, const Crypt_KeyringEntry entries[], size_t nEntries) {
+    Crypt_KeyringHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CRYPT_KEYRING_MAGIC, 4);
+    hdr.version = CRYPT_KEYRING_VERSION;
+    hdr.nKeys = (uint32_t) nEntries;
+    hdr.tableSize = 16;
+    while (hdr.tableSize < 2 * nEntries) {
+        hdr.tableSize *= 2;
+    }
+
+    uint32_t* table = (uint32_t*) calloc(hdr.tableSize, sizeof(uint32_t));
+    size_t nameLen = strlen(fname);
+    char* fnameTmp = (char*) malloc(nameLen + 8);
+    if (!table || !fnameTmp) {
+        free(table);
+        free(fnameTmp);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    size_t mask = hdr.tableSize - 1;
+    for (size_t i = 0; i < nEntries; i++) {
+        size_t slot = Crypt_KeyringSlot(entries[i].keyId, hdr.tableSize);
+        while (table[slot] && entries[table[slot] - 1].keyId != entries[i].keyId) {
+            slot = (slot + 1) & mask;
+        }
+        if (table[slot]) {
+            err = CRYPT_E_ARGUMENT;
+            break;
+        }
+        table[slot] = (uint32_t) (i + 1);
+    }
+
+    // write a new file and rename it over the old one (see
+    // Crypt_WriteManifest). mkstemp() gives it a unique name that only
+    // the owner may read
+    memcpy(fnameTmp, fname, nameLen);
+    memcpy(fnameTmp + nameLen, ".XXXXXX", 8);
+    int fd = (err == CRYPT_E_SUCCESS) ? mkstemp(fnameTmp) : -1;
+    FILE* file = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+    if (err == CRYPT_E_SUCCESS && !file) {
+        if (fd >= 0) {
+            close(fd);
+            remove(fnameTmp);
+        }
+        err = CRYPT_E_IO;
+    } else if (file) {
+        if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+            fwrite(table, sizeof(uint32_t), hdr.tableSize, file) != hdr.tableSize ||
+            fwrite(entries, sizeof(Crypt_KeyringEntry), nEntries, file) != nEntries ||
+            fflush(file) != 0 || fdatasync(fileno(file)) != 0) {
+            err = CRYPT_E_IO;
+        }
+        if (fclose(file) != 0) {
+            err = CRYPT_E_IO;
+        }
+        if (err == CRYPT_E_SUCCESS && rename(fnameTmp, fname) != 0) {
+            err = CRYPT_E_IO;
+        }
+        if (err != CRYPT_E_SUCCESS) {
+            remove(fnameTmp);
+        }
+    }
+    free(table);
+    free(fnameTmp);
+    return err;
+}
+
+int Crypt_KeyringLock(const char* fname) {
+    size_t nameLen = strlen(fname);
+    char* fnameLock = (char*) malloc(nameLen + sizeof(CRYPT_KEYRING_LOCK_EXT));
+    if (!fnameLock) {
+        return -1;
+    }
+    memcpy(fnameLock, fname, nameLen);
+    memcpy(fnameLock + nameLen, CRYPT_KEYRING_LOCK_EXT, sizeof(CRYPT_KEYRING_LOCK_EXT));
+    // a separate file, since the keyring itself is replaced by rename()
+    int fd = open(fnameLock, O_RDWR | O_CREAT, 0600);
+    free(fnameLock);
+    if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+Crypt_Error_t Crypt_KeyringMerge(const char* fname, const Crypt_KeyringEntry entries[], size_t nEntries) {
+    int fdLock = Crypt_KeyringLock(fname);
+    if (fdLock < 0) {
+        return CRYPT_E_IO;
+    }
+    Crypt_Keyring kr;
+    Crypt_Error_t err = Crypt_KeyringOpen(&kr, fname);
+    if (err != CRYPT_E_SUCCESS) {
+        close(fdLock);
+        return err;
+    }
+    size_t nOld = kr.hdr ? kr.hdr->nKeys : 0;
+    Crypt_KeyringEntry* all = (Crypt_KeyringEntry*) malloc((nOld + nEntries) * sizeof(Crypt_KeyringEntry) + 1);
+    if (!all) {
+        Crypt_KeyringClose(&kr);
+        close(fdLock);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    if (nOld) {
+        memcpy(all, kr.entries, nOld * sizeof(Crypt_KeyringEntry));
+    }
+    memcpy(all + nOld, entries, nEntries * sizeof(Crypt_KeyringEntry));
+    Crypt_KeyringClose(&kr);
+
+    // Crypt_KeyringWrite rejects ids that are taken
+    err = Crypt_KeyringWrite(fname, all, nOld + nEntries);
+    memset(all, 0, (nOld + nEntries) * sizeof(Crypt_KeyringEntry));
+    free(all);
+    close(fdLock);
+    return err;
+}
+
+Crypt_Error_t Crypt_KeyringAdd(const char* fname, const uint64_t keyIds[], size_t nIds, size_t keySize) {
+    if (keySize != 16 && keySize != 24 && keySize != 32) {
+        return CRYPT_E_ARGUMENT;
+    }
+    Crypt_KeyringEntry* entries = (Crypt_KeyringEntry*) calloc(nIds ? nIds : 1, sizeof(Crypt_KeyringEntry));
+    if (!entries) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    for (size_t i = 0; err == CRYPT_E_SUCCESS && i < nIds; i++) {
+        entries[i].keyId = keyIds[i];
+        entries[i].keySize = (uint8_t) keySize;
+        if (!Crypt_RandomBytes(entries[i].key, keySize)) {
+            err = CRYPT_E_IO;
+        }
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_KeyringMerge(fname, entries, nIds);
+    }
+    memset(entries, 0, nIds * sizeof(Crypt_KeyringEntry));
+    free(entries);
+    return err;
+}
+
+Crypt_Error_t Crypt_KeyringImport(const char* fname, uint64_t keyId, const char* fnameKey) {
+    Crypt_KeyringEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.keyId = keyId;
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, entry.key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    entry.keySize = (uint8_t) keySize;
+    err = Crypt_KeyringMerge(fname, &entry, 1);
+    memset(&entry, 0, sizeof(entry));
+    return err;
+}
+
+Crypt_Error_t Crypt_EncipherChunkedKeyring(const char* fnameIn,
+                                           Crypt_Keyring* kr,
+                                           uint64_t keyId,
+                                           const char* fnameOut,
+                                           uint16_t flags) {
+    const Crypt_KeyringKey* key;
+    Crypt_Error_t err = Crypt_KeyringGetKey(kr, keyId, &key);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
+    FILE* fileOut = fopen(fnameOut, "wb");
+    if (!fileOut) {
+        fclose(fileIn);
+        return CRYPT_E_IO;
+    }
+    Crypt_Header hdr;
+    Crypt_InitHeader(&hdr, key->keySize, (uint16_t) (flags | CRYPT_HDR_KEYID));
+    hdr.keyId = keyId;
+    err = Crypt_EncipherChunkedFile(fileIn, &key->ctx, &hdr, fileOut);
+    fclose(fileIn);
+    if (fclose(fileOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_DecipherChunkedKeyring(const char* fnameIn,
+                                           Crypt_Keyring* kr,
+                                           const char* fnameOut,
+                                           size_t firstByte,
+                                           size_t lastByte,
+                                           uint16_t required,
+                                           size_t nWorkers) {
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
+    Crypt_Header hdr;
+    const Crypt_KeyringKey* key = NULL;
+    Crypt_Error_t err = Crypt_ReadHeader(fileIn, &hdr);
+    if (err == CRYPT_E_SUCCESS && !(hdr.flags & CRYPT_HDR_KEYID)) {
+        // enciphered with a key file
+        err = CRYPT_E_ARGUMENT;
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_KeyringGetKey(kr, hdr.keyId, &key);
+    }
+    FILE* fileOut = NULL;
+    char* fnameTmp = NULL;
+    if (err == CRYPT_E_SUCCESS) {
+        rewind(fileIn);
+        fileOut = Crypt_OpenOutput(fnameOut, &fnameTmp);
+        err = fileOut ? CRYPT_E_SUCCESS : CRYPT_E_IO;
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_DecipherChunkedFile(fileIn, &key->ctx, key->keySize, fileOut, firstByte, lastByte, required,
+                                        nWorkers);
+    }
+    fclose(fileIn);
+    if (fileOut) {
+        err = Crypt_CloseOutput(fileOut, fnameOut, fnameTmp, err);
+    }
+    return err;
+}
+
+#endif  // CC_KEYRING_H_
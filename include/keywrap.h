@@ -0,0 +1,79 @@
+#ifndef CC_KEYWRAP_H_
+#define CC_KEYWRAP_H_
+
+// AES key wrap (RFC 3394): enciphers a key of n 64-bit blocks under a
+// key-encryption key, giving n + 1 blocks. unwrapping checks the
+// integrity of the result, so a wrong key-encryption key or a damaged
+// wrapped key is detected.
+
+#include <string.h>
+
+#include "ciph.h"
+
+// size of the integrity check value prepended to a wrapped key
+#define CRYPT_KEYWRAP_IV_SIZE 8
+
+// wraps the key of keySize bytes (a multiple of 8, at least 16) into
+// wrapped, which receives keySize + CRYPT_KEYWRAP_IV_SIZE bytes
+void Crypt_KeyWrap(const AES_KeyCtx* kek, const byte key[], size_t keySize, byte wrapped[]);
+// unwraps keySize + CRYPT_KEYWRAP_IV_SIZE bytes of wrapped into key.
+// returns CRYPT_E_FORMAT (and clears key) if the integrity check fails
+Crypt_Error_t Crypt_KeyUnwrap(const AES_KeyCtx* kek, const byte wrapped[], size_t keySize, byte key[]);
+
+const byte Crypt_keyWrapIV[CRYPT_KEYWRAP_IV_SIZE] = {0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6};
+
+void Crypt_KeyWrap(const AES_KeyCtx* kek, const byte key[], size_t keySize, byte wrapped[]) {
+    size_t n = keySize / 8;
+    byte block[STATE_SIZE];
+    memcpy(block, Crypt_keyWrapIV, 8);
+    memmove(wrapped + 8, key, keySize);
+
+    // block holds A | R[i]; wrapped + 8 holds R[1..n]
+    for (size_t j = 0; j < 6; j++) {
+        for (size_t i = 1; i <= n; i++) {
+            memcpy(block + 8, wrapped + 8 * i, 8);
+            AES_EncipherBlock(kek, block, block);
+            uint64_t t = (uint64_t) (n * j + i);
+            for (size_t k = 0; k < 8; k++) {
+                block[7 - k] ^= (byte) (t >> (8 * k));
+            }
+            memcpy(wrapped + 8 * i, block + 8, 8);
+        }
+    }
+    memcpy(wrapped, block, 8);
+    memset(block, 0, sizeof(block));
+}
+
+Crypt_Error_t Crypt_KeyUnwrap(const AES_KeyCtx* kek, const byte wrapped[], size_t keySize, byte key[]) {
+    size_t n = keySize / 8;
+    byte block[STATE_SIZE];
+    memcpy(block, wrapped, 8);
+    memmove(key, wrapped + 8, keySize);
+
+    for (size_t j = 6; j-- > 0;) {
+        for (size_t i = n; i >= 1; i--) {
+            uint64_t t = (uint64_t) (n * j + i);
+            for (size_t k = 0; k < 8; k++) {
+                block[7 - k] ^= (byte) (t >> (8 * k));
+            }
+            memcpy(block + 8, key + 8 * (i - 1), 8);
+            AES_DecipherBlock(kek, block, block);
+            memcpy(key + 8 * (i - 1), block + 8, 8);
+        }
+    }
+
+    // compared in full, so the time taken does not depend on where the
+    // first difference is
+    byte diff = 0;
+    for (size_t k = 0; k < 8; k++) {
+        diff |= block[k] ^ Crypt_keyWrapIV[k];
+    }
+    memset(block, 0, sizeof(block));
+    if (diff) {
+        memset(key, 0, keySize);
+        return CRYPT_E_FORMAT;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+#endif  // CC_KEYWRAP_H_
@@ -0,0 +1,346 @@
+#ifndef CC_LOG_H_
+#define CC_LOG_H_
+
+// an append-only writer for chunked containers (see container.h). records
+// are buffered in memory and written as new chunks at the end of the
+// file, so existing ciphertext is never rewritten.
+//
+// appends only copy the record into the pending buffer. a commit makes
+// every byte appended so far durable with a single write and a single
+// fdatasync. commits from several threads are grouped: the first
+// committer becomes the leader and flushes everything pending, while the
+// others wait for it and return without issuing their own sync if the
+// leader's flush already covered their records.
+//
+// chunk headers carry their payload size, so a final chunk torn by a
+// crash is detected on open and cut off (see Crypt_LogRecover). every
+// chunk also carries a checksum of its payload (CRYPT_CHUNK_SUM), and
+// the first chunk of each write is marked (CRYPT_CHUNK_BATCH). only the
+// last write can be torn, since each write is synced before the next
+// one starts, so on open the chunks of the last write are checked and a
+// chunk whose length reached the disk but whose payload did not is cut
+// off as well.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "container.h"
+
+typedef struct {
+    uint64_t appends;  // records appended
+    uint64_t commits;  // calls to Crypt_LogCommit
+    uint64_t syncs;  // calls to fdatasync
+    uint64_t chunks;  // chunks written
+    uint64_t tornBytes;  // bytes of a torn final chunk cut off on open
+} Crypt_LogStats;
+
+typedef struct {
+    int fd;
+    AES_KeyCtx ctx;
+    uint32_t chunkSize;
+    bool compress;
+    // bytes appended but not yet handed to a flush
+    byte* pending;
+    size_t nPending, capPending;
+    // number of bytes appended / made durable since the log was opened
+    uint64_t nAppended, nDurable;
+    // true while a leader is writing (only the leader touches fd)
+    bool flushing;
+    // a flush that failed poisons the log: every later commit fails
+    Crypt_Error_t err;
+    pthread_mutex_t lock;
+    pthread_cond_t flushed;
+    Crypt_LogStats stats;
+} Crypt_Log;
+
+// opens (or creates) the container fname for appending. an existing
+// container must have been written with a key of the same size; a
+// torn final chunk is truncated away (see log->stats.tornBytes)
+Crypt_Error_t Crypt_LogOpen(Crypt_Log* log, const char* fname, const char* fnameKey, uint16_t flags);
+// appends nBytes of data. if seq is not NULL, it receives the value to
+// pass to Crypt_LogCommit to make this record durable
+Crypt_Error_t Crypt_LogAppend(Crypt_Log* log, const byte data[], size_t nBytes, uint64_t* seq);
+// returns once every byte up to seq is durable (pass CRYPT_EOF to
+// commit everything appended so far)
+Crypt_Error_t Crypt_LogCommit(Crypt_Log* log, uint64_t seq);
+// commits all pending records and closes the log
+Crypt_Error_t Crypt_LogClose(Crypt_Log* log);
+
+// truncates fd after the last complete chunk whose payload matches its
+// checksum. returns the number of bytes cut off in *nTorn
+Crypt_Error_t Crypt_LogRecover(int fd, const Crypt_Header* hdr, size_t* nTorn);
+// writes nBytes of data to fd as chunks (called by the commit leader
+// without the lock held)
+Crypt_Error_t Crypt_LogWrite(Crypt_Log* log, const byte data[], size_t nBytes);
+// writes all of buf to fd, retrying on short writes
+Crypt_Error_t Crypt_WriteFd(int fd, const byte buf[], size_t nBytes);
+
+Crypt_Error_t Crypt_WriteFd(int fd, const byte buf[], size_t nBytes) {
+    while (nBytes > 0) {
+        ssize_t n = write(fd, buf, nBytes);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return CRYPT_E_IO;
+        }
+        buf += n;
+        nBytes -= (size_t) n;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_LogRecover(int fd, const Crypt_Header* hdr, size_t* nTorn) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return CRYPT_E_IO;
+    }
+    off_t fsize = st.st_size;
+    off_t offset = (off_t) sizeof(Crypt_Header);
+    // the first chunk of the last write (-1 if no chunk is marked)
+    off_t batch = -1;
+
+    // hop over complete chunks; stop at the first header that is cut
+    // off, invalid, or whose payload extends past the end of the file
+    while (offset < fsize) {
+        Crypt_ChunkHeader chdr;
+        if (pread(fd, &chdr, sizeof(Crypt_ChunkHeader), offset) != (ssize_t) sizeof(Crypt_ChunkHeader)) {
+            break;
+        }
+        bool isHole = chdr.flags & CRYPT_CHUNK_HOLE;
+        if (chdr.rawSize == 0 || (isHole && chdr.dataSize != 0) ||
+            (!isHole && chdr.rawSize > hdr->chunkSize) ||
+            chdr.dataSize > LZ_BOUND(hdr->chunkSize)) {
+            break;
+        }
+        off_t end = offset + (off_t) (sizeof(Crypt_ChunkHeader) + CRYPT_STORED_SIZE(chdr.dataSize));
+        if (end > fsize) {
+            break;
+        }
+        if (chdr.flags & CRYPT_CHUNK_BATCH) {
+            batch = offset;
+        }
+        offset = end;
+    }
+
+    // the payloads of the last write may not have reached the disk
+    byte* payload = (batch >= 0) ? (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(hdr->chunkSize)) : NULL;
+    if (batch >= 0 && !payload) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    for (off_t at = batch; batch >= 0 && at < offset;) {
+        Crypt_ChunkHeader chdr;
+        pread(fd, &chdr, sizeof(Crypt_ChunkHeader), at);
+        size_t storedSize = CRYPT_STORED_SIZE(chdr.dataSize);
+        off_t payloadOffset = at + (off_t) sizeof(Crypt_ChunkHeader);
+        if ((chdr.flags & CRYPT_CHUNK_SUM) &&
+            (pread(fd, payload, storedSize, payloadOffset) != (ssize_t) storedSize ||
+             Crypt_ChunkSum(payload, storedSize) != chdr.reserved)) {
+            offset = at;
+            break;
+        }
+        at = payloadOffset + (off_t) storedSize;
+    }
+    free(payload);
+
+    *nTorn = (size_t) (fsize - offset);
+    if (*nTorn && ftruncate(fd, offset) != 0) {
+        return CRYPT_E_IO;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_LogOpen(Crypt_Log* log, const char* fname, const char* fnameKey, uint16_t flags) {
+    memset(log, 0, sizeof(Crypt_Log));
+
+    // before the log is created
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        log->fd = -1;
+        return err;
+    }
+    AES_InitKeyCtx(&log->ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    log->fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (log->fd < 0) {
+        return CRYPT_E_IO;
+    }
+
+    Crypt_Header hdr;
+    ssize_t nRead = pread(log->fd, &hdr, sizeof(Crypt_Header), 0);
+    if (nRead == 0) {
+        // a new log
+        memset(&hdr, 0, sizeof(Crypt_Header));
+        memcpy(hdr.magic, CRYPT_MAGIC, CRYPT_MAGIC_SIZE);
+        hdr.version = CRYPT_CONTAINER_VERSION;
+        hdr.flags = (uint16_t) (flags & ~CRYPT_HDR_MERKLE);
+        hdr.chunkSize = CRYPT_CHUNK_SIZE;
+        hdr.keySize = (uint8_t) keySize;
+        err = Crypt_WriteFd(log->fd, (const byte*) &hdr, sizeof(Crypt_Header));
+        if (err == CRYPT_E_SUCCESS && fdatasync(log->fd) != 0) {
+            err = CRYPT_E_IO;
+        }
+    } else if (nRead != (ssize_t) sizeof(Crypt_Header) ||
+               memcmp(hdr.magic, CRYPT_MAGIC, CRYPT_MAGIC_SIZE) != 0 ||
+               hdr.version != CRYPT_CONTAINER_VERSION ||
+               hdr.chunkSize == 0 || hdr.chunkSize > CRYPT_MAX_CHUNK_SIZE ||
+               hdr.chunkSize % STATE_SIZE != 0 ||
+               (hdr.flags & CRYPT_HDR_MERKLE)) {
+        // the tree of a container is written once, after its last chunk,
+        // so nothing can be appended to it
+        err = CRYPT_E_FORMAT;
+    } else {
+        // appends go under the data key of a container with a wrapped key
+        err = Crypt_ContainerKey(&hdr, &log->ctx, keySize, &log->ctx);
+    }
+    if (err == CRYPT_E_SUCCESS && nRead != 0) {
+        size_t nTorn = 0;
+        err = Crypt_LogRecover(log->fd, &hdr, &nTorn);
+        log->stats.tornBytes = nTorn;
+    }
+
+    if (err == CRYPT_E_SUCCESS && lseek(log->fd, 0, SEEK_END) < 0) {
+        err = CRYPT_E_IO;
+    }
+    if (err != CRYPT_E_SUCCESS) {
+        close(log->fd);
+        return err;
+    }
+
+    log->chunkSize = hdr.chunkSize;
+    log->compress = hdr.flags & CRYPT_HDR_COMPRESSED;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->flushed, NULL);
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_LogAppend(Crypt_Log* log, const byte data[], size_t nBytes, uint64_t* seq) {
+    pthread_mutex_lock(&log->lock);
+    if (log->nPending + nBytes > log->capPending) {
+        size_t capacity = (log->capPending) ? log->capPending : log->chunkSize;
+        while (capacity < log->nPending + nBytes) {
+            capacity *= 2;
+        }
+        byte* pending = (byte*) realloc(log->pending, capacity);
+        if (!pending) {
+            pthread_mutex_unlock(&log->lock);
+            return CRYPT_E_MEMORY_ALLOCATION;
+        }
+        log->pending = pending;
+        log->capPending = capacity;
+    }
+    memcpy(log->pending + log->nPending, data, nBytes);
+    log->nPending += nBytes;
+    log->nAppended += nBytes;
+    log->stats.appends++;
+    if (seq) {
+        *seq = log->nAppended;
+    }
+    pthread_mutex_unlock(&log->lock);
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_LogWrite(Crypt_Log* log, const byte data[], size_t nBytes) {
+    // every chunk of the batch is enciphered into one buffer, so the
+    // whole batch reaches the file with a single write
+    size_t nChunks = (nBytes + log->chunkSize - 1) / log->chunkSize;
+    size_t chunkBufSize = sizeof(Crypt_ChunkHeader) + CRYPT_PAYLOAD_BUF_SIZE(log->chunkSize);
+    byte* buf = (byte*) malloc(nChunks * chunkBufSize);
+    if (!buf) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+
+    size_t nBuf = 0;
+    CRYPT_TRACE_BEGIN(traceCipher);
+    for (size_t i = 0; i < nChunks; i++) {
+        size_t rawSize = MIN(nBytes - i * log->chunkSize, (size_t) log->chunkSize);
+        Crypt_ChunkHeader chdr;
+        byte* payload = buf + nBuf + sizeof(Crypt_ChunkHeader);
+        Crypt_EncipherChunk(&log->ctx, data + i * log->chunkSize, rawSize, log->compress, &chdr, payload);
+        chdr.flags |= CRYPT_CHUNK_SUM | ((i == 0) ? CRYPT_CHUNK_BATCH : 0);
+        chdr.reserved = Crypt_ChunkSum(payload, CRYPT_STORED_SIZE(chdr.dataSize));
+        memcpy(buf + nBuf, &chdr, sizeof(Crypt_ChunkHeader));
+        nBuf += sizeof(Crypt_ChunkHeader) + CRYPT_STORED_SIZE(chdr.dataSize);
+    }
+    CRYPT_TRACE_END(traceCipher, CRYPT_SPAN_CIPHER);
+
+    CRYPT_TRACE_BEGIN(traceWrite);
+    Crypt_Error_t err = Crypt_WriteFd(log->fd, buf, nBuf);
+    CRYPT_TRACE_END(traceWrite, CRYPT_SPAN_WRITE);
+    free(buf);
+    CRYPT_TRACE_BEGIN(traceSync);
+    if (err == CRYPT_E_SUCCESS && fdatasync(log->fd) != 0) {
+        err = CRYPT_E_IO;
+    }
+    CRYPT_TRACE_END(traceSync, CRYPT_SPAN_SYNC);
+    log->stats.chunks += nChunks;
+    log->stats.syncs++;
+    return err;
+}
+
+Crypt_Error_t Crypt_LogCommit(Crypt_Log* log, uint64_t seq) {
+    pthread_mutex_lock(&log->lock);
+    log->stats.commits++;
+    if (seq > log->nAppended) {
+        seq = log->nAppended;
+    }
+
+    while (log->err == CRYPT_E_SUCCESS && log->nDurable < seq) {
+        if (log->flushing) {
+            // another thread is flushing; its batch may cover seq
+            pthread_cond_wait(&log->flushed, &log->lock);
+            continue;
+        }
+
+        // become the leader: take everything pending, including records
+        // appended by threads that are still waiting to commit
+        byte* batch = log->pending;
+        size_t nBatch = log->nPending;
+        uint64_t batchEnd = log->nAppended;
+        log->pending = NULL;
+        log->nPending = log->capPending = 0;
+        log->flushing = true;
+        pthread_mutex_unlock(&log->lock);
+
+        Crypt_Error_t err = Crypt_LogWrite(log, batch, nBatch);
+        free(batch);
+
+        pthread_mutex_lock(&log->lock);
+        log->flushing = false;
+        if (err != CRYPT_E_SUCCESS) {
+            log->err = err;
+        } else {
+            log->nDurable = batchEnd;
+        }
+        pthread_cond_broadcast(&log->flushed);
+    }
+
+    Crypt_Error_t err = log->err;
+    pthread_mutex_unlock(&log->lock);
+    return err;
+}
+
+Crypt_Error_t Crypt_LogClose(Crypt_Log* log) {
+    Crypt_Error_t err = Crypt_LogCommit(log, CRYPT_EOF);
+    if (close(log->fd) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    free(log->pending);
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->flushed);
+    return err;
+}
+
+#endif  // CC_LOG_H_
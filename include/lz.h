@@ -0,0 +1,217 @@
+#ifndef CC_LZ_H_
+#define CC_LZ_H_
+
+// a self-contained LZ77 block compressor using the LZ4 block format:
+// each sequence is a token byte (high nibble: number of literals, low
+// nibble: match length - LZ_MIN_MATCH), optional length extension bytes,
+// the literals, a 2-byte little-endian match offset, and optional match
+// length extension bytes. the final sequence has literals only.
+// compression uses a single hash table probe per position, which keeps
+// it fast at the cost of some ratio.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_LOG 12
+#define LZ_MAX_OFFSET 65535
+// the last LZ_LAST_LITERALS bytes are always literals, and no match
+// starts within the last LZ_MF_LIMIT bytes of the input
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+// largest compressed size of n input bytes (incompressible input)
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+// returned by LZ_Decompress for malformed input
+#define LZ_ERROR ((size_t) -1)
+
+// compresses nIn bytes of input into out. returns the number of
+// compressed bytes, or 0 if the result would not fit in outCap bytes
+size_t LZ_Compress(const byte in[], size_t nIn, byte out[], size_t outCap);
+// returns the number of decompressed bytes, or LZ_ERROR if the input
+// is malformed or does not fit in outCap bytes
+size_t LZ_Decompress(const byte in[], size_t nIn, byte out[], size_t outCap);
+
+// internal helpers
+uint32_t LZ_Read32(const byte* p);
+uint32_t LZ_Hash(uint32_t sequence);
+// writes the extension bytes of a length >= 15; returns 0 if out of space
+int LZ_WriteLength(byte** op, const byte* oend, size_t len);
+
+uint32_t LZ_Read32(const byte* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t LZ_Hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+int LZ_WriteLength(byte** op, const byte* oend, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (*op >= oend) {
+            return 0;
+        }
+        *(*op)++ = 255;
+    }
+    if (*op >= oend) {
+        return 0;
+    }
+    *(*op)++ = (byte) len;
+    return 1;
+}
+
+size_t LZ_Compress(const byte in[], size_t nIn, byte out[], size_t outCap) {
+    // position + 1 of the last occurrence of each hashed 4-byte sequence
+    // (0 means the slot is empty)
+    uint32_t table[1 << LZ_HASH_LOG];
+    memset(table, 0, sizeof(table));
+
+    byte* op = out;
+    const byte* oend = out + outCap;
+    size_t anchor = 0;  // start of the pending literals
+    size_t ip = 0;
+
+    if (nIn >= LZ_MF_LIMIT) {
+        size_t limit = nIn - LZ_MF_LIMIT;
+        size_t matchLimit = nIn - LZ_LAST_LITERALS;
+        while (ip <= limit) {
+            uint32_t sequence = LZ_Read32(in + ip);
+            uint32_t h = LZ_Hash(sequence);
+            size_t ref = table[h];
+            table[h] = (uint32_t) (ip + 1);
+
+            if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || LZ_Read32(in + ref - 1) != sequence) {
+                // no match: skip ahead faster the longer we go without one
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            ref--;
+
+            size_t matchLen = LZ_MIN_MATCH;
+            while (ip + matchLen < matchLimit && in[ref + matchLen] == in[ip + matchLen]) {
+                matchLen++;
+            }
+
+            // emit the sequence
+            size_t litLen = ip - anchor;
+            if (op >= oend) {
+                return 0;
+            }
+            byte* token = op++;
+            *token = (byte) (((litLen >= 15) ? 15 : litLen) << 4);
+            if (litLen >= 15 && !LZ_WriteLength(&op, oend, litLen - 15)) {
+                return 0;
+            }
+            if ((size_t) (oend - op) < litLen + 2) {
+                return 0;
+            }
+            memcpy(op, in + anchor, litLen);
+            op += litLen;
+            size_t offset = ip - ref;
+            *op++ = (byte) offset;
+            *op++ = (byte) (offset >> 8);
+            size_t mLen = matchLen - LZ_MIN_MATCH;
+            *token |= (byte) ((mLen >= 15) ? 15 : mLen);
+            if (mLen >= 15 && !LZ_WriteLength(&op, oend, mLen - 15)) {
+                return 0;
+            }
+
+            ip += matchLen;
+            anchor = ip;
+            // index a position inside the match so the next sequence
+            // has a better chance of finding a nearby match
+            if (ip - 2 <= limit) {
+                table[LZ_Hash(LZ_Read32(in + ip - 2))] = (uint32_t) (ip - 2 + 1);
+            }
+        }
+    }
+
+    // the final sequence holds the remaining literals
+    size_t litLen = nIn - anchor;
+    if (op >= oend) {
+        return 0;
+    }
+    byte* token = op++;
+    *token = (byte) (((litLen >= 15) ? 15 : litLen) << 4);
+    if (litLen >= 15 && !LZ_WriteLength(&op, oend, litLen - 15)) {
+        return 0;
+    }
+    if ((size_t) (oend - op) < litLen) {
+        return 0;
+    }
+    memcpy(op, in + anchor, litLen);
+    op += litLen;
+    return (size_t) (op - out);
+}
+
+size_t LZ_Decompress(const byte in[], size_t nIn, byte out[], size_t outCap) {
+    const byte* ip = in;
+    const byte* iend = in + nIn;
+    byte* op = out;
+    const byte* oend = out + outCap;
+
+    while (ip < iend) {
+        byte token = *ip++;
+
+        size_t litLen = token >> 4;
+        if (litLen == 15) {
+            byte b;
+            do {
+                if (ip >= iend) {
+                    return LZ_ERROR;
+                }
+                b = *ip++;
+                litLen += b;
+            } while (b == 255);
+        }
+        if ((size_t) (iend - ip) < litLen || (size_t) (oend - op) < litLen) {
+            return LZ_ERROR;
+        }
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        if (ip == iend) {
+            // the final sequence has no match
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return LZ_ERROR;
+        }
+        size_t offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - out)) {
+            return LZ_ERROR;
+        }
+
+        size_t matchLen = token & 0x0f;
+        if (matchLen == 15) {
+            byte b;
+            do {
+                if (ip >= iend) {
+                    return LZ_ERROR;
+                }
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += LZ_MIN_MATCH;
+        if ((size_t) (oend - op) < matchLen) {
+            return LZ_ERROR;
+        }
+
+        // the match may overlap the bytes it produces, so copy bytewise
+        const byte* match = op - offset;
+        for (size_t i = 0; i < matchLen; i++) {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+    return (size_t) (op - out);
+}
+
+#endif  // CC_LZ_H_
@@ -0,0 +1,247 @@
+#ifndef CC_MERKLE_H_
+#define CC_MERKLE_H_
+
+// a Merkle tree of chunk tags, so each chunk of a container can be
+// authenticated on its own (see CRYPT_HDR_MERKLE in container.h).
+//
+// - the leaves are HMAC-SHA256 tags over the index of a chunk, its
+//   chunk header and its stored (enciphered) payload, so checking a
+//   chunk needs no deciphering, and chunks cannot be moved around.
+// - a parent is SHA-256(0x01 || left || right). a node without a
+//   sibling moves up a level unchanged.
+// - the root tag is an HMAC over the number of leaves, the bound bytes
+//   the tree is built for (the container header) and the top node, so a
+//   tree over fewer chunks, under another header, or from another
+//   container, fails.
+//
+// the MAC key is derived with HMAC from the key the chunks are
+// enciphered with (see Crypt_SubKey), never with the cipher itself.
+// the tree is stored level by level, leaves first; the root tag is kept
+// apart from it (in the container header, see container.h). to check
+// one leaf, only its path of siblings up to the top is hashed, and the
+// top is checked against the root tag once.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ciph.h"
+
+#define CRYPT_MERKLE_TAG_SIZE SHA256_DIGEST_SIZE
+#define CRYPT_MERKLE_KEY_SIZE SHA256_DIGEST_SIZE
+
+// collects the leaf tags of a tree while its chunks are written
+typedef struct {
+    byte macKey[CRYPT_MERKLE_KEY_SIZE];
+    byte* leaves;
+    size_t nLeaves, capacity;
+    byte root[CRYPT_MERKLE_TAG_SIZE];  // the root tag, set by Crypt_MerkleFinish
+} Crypt_Merkle;
+
+// number of nodes of a tree over nLeaves leaves, over all levels
+size_t Crypt_MerkleNodes(size_t nLeaves);
+// number of bytes of a stored tree (its nodes, without the root tag)
+size_t Crypt_MerkleSize(size_t nLeaves);
+// derives the MAC key from the key of the schedule the chunks are
+// enciphered with
+void Crypt_MerkleKey(const AES_KeyCtx* ctx, byte macKey[]);
+// computes the tag of leaf i over a chunk header and its payload
+void Crypt_MerkleLeaf(const byte macKey[],
+                      uint64_t i,
+                      const void* chdr,
+                      size_t hdrSize,
+                      const byte payload[],
+                      size_t payloadSize,
+                      byte tag[]);
+// fills in the levels above the nLeaves leaves at the start of tree,
+// which holds Crypt_MerkleSize bytes, and sets root to the root tag over
+// them and the boundSize bytes of bound
+void Crypt_MerkleBuild(const byte macKey[], byte tree[], size_t nLeaves, const void* bound, size_t boundSize,
+                       byte root[]);
+// checks the root tag of a stored tree built for bound
+bool Crypt_MerkleCheckRoot(const byte macKey[], const byte tree[], size_t nLeaves, const void* bound, size_t boundSize,
+                           const byte root[]);
+// checks that leaf i has the given tag, hashing its path up to the top
+// of a tree whose root tag was checked
+bool Crypt_MerkleCheckLeaf(const byte tree[], size_t nLeaves, size_t i, const byte tag[]);
+
+void Crypt_MerkleInit(Crypt_Merkle* m, const AES_KeyCtx* ctx);
+// adds the tag of the next chunk
+Crypt_Error_t Crypt_MerkleAdd(Crypt_Merkle* m, const void* chdr, size_t hdrSize, const byte payload[], size_t payloadSize);
+// builds the tree for bound in m->leaves, which then holds
+// Crypt_MerkleSize(m->nLeaves) bytes, and its root tag in m->root
+Crypt_Error_t Crypt_MerkleFinish(Crypt_Merkle* m, const void* bound, size_t boundSize);
+void Crypt_MerkleFree(Crypt_Merkle* m);
+
+// internal helpers
+void Crypt_MerkleParent(const byte left[], const byte right[], byte parent[]);
+void Crypt_MerkleRootTag(const byte macKey[],
+                         const byte top[],
+                         size_t nLeaves,
+                         const void* bound,
+                         size_t boundSize,
+                         byte tag[]);
+
+size_t Crypt_MerkleNodes(size_t nLeaves) {
+    size_t nNodes = nLeaves;
+    for (size_t n = nLeaves; n > 1; n = (n + 1) / 2) {
+        nNodes += (n + 1) / 2;
+    }
+    return nNodes;
+}
+
+size_t Crypt_MerkleSize(size_t nLeaves) {
+    return Crypt_MerkleNodes(nLeaves) * CRYPT_MERKLE_TAG_SIZE;
+}
+
+void Crypt_MerkleKey(const AES_KeyCtx* ctx, byte macKey[]) {
+    Crypt_SubKey(ctx, "ciph merkle key", macKey);
+}
+
+void Crypt_MerkleLeaf(const byte macKey[],
+                      uint64_t i,
+                      const void* chdr,
+                      size_t hdrSize,
+                      const byte payload[],
+                      size_t payloadSize,
+                      byte tag[]) {
+    SHA256_HmacCtx ctx;
+    SHA256_HmacInit(&ctx, macKey, CRYPT_MERKLE_KEY_SIZE);
+    SHA256_HmacUpdate(&ctx, (const byte*) &i, sizeof(i));
+    SHA256_HmacUpdate(&ctx, (const byte*) chdr, hdrSize);
+    SHA256_HmacUpdate(&ctx, payload, payloadSize);
+    SHA256_HmacFinal(&ctx, tag);
+}
+
+void Crypt_MerkleParent(const byte left[], const byte right[], byte parent[]) {
+    const byte prefix = 0x01;
+    SHA256_Ctx ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &prefix, 1);
+    SHA256_Update(&ctx, left, CRYPT_MERKLE_TAG_SIZE);
+    SHA256_Update(&ctx, right, CRYPT_MERKLE_TAG_SIZE);
+    SHA256_Final(&ctx, parent);
+}
+
+void Crypt_MerkleRootTag(const byte macKey[],
+                         const byte top[],
+                         size_t nLeaves,
+                         const void* bound,
+                         size_t boundSize,
+                         byte tag[]) {
+    uint64_t n = nLeaves;
+    SHA256_HmacCtx ctx;
+    SHA256_HmacInit(&ctx, macKey, CRYPT_MERKLE_KEY_SIZE);
+    SHA256_HmacUpdate(&ctx, (const byte*) &n, sizeof(n));
+    SHA256_HmacUpdate(&ctx, (const byte*) bound, boundSize);
+    SHA256_HmacUpdate(&ctx, top, CRYPT_MERKLE_TAG_SIZE);
+    SHA256_HmacFinal(&ctx, tag);
+}
+
+void Crypt_MerkleBuild(const byte macKey[], byte tree[], size_t nLeaves, const void* bound, size_t boundSize,
+                       byte root[]) {
+    byte* level = tree;
+    for (size_t n = nLeaves; n > 1; n = (n + 1) / 2) {
+        byte* next = level + n * CRYPT_MERKLE_TAG_SIZE;
+        for (size_t i = 0; i + 1 < n; i += 2) {
+            Crypt_MerkleParent(level + i * CRYPT_MERKLE_TAG_SIZE, level + (i + 1) * CRYPT_MERKLE_TAG_SIZE,
+                               next + i / 2 * CRYPT_MERKLE_TAG_SIZE);
+        }
+        if (n % 2) {
+            memcpy(next + n / 2 * CRYPT_MERKLE_TAG_SIZE, level + (n - 1) * CRYPT_MERKLE_TAG_SIZE, CRYPT_MERKLE_TAG_SIZE);
+        }
+        level = next;
+    }
+
+    // the top node of an empty tree is all zeros
+    byte top[CRYPT_MERKLE_TAG_SIZE];
+    memset(top, 0, sizeof(top));
+    size_t nNodes = Crypt_MerkleNodes(nLeaves);
+    if (nNodes) {
+        memcpy(top, tree + (nNodes - 1) * CRYPT_MERKLE_TAG_SIZE, sizeof(top));
+    }
+    Crypt_MerkleRootTag(macKey, top, nLeaves, bound, boundSize, root);
+}
+
+bool Crypt_MerkleCheckRoot(const byte macKey[], const byte tree[], size_t nLeaves, const void* bound, size_t boundSize,
+                           const byte root[]) {
+    byte top[CRYPT_MERKLE_TAG_SIZE];
+    memset(top, 0, sizeof(top));
+    size_t nNodes = Crypt_MerkleNodes(nLeaves);
+    if (nNodes) {
+        memcpy(top, tree + (nNodes - 1) * CRYPT_MERKLE_TAG_SIZE, sizeof(top));
+    }
+    byte tag[CRYPT_MERKLE_TAG_SIZE];
+    Crypt_MerkleRootTag(macKey, top, nLeaves, bound, boundSize, tag);
+    // constant time, like Crypt_KeyUnwrap
+    byte diff = 0;
+    for (size_t i = 0; i < CRYPT_MERKLE_TAG_SIZE; i++) {
+        diff |= tag[i] ^ root[i];
+    }
+    return diff == 0;
+}
+
+bool Crypt_MerkleCheckLeaf(const byte tree[], size_t nLeaves, size_t i, const byte tag[]) {
+    if (i >= nLeaves) {
+        return false;
+    }
+    byte node[CRYPT_MERKLE_TAG_SIZE];
+    memcpy(node, tag, sizeof(node));
+    const byte* level = tree;
+    for (size_t n = nLeaves; n > 1; n = (n + 1) / 2, i /= 2) {
+        if (i % 2) {
+            Crypt_MerkleParent(level + (i - 1) * CRYPT_MERKLE_TAG_SIZE, node, node);
+        } else if (i + 1 < n) {
+            Crypt_MerkleParent(node, level + (i + 1) * CRYPT_MERKLE_TAG_SIZE, node);
+        }
+        level += n * CRYPT_MERKLE_TAG_SIZE;
+    }
+    // level now points at the top node
+    byte diff = 0;
+    for (size_t j = 0; j < CRYPT_MERKLE_TAG_SIZE; j++) {
+        diff |= node[j] ^ level[j];
+    }
+    return diff == 0;
+}
+
+void Crypt_MerkleInit(Crypt_Merkle* m, const AES_KeyCtx* ctx) {
+    memset(m, 0, sizeof(Crypt_Merkle));
+    Crypt_MerkleKey(ctx, m->macKey);
+}
+
+Crypt_Error_t Crypt_MerkleAdd(Crypt_Merkle* m, const void* chdr, size_t hdrSize, const byte payload[], size_t payloadSize) {
+    if (m->nLeaves == m->capacity) {
+        size_t capacity = (m->capacity) ? 2 * m->capacity : 64;
+        byte* leaves = (byte*) realloc(m->leaves, capacity * CRYPT_MERKLE_TAG_SIZE);
+        if (!leaves) {
+            return CRYPT_E_MEMORY_ALLOCATION;
+        }
+        m->leaves = leaves;
+        m->capacity = capacity;
+    }
+    Crypt_MerkleLeaf(m->macKey, m->nLeaves, chdr, hdrSize, payload, payloadSize,
+                     m->leaves + m->nLeaves * CRYPT_MERKLE_TAG_SIZE);
+    m->nLeaves++;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_MerkleFinish(Crypt_Merkle* m, const void* bound, size_t boundSize) {
+    // an empty tree has no nodes, but still gets a root tag
+    size_t treeSize = Crypt_MerkleSize(m->nLeaves);
+    byte* tree = (byte*) realloc(m->leaves, (treeSize) ? treeSize : 1);
+    if (!tree) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    m->leaves = tree;
+    m->capacity = m->nLeaves;
+    Crypt_MerkleBuild(m->macKey, m->leaves, m->nLeaves, bound, boundSize, m->root);
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_MerkleFree(Crypt_Merkle* m) {
+    free(m->leaves);
+    memset(m, 0, sizeof(Crypt_Merkle));
+}
+
+#endif  // CC_MERKLE_H_
@@ -0,0 +1,304 @@
+#ifndef CC_POOL_H_
+#define CC_POOL_H_
+
+// a work-stealing thread pool. every worker owns a deque of tasks: it
+// pushes and pops its own tasks at the bottom (newest first, so the
+// parts of a job that a worker split up stay on that worker while they
+// are warm), and idle workers steal from the top of other deques
+// (oldest first, so a thief takes the largest remaining piece of work).
+//
+// tasks submitted from outside the pool are spread over the deques
+// round robin; tasks submitted by a task go to the deque of the worker
+// running it.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ciph.h"
+
+// initial number of tasks a deque can hold (doubled when it fills up)
+#define CRYPT_DEQUE_INIT_SIZE 64
+
+typedef void (*Crypt_TaskFn)(void* arg);
+
+typedef struct {
+    Crypt_TaskFn fn;
+    void* arg;
+} Crypt_Task;
+
+typedef struct {
+    // tasks[top % capacity] .. tasks[(bottom - 1) % capacity]
+    Crypt_Task* tasks;
+    size_t capacity;
+    size_t top, bottom;
+    pthread_mutex_t lock;
+} Crypt_Deque;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t executed;
+    uint64_t steals;  // tasks taken from another worker's deque
+} Crypt_PoolStats;
+
+typedef struct Crypt_Pool {
+    size_t nWorkers;
+    size_t nStarted;  // threads that were started successfully
+    pthread_t* threads;
+    Crypt_Deque* deques;
+    // deque that receives the next task submitted from outside the pool
+    size_t nextDeque;
+    // tasks sitting in deques / tasks submitted but not finished
+    size_t nQueued, nPending;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t idle;
+    Crypt_PoolStats stats;
+} Crypt_Pool;
+
+// starts nWorkers threads (at least one). returns NULL on failure
+Crypt_Pool* Crypt_PoolNew(size_t nWorkers);
+// queues fn(arg) to run on one of the workers
+Crypt_Error_t Crypt_PoolSubmit(Crypt_Pool* pool, Crypt_TaskFn fn, void* arg);
+// returns once every submitted task (including the tasks they
+// submitted) has finished
+void Crypt_PoolWait(Crypt_Pool* pool);
+// waits for all tasks, then stops the workers and frees the pool
+void Crypt_PoolFree(Crypt_Pool* pool);
+
+// internal helpers
+bool Crypt_DequePush(Crypt_Deque* deque, Crypt_TaskFn fn, void* arg);
+bool Crypt_DequePop(Crypt_Deque* deque, Crypt_Task* task);
+bool Crypt_DequeSteal(Crypt_Deque* deque, Crypt_Task* task);
+void* Crypt_PoolWorker(void* arg);
+
+// the pool and worker index of the calling thread (NULL outside workers)
+__thread Crypt_Pool* Crypt_poolSelf = NULL;
+__thread size_t Crypt_poolWorker = 0;
+
+typedef struct {
+    Crypt_Pool* pool;
+    size_t index;
+} Crypt_WorkerArg;
+
+bool Crypt_DequePush(Crypt_Deque* deque, Crypt_TaskFn fn, void* arg) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        // grow, unwrapping the ring into the new array
+        size_t capacity = deque->capacity * 2;
+        Crypt_Task* tasks = (Crypt_Task*) malloc(capacity * sizeof(Crypt_Task));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (size_t i = deque->top; i < deque->bottom; i++) {
+            tasks[i - deque->top] = deque->tasks[i % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->bottom -= deque->top;
+        deque->top = 0;
+        deque->capacity = capacity;
+    }
+    Crypt_Task* task = &deque->tasks[deque->bottom % deque->capacity];
+    task->fn = fn;
+    task->arg = arg;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+bool Crypt_DequePop(Crypt_Deque* deque, Crypt_Task* task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->bottom > deque->top;
+    if (found) {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+bool Crypt_DequeSteal(Crypt_Deque* deque, Crypt_Task* task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->bottom > deque->top;
+    if (found) {
+        *task = deque->tasks[deque->top % deque->capacity];
+        deque->top++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+void* Crypt_PoolWorker(void* arg) {
+    Crypt_WorkerArg* workerArg = (Crypt_WorkerArg*) arg;
+    Crypt_Pool* pool = workerArg->pool;
+    size_t self = workerArg->index;
+    free(workerArg);
+    Crypt_poolSelf = pool;
+    Crypt_poolWorker = self;
+
+    for (;;) {
+        Crypt_Task task;
+        bool stolen = false;
+        bool found = Crypt_DequePop(&pool->deques[self], &task);
+        for (size_t i = 1; !found && i < pool->nWorkers; i++) {
+            found = stolen = Crypt_DequeSteal(&pool->deques[(self + i) % pool->nWorkers], &task);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (!found) {
+            // nothing to do: sleep until a task is queued. nQueued is
+            // only changed under the lock, so no wakeup is missed. it
+            // counts a task just before the push, so a worker may spin
+            // briefly until the task shows up in a deque
+            while (pool->nQueued == 0 && !pool->stop) {
+                pthread_cond_wait(&pool->workAvailable, &pool->lock);
+            }
+            bool stop = pool->nQueued == 0 && pool->stop;
+            pthread_mutex_unlock(&pool->lock);
+            if (stop) {
+                break;
+            }
+            continue;
+        }
+        pool->nQueued--;
+        if (stolen) {
+            pool->stats.steals++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.executed++;
+        pool->nPending--;
+        if (pool->nPending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+Crypt_Pool* Crypt_PoolNew(size_t nWorkers) {
+    if (nWorkers == 0) {
+        nWorkers = 1;
+    }
+    Crypt_Pool* pool = (Crypt_Pool*) calloc(1, sizeof(Crypt_Pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->threads = (pthread_t*) calloc(nWorkers, sizeof(pthread_t));
+    pool->deques = (Crypt_Deque*) calloc(nWorkers, sizeof(Crypt_Deque));
+    if (!pool->threads || !pool->deques) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workAvailable, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (size_t i = 0; i < nWorkers; i++) {
+        pool->deques[i].capacity = CRYPT_DEQUE_INIT_SIZE;
+        pool->deques[i].tasks = (Crypt_Task*) malloc(CRYPT_DEQUE_INIT_SIZE * sizeof(Crypt_Task));
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        if (!pool->deques[i].tasks) {
+            pool->nWorkers = i + 1;
+            Crypt_PoolFree(pool);
+            return NULL;
+        }
+    }
+
+    // workers are counted as they start, so a failed start can be
+    // cleaned up by stopping the ones that are already running
+    pool->nWorkers = nWorkers;
+    for (size_t i = 0; i < nWorkers; i++) {
+        Crypt_WorkerArg* arg = (Crypt_WorkerArg*) malloc(sizeof(Crypt_WorkerArg));
+        if (arg) {
+            arg->pool = pool;
+            arg->index = i;
+        }
+        if (!arg || pthread_create(&pool->threads[i], NULL, Crypt_PoolWorker, arg) != 0) {
+            free(arg);
+            Crypt_PoolFree(pool);
+            return NULL;
+        }
+        pool->nStarted++;
+    }
+    return pool;
+}
+
+Crypt_Error_t Crypt_PoolSubmit(Crypt_Pool* pool, Crypt_TaskFn fn, void* arg) {
+    size_t target;
+    if (Crypt_poolSelf == pool) {
+        target = Crypt_poolWorker;
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        target = pool->nextDeque;
+        pool->nextDeque = (pool->nextDeque + 1) % pool->nWorkers;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    // counted as pending and queued before it is visible, so a wait
+    // cannot return between the push and the count, and a worker that
+    // takes the task at once cannot decrement nQueued below zero
+    pthread_mutex_lock(&pool->lock);
+    pool->nPending++;
+    pool->nQueued++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!Crypt_DequePush(&pool->deques[target], fn, arg)) {
+        pthread_mutex_lock(&pool->lock);
+        pool->nQueued--;
+        pool->nPending--;
+        if (pool->nPending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.submitted++;
+    pthread_cond_signal(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->lock);
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_PoolWait(Crypt_Pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->nPending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void Crypt_PoolFree(Crypt_Pool* pool) {
+    Crypt_PoolWait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->nStarted; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (size_t i = 0; i < pool->nWorkers; i++) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workAvailable);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool->deques);
+    free(pool);
+}
+
+#endif  // CC_POOL_H_
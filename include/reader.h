@@ -0,0 +1,493 @@
+#ifndef CC_READER_H_
+#define CC_READER_H_
+
+// random-access reads of enciphered files, backed by a bounded cache
+// of deciphered chunks. a reader interprets its file the same way
+// Crypt_DecipherRange does: bytes before firstByte and after lastByte
+// are plaintext, and the range in between holds ECB blocks whose final
+// block carries the padding.
+//
+// the enciphered range is split into chunks of CRYPT_CHUNK_SIZE
+// ciphertext bytes. a chunk is read and deciphered once, then served
+// from the cache until it is evicted. a cache may be shared by several
+// readers; entries are keyed by (file id, chunk number), where the file
+// id is assigned to each reader when it is opened.
+//
+// NOTE: neither the cache nor the readers are thread-safe
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "ciph.h"
+
+// marks the end of a list / hash chain of cache entries
+#define CRYPT_CACHE_NIL ((size_t) -1)
+// default (maximum) number of chunks read ahead on sequential access
+#define CRYPT_READAHEAD_CHUNKS 8
+
+typedef enum {
+    CRYPT_EVICT_LRU,  // evict the least recently used chunk
+    CRYPT_EVICT_FIFO  // evict the least recently inserted chunk
+} Crypt_EvictPolicy_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // chunks loaded speculatively because of sequential access
+    uint64_t readahead;
+} Crypt_CacheStats;
+
+typedef struct {
+    uint64_t fileId;
+    size_t chunk;
+    // number of valid (deciphered, non-padding) bytes in data
+    size_t nBytes;
+    byte* data;
+    // links in the recency list (head is the most recently used)
+    size_t prev, next;
+    // link in the hash chain of the entry's bucket
+    size_t hnext;
+} Crypt_CacheEntry;
+
+typedef struct {
+    Crypt_EvictPolicy_t policy;
+    size_t capacity;  // max number of chunks held
+    size_t nEntries;
+    Crypt_CacheEntry* entries;
+    byte* pool;  // capacity * CRYPT_CHUNK_SIZE bytes of chunk data
+    size_t* buckets;
+    size_t nBuckets;
+    size_t head, tail;
+    // unused entries, linked through hnext
+    size_t freeList;
+    uint64_t nextFileId;
+    Crypt_CacheStats stats;
+} Crypt_Cache;
+
+typedef struct {
+    FILE* file;
+    Crypt_Cache* cache;
+    uint64_t fileId;
+    AES_KeyCtx keyCtx;
+    // schedule for the padded final block (see CRYPT_PAD_NK)
+    AES_KeyCtx padCtx;
+    // the enciphered range of the file (ciphertext offsets)
+    size_t firstByte, lastByte;
+    size_t fsize;  // size of the enciphered file
+    byte nPad;  // number of padding bytes in the final block
+    size_t nChunks;  // number of chunks in the enciphered range
+    // readahead state: the previously requested chunk, the current
+    // window and its upper bound (0 disables readahead)
+    size_t lastChunk;
+    size_t window;
+    size_t maxReadahead;
+    byte* ioBuf;  // maxReadahead chunks of ciphertext
+} Crypt_Reader;
+
+// returns NULL if memory allocation fails or nChunks == 0
+Crypt_Cache* Crypt_CacheNew(size_t nChunks, Crypt_EvictPolicy_t policy);
+void Crypt_CacheFree(Crypt_Cache* cache);
+// returns the entry holding the given chunk or NULL on a miss
+// (updates the hit / miss counters and the recency order)
+Crypt_CacheEntry* Crypt_CacheLookup(Crypt_Cache* cache, uint64_t fileId, size_t chunk);
+// returns an empty entry for the given chunk, evicting another entry
+// if the cache is full. the caller fills in data and nBytes
+Crypt_CacheEntry* Crypt_CacheInsert(Crypt_Cache* cache, uint64_t fileId, size_t chunk);
+// drops every chunk of the given file
+void Crypt_CacheInvalidate(Crypt_Cache* cache, uint64_t fileId);
+
+// opens fnameIn for reading with the same range semantics as
+// Crypt_DecipherRange, setting *reader. returns the error from loading
+// the key, CRYPT_E_IO if the file cannot be opened or read,
+// CRYPT_E_FORMAT if the range or its padding is malformed, or
+// CRYPT_E_MEMORY_ALLOCATION, leaving *reader NULL
+Crypt_Error_t Crypt_ReaderOpen(const char* fnameIn,
+                               const char* fnameKey,
+                               Crypt_Cache* cache,
+                               size_t firstByte,
+                               size_t lastByte,
+                               Crypt_Reader** reader);
+// reads up to nBytes deciphered bytes starting at offset (in the
+// deciphered file) into buf, returning the number of bytes read
+size_t Crypt_ReaderRead(Crypt_Reader* reader, size_t offset, byte buf[], size_t nBytes);
+// returns the size of the deciphered file
+size_t Crypt_ReaderSize(const Crypt_Reader* reader);
+// sets the largest readahead window in chunks (0 disables readahead)
+void Crypt_ReaderSetReadahead(Crypt_Reader* reader, size_t nChunks);
+void Crypt_ReaderClose(Crypt_Reader* reader);
+
+// internal helpers
+size_t Crypt_CacheBucket(const Crypt_Cache* cache, uint64_t fileId, size_t chunk);
+// like Crypt_CacheLookup, but does not count as an access
+size_t Crypt_CacheFind(const Crypt_Cache* cache, uint64_t fileId, size_t chunk);
+void Crypt_CacheUnlink(Crypt_Cache* cache, size_t i);
+void Crypt_CachePushFront(Crypt_Cache* cache, size_t i);
+void Crypt_CacheRemove(Crypt_Cache* cache, size_t i);
+Crypt_CacheEntry* Crypt_ReaderLoad(Crypt_Reader* reader, size_t chunk);
+
+Crypt_Cache* Crypt_CacheNew(size_t nChunks, Crypt_EvictPolicy_t policy) {
+    if (nChunks == 0) {
+        return NULL;
+    }
+
+    Crypt_Cache* cache = (Crypt_Cache*) calloc(1, sizeof(Crypt_Cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->policy = policy;
+    cache->capacity = nChunks;
+    // keep the load factor of the hash table at or below 1/2
+    cache->nBuckets = 2 * nChunks;
+    cache->entries = (Crypt_CacheEntry*) malloc(nChunks * sizeof(Crypt_CacheEntry));
+    cache->pool = (byte*) malloc(nChunks * CRYPT_CHUNK_SIZE);
+    cache->buckets = (size_t*) malloc(cache->nBuckets * sizeof(size_t));
+    if (!cache->entries || !cache->pool || !cache->buckets) {
+        Crypt_CacheFree(cache);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nChunks; i++) {
+        cache->entries[i].data = cache->pool + i * CRYPT_CHUNK_SIZE;
+        cache->entries[i].hnext = (i + 1 < nChunks) ? i + 1 : CRYPT_CACHE_NIL;
+    }
+    cache->freeList = 0;
+    for (size_t i = 0; i < cache->nBuckets; i++) {
+        cache->buckets[i] = CRYPT_CACHE_NIL;
+    }
+    cache->head = cache->tail = CRYPT_CACHE_NIL;
+    return cache;
+}
+
+void Crypt_CacheFree(Crypt_Cache* cache) {
+    if (!cache) {
+        return;
+    }
+    free(cache->entries);
+    free(cache->pool);
+    free(cache->buckets);
+    free(cache);
+}
+
+size_t Crypt_CacheBucket(const Crypt_Cache* cache, uint64_t fileId, size_t chunk) {
+    // mix the file id and chunk number (64-bit multiplicative hashing)
+    uint64_t h = (fileId * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t) chunk * 0xc2b2ae3d27d4eb4fULL);
+    h ^= h >> 29;
+    return (size_t) (h % cache->nBuckets);
+}
+
+void Crypt_CacheUnlink(Crypt_Cache* cache, size_t i) {
+    Crypt_CacheEntry* e = &cache->entries[i];
+    if (e->prev != CRYPT_CACHE_NIL) {
+        cache->entries[e->prev].next = e->next;
+    } else {
+        cache->head = e->next;
+    }
+    if (e->next != CRYPT_CACHE_NIL) {
+        cache->entries[e->next].prev = e->prev;
+    } else {
+        cache->tail = e->prev;
+    }
+}
+
+void Crypt_CachePushFront(Crypt_Cache* cache, size_t i) {
+    Crypt_CacheEntry* e = &cache->entries[i];
+    e->prev = CRYPT_CACHE_NIL;
+    e->next = cache->head;
+    if (cache->head != CRYPT_CACHE_NIL) {
+        cache->entries[cache->head].prev = i;
+    } else {
+        cache->tail = i;
+    }
+    cache->head = i;
+}
+
+void Crypt_CacheRemove(Crypt_Cache* cache, size_t i) {
+    // remove entry i from its hash chain and the recency list
+    Crypt_CacheEntry* e = &cache->entries[i];
+    size_t* link = &cache->buckets[Crypt_CacheBucket(cache, e->fileId, e->chunk)];
+    while (*link != i) {
+        link = &cache->entries[*link].hnext;
+    }
+    *link = e->hnext;
+    Crypt_CacheUnlink(cache, i);
+}
+
+size_t Crypt_CacheFind(const Crypt_Cache* cache, uint64_t fileId, size_t chunk) {
+    size_t i = cache->buckets[Crypt_CacheBucket(cache, fileId, chunk)];
+    while (i != CRYPT_CACHE_NIL) {
+        const Crypt_CacheEntry* e = &cache->entries[i];
+        if (e->fileId == fileId && e->chunk == chunk) {
+            break;
+        }
+        i = e->hnext;
+    }
+    return i;
+}
+
+Crypt_CacheEntry* Crypt_CacheLookup(Crypt_Cache* cache, uint64_t fileId, size_t chunk) {
+    size_t i = Crypt_CacheFind(cache, fileId, chunk);
+    if (i == CRYPT_CACHE_NIL) {
+        cache->stats.misses++;
+        return NULL;
+    }
+
+    cache->stats.hits++;
+    if (cache->policy == CRYPT_EVICT_LRU && cache->head != i) {
+        Crypt_CacheUnlink(cache, i);
+        Crypt_CachePushFront(cache, i);
+    }
+    return &cache->entries[i];
+}
+
+Crypt_CacheEntry* Crypt_CacheInsert(Crypt_Cache* cache, uint64_t fileId, size_t chunk) {
+    size_t i;
+    if (cache->freeList != CRYPT_CACHE_NIL) {
+        i = cache->freeList;
+        cache->freeList = cache->entries[i].hnext;
+        cache->nEntries++;
+    } else {
+        // reuse the entry at the tail of the list
+        i = cache->tail;
+        Crypt_CacheRemove(cache, i);
+        cache->stats.evictions++;
+    }
+
+    Crypt_CacheEntry* e = &cache->entries[i];
+    e->fileId = fileId;
+    e->chunk = chunk;
+    e->nBytes = 0;
+    size_t* bucket = &cache->buckets[Crypt_CacheBucket(cache, fileId, chunk)];
+    e->hnext = *bucket;
+    *bucket = i;
+    Crypt_CachePushFront(cache, i);
+    return e;
+}
+
+void Crypt_CacheInvalidate(Crypt_Cache* cache, uint64_t fileId) {
+    size_t i = cache->head;
+    while (i != CRYPT_CACHE_NIL) {
+        size_t next = cache->entries[i].next;
+        if (cache->entries[i].fileId == fileId) {
+            Crypt_CacheRemove(cache, i);
+            cache->entries[i].hnext = cache->freeList;
+            cache->freeList = i;
+            cache->nEntries--;
+        }
+        i = next;
+    }
+}
+
+Crypt_Error_t Crypt_ReaderOpen(const char* fnameIn,
+                               const char* fnameKey,
+                               Crypt_Cache* cache,
+                               size_t firstByte,
+                               size_t lastByte,
+                               Crypt_Reader** readerOut) {
+    *readerOut = NULL;
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        memset(key, 0, sizeof(key));
+        return CRYPT_E_IO;
+    }
+
+    // get the size of the file
+    fseeko(fileIn, 0L, SEEK_END);
+    size_t fsize = (size_t) ftello(fileIn);
+    // if the given lastByte is out of range, just read to the end of the file
+    lastByte = MIN(lastByte, fsize);
+
+    // the range must hold at least the final (padded) block
+    if (firstByte >= lastByte || (lastByte - firstByte) % STATE_SIZE != 0) {
+        memset(key, 0, sizeof(key));
+        fclose(fileIn);
+        return CRYPT_E_FORMAT;
+    }
+
+    Crypt_Reader* reader = (Crypt_Reader*) calloc(1, sizeof(Crypt_Reader));
+    if (!reader) {
+        memset(key, 0, sizeof(key));
+        fclose(fileIn);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+
+    AES_InitKeyCtx(&reader->keyCtx, key, NK_BYTES_TO_WORDS(keySize));
+    AES_InitKeyCtx(&reader->padCtx, key, CRYPT_PAD_NK);
+    memset(key, 0, sizeof(key));
+
+    reader->file = fileIn;
+    reader->cache = cache;
+    reader->fileId = cache->nextFileId++;
+    reader->firstByte = firstByte;
+    reader->lastByte = lastByte;
+    reader->fsize = fsize;
+    reader->nChunks = (lastByte - firstByte + CRYPT_CHUNK_SIZE - 1) / CRYPT_CHUNK_SIZE;
+    reader->lastChunk = CRYPT_CACHE_NIL;
+    reader->window = 1;
+
+    // the amount of padding determines where the range ends in the
+    // deciphered file, so decipher the final block up front
+    byte ciphertext[STATE_SIZE];
+    byte decrypted[STATE_SIZE];
+    fseeko(fileIn, (off_t) (lastByte - STATE_SIZE), SEEK_SET);
+    if (fread(ciphertext, sizeof(byte), STATE_SIZE, fileIn) != STATE_SIZE) {
+        Crypt_ReaderClose(reader);
+        return CRYPT_E_IO;
+    }
+    AES_DecipherBlock(&reader->padCtx, ciphertext, decrypted);
+    reader->nPad = decrypted[STATE_SIZE - 1];
+    if (reader->nPad == 0 || reader->nPad > STATE_SIZE) {
+        fprintf(stderr, "Decipher error: encountered malformed padding" \
+                        " sequence of size %d.\n", reader->nPad);
+        Crypt_ReaderClose(reader);
+        return CRYPT_E_FORMAT;
+    }
+
+    Crypt_ReaderSetReadahead(reader, CRYPT_READAHEAD_CHUNKS);
+    if (reader->maxReadahead && !reader->ioBuf) {
+        Crypt_ReaderClose(reader);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    *readerOut = reader;
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_ReaderSetReadahead(Crypt_Reader* reader, size_t nChunks) {
+    // keep at least half of the cache out of reach of a single readahead,
+    // so the chunk that triggered it is never evicted by its own window
+    size_t limit = reader->cache->capacity / 2;
+    nChunks = MIN(nChunks, limit);
+
+    free(reader->ioBuf);
+    reader->ioBuf = NULL;
+    reader->maxReadahead = nChunks;
+    reader->window = 1;
+    // at least one chunk of buffer is needed to load a single chunk
+    reader->ioBuf = (byte*) malloc((nChunks ? nChunks : 1) * CRYPT_CHUNK_SIZE);
+}
+
+size_t Crypt_ReaderSize(const Crypt_Reader* reader) {
+    return reader->fsize - reader->nPad;
+}
+
+Crypt_CacheEntry* Crypt_ReaderLoad(Crypt_Reader* reader, size_t chunk) {
+    // a chunk immediately following the previous one is treated as
+    // sequential access: the readahead window grows (doubling, up to
+    // maxReadahead) and that many chunks are read with a single request.
+    // any other access pattern resets the window
+    size_t nLoad = 1;
+    if (reader->maxReadahead) {
+        if (reader->lastChunk != CRYPT_CACHE_NIL && chunk == reader->lastChunk + 1) {
+            reader->window = MIN(2 * reader->window, reader->maxReadahead);
+            nLoad = reader->window;
+        } else {
+            reader->window = 1;
+        }
+    }
+    nLoad = MIN(nLoad, reader->nChunks - chunk);
+
+    // stop at the first chunk that is already cached
+    for (size_t i = 1; i < nLoad; i++) {
+        if (Crypt_CacheFind(reader->cache, reader->fileId, chunk + i) != CRYPT_CACHE_NIL) {
+            nLoad = i;
+            break;
+        }
+    }
+
+    size_t start = reader->firstByte + chunk * CRYPT_CHUNK_SIZE;
+    size_t nBytes = MIN(nLoad * CRYPT_CHUNK_SIZE, reader->lastByte - start);
+    fseeko(reader->file, (off_t) start, SEEK_SET);
+    if (fread(reader->ioBuf, sizeof(byte), nBytes, reader->file) != nBytes) {
+        return NULL;
+    }
+
+    Crypt_CacheEntry* first = NULL;
+    for (size_t i = 0; i < nLoad; i++) {
+        size_t nChunkBytes = MIN((size_t) CRYPT_CHUNK_SIZE, nBytes - i * CRYPT_CHUNK_SIZE);
+        size_t nBlocks = nChunkBytes / STATE_SIZE;
+        byte* ciphertext = reader->ioBuf + i * CRYPT_CHUNK_SIZE;
+
+        Crypt_CacheEntry* e = Crypt_CacheInsert(reader->cache, reader->fileId, chunk + i);
+        if (chunk + i == reader->nChunks - 1) {
+            // the final block of the range is enciphered with padCtx
+            AES_DecipherBlocks(&reader->keyCtx, ciphertext, nBlocks - 1, e->data);
+            AES_DecipherBlock(&reader->padCtx, ciphertext + (nBlocks - 1) * STATE_SIZE,
+                              e->data + (nBlocks - 1) * STATE_SIZE);
+            e->nBytes = nChunkBytes - reader->nPad;
+        } else {
+            AES_DecipherBlocks(&reader->keyCtx, ciphertext, nBlocks, e->data);
+            e->nBytes = nChunkBytes;
+        }
+
+        if (i == 0) {
+            first = e;
+        } else {
+            reader->cache->stats.readahead++;
+        }
+    }
+    return first;
+}
+
+size_t Crypt_ReaderRead(Crypt_Reader* reader, size_t offset, byte buf[], size_t nBytes) {
+    size_t size = Crypt_ReaderSize(reader);
+    // end of the enciphered range in the deciphered file
+    size_t rangeEnd = reader->lastByte - reader->nPad;
+    size_t nRead = 0;
+
+    while (nRead < nBytes && offset < size) {
+        size_t n;
+        if (offset < reader->firstByte || offset >= rangeEnd) {
+            // plaintext outside the range; bytes after the range are
+            // shifted by the padding in the enciphered file
+            size_t end = (offset < reader->firstByte) ? reader->firstByte : size;
+            n = MIN(nBytes - nRead, end - offset);
+            size_t fileOffset = (offset < reader->firstByte) ? offset : offset + reader->nPad;
+            fseeko(reader->file, (off_t) fileOffset, SEEK_SET);
+            n = fread(buf + nRead, sizeof(byte), n, reader->file);
+            if (n == 0) {
+                break;
+            }
+        } else {
+            size_t rangeOffset = offset - reader->firstByte;
+            size_t chunk = rangeOffset / CRYPT_CHUNK_SIZE;
+            size_t chunkOffset = rangeOffset % CRYPT_CHUNK_SIZE;
+
+            Crypt_CacheEntry* e = Crypt_CacheLookup(reader->cache, reader->fileId, chunk);
+            if (!e) {
+                e = Crypt_ReaderLoad(reader, chunk);
+                if (!e) {
+                    break;
+                }
+            }
+            reader->lastChunk = chunk;
+
+            n = MIN(nBytes - nRead, e->nBytes - chunkOffset);
+            memcpy(buf + nRead, e->data + chunkOffset, n);
+        }
+        nRead += n;
+        offset += n;
+    }
+    return nRead;
+}
+
+void Crypt_ReaderClose(Crypt_Reader* reader) {
+    if (!reader) {
+        return;
+    }
+    // the file id is never reused, so its chunks can only waste space
+    Crypt_CacheInvalidate(reader->cache, reader->fileId);
+    fclose(reader->file);
+    free(reader->ioBuf);
+    free(reader);
+}
+
+#endif  // CC_READER_H_
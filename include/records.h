@@ -0,0 +1,106 @@
+#ifndef CC_RECORDS_H_
+#define CC_RECORDS_H_
+
+// enciphers many small in-memory records, each under its own key and IV,
+// e.g. the fields of database rows with per-tenant keys. records use
+// AES in counter mode (NIST SP 800-38A): the IV is the first counter
+// block, incremented as a 128-bit big-endian integer for every further
+// block, and the records are XORed with the enciphered counter blocks.
+// so the output has the size of the input, and deciphering is the same
+// operation as enciphering.
+//
+// the counter blocks of all records are gathered into groups of
+// AES_MAX_LANES blocks, whatever record and key they belong to, and
+// each group is enciphered with AES_EncipherLanes. a field of a few
+// dozen bytes is only two or three blocks, so this keeps the AES
+// instructions busy where one record at a time would leave them idle.
+// nothing is allocated, and the outputs are buffers of the caller.
+//
+// an IV must never be reused with the same key; Crypt_RandomBytes (see
+// drbg.h) supplies fresh ones cheaply. a record stored next to its IV
+// takes STATE_SIZE extra bytes.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aes.h"
+#include "drbg.h"
+
+typedef struct {
+    const AES_KeyCtx* ctx;
+    const byte* iv;  // the first counter block, STATE_SIZE bytes
+    const byte* in;
+    byte* out;  // nBytes bytes, may be the same as in
+    size_t nBytes;
+} Crypt_Record;
+
+// enciphers or deciphers the n records
+void Crypt_TransformRecords(const Crypt_Record records[], size_t n);
+
+// internal helpers
+// XORs the keystream blocks of lanes into their records
+void Crypt_RecordsXor(const Crypt_Record records[],
+                      const size_t recordOf[],
+                      const size_t offsetOf[],
+                      const byte stream[],
+                      size_t nLanes);
+
+void Crypt_RecordsXor(const Crypt_Record records[],
+                      const size_t recordOf[],
+                      const size_t offsetOf[],
+                      const byte stream[],
+                      size_t nLanes) {
+    for (size_t i = 0; i < nLanes; i++) {
+        const Crypt_Record* r = &records[recordOf[i]];
+        size_t offset = offsetOf[i];
+        if (r->nBytes - offset >= STATE_SIZE) {
+            // a whole block, a word at a time
+            for (size_t j = 0; j < STATE_SIZE; j += sizeof(uint64_t)) {
+                uint64_t a, b;
+                memcpy(&a, r->in + offset + j, sizeof(a));
+                memcpy(&b, stream + i * STATE_SIZE + j, sizeof(b));
+                a ^= b;
+                memcpy(r->out + offset + j, &a, sizeof(a));
+            }
+            continue;
+        }
+        for (size_t j = 0; j < r->nBytes - offset; j++) {
+            r->out[offset + j] = r->in[offset + j] ^ stream[i * STATE_SIZE + j];
+        }
+    }
+}
+
+void Crypt_TransformRecords(const Crypt_Record records[], size_t n) {
+    const AES_KeyCtx* ctxs[AES_MAX_LANES];
+    byte blocks[AES_MAX_LANES * STATE_SIZE];
+    size_t recordOf[AES_MAX_LANES], offsetOf[AES_MAX_LANES];
+    size_t nLanes = 0;
+
+    byte counter[STATE_SIZE];
+    for (size_t i = 0; i < n; i++) {
+        const Crypt_Record* r = &records[i];
+        if (r->nBytes == 0) {
+            continue;
+        }
+        memcpy(counter, r->iv, STATE_SIZE);
+        for (size_t offset = 0; offset < r->nBytes; offset += STATE_SIZE) {
+            ctxs[nLanes] = r->ctx;
+            memcpy(blocks + nLanes * STATE_SIZE, counter, STATE_SIZE);
+            recordOf[nLanes] = i;
+            offsetOf[nLanes] = offset;
+            Crypt_DrbgIncrement(counter);
+            if (++nLanes == AES_MAX_LANES) {
+                AES_EncipherLanes(ctxs, blocks, nLanes);
+                Crypt_RecordsXor(records, recordOf, offsetOf, blocks, nLanes);
+                nLanes = 0;
+            }
+        }
+    }
+    if (nLanes > 0) {
+        AES_EncipherLanes(ctxs, blocks, nLanes);
+        Crypt_RecordsXor(records, recordOf, offsetOf, blocks, nLanes);
+    }
+}
+
+#endif  // CC_RECORDS_H_
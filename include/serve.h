@@ -0,0 +1,599 @@
+#ifndef CC_SERVE_H_
+#define CC_SERVE_H_
+
+// a local daemon that keeps key schedules in memory and enciphers /
+// deciphers on request, so clients that run many small operations do
+// not pay for starting a process and expanding a key each time.
+//
+// the daemon listens on a unix domain socket (SOCK_SEQPACKET, so every
+// request and reply is one message) that only its owner can connect to:
+// the socket file is created with mode 0600 and peers with another uid
+// are turned away. a request names an absolute key file path, an
+// operation, and a range (as in a batch manifest, see batch.h). its
+// input and output are either
+//  - two open file descriptors passed with SCM_RIGHTS, in which case
+//    the daemon reads and writes the client's files directly, or
+//  - for payloads of at most CRYPT_SERVE_INLINE_MAX bytes, the input
+//    inline after the request and the output inline after the reply.
+// the output is the same as that of a batch job with the same fields.
+//
+// every connection is served by its own thread, one request at a time.
+// key files are loaded the first time they are named and cached until
+// the daemon exits, so a key file that is replaced while the daemon
+// runs needs a restart to take effect.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "container.h"
+#include "batch.h"
+
+#define CRYPT_SERVE_MAGIC "CSRV"
+// max length of a key file path in a request (including the NUL)
+#define CRYPT_SERVE_PATH_MAX 1024
+// max number of input bytes sent inline; larger inputs are passed as fds
+#define CRYPT_SERVE_INLINE_MAX (32 * 1024)
+#define CRYPT_SERVE_BACKLOG 64
+
+// request flags
+#define CRYPT_SERVE_INLINE 1  // the input follows the request
+
+typedef struct {
+    char magic[4];
+    uint32_t op;  // Crypt_Op_t
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t firstByte, lastByte;
+    char fnameKey[CRYPT_SERVE_PATH_MAX];
+    // followed by the input if flags has CRYPT_SERVE_INLINE
+} Crypt_ServeRequest;
+
+typedef struct {
+    uint32_t err;  // Crypt_Error_t
+    uint32_t reserved;
+    uint64_t nInline;
+    // followed by nInline bytes of output for an inline request
+} Crypt_ServeReply;
+
+typedef struct {
+    int fd;
+    char* path;
+    // the key cache. the batch never has jobs; its keys are shared by
+    // every connection
+    Crypt_Batch keys;
+    // open connections, so they can be shut down when the daemon stops
+    int* conns;
+    size_t nConns, capConns;
+    volatile bool stop;
+    pthread_mutex_t lock;  // protects keys and conns
+    pthread_cond_t connsDone;
+} Crypt_Server;
+
+// creates the socket at path (replacing a stale one left by a daemon
+// that is no longer running) and starts listening
+Crypt_Error_t Crypt_ServeOpen(Crypt_Server* server, const char* path);
+// serves connections until Crypt_ServeStop is called, then waits for
+// the requests in progress to finish
+Crypt_Error_t Crypt_ServeRun(Crypt_Server* server);
+// makes Crypt_ServeRun return. safe to call from a signal handler
+void Crypt_ServeStop(Crypt_Server* server);
+// removes the socket and frees the server
+void Crypt_ServeClose(Crypt_Server* server);
+
+// connects to the daemon at path. returns the socket, or -1
+int Crypt_ServeConnect(const char* path);
+// runs a request on open descriptors (which the caller still owns).
+// fnameKey must be an absolute path
+Crypt_Error_t Crypt_ServeTransformFds(int sock, Crypt_Op_t op, int fdIn, int fdOut, const char* fnameKey,
+                                      size_t firstByte, size_t lastByte);
+// runs a request on a buffer of at most CRYPT_SERVE_INLINE_MAX bytes.
+// out must hold nIn + STATE_SIZE bytes; *nOut is set to the output size.
+// a container that deciphers to more than that fails with CRYPT_E_IO
+Crypt_Error_t Crypt_ServeTransformInline(int sock, Crypt_Op_t op, const byte in[], size_t nIn,
+                                         const char* fnameKey, size_t firstByte, size_t lastByte,
+                                         byte out[], size_t* nOut);
+// runs a request on files, inline if the input is small enough
+Crypt_Error_t Crypt_ServeTransform(int sock, Crypt_Op_t op, const char* fnameIn, const char* fnameKey,
+                                   const char* fnameOut, size_t firstByte, size_t lastByte);
+
+// internal helpers
+void* Crypt_ServeConnection(void* arg);
+Crypt_Error_t Crypt_ServeHandle(Crypt_Server* server, const Crypt_ServeRequest* req, const byte in[], size_t nIn,
+                                int fds[2], byte out[], size_t* nOut);
+Crypt_Error_t Crypt_ServeSend(int sock, const void* msg, size_t nMsg, const void* data, size_t nData,
+                              const int fds[], size_t nFds);
+Crypt_Error_t Crypt_ServeCall(int sock, const Crypt_ServeRequest* req, const byte in[], size_t nIn,
+                              const int fds[], size_t nFds, byte out[], size_t* nOut);
+void Crypt_ServeRemoveConn(Crypt_Server* server, int conn);
+
+typedef struct {
+    Crypt_Server* server;
+    int conn;
+} Crypt_ConnArg;
+
+Crypt_Error_t Crypt_ServeOpen(Crypt_Server* server, const char* path) {
+    memset(server, 0, sizeof(Crypt_Server));
+    server->fd = -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return CRYPT_E_ARGUMENT;
+    }
+    strcpy(addr.sun_path, path);
+    server->path = strdup(path);
+    if (!server->path) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+
+    server->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (server->fd < 0) {
+        free(server->path);
+        return CRYPT_E_IO;
+    }
+    // the socket file must never be reachable by others, not even
+    // between bind and chmod
+    mode_t mask = umask(0077);
+    int ret = bind(server->fd, (struct sockaddr*) &addr, sizeof(addr));
+    if (ret != 0 && errno == EADDRINUSE) {
+        // a socket nobody listens on is left over from an earlier run
+        int probe = Crypt_ServeConnect(path);
+        if (probe >= 0) {
+            close(probe);
+        } else if (errno == ECONNREFUSED && unlink(path) == 0) {
+            ret = bind(server->fd, (struct sockaddr*) &addr, sizeof(addr));
+        }
+    }
+    umask(mask);
+    if (ret != 0 || chmod(path, 0600) != 0 || listen(server->fd, CRYPT_SERVE_BACKLOG) != 0) {
+        if (ret == 0) {
+            unlink(path);
+        }
+        close(server->fd);
+        free(server->path);
+        return CRYPT_E_IO;
+    }
+
+    Crypt_BatchInit(&server->keys);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->connsDone, NULL);
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_ServeStop(Crypt_Server* server) {
+    // shutdown wakes up the accept in Crypt_ServeRun
+    server->stop = true;
+    shutdown(server->fd, SHUT_RDWR);
+}
+
+void Crypt_ServeClose(Crypt_Server* server) {
+    close(server->fd);
+    unlink(server->path);
+    free(server->path);
+    free(server->conns);
+    Crypt_BatchFree(&server->keys);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->connsDone);
+}
+
+void Crypt_ServeRemoveConn(Crypt_Server* server, int conn) {
+    pthread_mutex_lock(&server->lock);
+    for (size_t i = 0; i < server->nConns; i++) {
+        if (server->conns[i] == conn) {
+            server->conns[i] = server->conns[--server->nConns];
+            break;
+        }
+    }
+    if (server->nConns == 0) {
+        pthread_cond_broadcast(&server->connsDone);
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+Crypt_Error_t Crypt_ServeRun(Crypt_Server* server) {
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    while (!server->stop) {
+        int conn = accept4(server->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (!server->stop) {
+                err = CRYPT_E_IO;
+            }
+            break;
+        }
+
+        struct ucred cred;
+        socklen_t credLen = sizeof(cred);
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) != 0 || cred.uid != geteuid()) {
+            close(conn);
+            continue;
+        }
+
+        pthread_mutex_lock(&server->lock);
+        bool added = true;
+        if (server->nConns == server->capConns) {
+            size_t capacity = (server->capConns) ? 2 * server->capConns : 16;
+            int* conns = (int*) realloc(server->conns, capacity * sizeof(int));
+            if (conns) {
+                server->conns = conns;
+                server->capConns = capacity;
+            } else {
+                added = false;
+            }
+        }
+        if (added) {
+            server->conns[server->nConns++] = conn;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        Crypt_ConnArg* arg = added ? (Crypt_ConnArg*) malloc(sizeof(Crypt_ConnArg)) : NULL;
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (arg) {
+            arg->server = server;
+            arg->conn = conn;
+        }
+        if (!arg || pthread_create(&thread, &attr, Crypt_ServeConnection, arg) != 0) {
+            free(arg);
+            if (added) {
+                Crypt_ServeRemoveConn(server, conn);
+            }
+            close(conn);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    // connections finish the request they are on, then see end of file
+    pthread_mutex_lock(&server->lock);
+    for (size_t i = 0; i < server->nConns; i++) {
+        shutdown(server->conns[i], SHUT_RD);
+    }
+    while (server->nConns > 0) {
+        pthread_cond_wait(&server->connsDone, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return err;
+}
+
+void* Crypt_ServeConnection(void* arg) {
+    Crypt_ConnArg* connArg = (Crypt_ConnArg*) arg;
+    Crypt_Server* server = connArg->server;
+    int conn = connArg->conn;
+    free(connArg);
+
+    // a request with inline input, plus a byte to detect larger messages
+    size_t capMsg = sizeof(Crypt_ServeRequest) + CRYPT_SERVE_INLINE_MAX + 1;
+    byte* msg = (byte*) malloc(capMsg);
+    byte* out = (byte*) malloc(CRYPT_SERVE_INLINE_MAX + STATE_SIZE);
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+
+    while (msg && out) {
+        struct iovec iov;
+        iov.iov_base = msg;
+        iov.iov_len = capMsg;
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = sizeof(control.buf);
+        ssize_t nMsg = recvmsg(conn, &hdr, MSG_CMSG_CLOEXEC);
+        if (nMsg < 0 && errno == EINTR) {
+            continue;
+        } else if (nMsg <= 0) {
+            break;
+        }
+
+        int fds[2] = {-1, -1};
+        size_t nFds = 0;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&hdr); c; c = CMSG_NXTHDR(&hdr, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                size_t n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                int* received = (int*) CMSG_DATA(c);
+                for (size_t i = 0; i < n; i++) {
+                    if (nFds < 2) {
+                        fds[nFds++] = received[i];
+                    } else {
+                        close(received[i]);
+                    }
+                }
+            }
+        }
+
+        const Crypt_ServeRequest* req = (const Crypt_ServeRequest*) msg;
+        size_t nOut = 0;
+        Crypt_Error_t err;
+        if ((size_t) nMsg < sizeof(Crypt_ServeRequest) || (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+            (size_t) nMsg == capMsg ||
+            memcmp(req->magic, CRYPT_SERVE_MAGIC, 4) != 0) {
+            err = CRYPT_E_FORMAT;
+        } else if ((req->flags & CRYPT_SERVE_INLINE) ? nFds != 0 : nFds != 2) {
+            err = CRYPT_E_ARGUMENT;
+        } else {
+            size_t nIn = (size_t) nMsg - sizeof(Crypt_ServeRequest);
+            err = Crypt_ServeHandle(server, req, msg + sizeof(Crypt_ServeRequest), nIn, fds, out, &nOut);
+        }
+        // Crypt_ServeHandle takes the descriptors; these are left over
+        // from a rejected request
+        for (size_t i = 0; i < 2; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+
+        Crypt_ServeReply reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.err = (uint32_t) err;
+        reply.nInline = nOut;
+        if (Crypt_ServeSend(conn, &reply, sizeof(reply), out, nOut, NULL, 0) != CRYPT_E_SUCCESS) {
+            break;
+        }
+    }
+
+    free(msg);
+    free(out);
+    Crypt_ServeRemoveConn(server, conn);
+    close(conn);
+    return NULL;
+}
+
+Crypt_Error_t Crypt_ServeHandle(Crypt_Server* server, const Crypt_ServeRequest* req, const byte in[], size_t nIn,
+                                int fds[2], byte out[], size_t* nOut) {
+    *nOut = 0;
+    if (memchr(req->fnameKey, '\0', CRYPT_SERVE_PATH_MAX) == NULL || req->fnameKey[0] != '/' ||
+        (req->op != CRYPT_OP_ENCIPHER && req->op != CRYPT_OP_DECIPHER) ||
+        req->firstByte > req->lastByte) {
+        return CRYPT_E_ARGUMENT;
+    }
+
+    // the job runs on this thread (the key cache has no pool), so it is
+    // done when Crypt_JobStart returns
+    Crypt_Job job;
+    memset(&job, 0, sizeof(Crypt_Job));
+    job.op = (Crypt_Op_t) req->op;
+    job.firstByte = (size_t) req->firstByte;
+    job.lastByte = (size_t) req->lastByte;
+    job.batch = &server->keys;
+    job.fdIn = job.fdOut = -1;
+
+    pthread_mutex_lock(&server->lock);
+    Crypt_Error_t err = Crypt_BatchFindKey(&server->keys, req->fnameKey, &job.key);
+    pthread_mutex_unlock(&server->lock);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+
+    if (!(req->flags & CRYPT_SERVE_INLINE)) {
+        job.fdIn = fds[0];
+        job.fdOut = fds[1];
+        fds[0] = fds[1] = -1;
+        Crypt_JobStart(&job);
+        return job.err;
+    }
+
+    // inline data goes through memory-backed files, so it takes the same
+    // path as data in the client's files
+    int memIn = memfd_create("ciph-in", MFD_CLOEXEC);
+    int memOut = memfd_create("ciph-out", MFD_CLOEXEC);
+    job.fdIn = memIn;
+    job.fdOut = (memOut >= 0) ? dup(memOut) : -1;
+    if (memIn < 0 || job.fdOut < 0 || Crypt_PwriteFull(memIn, in, nIn, 0) != CRYPT_E_SUCCESS) {
+        if (memIn >= 0) {
+            close(memIn);
+        }
+        if (job.fdOut >= 0) {
+            close(job.fdOut);
+        }
+        if (memOut >= 0) {
+            close(memOut);
+        }
+        return CRYPT_E_IO;
+    }
+    Crypt_JobStart(&job);
+
+    struct stat st;
+    err = job.err;
+    if (err == CRYPT_E_SUCCESS && fstat(memOut, &st) != 0) {
+        err = CRYPT_E_IO;
+    } else if (err == CRYPT_E_SUCCESS && (size_t) st.st_size > CRYPT_SERVE_INLINE_MAX + STATE_SIZE) {
+        // e.g. a compressed container that expands; pass fds instead
+        err = CRYPT_E_ARGUMENT;
+    } else if (err == CRYPT_E_SUCCESS) {
+        *nOut = (size_t) st.st_size;
+        err = Crypt_PreadFull(memOut, out, *nOut, 0);
+    }
+    close(memOut);
+    if (err != CRYPT_E_SUCCESS) {
+        *nOut = 0;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_ServeSend(int sock, const void* msg, size_t nMsg, const void* data, size_t nData,
+                              const int fds[], size_t nFds) {
+    struct iovec iov[2];
+    iov[0].iov_base = (void*) msg;
+    iov[0].iov_len = nMsg;
+    iov[1].iov_base = (void*) data;
+    iov[1].iov_len = nData;
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = (nData) ? 2 : 1;
+
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    if (nFds) {
+        memset(control.buf, 0, sizeof(control.buf));
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = CMSG_SPACE(nFds * sizeof(int));
+        struct cmsghdr* c = CMSG_FIRSTHDR(&hdr);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(nFds * sizeof(int));
+        memcpy(CMSG_DATA(c), fds, nFds * sizeof(int));
+    }
+
+    ssize_t nSent;
+    do {
+        nSent = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+    } while (nSent < 0 && errno == EINTR);
+    return (nSent == (ssize_t) (nMsg + nData)) ? CRYPT_E_SUCCESS : CRYPT_E_IO;
+}
+
+int Crypt_ServeConnect(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    return sock;
+}
+
+Crypt_Error_t Crypt_ServeCall(int sock, const Crypt_ServeRequest* req, const byte in[], size_t nIn,
+                              const int fds[], size_t nFds, byte out[], size_t* nOut) {
+    Crypt_Error_t err = Crypt_ServeSend(sock, req, sizeof(Crypt_ServeRequest), in, nIn, fds, nFds);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+
+    Crypt_ServeReply reply;
+    struct iovec iov[2];
+    iov[0].iov_base = &reply;
+    iov[0].iov_len = sizeof(reply);
+    iov[1].iov_base = out;
+    iov[1].iov_len = (out) ? nIn + STATE_SIZE : 0;
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 2;
+    ssize_t nRecv;
+    do {
+        nRecv = recvmsg(sock, &hdr, 0);
+    } while (nRecv < 0 && errno == EINTR);
+
+    if (nRecv < (ssize_t) sizeof(reply) || (hdr.msg_flags & MSG_TRUNC) ||
+        (size_t) nRecv != sizeof(reply) + reply.nInline) {
+        return CRYPT_E_IO;
+    }
+    if (nOut) {
+        *nOut = (size_t) reply.nInline;
+    }
+    return (Crypt_Error_t) reply.err;
+}
+
+Crypt_Error_t Crypt_ServeTransformFds(int sock, Crypt_Op_t op, int fdIn, int fdOut, const char* fnameKey,
+                                      size_t firstByte, size_t lastByte) {
+    Crypt_ServeRequest req;
+    memset(&req, 0, sizeof(req));
+    memcpy(req.magic, CRYPT_SERVE_MAGIC, 4);
+    req.op = (uint32_t) op;
+    req.firstByte = firstByte;
+    req.lastByte = lastByte;
+    if (strlen(fnameKey) >= CRYPT_SERVE_PATH_MAX) {
+        return CRYPT_E_ARGUMENT;
+    }
+    strcpy(req.fnameKey, fnameKey);
+
+    int fds[2] = {fdIn, fdOut};
+    return Crypt_ServeCall(sock, &req, NULL, 0, fds, 2, NULL, NULL);
+}
+
+Crypt_Error_t Crypt_ServeTransformInline(int sock, Crypt_Op_t op, const byte in[], size_t nIn,
+                                         const char* fnameKey, size_t firstByte, size_t lastByte,
+                                         byte out[], size_t* nOut) {
+    Crypt_ServeRequest req;
+    memset(&req, 0, sizeof(req));
+    memcpy(req.magic, CRYPT_SERVE_MAGIC, 4);
+    req.op = (uint32_t) op;
+    req.flags = CRYPT_SERVE_INLINE;
+    req.firstByte = firstByte;
+    req.lastByte = lastByte;
+    if (nIn > CRYPT_SERVE_INLINE_MAX || strlen(fnameKey) >= CRYPT_SERVE_PATH_MAX) {
+        return CRYPT_E_ARGUMENT;
+    }
+    strcpy(req.fnameKey, fnameKey);
+
+    return Crypt_ServeCall(sock, &req, in, nIn, NULL, 0, out, nOut);
+}
+
+Crypt_Error_t Crypt_ServeTransform(int sock, Crypt_Op_t op, const char* fnameIn, const char* fnameKey,
+                                   const char* fnameOut, size_t firstByte, size_t lastByte) {
+    // the daemon has its own working directory
+    char* fnameKeyAbs = realpath(fnameKey, NULL);
+    if (!fnameKeyAbs) {
+        return CRYPT_E_IO;
+    }
+    int fdIn = open(fnameIn, O_RDONLY);
+    int fdOut = (fdIn >= 0) ? open(fnameOut, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    struct stat st;
+    Crypt_Error_t err = (fdOut >= 0 && fstat(fdIn, &st) == 0) ? CRYPT_E_SUCCESS : CRYPT_E_IO;
+
+    // containers are always passed as fds, since compressed ones can
+    // expand past the inline limit
+    if (err == CRYPT_E_SUCCESS && (size_t) st.st_size <= CRYPT_SERVE_INLINE_MAX &&
+        !(op == CRYPT_OP_DECIPHER && Crypt_IsContainerFd(fdIn))) {
+        size_t nIn = (size_t) st.st_size;
+        size_t nOut = 0;
+        byte* in = (byte*) malloc(nIn + 1);
+        byte* out = (byte*) malloc(nIn + STATE_SIZE);
+        if (!in || !out) {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+        } else {
+            err = Crypt_PreadFull(fdIn, in, nIn, 0);
+        }
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_ServeTransformInline(sock, op, in, nIn, fnameKeyAbs, firstByte, lastByte, out, &nOut);
+        }
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_PwriteFull(fdOut, out, nOut, 0);
+        }
+        free(in);
+        free(out);
+    } else if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_ServeTransformFds(sock, op, fdIn, fdOut, fnameKeyAbs, firstByte, lastByte);
+    }
+
+    if (fdOut >= 0 && close(fdOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    if (fdIn >= 0) {
+        close(fdIn);
+    }
+    free(fnameKeyAbs);
+    return err;
+}
+
+#endif  // CC_SERVE_H_
@@ -0,0 +1,475 @@
+#ifndef CC_SHA256_H_
+#define CC_SHA256_H_
+
+// the SHA-256 hash function (FIPS 180-4), with a streaming interface
+// (SHA256_Init / SHA256_Update / SHA256_Final) for data that arrives in
+// pieces, SHA256_Hash for data that is all in memory, SHA256_HashBatch
+// for many independent messages, and HMAC-SHA256 (RFC 2104) on top.
+//
+// the compression function has three implementations, chosen at run
+// time from what the CPU supports:
+// - a portable scalar one, the reference for the others;
+// - one with the SHA extensions (SHA-NI), used for every single message;
+// - an AVX2 one that hashes 8 messages at once, one per 32-bit lane,
+//   used by SHA256_HashBatch when SHA-NI is missing.
+// the x86 paths are compiled with target attributes, so no compiler
+// flags are needed; defining CIPH_NO_SIMD leaves only the scalar one.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(CIPH_NO_SIMD)
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// size in bytes of a message block
+#define SHA256_BLOCK_SIZE 64
+// size in bytes of a digest
+#define SHA256_DIGEST_SIZE 32
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// implementations of the compression function besides the scalar one
+#define SHA256_SHANI 0x1
+#define SHA256_AVX2 0x2
+
+typedef struct {
+    uint32_t h[8];
+    byte buf[SHA256_BLOCK_SIZE];  // the partial block not hashed yet
+    uint64_t nBytes;  // total number of bytes hashed so far
+} SHA256_Ctx;
+
+typedef struct {
+    SHA256_Ctx inner;  // after hashing the key xor ipad
+    SHA256_Ctx outer;  // after hashing the key xor opad
+} SHA256_HmacCtx;
+
+void SHA256_Init(SHA256_Ctx* ctx);
+void SHA256_Update(SHA256_Ctx* ctx, const byte data[], size_t nBytes);
+// pads the message and writes the digest. the context must be
+// initialized again before it is reused
+void SHA256_Final(SHA256_Ctx* ctx, byte digest[]);
+// hashes nBytes of data in one call
+void SHA256_Hash(const byte data[], size_t nBytes, byte digest[]);
+
+void SHA256_HmacInit(SHA256_HmacCtx* ctx, const byte key[], size_t keySize);
+void SHA256_HmacUpdate(SHA256_HmacCtx* ctx, const byte data[], size_t nBytes);
+void SHA256_HmacFinal(SHA256_HmacCtx* ctx, byte mac[]);
+// computes the HMAC of nBytes of data in one call
+void SHA256_Hmac(const byte key[], size_t keySize, const byte data[], size_t nBytes, byte mac[]);
+
+// hashes n messages, writing n digests one after another to digests.
+// messages of about the same size are hashed fastest
+void SHA256_HashBatch(const byte* const data[], const size_t sizes[], size_t n, byte digests[]);
+
+// the implementations the CPU supports (SHA256_SHANI, SHA256_AVX2)
+unsigned SHA256_Supported(void);
+// restricts the implementations used to those in mask (and supported),
+// for testing and benchmarking. not thread safe: call it before hashing.
+// returns the implementations now in use
+unsigned SHA256_Use(unsigned mask);
+
+// internal helpers
+// runs the compression function over nBlocks consecutive blocks
+void SHA256_Compress(uint32_t h[], const byte blocks[], size_t nBlocks);
+void SHA256_CompressScalar(uint32_t h[], const byte blocks[], size_t nBlocks);
+uint32_t SHA256_Load32(const byte* p);
+void SHA256_Store32(byte* p, uint32_t v);
+void SHA256_Detect(void);
+#ifdef SHA256_X86
+void SHA256_CompressShaNi(uint32_t h[], const byte blocks[], size_t nBlocks);
+// runs nBlocks blocks of 8 messages through the 8 states in h (each of
+// 8 words, one after another)
+void SHA256_Compress8(uint32_t h[], const byte* const blocks[], size_t nBlocks);
+#endif
+
+// implementations supported and in use, set once by SHA256_Detect
+unsigned SHA256_supported = 0;
+unsigned SHA256_used = 0;
+pthread_once_t SHA256_detectOnce = PTHREAD_ONCE_INIT;
+
+const uint32_t SHA256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t SHA256_h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+uint32_t SHA256_Load32(const byte* p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+void SHA256_Store32(byte* p, uint32_t v) {
+    p[0] = (byte) (v >> 24);
+    p[1] = (byte) (v >> 16);
+    p[2] = (byte) (v >> 8);
+    p[3] = (byte) v;
+}
+
+void SHA256_CompressScalar(uint32_t h[], const byte blocks[], size_t nBlocks) {
+    uint32_t w[64];
+    for (size_t n = 0; n < nBlocks; n++, blocks += SHA256_BLOCK_SIZE) {
+        for (size_t i = 0; i < 16; i++) {
+            w[i] = SHA256_Load32(blocks + 4 * i);
+        }
+        for (size_t i = 16; i < 64; i++) {
+            uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+        for (size_t i = 0; i < 64; i++) {
+            uint32_t s1 = SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = k + s1 + ch + SHA256_k[i] + w[i];
+            uint32_t s0 = SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + s0 + maj;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += k;
+    }
+}
+
+void SHA256_Detect(void) {
+#ifdef SHA256_X86
+    unsigned a, b, c, d;
+    unsigned ecx1 = 0, ebx7 = 0;
+    if (__get_cpuid(1, &a, &b, &c, &d)) {
+        ecx1 = c;
+    }
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, a, b, c, d);
+        ebx7 = b;
+    }
+    if ((ebx7 & bit_SHA) && (ecx1 & bit_SSSE3) && (ecx1 & bit_SSE4_1)) {
+        SHA256_supported |= SHA256_SHANI;
+    }
+    // AVX2 also needs the OS to save the ymm registers
+    if ((ebx7 & bit_AVX2) && (ecx1 & bit_OSXSAVE) && (ecx1 & bit_AVX)) {
+        unsigned lo, hi;
+        __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        if ((lo & 0x6) == 0x6) {
+            SHA256_supported |= SHA256_AVX2;
+        }
+    }
+#endif
+    SHA256_used = SHA256_supported;
+}
+
+unsigned SHA256_Supported(void) {
+    pthread_once(&SHA256_detectOnce, SHA256_Detect);
+    return SHA256_supported;
+}
+
+unsigned SHA256_Use(unsigned mask) {
+    SHA256_used = SHA256_Supported() & mask;
+    return SHA256_used;
+}
+
+void SHA256_Compress(uint32_t h[], const byte blocks[], size_t nBlocks) {
+    pthread_once(&SHA256_detectOnce, SHA256_Detect);
+#ifdef SHA256_X86
+    if (SHA256_used & SHA256_SHANI) {
+        SHA256_CompressShaNi(h, blocks, nBlocks);
+        return;
+    }
+#endif
+    SHA256_CompressScalar(h, blocks, nBlocks);
+}
+
+#ifdef SHA256_X86
+__attribute__((target("sha,sse4.1,ssse3")))
+void SHA256_CompressShaNi(uint32_t h[], const byte blocks[], size_t nBlocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // the rounds instruction keeps the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &h[0]), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &h[4]), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (size_t n = 0; n < nBlocks; n++, blocks += SHA256_BLOCK_SIZE) {
+        __m128i saved0 = state0, saved1 = state1;
+        __m128i m[4];
+        // each group runs 4 rounds, and works ahead on the message
+        // schedule of the groups that follow. unrolled, so m stays in
+        // registers
+#pragma GCC unroll 16
+        for (size_t g = 0; g < 16; g++) {
+            if (g < 4) {
+                m[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (blocks + 16 * g)), mask);
+            }
+            __m128i msg = _mm_add_epi32(m[g % 4], _mm_loadu_si128((const __m128i*) &SHA256_k[4 * g]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            if (g >= 3 && g <= 14) {
+                tmp = _mm_alignr_epi8(m[g % 4], m[(g + 3) % 4], 4);
+                m[(g + 1) % 4] = _mm_sha256msg2_epu32(_mm_add_epi32(m[(g + 1) % 4], tmp), m[g % 4]);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if (g >= 1 && g <= 12) {
+                m[(g + 3) % 4] = _mm_sha256msg1_epu32(m[(g + 3) % 4], m[g % 4]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    _mm_storeu_si128((__m128i*) &h[0], _mm_blend_epi16(tmp, state1, 0xf0));
+    _mm_storeu_si128((__m128i*) &h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+// transposes an 8x8 matrix of 32-bit words held in 8 rows
+__attribute__((target("avx2")))
+static inline void SHA256_Transpose8(__m256i r[]) {
+    __m256i t[8], u[8];
+    for (size_t i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (size_t i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+#define SHA256_ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("avx2")))
+void SHA256_Compress8(uint32_t h[], const byte* const blocks[], size_t nBlocks) {
+    const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    // s[i] holds word i of the 8 states
+    __m256i s[8];
+    for (size_t i = 0; i < 8; i++) {
+        s[i] = _mm256_loadu_si256((const __m256i*) (h + 8 * i));
+    }
+    SHA256_Transpose8(s);
+
+    for (size_t n = 0; n < nBlocks; n++) {
+        __m256i w[64];
+        for (size_t half = 0; half < 2; half++) {
+            for (size_t i = 0; i < 8; i++) {
+                w[8 * half + i] = _mm256_loadu_si256((const __m256i*) (blocks[i] + n * SHA256_BLOCK_SIZE + 32 * half));
+            }
+            SHA256_Transpose8(w + 8 * half);
+            for (size_t i = 0; i < 8; i++) {
+                w[8 * half + i] = _mm256_shuffle_epi8(w[8 * half + i], bswap);
+            }
+        }
+        for (size_t i = 16; i < 64; i++) {
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(w[i - 15], 7), SHA256_ROTR8(w[i - 15], 18)),
+                                          _mm256_srli_epi32(w[i - 15], 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(w[i - 2], 17), SHA256_ROTR8(w[i - 2], 19)),
+                                          _mm256_srli_epi32(w[i - 2], 10));
+            w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i - 16], s0), _mm256_add_epi32(w[i - 7], s1));
+        }
+
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+        __m256i e = s[4], f = s[5], g = s[6], k = s[7];
+        for (size_t i = 0; i < 64; i++) {
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(e, 6), SHA256_ROTR8(e, 11)), SHA256_ROTR8(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(k, s1), _mm256_add_epi32(ch, w[i]));
+            t1 = _mm256_add_epi32(t1, _mm256_set1_epi32((int) SHA256_k[i]));
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(a, 2), SHA256_ROTR8(a, 13)), SHA256_ROTR8(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            k = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, _mm256_add_epi32(s0, maj));
+        }
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], k);
+    }
+
+    SHA256_Transpose8(s);
+    for (size_t i = 0; i < 8; i++) {
+        _mm256_storeu_si256((__m256i*) (h + 8 * i), s[i]);
+    }
+}
+
+#undef SHA256_ROTR8
+#endif
+
+void SHA256_Init(SHA256_Ctx* ctx) {
+    memcpy(ctx->h, SHA256_h0, sizeof(SHA256_h0));
+    ctx->nBytes = 0;
+}
+
+void SHA256_Update(SHA256_Ctx* ctx, const byte data[], size_t nBytes) {
+    size_t nBuffered = ctx->nBytes % SHA256_BLOCK_SIZE;
+    ctx->nBytes += nBytes;
+    if (nBuffered) {
+        size_t n = SHA256_BLOCK_SIZE - nBuffered;
+        if (nBytes < n) {
+            memcpy(ctx->buf + nBuffered, data, nBytes);
+            return;
+        }
+        memcpy(ctx->buf + nBuffered, data, n);
+        SHA256_Compress(ctx->h, ctx->buf, 1);
+        data += n;
+        nBytes -= n;
+    }
+    // whole blocks are hashed straight from the input
+    size_t nBlocks = nBytes / SHA256_BLOCK_SIZE;
+    SHA256_Compress(ctx->h, data, nBlocks);
+    memcpy(ctx->buf, data + nBlocks * SHA256_BLOCK_SIZE, nBytes % SHA256_BLOCK_SIZE);
+}
+
+void SHA256_Final(SHA256_Ctx* ctx, byte digest[]) {
+    // a 1 bit, zeros, and the length in bits in the last 8 bytes
+    uint64_t nBits = ctx->nBytes * 8;
+    size_t nBuffered = ctx->nBytes % SHA256_BLOCK_SIZE;
+    byte pad[2 * SHA256_BLOCK_SIZE];
+    size_t nPad = (nBuffered < SHA256_BLOCK_SIZE - 8) ? SHA256_BLOCK_SIZE - nBuffered : 2 * SHA256_BLOCK_SIZE - nBuffered;
+    memset(pad, 0, nPad);
+    pad[0] = 0x80;
+    for (size_t i = 0; i < 8; i++) {
+        pad[nPad - 1 - i] = (byte) (nBits >> (8 * i));
+    }
+    SHA256_Update(ctx, pad, nPad);
+    for (size_t i = 0; i < 8; i++) {
+        SHA256_Store32(digest + 4 * i, ctx->h[i]);
+    }
+    memset(ctx, 0, sizeof(SHA256_Ctx));
+}
+
+void SHA256_Hash(const byte data[], size_t nBytes, byte digest[]) {
+    SHA256_Ctx ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, data, nBytes);
+    SHA256_Final(&ctx, digest);
+}
+
+void SHA256_HashBatch(const byte* const data[], const size_t sizes[], size_t n, byte digests[]) {
+    size_t i = 0;
+#ifdef SHA256_X86
+    // with SHA-NI, one message at a time beats 8 lanes of AVX2
+    pthread_once(&SHA256_detectOnce, SHA256_Detect);
+    for (; (SHA256_used & SHA256_AVX2) && !(SHA256_used & SHA256_SHANI) && i + 1 < n; i += 8) {
+        // the lanes run the blocks that all their messages have; spare
+        // lanes repeat the first message
+        size_t nLanes = (n - i < 8) ? n - i : 8;
+        const byte* blocks[8];
+        size_t nBlocks = sizes[i] / SHA256_BLOCK_SIZE;
+        for (size_t j = 0; j < 8; j++) {
+            size_t k = (j < nLanes) ? i + j : i;
+            blocks[j] = data[k];
+            if (sizes[k] / SHA256_BLOCK_SIZE < nBlocks) {
+                nBlocks = sizes[k] / SHA256_BLOCK_SIZE;
+            }
+        }
+        uint32_t h[8 * 8];
+        for (size_t j = 0; j < 8; j++) {
+            memcpy(h + 8 * j, SHA256_h0, sizeof(SHA256_h0));
+        }
+        SHA256_Compress8(h, blocks, nBlocks);
+
+        // each message is finished on its own
+        for (size_t j = 0; j < nLanes; j++) {
+            SHA256_Ctx ctx;
+            memcpy(ctx.h, h + 8 * j, sizeof(ctx.h));
+            ctx.nBytes = nBlocks * SHA256_BLOCK_SIZE;
+            SHA256_Update(&ctx, data[i + j] + ctx.nBytes, sizes[i + j] - ctx.nBytes);
+            SHA256_Final(&ctx, digests + (i + j) * SHA256_DIGEST_SIZE);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        SHA256_Hash(data[i], sizes[i], digests + i * SHA256_DIGEST_SIZE);
+    }
+}
+
+void SHA256_HmacInit(SHA256_HmacCtx* ctx, const byte key[], size_t keySize) {
+    // keys longer than a block are hashed first
+    byte block[SHA256_BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+    if (keySize > SHA256_BLOCK_SIZE) {
+        SHA256_Hash(key, keySize, block);
+    } else {
+        memcpy(block, key, keySize);
+    }
+
+    for (size_t i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        block[i] ^= 0x36;
+    }
+    SHA256_Init(&ctx->inner);
+    SHA256_Update(&ctx->inner, block, SHA256_BLOCK_SIZE);
+    for (size_t i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        block[i] ^= 0x36 ^ 0x5c;
+    }
+    SHA256_Init(&ctx->outer);
+    SHA256_Update(&ctx->outer, block, SHA256_BLOCK_SIZE);
+    memset(block, 0, sizeof(block));
+}
+
+void SHA256_HmacUpdate(SHA256_HmacCtx* ctx, const byte data[], size_t nBytes) {
+    SHA256_Update(&ctx->inner, data, nBytes);
+}
+
+void SHA256_HmacFinal(SHA256_HmacCtx* ctx, byte mac[]) {
+    byte digest[SHA256_DIGEST_SIZE];
+    SHA256_Final(&ctx->inner, digest);
+    SHA256_Update(&ctx->outer, digest, SHA256_DIGEST_SIZE);
+    SHA256_Final(&ctx->outer, mac);
+    memset(digest, 0, sizeof(digest));
+}
+
+void SHA256_Hmac(const byte key[], size_t keySize, const byte data[], size_t nBytes, byte mac[]) {
+    SHA256_HmacCtx ctx;
+    SHA256_HmacInit(&ctx, key, keySize);
+    SHA256_HmacUpdate(&ctx, data, nBytes);
+    SHA256_HmacFinal(&ctx, mac);
+}
+
+#endif  // CC_SHA256_H_
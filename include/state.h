@@ -0,0 +1,430 @@
+#ifndef CC_STATE_H_
+#define CC_STATE_H_
+
+// a state database for recurring batches (see batch.h). for every input
+// that was processed successfully, it records the size and mtime of the
+// input, the job that produced the output (operation, range, output,
+// key), and a hash of the input's contents. a job whose record still
+// matches is skipped, so a recurring batch only pays for the files that
+// changed.
+//
+// size and mtime decide on their own unless they are ambiguous:
+//   - the mtime changed but the size did not (e.g., the file was touched
+//     or rewritten with the same contents), or
+//   - the mtime was not older than the second in which it was recorded,
+//     so the file could have been modified again within the same second
+//     without changing its mtime ("racy" timestamps).
+// only then is the input hashed (XXH64) and compared with the recorded
+// hash; a record without a hash cannot be compared, so its job runs,
+// but it gets a hash for the next time. an input whose job runs for
+// any other reason is only hashed if its new timestamp is racy, since
+// the next run cannot decide by size and mtime alone. inputs are
+// hashed before their jobs run, so a hash never describes newer
+// contents than the output.
+//
+// records are keyed by input file, so an input should appear in only one
+// job of a batch. the database is a single file, replaced atomically
+// when saved.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "batch.h"
+#include "incremental.h"
+#include "xxhash.h"
+
+#define CRYPT_STATE_MAGIC "CSTA"
+#define CRYPT_STATE_VERSION 1
+
+// record flags
+#define CRYPT_STATE_HASHED 0x0001  // hash holds the hash of the input
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t nRecords;
+} Crypt_StateHeader;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtimeSec, mtimeNsec;
+    int64_t checkedAt;  // when size and mtime were taken (seconds since the epoch)
+    uint64_t hash;
+    uint64_t keyCheck;  // see Crypt_KeyCheck
+    uint64_t firstByte, lastByte;
+    uint32_t op;
+    uint32_t flags;
+    uint32_t inLen, outLen;  // followed by the input and output names, each NUL-terminated
+} Crypt_StateEntry;
+
+typedef struct {
+    Crypt_StateEntry entry;
+    char* fnameIn;
+    char* fnameOut;
+    bool valid;  // false once the record was removed
+} Crypt_StateRecord;
+
+typedef struct {
+    Crypt_StateRecord* records;
+    size_t nRecords, capRecords;
+    // open addressing table of record index + 1 by input name (0 is empty)
+    size_t* table;
+    size_t tableSize;
+} Crypt_State;
+
+// reads the database in fname. a missing file gives an empty database
+Crypt_Error_t Crypt_StateLoad(Crypt_State* state, const char* fname);
+Crypt_Error_t Crypt_StateSave(const Crypt_State* state, const char* fname);
+void Crypt_StateFree(Crypt_State* state);
+// returns the record of the input fnameIn, or NULL
+Crypt_StateRecord* Crypt_StateFind(const Crypt_State* state, const char* fnameIn);
+// adds or replaces the record of fnameIn
+Crypt_Error_t Crypt_StatePut(Crypt_State* state, const Crypt_StateEntry* entry,
+                             const char* fnameIn, const char* fnameOut);
+
+// marks the jobs of batch whose inputs are unchanged as skipped. fresh
+// receives one entry per job, to be recorded by Crypt_StateUpdate.
+// nHashed (may be NULL) receives the number of inputs that were hashed
+Crypt_Error_t Crypt_StateSkipUnchanged(const Crypt_State* state, Crypt_Batch* batch,
+                                       Crypt_StateEntry fresh[], size_t* nHashed);
+// records the jobs that succeeded (or were skipped), and removes the
+// records of jobs that failed, whose outputs may be incomplete
+Crypt_Error_t Crypt_StateUpdate(Crypt_State* state, const Crypt_Batch* batch, const Crypt_StateEntry fresh[]);
+
+// internal helpers
+Crypt_Error_t Crypt_HashFile(const char* fname, uint64_t* hash);
+Crypt_Error_t Crypt_StateGrowTable(Crypt_State* state);
+
+Crypt_Error_t Crypt_HashFile(const char* fname, uint64_t* hash) {
+    // XXH64 has no streaming interface here, so hash every chunk and
+    // then the list of chunk hashes
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        return CRYPT_E_IO;
+    }
+    byte* buf = (byte*) malloc(CRYPT_CHUNK_SIZE);
+    uint64_t* hashes = NULL;
+    size_t nHashes = 0, capHashes = 0;
+    Crypt_Error_t err = (buf) ? CRYPT_E_SUCCESS : CRYPT_E_MEMORY_ALLOCATION;
+    while (err == CRYPT_E_SUCCESS) {
+        size_t nRead = fread(buf, sizeof(byte), CRYPT_CHUNK_SIZE, file);
+        if (nRead == 0) {
+            if (ferror(file)) {
+                err = CRYPT_E_IO;
+            }
+            break;
+        }
+        if (nHashes == capHashes) {
+            capHashes = (capHashes) ? 2 * capHashes : 16;
+            uint64_t* grown = (uint64_t*) realloc(hashes, capHashes * sizeof(uint64_t));
+            if (!grown) {
+                err = CRYPT_E_MEMORY_ALLOCATION;
+                break;
+            }
+            hashes = grown;
+        }
+        hashes[nHashes++] = XXH_Hash64(buf, nRead, 0);
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        *hash = XXH_Hash64((const byte*) hashes, nHashes * sizeof(uint64_t), 0);
+    }
+    free(hashes);
+    free(buf);
+    fclose(file);
+    return err;
+}
+
+Crypt_Error_t Crypt_StateGrowTable(Crypt_State* state) {
+    size_t size = (state->tableSize) ? 2 * state->tableSize : CRYPT_KEY_TABLE_INIT_SIZE;
+    size_t* table = (size_t*) calloc(size, sizeof(size_t));
+    if (!table) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    for (size_t i = 0; i < state->nRecords; i++) {
+        const char* name = state->records[i].fnameIn;
+        size_t slot = XXH_Hash64((const byte*) name, strlen(name), 0) & (size - 1);
+        while (table[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+    free(state->table);
+    state->table = table;
+    state->tableSize = size;
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_StateRecord* Crypt_StateFind(const Crypt_State* state, const char* fnameIn) {
+    if (state->tableSize == 0) {
+        return NULL;
+    }
+    size_t slot = XXH_Hash64((const byte*) fnameIn, strlen(fnameIn), 0) & (state->tableSize - 1);
+    while (state->table[slot]) {
+        Crypt_StateRecord* record = &state->records[state->table[slot] - 1];
+        if (strcmp(record->fnameIn, fnameIn) == 0) {
+            return (record->valid) ? record : NULL;
+        }
+        slot = (slot + 1) & (state->tableSize - 1);
+    }
+    return NULL;
+}
+
+Crypt_Error_t Crypt_StatePut(Crypt_State* state, const Crypt_StateEntry* entry,
+                             const char* fnameIn, const char* fnameOut) {
+    char* out = strdup(fnameOut);
+    if (!out) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+
+    // a removed record is still in the table, so look it up directly
+    Crypt_StateRecord* record = NULL;
+    if (state->tableSize) {
+        size_t slot = XXH_Hash64((const byte*) fnameIn, strlen(fnameIn), 0) & (state->tableSize - 1);
+        while (state->table[slot] && !record) {
+            Crypt_StateRecord* candidate = &state->records[state->table[slot] - 1];
+            if (strcmp(candidate->fnameIn, fnameIn) == 0) {
+                record = candidate;
+            }
+            slot = (slot + 1) & (state->tableSize - 1);
+        }
+    }
+
+    if (!record) {
+        // keep the table at most half full
+        Crypt_Error_t err = CRYPT_E_SUCCESS;
+        if (2 * (state->nRecords + 1) > state->tableSize) {
+            err = Crypt_StateGrowTable(state);
+        }
+        if (err == CRYPT_E_SUCCESS && state->nRecords == state->capRecords) {
+            size_t capacity = (state->capRecords) ? 2 * state->capRecords : 64;
+            Crypt_StateRecord* records = (Crypt_StateRecord*) realloc(state->records, capacity * sizeof(Crypt_StateRecord));
+            if (records) {
+                state->records = records;
+                state->capRecords = capacity;
+            } else {
+                err = CRYPT_E_MEMORY_ALLOCATION;
+            }
+        }
+        char* in = (err == CRYPT_E_SUCCESS) ? strdup(fnameIn) : NULL;
+        if (!in) {
+            free(out);
+            return (err == CRYPT_E_SUCCESS) ? CRYPT_E_MEMORY_ALLOCATION : err;
+        }
+
+        size_t slot = XXH_Hash64((const byte*) in, strlen(in), 0) & (state->tableSize - 1);
+        while (state->table[slot]) {
+            slot = (slot + 1) & (state->tableSize - 1);
+        }
+        state->table[slot] = state->nRecords + 1;
+        record = &state->records[state->nRecords++];
+        record->fnameIn = in;
+        record->fnameOut = NULL;
+    }
+
+    free(record->fnameOut);
+    record->fnameOut = out;
+    record->entry = *entry;
+    record->entry.inLen = (uint32_t) strlen(record->fnameIn);
+    record->entry.outLen = (uint32_t) strlen(out);
+    record->valid = true;
+    return CRYPT_E_SUCCESS;
+}
+
+void Crypt_StateFree(Crypt_State* state) {
+    for (size_t i = 0; i < state->nRecords; i++) {
+        free(state->records[i].fnameIn);
+        free(state->records[i].fnameOut);
+    }
+    free(state->records);
+    free(state->table);
+    memset(state, 0, sizeof(Crypt_State));
+}
+
+Crypt_Error_t Crypt_StateLoad(Crypt_State* state, const char* fname) {
+    memset(state, 0, sizeof(Crypt_State));
+    FILE* file = fopen(fname, "rb");
+    if (!file) {
+        // the first run
+        return (access(fname, F_OK) != 0) ? CRYPT_E_SUCCESS : CRYPT_E_IO;
+    }
+
+    Crypt_StateHeader hdr;
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (fread(&hdr, sizeof(Crypt_StateHeader), 1, file) != 1 ||
+        memcmp(hdr.magic, CRYPT_STATE_MAGIC, 4) != 0 || hdr.version != CRYPT_STATE_VERSION) {
+        err = CRYPT_E_FORMAT;
+    }
+
+    char* names = NULL;
+    size_t capNames = 0;
+    for (uint64_t i = 0; err == CRYPT_E_SUCCESS && i < hdr.nRecords; i++) {
+        Crypt_StateEntry entry;
+        if (fread(&entry, sizeof(Crypt_StateEntry), 1, file) != 1) {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        size_t nNames = (size_t) entry.inLen + entry.outLen + 2;
+        if (nNames > capNames) {
+            char* grown = (char*) realloc(names, nNames);
+            if (!grown) {
+                err = CRYPT_E_MEMORY_ALLOCATION;
+                break;
+            }
+            names = grown;
+            capNames = nNames;
+        }
+        if (fread(names, sizeof(char), nNames, file) != nNames ||
+            names[entry.inLen] != '\0' || names[nNames - 1] != '\0') {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        err = Crypt_StatePut(state, &entry, names, names + entry.inLen + 1);
+    }
+
+    free(names);
+    fclose(file);
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_StateFree(state);
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_StateSave(const Crypt_State* state, const char* fname) {
+    // written next to the database and renamed over it, so the database
+    // is always either the old or the new version
+    size_t nameLen = strlen(fname);
+    char* fnameTmp = (char*) malloc(nameLen + 5);
+    if (!fnameTmp) {
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    memcpy(fnameTmp, fname, nameLen);
+    memcpy(fnameTmp + nameLen, ".tmp", 5);
+
+    Crypt_StateHeader hdr;
+    memset(&hdr, 0, sizeof(Crypt_StateHeader));
+    memcpy(hdr.magic, CRYPT_STATE_MAGIC, 4);
+    hdr.version = CRYPT_STATE_VERSION;
+    for (size_t i = 0; i < state->nRecords; i++) {
+        hdr.nRecords += state->records[i].valid;
+    }
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    FILE* file = fopen(fnameTmp, "wb");
+    if (!file) {
+        err = CRYPT_E_IO;
+    } else {
+        if (fwrite(&hdr, sizeof(Crypt_StateHeader), 1, file) != 1) {
+            err = CRYPT_E_IO;
+        }
+        for (size_t i = 0; err == CRYPT_E_SUCCESS && i < state->nRecords; i++) {
+            const Crypt_StateRecord* record = &state->records[i];
+            if (!record->valid) {
+                continue;
+            }
+            if (fwrite(&record->entry, sizeof(Crypt_StateEntry), 1, file) != 1 ||
+                fwrite(record->fnameIn, sizeof(char), record->entry.inLen + 1, file) != record->entry.inLen + 1 ||
+                fwrite(record->fnameOut, sizeof(char), record->entry.outLen + 1, file) != record->entry.outLen + 1) {
+                err = CRYPT_E_IO;
+            }
+        }
+        if (err == CRYPT_E_SUCCESS && (fflush(file) != 0 || fdatasync(fileno(file)) != 0)) {
+            err = CRYPT_E_IO;
+        }
+        if (fclose(file) != 0) {
+            err = CRYPT_E_IO;
+        }
+        if (err == CRYPT_E_SUCCESS && rename(fnameTmp, fname) != 0) {
+            err = CRYPT_E_IO;
+        }
+    }
+    if (err != CRYPT_E_SUCCESS) {
+        remove(fnameTmp);
+    }
+    free(fnameTmp);
+    return err;
+}
+
+Crypt_Error_t Crypt_StateSkipUnchanged(const Crypt_State* state, Crypt_Batch* batch,
+                                       Crypt_StateEntry fresh[], size_t* nHashed) {
+    int64_t now = (int64_t) time(NULL);
+    size_t hashed = 0;
+
+    for (size_t i = 0; i < batch->nJobs; i++) {
+        Crypt_Job* job = &batch->jobs[i];
+        const Crypt_BatchKey* key = job->key;
+        Crypt_StateEntry* entry = &fresh[i];
+        memset(entry, 0, sizeof(Crypt_StateEntry));
+        job->skip = false;
+
+        struct stat st;
+        if (key->err != CRYPT_E_SUCCESS || stat(job->fnameIn, &st) != 0) {
+            // the job fails on its own
+            continue;
+        }
+        entry->size = (uint64_t) st.st_size;
+        entry->mtimeSec = (int64_t) st.st_mtim.tv_sec;
+        entry->mtimeNsec = (int64_t) st.st_mtim.tv_nsec;
+        entry->checkedAt = now;
+        entry->keyCheck = Crypt_KeyCheck(&key->ctx);
+        entry->firstByte = job->firstByte;
+        entry->lastByte = job->lastByte;
+        entry->op = (uint32_t) job->op;
+
+        const Crypt_StateRecord* record = Crypt_StateFind(state, job->fnameIn);
+        const Crypt_StateEntry* old = (record) ? &record->entry : NULL;
+        bool sameJob = old && old->op == entry->op && old->keyCheck == entry->keyCheck &&
+                       old->firstByte == entry->firstByte && old->lastByte == entry->lastByte &&
+                       strcmp(record->fnameOut, job->fnameOut) == 0 &&
+                       access(job->fnameOut, F_OK) == 0;
+        bool sameMtime = sameJob && old->mtimeSec == entry->mtimeSec && old->mtimeNsec == entry->mtimeNsec;
+
+        if (sameJob && old->size == entry->size && sameMtime && old->mtimeSec < old->checkedAt) {
+            // unambiguous: carry the old record over
+            job->skip = true;
+            *entry = *old;
+        } else if (sameJob && old->size == entry->size) {
+            // ambiguous, so compare the contents
+            if (Crypt_HashFile(job->fnameIn, &entry->hash) == CRYPT_E_SUCCESS) {
+                entry->flags |= CRYPT_STATE_HASHED;
+                job->skip = (old->flags & CRYPT_STATE_HASHED) && entry->hash == old->hash;
+                hashed++;
+            }
+        } else if (entry->mtimeSec >= now) {
+            // the job runs, and its timestamp will be ambiguous next time
+            if (Crypt_HashFile(job->fnameIn, &entry->hash) == CRYPT_E_SUCCESS) {
+                entry->flags |= CRYPT_STATE_HASHED;
+                hashed++;
+            }
+        }
+    }
+
+    if (nHashed) {
+        *nHashed = hashed;
+    }
+    return CRYPT_E_SUCCESS;
+}
+
+Crypt_Error_t Crypt_StateUpdate(Crypt_State* state, const Crypt_Batch* batch, const Crypt_StateEntry fresh[]) {
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    for (size_t i = 0; err == CRYPT_E_SUCCESS && i < batch->nJobs; i++) {
+        const Crypt_Job* job = &batch->jobs[i];
+        if (job->err == CRYPT_E_SUCCESS && fresh[i].checkedAt != 0) {
+            err = Crypt_StatePut(state, &fresh[i], job->fnameIn, job->fnameOut);
+        } else if (job->err != CRYPT_E_SUCCESS) {
+            Crypt_StateRecord* record = Crypt_StateFind(state, job->fnameIn);
+            if (record) {
+                record->valid = false;
+            }
+        }
+    }
+    return err;
+}
+
+#endif  // CC_STATE_H_
@@ -0,0 +1,219 @@
+#ifndef CC_STATS_H_
+#define CC_STATS_H_
+
+// counters for where the time of an encipher or decipher operation goes:
+// loading the key, copying the bytes outside the range, transforming
+// the range and its padded final block. the range is transformed a
+// buffer at a time, and reading it (with stdio), running AES on it and
+// writing it out are separate phases, so the cipher is timed apart from
+// the I/O around it. with digests, the reads and writes include hashing.
+// each phase records its calls, bytes, wall time and CPU time; the
+// whole run adds the process CPU time, read and write syscalls and peak
+// RSS.
+//
+// recording is off unless Crypt_StatsStart was called, and costs two
+// clock readings per phase and buffer (not per block) when it is on:
+//
+//     Crypt_Stats stats;
+//     Crypt_StatsStart(&stats);
+//     Crypt_EncipherRange(...);
+//     Crypt_StatsStop(&stats);
+//     Crypt_PrintStats(stderr, &stats, false);
+//
+// the phases are recorded by the calling thread only, and only one run
+// may record at a time.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+typedef enum {
+    CRYPT_PHASE_KEY,
+    CRYPT_PHASE_COPY,
+    CRYPT_PHASE_READ,  // of the range
+    CRYPT_PHASE_CIPHER,
+    CRYPT_PHASE_WRITE,  // of the range
+    CRYPT_PHASE_PAD,
+    CRYPT_N_PHASES
+} Crypt_Phase;
+
+typedef struct {
+    uint64_t nCalls;
+    uint64_t nBytes;
+    uint64_t wallNs;
+    uint64_t cpuNs;  // of the calling thread
+} Crypt_PhaseStats;
+
+typedef struct {
+    Crypt_PhaseStats phases[CRYPT_N_PHASES];
+    uint64_t wallNs;
+    uint64_t cpuNs;  // of the process, user and system
+    int64_t nReads;  // read syscalls, or -1 if unknown
+    int64_t nWrites;  // write syscalls, or -1 if unknown
+    uint64_t peakRssKiB;
+} Crypt_Stats;
+
+// the start of a phase (zero if recording is off)
+typedef struct {
+    uint64_t wallNs;
+    uint64_t cpuNs;
+} Crypt_StatsMark;
+
+// the run the calling thread records into, or NULL
+__thread Crypt_Stats* Crypt_stats = NULL;
+
+// clears stats and records into it until Crypt_StatsStop
+void Crypt_StatsStart(Crypt_Stats* stats);
+// stops recording and fills in the totals of the run
+void Crypt_StatsStop(Crypt_Stats* stats);
+Crypt_StatsMark Crypt_PhaseBegin(void);
+// adds the time since mark and nBytes to phase
+void Crypt_PhaseEnd(Crypt_Phase phase, Crypt_StatsMark mark, size_t nBytes);
+// writes stats as a table, or as a JSON object if json is true
+void Crypt_PrintStats(FILE* file, const Crypt_Stats* stats, bool json);
+
+// internal helpers
+uint64_t Crypt_StatsClock(clockid_t clock);
+uint64_t Crypt_StatsProcessCpu(void);
+// reads the read and write syscall counts of the process from
+// /proc/self/io, or returns false if it is unavailable
+bool Crypt_StatsSyscalls(int64_t* nReads, int64_t* nWrites);
+double Crypt_StatsMBps(uint64_t nBytes, uint64_t ns);
+
+const char* Crypt_phaseNames[CRYPT_N_PHASES] = {"key", "copy", "read", "cipher", "write", "pad"};
+
+void Crypt_StatsStart(Crypt_Stats* stats) {
+    memset(stats, 0, sizeof(Crypt_Stats));
+    if (!Crypt_StatsSyscalls(&stats->nReads, &stats->nWrites)) {
+        stats->nReads = stats->nWrites = -1;
+    }
+    stats->cpuNs = Crypt_StatsProcessCpu();
+    stats->wallNs = Crypt_StatsClock(CLOCK_MONOTONIC);
+    Crypt_stats = stats;
+}
+
+void Crypt_StatsStop(Crypt_Stats* stats) {
+    Crypt_stats = NULL;
+    // the start values were stored in the totals
+    stats->wallNs = Crypt_StatsClock(CLOCK_MONOTONIC) - stats->wallNs;
+    stats->cpuNs = Crypt_StatsProcessCpu() - stats->cpuNs;
+    int64_t nReads, nWrites;
+    if (stats->nReads >= 0 && Crypt_StatsSyscalls(&nReads, &nWrites)) {
+        stats->nReads = nReads - stats->nReads;
+        stats->nWrites = nWrites - stats->nWrites;
+    } else {
+        stats->nReads = stats->nWrites = -1;
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // in KiB on linux
+        stats->peakRssKiB = (uint64_t) usage.ru_maxrss;
+    }
+}
+
+Crypt_StatsMark Crypt_PhaseBegin(void) {
+    Crypt_StatsMark mark = {0, 0};
+    if (Crypt_stats) {
+        mark.wallNs = Crypt_StatsClock(CLOCK_MONOTONIC);
+        mark.cpuNs = Crypt_StatsClock(CLOCK_THREAD_CPUTIME_ID);
+    }
+    return mark;
+}
+
+void Crypt_PhaseEnd(Crypt_Phase phase, Crypt_StatsMark mark, size_t nBytes) {
+    // a phase that began before recording started is not counted
+    if (!Crypt_stats || mark.wallNs == 0) {
+        return;
+    }
+    Crypt_PhaseStats* p = &Crypt_stats->phases[phase];
+    p->nCalls++;
+    p->nBytes += nBytes;
+    p->wallNs += Crypt_StatsClock(CLOCK_MONOTONIC) - mark.wallNs;
+    p->cpuNs += Crypt_StatsClock(CLOCK_THREAD_CPUTIME_ID) - mark.cpuNs;
+}
+
+void Crypt_PrintStats(FILE* file, const Crypt_Stats* stats, bool json) {
+    // the bytes of the range are read, ciphered and written, so they
+    // are only counted once
+    uint64_t nBytes = 0;
+    for (size_t i = 0; i < CRYPT_N_PHASES; i++) {
+        if (i == CRYPT_PHASE_COPY || i == CRYPT_PHASE_CIPHER || i == CRYPT_PHASE_PAD) {
+            nBytes += stats->phases[i].nBytes;
+        }
+    }
+    if (json) {
+        fprintf(file, "{\"phases\": {");
+        for (size_t i = 0; i < CRYPT_N_PHASES; i++) {
+            const Crypt_PhaseStats* p = &stats->phases[i];
+            fprintf(file, "%s\"%s\": {\"calls\": %llu, \"bytes\": %llu, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"mb_per_s\": %.1f}",
+                    (i == 0) ? "" : ", ", Crypt_phaseNames[i], (unsigned long long) p->nCalls,
+                    (unsigned long long) p->nBytes, p->wallNs / 1e6, p->cpuNs / 1e6, Crypt_StatsMBps(p->nBytes, p->wallNs));
+        }
+        fprintf(file, "}, \"total\": {\"bytes\": %llu, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"mb_per_s\": %.1f}",
+                (unsigned long long) nBytes, stats->wallNs / 1e6, stats->cpuNs / 1e6, Crypt_StatsMBps(nBytes, stats->wallNs));
+        if (stats->nReads >= 0) {
+            fprintf(file, ", \"syscalls\": {\"read\": %lld, \"write\": %lld}", (long long) stats->nReads, (long long) stats->nWrites);
+        }
+        fprintf(file, ", \"peak_rss_kib\": %llu}\n", (unsigned long long) stats->peakRssKiB);
+        return;
+    }
+
+    fprintf(file, "%-10s %8s %14s %11s %11s %10s\n", "phase", "calls", "bytes", "wall ms", "cpu ms", "MB/s");
+    for (size_t i = 0; i < CRYPT_N_PHASES; i++) {
+        const Crypt_PhaseStats* p = &stats->phases[i];
+        fprintf(file, "%-10s %8llu %14llu %11.3f %11.3f %10.1f\n", Crypt_phaseNames[i], (unsigned long long) p->nCalls,
+                (unsigned long long) p->nBytes, p->wallNs / 1e6, p->cpuNs / 1e6, Crypt_StatsMBps(p->nBytes, p->wallNs));
+    }
+    fprintf(file, "%-10s %8s %14llu %11.3f %11.3f %10.1f\n", "total", "", (unsigned long long) nBytes,
+            stats->wallNs / 1e6, stats->cpuNs / 1e6, Crypt_StatsMBps(nBytes, stats->wallNs));
+    if (stats->nReads >= 0) {
+        fprintf(file, "syscalls: %lld read, %lld write\n", (long long) stats->nReads, (long long) stats->nWrites);
+    }
+    fprintf(file, "peak RSS: %llu KiB\n", (unsigned long long) stats->peakRssKiB);
+}
+
+uint64_t Crypt_StatsClock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t Crypt_StatsProcessCpu(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return ((uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ull +
+            (uint64_t) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)) * 1000ull;
+}
+
+bool Crypt_StatsSyscalls(int64_t* nReads, int64_t* nWrites) {
+    FILE* file = fopen("/proc/self/io", "r");
+    if (!file) {
+        return false;
+    }
+    char line[64];
+    int found = 0;
+    long long n;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "syscr: %lld", &n) == 1) {
+            *nReads = n;
+            found++;
+        } else if (sscanf(line, "syscw: %lld", &n) == 1) {
+            *nWrites = n;
+            found++;
+        }
+    }
+    fclose(file);
+    return found == 2;
+}
+
+double Crypt_StatsMBps(uint64_t nBytes, uint64_t ns) {
+    return ns ? nBytes * 1e3 / ns : 0.0;
+}
+
+#endif  // CC_STATS_H_
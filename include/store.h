@@ -0,0 +1,570 @@
+#ifndef CC_STORE_H_
+#define CC_STORE_H_
+
+// convergent encryption into a content-addressed chunk store, so files
+// that share data (e.g., successive backups) share its chunks.
+//
+// - the input is split into content-defined chunks: a cut is made where
+//   a gear hash of the last 64 bytes has its top CRYPT_CDC_AVG_BITS bits
+//   clear, so an insertion or deletion only moves the cuts around it.
+// - each chunk is enciphered with a key derived from its contents: an
+//   HMAC of its SHA-256 under a secret derived from the user's key
+//   with HMAC (see Crypt_SubKey), never with the cipher itself. the
+//   same chunk always gets the same key (and ciphertext) under the same
+//   user key, but chunks cannot be confirmed without that key.
+// - a chunk is stored once, as a chunk header and payload (see
+//   Crypt_EncipherChunk) in dirStore/xx/yyyy..., named by the SHA-256 of
+//   its key. a chunk that is already in the store is neither enciphered
+//   nor written again.
+// - a recipe lists the chunks of a file in order, each with its key
+//   wrapped under the user's key (see keywrap.h).
+//
+// restoring unwraps each key, deciphers the chunk and checks that its
+// contents derive the same key, so a damaged or swapped chunk fails with
+// CRYPT_E_INTEGRITY. chunks are never removed from the store.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ciph.h"
+#include "container.h"
+#include "keywrap.h"
+
+// chunks are at least CRYPT_CDC_MIN_SIZE bytes (except the last), at
+// most CRYPT_CDC_MAX_SIZE, and about 2^CRYPT_CDC_AVG_BITS bytes longer
+// than the minimum on average
+#define CRYPT_CDC_MIN_SIZE (16 * 1024)
+#define CRYPT_CDC_MAX_SIZE (256 * 1024)
+#define CRYPT_CDC_AVG_BITS 16
+#define CRYPT_CDC_MASK ((((uint64_t) 1 << CRYPT_CDC_AVG_BITS) - 1) << (64 - CRYPT_CDC_AVG_BITS))
+// bytes that affect the gear hash
+#define CRYPT_CDC_WINDOW 64
+
+#define CRYPT_STORE_ID_SIZE SHA256_DIGEST_SIZE
+#define CRYPT_STORE_KEY_SIZE SHA256_DIGEST_SIZE
+
+#define CRYPT_RECIPE_MAGIC "CREC"
+// 2: the chunk key secret is derived with HMAC (see Crypt_StoreSecret)
+#define CRYPT_RECIPE_VERSION 2
+
+// NOTE: recipes are written as-is, like container headers
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t keySize;  // of the user's key
+    uint32_t reserved;
+    uint64_t nChunks;
+    uint64_t rawSize;
+} Crypt_RecipeHeader;
+
+typedef struct {
+    byte id[CRYPT_STORE_ID_SIZE];
+    byte wrappedKey[CRYPT_STORE_KEY_SIZE + CRYPT_KEYWRAP_IV_SIZE];
+    uint32_t rawSize;
+    uint32_t reserved;
+} Crypt_RecipeEntry;
+
+typedef struct {
+    uint64_t nChunks, nNew;  // chunks of the input, and those new to the store
+    uint64_t rawBytes, newBytes;
+} Crypt_StoreStats;
+
+// returns the length of the first chunk of the nBytes bytes of data.
+// unless data ends the input, nBytes must be at least CRYPT_CDC_MAX_SIZE
+size_t Crypt_CdcCut(const byte data[], size_t nBytes);
+
+// stores the input file fnameIn in the store dirStore (created if it
+// does not exist) under the key in fnameKey, and writes its recipe to
+// fnameRecipe. if compress is set, chunks are compressed first (see
+// Crypt_EncipherChunk). stats (if not NULL) is filled in
+Crypt_Error_t Crypt_StorePut(const char* fnameIn,
+                             const char* fnameKey,
+                             const char* dirStore,
+                             const char* fnameRecipe,
+                             bool compress,
+                             Crypt_StoreStats* stats);
+// the same on open files, with an expanded key of keySize bytes. the
+// recipe file must be seekable
+Crypt_Error_t Crypt_StorePutFile(FILE* fileIn,
+                                 const AES_KeyCtx* ctx,
+                                 size_t keySize,
+                                 const char* dirStore,
+                                 bool compress,
+                                 FILE* fileRecipe,
+                                 Crypt_StoreStats* stats);
+// rebuilds the file of the recipe fnameRecipe from the store dirStore
+Crypt_Error_t Crypt_StoreGet(const char* fnameRecipe,
+                             const char* fnameKey,
+                             const char* dirStore,
+                             const char* fnameOut);
+Crypt_Error_t Crypt_StoreGetFile(FILE* fileRecipe,
+                                 const AES_KeyCtx* ctx,
+                                 size_t keySize,
+                                 const char* dirStore,
+                                 FILE* fileOut);
+
+// internal helpers
+void Crypt_CdcInitGear(void);
+// derives the secret that chunk keys are derived under
+void Crypt_StoreSecret(const AES_KeyCtx* ctx, byte secret[]);
+// derives the key of a chunk from its contents
+void Crypt_StoreChunkKey(const byte secret[], const byte raw[], size_t rawSize, byte key[]);
+// returns dirStore/xx/yyyy... for a chunk id (to be freed), or NULL
+char* Crypt_StorePath(const char* dirStore, const byte id[]);
+// writes a chunk to the store unless it is already there
+Crypt_Error_t Crypt_StorePutChunk(const byte secret[],
+                                  const AES_KeyCtx* ctx,
+                                  const char* dirStore,
+                                  const byte raw[],
+                                  size_t rawSize,
+                                  bool compress,
+                                  byte payload[],
+                                  Crypt_RecipeEntry* entry,
+                                  bool* isNew);
+// reads, deciphers and checks the chunk of an entry into raw, which
+// holds CRYPT_CDC_MAX_SIZE bytes
+Crypt_Error_t Crypt_StoreGetChunk(const byte secret[],
+                                  const AES_KeyCtx* ctx,
+                                  const char* dirStore,
+                                  const Crypt_RecipeEntry* entry,
+                                  byte payload[],
+                                  byte raw[]);
+
+// gear hash table, filled in once by Crypt_CdcInitGear
+uint64_t Crypt_gear[256];
+pthread_once_t Crypt_gearOnce = PTHREAD_ONCE_INIT;
+
+void Crypt_CdcInitGear(void) {
+    // splitmix64 from a fixed seed, so every build cuts the same chunks
+    uint64_t x = 0x63697068u;
+    for (size_t i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15u);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+        Crypt_gear[i] = z ^ (z >> 31);
+    }
+}
+
+size_t Crypt_CdcCut(const byte data[], size_t nBytes) {
+    pthread_once(&Crypt_gearOnce, Crypt_CdcInitGear);
+    if (nBytes <= CRYPT_CDC_MIN_SIZE) {
+        return nBytes;
+    }
+    size_t end = MIN(nBytes, CRYPT_CDC_MAX_SIZE);
+    // the hash only depends on the last CRYPT_CDC_WINDOW bytes, so it
+    // starts that far before the first possible cut
+    uint64_t h = 0;
+    size_t i = CRYPT_CDC_MIN_SIZE - CRYPT_CDC_WINDOW;
+    for (; i < CRYPT_CDC_MIN_SIZE; i++) {
+        h = (h << 1) + Crypt_gear[data[i]];
+    }
+    for (; i < end; i++) {
+        h = (h << 1) + Crypt_gear[data[i]];
+        if (!(h & CRYPT_CDC_MASK)) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+void Crypt_StoreSecret(const AES_KeyCtx* ctx, byte secret[]) {
+    // with a label of its own, so it is unrelated to the Merkle key
+    Crypt_SubKey(ctx, "ciph store chunk keys", secret);
+}
+
+void Crypt_StoreChunkKey(const byte secret[], const byte raw[], size_t rawSize, byte key[]) {
+    byte digest[SHA256_DIGEST_SIZE];
+    SHA256_Hash(raw, rawSize, digest);
+    SHA256_Hmac(secret, CRYPT_STORE_KEY_SIZE, digest, sizeof(digest), key);
+}
+
+char* Crypt_StorePath(const char* dirStore, const byte id[]) {
+    size_t dirLen = strlen(dirStore);
+    // dir + '/' + 2 hex digits + '/' + the rest + NUL
+    char* path = (char*) malloc(dirLen + 2 * CRYPT_STORE_ID_SIZE + 3);
+    if (!path) {
+        return NULL;
+    }
+    memcpy(path, dirStore, dirLen);
+    char* p = path + dirLen;
+    for (size_t i = 0; i < CRYPT_STORE_ID_SIZE; i++) {
+        if (i < 2) {
+            *p++ = '/';
+        }
+        *p++ = "0123456789abcdef"[id[i] >> 4];
+        *p++ = "0123456789abcdef"[id[i] & 0xf];
+    }
+    *p = '\0';
+    return path;
+}
+
+Crypt_Error_t Crypt_StorePutChunk(const byte secret[],
+                                  const AES_KeyCtx* ctx,
+                                  const char* dirStore,
+                                  const byte raw[],
+                                  size_t rawSize,
+                                  bool compress,
+                                  byte payload[],
+                                  Crypt_RecipeEntry* entry,
+                                  bool* isNew) {
+    byte key[CRYPT_STORE_KEY_SIZE];
+    Crypt_StoreChunkKey(secret, raw, rawSize, key);
+    memset(entry, 0, sizeof(Crypt_RecipeEntry));
+    SHA256_Hash(key, sizeof(key), entry->id);
+    Crypt_KeyWrap(ctx, key, sizeof(key), entry->wrappedKey);
+    entry->rawSize = (uint32_t) rawSize;
+
+    *isNew = false;
+    char* path = Crypt_StorePath(dirStore, entry->id);
+    if (!path) {
+        memset(key, 0, sizeof(key));
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (access(path, F_OK) != 0) {
+        *isNew = true;
+        AES_KeyCtx chunkCtx;
+        AES_InitKeyCtx(&chunkCtx, key, NK_BYTES_TO_WORDS(sizeof(key)));
+        Crypt_ChunkHeader chdr;
+        Crypt_EncipherChunk(&chunkCtx, raw, rawSize, compress, &chdr, payload);
+        memset(&chunkCtx, 0, sizeof(chunkCtx));
+        size_t storedSize = CRYPT_STORED_SIZE(chdr.dataSize);
+
+        // the subdirectory of the chunk
+        size_t dirLen = strlen(dirStore) + 3;
+        path[dirLen] = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            err = CRYPT_E_IO;
+        }
+        path[dirLen] = '/';
+
+        // written to a unique file and renamed, so a concurrent put of the
+        // same chunk, or a crash, never leaves a partial chunk behind
+        size_t pathLen = strlen(path);
+        char* pathTmp = (char*) malloc(pathLen + 8);
+        int fd = -1;
+        if (err == CRYPT_E_SUCCESS && !pathTmp) {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+        }
+        if (err == CRYPT_E_SUCCESS) {
+            memcpy(pathTmp, path, pathLen);
+            memcpy(pathTmp + pathLen, ".XXXXXX", 8);
+            fd = mkstemp(pathTmp);
+            if (fd < 0) {
+                err = CRYPT_E_IO;
+            }
+        }
+        if (err == CRYPT_E_SUCCESS) {
+            FILE* file = fdopen(fd, "wb");
+            if (!file) {
+                close(fd);
+                err = CRYPT_E_IO;
+            } else {
+                if (fwrite(&chdr, sizeof(Crypt_ChunkHeader), 1, file) != 1 ||
+                    fwrite(payload, sizeof(byte), storedSize, file) != storedSize) {
+                    err = CRYPT_E_IO;
+                }
+                if (fclose(file) != 0 && err == CRYPT_E_SUCCESS) {
+                    err = CRYPT_E_IO;
+                }
+            }
+            if (err == CRYPT_E_SUCCESS && rename(pathTmp, path) != 0) {
+                err = CRYPT_E_IO;
+            }
+            if (err != CRYPT_E_SUCCESS) {
+                remove(pathTmp);
+            }
+        }
+        free(pathTmp);
+    }
+    free(path);
+    memset(key, 0, sizeof(key));
+    return err;
+}
+
+Crypt_Error_t Crypt_StoreGetChunk(const byte secret[],
+                                  const AES_KeyCtx* ctx,
+                                  const char* dirStore,
+                                  const Crypt_RecipeEntry* entry,
+                                  byte payload[],
+                                  byte raw[]) {
+    if (entry->rawSize == 0 || entry->rawSize > CRYPT_CDC_MAX_SIZE) {
+        return CRYPT_E_FORMAT;
+    }
+    byte key[CRYPT_STORE_KEY_SIZE];
+    if (Crypt_KeyUnwrap(ctx, entry->wrappedKey, sizeof(key), key) != CRYPT_E_SUCCESS) {
+        return CRYPT_E_ARGUMENT;
+    }
+    byte id[CRYPT_STORE_ID_SIZE];
+    SHA256_Hash(key, sizeof(key), id);
+    if (memcmp(id, entry->id, sizeof(id)) != 0) {
+        memset(key, 0, sizeof(key));
+        return CRYPT_E_FORMAT;
+    }
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    char* path = Crypt_StorePath(dirStore, entry->id);
+    FILE* file = path ? fopen(path, "rb") : NULL;
+    if (!path) {
+        err = CRYPT_E_MEMORY_ALLOCATION;
+    } else if (!file) {
+        err = CRYPT_E_IO;
+    }
+    Crypt_ChunkHeader chdr;
+    if (err == CRYPT_E_SUCCESS && fread(&chdr, sizeof(Crypt_ChunkHeader), 1, file) != 1) {
+        err = CRYPT_E_INTEGRITY;
+    }
+    if (err == CRYPT_E_SUCCESS &&
+        (chdr.rawSize != entry->rawSize || (chdr.flags & ~CRYPT_CHUNK_LZ) ||
+         CRYPT_STORED_SIZE(chdr.dataSize) > CRYPT_PAYLOAD_BUF_SIZE(CRYPT_CDC_MAX_SIZE) ||
+         (!(chdr.flags & CRYPT_CHUNK_LZ) && chdr.dataSize != chdr.rawSize))) {
+        err = CRYPT_E_INTEGRITY;
+    }
+    size_t storedSize = (err == CRYPT_E_SUCCESS) ? CRYPT_STORED_SIZE(chdr.dataSize) : 0;
+    if (err == CRYPT_E_SUCCESS && fread(payload, sizeof(byte), storedSize, file) != storedSize) {
+        err = CRYPT_E_INTEGRITY;
+    }
+    if (file) {
+        fclose(file);
+    }
+    free(path);
+
+    if (err == CRYPT_E_SUCCESS) {
+        AES_KeyCtx chunkCtx;
+        AES_InitKeyCtx(&chunkCtx, key, NK_BYTES_TO_WORDS(sizeof(key)));
+        const byte* data;
+        if (Crypt_DecipherChunk(&chunkCtx, &chdr, CRYPT_CDC_MAX_SIZE, payload, raw, &data) != CRYPT_E_SUCCESS) {
+            err = CRYPT_E_INTEGRITY;
+        } else if (data != raw) {
+            memcpy(raw, data, chdr.rawSize);
+        }
+        memset(&chunkCtx, 0, sizeof(chunkCtx));
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        // the contents must derive the key they were deciphered with
+        byte check[CRYPT_STORE_KEY_SIZE];
+        Crypt_StoreChunkKey(secret, raw, chdr.rawSize, check);
+        byte diff = 0;
+        for (size_t i = 0; i < sizeof(check); i++) {
+            diff |= check[i] ^ key[i];
+        }
+        if (diff) {
+            err = CRYPT_E_INTEGRITY;
+        }
+    }
+    memset(key, 0, sizeof(key));
+    return err;
+}
+
+Crypt_Error_t Crypt_StorePutFile(FILE* fileIn,
+                                 const AES_KeyCtx* ctx,
+                                 size_t keySize,
+                                 const char* dirStore,
+                                 bool compress,
+                                 FILE* fileRecipe,
+                                 Crypt_StoreStats* stats) {
+    Crypt_StoreStats s;
+    memset(&s, 0, sizeof(s));
+    if (mkdir(dirStore, 0755) != 0 && errno != EEXIST) {
+        return CRYPT_E_IO;
+    }
+
+    Crypt_RecipeHeader rhdr;
+    memset(&rhdr, 0, sizeof(Crypt_RecipeHeader));
+    memcpy(rhdr.magic, CRYPT_RECIPE_MAGIC, sizeof(rhdr.magic));
+    rhdr.version = CRYPT_RECIPE_VERSION;
+    rhdr.keySize = (uint16_t) keySize;
+    if (fwrite(&rhdr, sizeof(Crypt_RecipeHeader), 1, fileRecipe) != 1) {
+        return CRYPT_E_IO;
+    }
+
+    // the input is read into buf in runs of up to CRYPT_CDC_MAX_SIZE
+    // bytes, and the unchunked rest is moved to the front before reading
+    // more, so a chunk is always contiguous
+    byte* buf = (byte*) malloc(2 * CRYPT_CDC_MAX_SIZE);
+    byte* payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(CRYPT_CDC_MAX_SIZE));
+    if (!buf || !payload) {
+        free(buf);
+        free(payload);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    byte secret[CRYPT_STORE_KEY_SIZE];
+    Crypt_StoreSecret(ctx, secret);
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    size_t begin = 0, end = 0;
+    bool eof = false;
+    while (err == CRYPT_E_SUCCESS) {
+        if (!eof && end - begin < CRYPT_CDC_MAX_SIZE) {
+            memmove(buf, buf + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            end += fread(buf + end, sizeof(byte), 2 * CRYPT_CDC_MAX_SIZE - end, fileIn);
+            if (end < 2 * CRYPT_CDC_MAX_SIZE) {
+                if (ferror(fileIn)) {
+                    err = CRYPT_E_IO;
+                    break;
+                }
+                eof = true;
+            }
+        }
+        if (begin == end) {
+            break;
+        }
+
+        size_t n = Crypt_CdcCut(buf + begin, end - begin);
+        Crypt_RecipeEntry entry;
+        bool isNew;
+        err = Crypt_StorePutChunk(secret, ctx, dirStore, buf + begin, n, compress, payload, &entry, &isNew);
+        if (err == CRYPT_E_SUCCESS && fwrite(&entry, sizeof(Crypt_RecipeEntry), 1, fileRecipe) != 1) {
+            err = CRYPT_E_IO;
+        }
+        s.nChunks++;
+        s.rawBytes += n;
+        if (isNew) {
+            s.nNew++;
+            s.newBytes += n;
+        }
+        begin += n;
+    }
+
+    rhdr.nChunks = s.nChunks;
+    rhdr.rawSize = s.rawBytes;
+    if (err == CRYPT_E_SUCCESS &&
+        (fseeko(fileRecipe, 0, SEEK_SET) != 0 ||
+         fwrite(&rhdr, sizeof(Crypt_RecipeHeader), 1, fileRecipe) != 1)) {
+        err = CRYPT_E_IO;
+    }
+    if (stats) {
+        *stats = s;
+    }
+
+    memset(secret, 0, sizeof(secret));
+    free(buf);
+    free(payload);
+    return err;
+}
+
+Crypt_Error_t Crypt_StoreGetFile(FILE* fileRecipe,
+                                 const AES_KeyCtx* ctx,
+                                 size_t keySize,
+                                 const char* dirStore,
+                                 FILE* fileOut) {
+    Crypt_RecipeHeader rhdr;
+    if (fread(&rhdr, sizeof(Crypt_RecipeHeader), 1, fileRecipe) != 1 ||
+        memcmp(rhdr.magic, CRYPT_RECIPE_MAGIC, sizeof(rhdr.magic)) != 0 ||
+        rhdr.version != CRYPT_RECIPE_VERSION) {
+        return CRYPT_E_FORMAT;
+    }
+    if (rhdr.keySize != keySize) {
+        return CRYPT_E_ARGUMENT;
+    }
+
+    byte* raw = (byte*) malloc(CRYPT_CDC_MAX_SIZE);
+    byte* payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(CRYPT_CDC_MAX_SIZE));
+    if (!raw || !payload) {
+        free(raw);
+        free(payload);
+        return CRYPT_E_MEMORY_ALLOCATION;
+    }
+    byte secret[CRYPT_STORE_KEY_SIZE];
+    Crypt_StoreSecret(ctx, secret);
+
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    uint64_t total = 0;
+    for (uint64_t i = 0; err == CRYPT_E_SUCCESS && i < rhdr.nChunks; i++) {
+        Crypt_RecipeEntry entry;
+        if (fread(&entry, sizeof(Crypt_RecipeEntry), 1, fileRecipe) != 1) {
+            err = CRYPT_E_FORMAT;
+            break;
+        }
+        err = Crypt_StoreGetChunk(secret, ctx, dirStore, &entry, payload, raw);
+        if (err == CRYPT_E_SUCCESS && fwrite(raw, sizeof(byte), entry.rawSize, fileOut) != entry.rawSize) {
+            err = CRYPT_E_IO;
+        }
+        total += entry.rawSize;
+    }
+    if (err == CRYPT_E_SUCCESS && total != rhdr.rawSize) {
+        err = CRYPT_E_FORMAT;
+    }
+
+    memset(secret, 0, sizeof(secret));
+    free(raw);
+    free(payload);
+    return err;
+}
+
+Crypt_Error_t Crypt_StorePut(const char* fnameIn,
+                             const char* fnameKey,
+                             const char* dirStore,
+                             const char* fnameRecipe,
+                             bool compress,
+                             Crypt_StoreStats* stats) {
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
+    FILE* fileRecipe = fopen(fnameRecipe, "wb");
+    if (!fileRecipe) {
+        fclose(fileIn);
+        return CRYPT_E_IO;
+    }
+    err = Crypt_StorePutFile(fileIn, &ctx, keySize, dirStore, compress, fileRecipe, stats);
+    memset(&ctx, 0, sizeof(ctx));
+    fclose(fileIn);
+    if (fclose(fileRecipe) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+Crypt_Error_t Crypt_StoreGet(const char* fnameRecipe,
+                             const char* fnameKey,
+                             const char* dirStore,
+                             const char* fnameOut) {
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    FILE* fileRecipe = fopen(fnameRecipe, "rb");
+    if (!fileRecipe) {
+        return CRYPT_E_IO;
+    }
+    FILE* fileOut = fopen(fnameOut, "wb");
+    if (!fileOut) {
+        fclose(fileRecipe);
+        return CRYPT_E_IO;
+    }
+    err = Crypt_StoreGetFile(fileRecipe, &ctx, keySize, dirStore, fileOut);
+    memset(&ctx, 0, sizeof(ctx));
+    fclose(fileRecipe);
+    if (fclose(fileOut) != 0 && err == CRYPT_E_SUCCESS) {
+        err = CRYPT_E_IO;
+    }
+    return err;
+}
+
+#endif  // CC_STORE_H_
@@ -0,0 +1,121 @@
+#ifndef CC_STREAM_H_
+#define CC_STREAM_H_
+
+// enciphers or deciphers data as it arrives, in pieces of any size, for
+// inputs that are not seekable files or whose size is not known up
+// front (e.g., sockets, pipes or generated data). the output is the
+// same as that of Crypt_EncipherRange over the whole input: blocks
+// under the key, then a padded final block under its first 128 bits
+// (see CRYPT_PAD_NK), so either side may be a file.
+//
+// Crypt_Update passes the whole blocks of each piece straight to
+// AES_EncipherBlocks or AES_DecipherBlocks, and keeps at most one block
+// in the context: the partial block at the end when enciphering, and
+// the last block (which may be the padded one) when deciphering.
+// Crypt_Final writes or removes the padded block.
+//
+//     Crypt_StreamCtx s;
+//     Crypt_Init(&s, key, keySize, true);
+//     while ((n = read(fd, in, sizeof(in))) > 0) {
+//         write(out, buf, Crypt_Update(&s, in, n, buf));
+//     }
+//     Crypt_Final(&s, buf, &nOut);
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "aes.h"
+#include "ciph.h"
+#include "iov.h"  // for Crypt_AESBlocksFn
+
+typedef struct {
+    AES_KeyCtx ctx;
+    AES_KeyCtx padCtx;  // the first 128 bits of the key
+    bool encipher;
+    byte buf[STATE_SIZE];
+    size_t nBuf;
+} Crypt_StreamCtx;
+
+// starts enciphering (or deciphering, if encipher is false) with a key
+// of keySize bytes
+void Crypt_Init(Crypt_StreamCtx* s, const byte key[], size_t keySize, bool encipher);
+// transforms the next n bytes of input into out, which must have room
+// for n + STATE_SIZE bytes and must not overlap in. returns the number
+// of bytes written, a multiple of STATE_SIZE
+size_t Crypt_Update(Crypt_StreamCtx* s, const byte in[], size_t n, byte out[]);
+// ends the stream, writing the rest of the output (at most STATE_SIZE
+// bytes) to out and its size to *nOut, and clears the context. when
+// deciphering, returns CRYPT_E_FORMAT if the input was not a whole
+// number of blocks or its padding is malformed
+Crypt_Error_t Crypt_Final(Crypt_StreamCtx* s, byte out[], size_t* nOut);
+
+void Crypt_Init(Crypt_StreamCtx* s, const byte key[], size_t keySize, bool encipher) {
+    memset(s, 0, sizeof(Crypt_StreamCtx));
+    AES_InitKeyCtx(&s->ctx, (byte*) key, NK_BYTES_TO_WORDS(keySize));
+    AES_InitKeyCtx(&s->padCtx, (byte*) key, CRYPT_PAD_NK);
+    s->encipher = encipher;
+}
+
+size_t Crypt_Update(Crypt_StreamCtx* s, const byte in[], size_t n, byte out[]) {
+    Crypt_AESBlocksFn fn = s->encipher ? AES_EncipherBlocks : AES_DecipherBlocks;
+    // deciphering holds back the last block, even a whole one, since
+    // only Crypt_Final knows it is the padded one
+    size_t total = s->nBuf + n;
+    size_t nBlocks = s->encipher ? total / STATE_SIZE : (total ? (total - 1) / STATE_SIZE : 0);
+    if (nBlocks == 0) {
+        memcpy(s->buf + s->nBuf, in, n);
+        s->nBuf += n;
+        return 0;
+    }
+
+    size_t nOut = 0;
+    if (s->nBuf > 0) {
+        // complete the buffered block
+        size_t nFill = STATE_SIZE - s->nBuf;
+        memcpy(s->buf + s->nBuf, in, nFill);
+        fn(&s->ctx, s->buf, 1, out);
+        in += nFill;
+        n -= nFill;
+        nOut += STATE_SIZE;
+        nBlocks--;
+    }
+    fn(&s->ctx, in, nBlocks, out + nOut);
+    nOut += nBlocks * STATE_SIZE;
+    in += nBlocks * STATE_SIZE;
+    n -= nBlocks * STATE_SIZE;
+
+    memcpy(s->buf, in, n);
+    s->nBuf = n;
+    return nOut;
+}
+
+Crypt_Error_t Crypt_Final(Crypt_StreamCtx* s, byte out[], size_t* nOut) {
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    *nOut = 0;
+    if (s->encipher) {
+        // if the input was a whole number of blocks, a whole block of
+        // padding is added
+        byte nPad = (byte) (STATE_SIZE - s->nBuf);
+        memset(s->buf + s->nBuf, nPad, nPad);
+        AES_EncipherBlock(&s->padCtx, s->buf, out);
+        *nOut = STATE_SIZE;
+    } else if (s->nBuf != STATE_SIZE) {
+        err = CRYPT_E_FORMAT;
+    } else {
+        byte block[STATE_SIZE];
+        AES_DecipherBlock(&s->padCtx, s->buf, block);
+        byte padByte = block[STATE_SIZE - 1];
+        if (padByte == 0 || padByte > STATE_SIZE) {
+            err = CRYPT_E_FORMAT;
+        } else {
+            memcpy(out, block, STATE_SIZE - padByte);
+            *nOut = STATE_SIZE - padByte;
+        }
+        memset(block, 0, sizeof(block));
+    }
+    memset(s, 0, sizeof(Crypt_StreamCtx));
+    return err;
+}
+
+#endif  // CC_STREAM_H_
@@ -0,0 +1,183 @@
+#ifndef CC_TRACE_H_
+#define CC_TRACE_H_
+
+// a timeline of the read, cipher, write, copy and sync spans of a run,
+// per thread, written in the Trace Event format that Perfetto and
+// chrome://tracing load, so stalls between pipeline stages and idle
+// workers show up.
+//
+// the hooks are compiled in only with -DCIPH_TRACE (make ciph TRACE=1);
+// otherwise CRYPT_TRACE_BEGIN and CRYPT_TRACE_END are empty and cost
+// nothing. with them compiled in, nothing is recorded until
+// Crypt_TraceStart:
+//
+//     CRYPT_TRACE_BEGIN(t);
+//     AES_EncipherBlocks(&ctx, buf, nBlocks, buf);
+//     CRYPT_TRACE_END(t, CRYPT_SPAN_CIPHER);
+//
+// every thread records into its own ring buffer of
+// CRYPT_TRACE_RING_SIZE events (the oldest are overwritten), which it
+// alone writes, so recording takes no lock. a thread's ring is added to
+// a lock-free list on its first event and lives until the process
+// exits. Crypt_TraceWrite reads the rings, so it must be called once
+// the traced threads are done (e.g., after Crypt_PoolFree).
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>  // for getpid()
+
+// events kept per thread (must be a power of 2)
+#define CRYPT_TRACE_RING_SIZE (64 * 1024)
+
+#ifdef CIPH_TRACE
+// starts a span, noting its start in the local variable var
+#define CRYPT_TRACE_BEGIN(var) uint64_t var = Crypt_TraceOn() ? Crypt_TraceNow() : 0
+// ends the span started by CRYPT_TRACE_BEGIN(var) as span
+#define CRYPT_TRACE_END(var, span) Crypt_TraceRecord(span, var)
+#else
+#define CRYPT_TRACE_BEGIN(var)
+#define CRYPT_TRACE_END(var, span)
+#endif
+
+typedef enum {
+    CRYPT_SPAN_READ,
+    CRYPT_SPAN_CIPHER,
+    CRYPT_SPAN_WRITE,
+    CRYPT_SPAN_COPY,
+    CRYPT_SPAN_SYNC,
+    CRYPT_N_SPANS
+} Crypt_Span;
+
+typedef struct {
+    uint64_t start;  // in ns, of CLOCK_MONOTONIC
+    uint64_t end;
+    uint32_t span;
+} Crypt_TraceEvent;
+
+typedef struct Crypt_TraceRing {
+    struct Crypt_TraceRing* next;
+    uint32_t tid;  // the thread's number in the trace
+    // events recorded so far; the last CRYPT_TRACE_RING_SIZE are kept
+    uint64_t head;
+    Crypt_TraceEvent events[CRYPT_TRACE_RING_SIZE];
+} Crypt_TraceRing;
+
+// the rings of all threads that recorded an event
+Crypt_TraceRing* Crypt_traceRings = NULL;
+uint32_t Crypt_traceNextTid = 0;
+bool Crypt_traceOn = false;
+// the start of the trace, time 0 in its events
+uint64_t Crypt_traceEpoch = 0;
+// the ring of the calling thread
+__thread Crypt_TraceRing* Crypt_traceSelf = NULL;
+
+// starts recording, dropping the events of an earlier trace. no thread
+// may be recording meanwhile
+void Crypt_TraceStart(void);
+// stops recording
+void Crypt_TraceStop(void);
+// records a span of the calling thread from start until now (nothing
+// if recording is off, or was off at start)
+void Crypt_TraceRecord(Crypt_Span span, uint64_t start);
+// writes the events of all threads as a Trace Event JSON object.
+// returns false if writing failed
+bool Crypt_TraceWrite(FILE* file);
+
+// internal helpers
+bool Crypt_TraceOn(void);
+uint64_t Crypt_TraceNow(void);
+// returns the ring of the calling thread, or NULL if it cannot be
+// allocated
+Crypt_TraceRing* Crypt_TraceSelf(void);
+
+const char* Crypt_spanNames[CRYPT_N_SPANS] = {"read", "cipher", "write", "copy", "sync"};
+
+void Crypt_TraceStart(void) {
+    Crypt_TraceRing* ring = __atomic_load_n(&Crypt_traceRings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next) {
+        __atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+    }
+    Crypt_traceEpoch = Crypt_TraceNow();
+    __atomic_store_n(&Crypt_traceOn, true, __ATOMIC_RELEASE);
+}
+
+void Crypt_TraceStop(void) {
+    __atomic_store_n(&Crypt_traceOn, false, __ATOMIC_RELEASE);
+}
+
+bool Crypt_TraceOn(void) {
+    return __atomic_load_n(&Crypt_traceOn, __ATOMIC_RELAXED);
+}
+
+uint64_t Crypt_TraceNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+Crypt_TraceRing* Crypt_TraceSelf(void) {
+    if (Crypt_traceSelf) {
+        return Crypt_traceSelf;
+    }
+    Crypt_TraceRing* ring = (Crypt_TraceRing*) malloc(sizeof(Crypt_TraceRing));
+    if (!ring) {
+        return NULL;
+    }
+    ring->head = 0;
+    ring->tid = __atomic_fetch_add(&Crypt_traceNextTid, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&Crypt_traceRings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&Crypt_traceRings, &ring->next, ring, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // ring->next now holds the new head of the list
+    }
+    Crypt_traceSelf = ring;
+    return ring;
+}
+
+void Crypt_TraceRecord(Crypt_Span span, uint64_t start) {
+    if (start == 0 || !Crypt_TraceOn()) {
+        return;
+    }
+    Crypt_TraceRing* ring = Crypt_TraceSelf();
+    if (!ring) {
+        return;
+    }
+    uint64_t head = ring->head;
+    Crypt_TraceEvent* event = &ring->events[head & (CRYPT_TRACE_RING_SIZE - 1)];
+    event->start = start;
+    event->end = Crypt_TraceNow();
+    event->span = (uint32_t) span;
+    // the event is complete before a reader can see it
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+bool Crypt_TraceWrite(FILE* file) {
+    int pid = (int) getpid();
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"ciph\"}}", pid);
+    Crypt_TraceRing* ring = __atomic_load_n(&Crypt_traceRings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == 0) {
+            continue;
+        }
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}",
+                pid, ring->tid, ring->tid);
+        uint64_t first = (head > CRYPT_TRACE_RING_SIZE) ? head - CRYPT_TRACE_RING_SIZE : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const Crypt_TraceEvent* event = &ring->events[i & (CRYPT_TRACE_RING_SIZE - 1)];
+            // complete events, in microseconds since the start
+            fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"ciph\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %u}",
+                    Crypt_spanNames[event->span],
+                    (event->start >= Crypt_traceEpoch) ? (event->start - Crypt_traceEpoch) / 1e3 : 0.0,
+                    (event->end - event->start) / 1e3, pid, ring->tid);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return !ferror(file);
+}
+
+#endif  // CC_TRACE_H_
@@ -0,0 +1,184 @@
+#ifndef CC_VERIFY_H_
+#define CC_VERIFY_H_
+
+// checks every chunk of a container with a Merkle tree (see merkle.h)
+// without deciphering or writing anything. the chunks are split into
+// runs of about the same number of bytes that are checked in parallel
+// on a thread pool, each with its own buffer and positioned reads of
+// the same file descriptor.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>  // for pread()
+
+#include "container.h"
+#include "pool.h"
+
+// number of runs per worker, so a slow run does not hold up the rest
+#define CRYPT_VERIFY_RUNS_PER_WORKER 4
+
+typedef struct Crypt_Verifier Crypt_Verifier;
+
+typedef struct {
+    Crypt_Verifier* v;
+    size_t first, last;  // chunks first to last - 1
+} Crypt_VerifyRun;
+
+struct Crypt_Verifier {
+    int fd;
+    const Crypt_ChunkIndex* index;
+    const byte* tree;
+    byte macKey[CRYPT_MERKLE_KEY_SIZE];
+    pthread_mutex_t lock;
+    size_t nFailed;  // chunks that failed authentication
+    Crypt_Error_t err;  // the first error other than a failed chunk
+};
+
+// checks the container fnameIn, opened with the key in fnameKey, on
+// nWorkers threads. returns CRYPT_E_INTEGRITY if any chunk or the tree
+// fails, and CRYPT_E_FORMAT if the container has no tree. *nFailed (if
+// not NULL) is set to the number of chunks that failed (0 if the tree
+// itself failed)
+Crypt_Error_t Crypt_Verify(const char* fnameIn, const char* fnameKey, size_t nWorkers, size_t* nFailed);
+// the same on an open file, with an expanded key of keySize bytes
+Crypt_Error_t Crypt_VerifyFile(FILE* fileIn, const AES_KeyCtx* ctx, size_t keySize, size_t nWorkers, size_t* nFailed);
+
+// internal helpers
+void Crypt_VerifyRunChunks(void* arg);
+
+void Crypt_VerifyRunChunks(void* arg) {
+    Crypt_VerifyRun* run = (Crypt_VerifyRun*) arg;
+    Crypt_Verifier* v = run->v;
+    byte* payload = (byte*) malloc(CRYPT_PAYLOAD_BUF_SIZE(v->index->hdr.chunkSize));
+    Crypt_Error_t err = payload ? CRYPT_E_SUCCESS : CRYPT_E_MEMORY_ALLOCATION;
+    size_t nFailed = 0;
+    for (size_t i = run->first; err == CRYPT_E_SUCCESS && i < run->last; i++) {
+        const Crypt_ChunkInfo* info = &v->index->chunks[i];
+        size_t storedSize = CRYPT_STORED_SIZE(info->hdr.dataSize);
+        off_t offset = info->offset + (off_t) sizeof(Crypt_ChunkHeader);
+        CRYPT_TRACE_BEGIN(traceRead);
+        ssize_t nRead = pread(v->fd, payload, storedSize, offset);
+        CRYPT_TRACE_END(traceRead, CRYPT_SPAN_READ);
+        if (nRead != (ssize_t) storedSize) {
+            err = CRYPT_E_IO;
+            break;
+        }
+        CRYPT_TRACE_BEGIN(traceCipher);
+        if (Crypt_CheckChunk(v->tree, v->index, v->macKey, i, payload) != CRYPT_E_SUCCESS) {
+            nFailed++;
+        }
+        CRYPT_TRACE_END(traceCipher, CRYPT_SPAN_CIPHER);
+    }
+    free(payload);
+
+    pthread_mutex_lock(&v->lock);
+    v->nFailed += nFailed;
+    if (v->err == CRYPT_E_SUCCESS) {
+        v->err = err;
+    }
+    pthread_mutex_unlock(&v->lock);
+}
+
+Crypt_Error_t Crypt_VerifyFile(FILE* fileIn, const AES_KeyCtx* ctx, size_t keySize, size_t nWorkers, size_t* nFailed) {
+    if (nFailed) {
+        *nFailed = 0;
+    }
+    Crypt_ChunkIndex index;
+    Crypt_Error_t err = Crypt_IndexChunks(fileIn, &index);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    if (!(index.hdr.flags & CRYPT_HDR_MERKLE)) {
+        Crypt_FreeIndex(&index);
+        return CRYPT_E_FORMAT;
+    }
+
+    Crypt_Verifier v;
+    memset(&v, 0, sizeof(Crypt_Verifier));
+    v.fd = fileno(fileIn);
+    v.index = &index;
+    AES_KeyCtx dataCtx;
+    byte* tree = NULL;
+    err = Crypt_ContainerKey(&index.hdr, ctx, keySize, &dataCtx);
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_LoadTree(fileIn, &index, &dataCtx, &tree);
+        Crypt_MerkleKey(&dataCtx, v.macKey);
+    }
+    v.tree = tree;
+
+    // runs of about equal numbers of stored bytes
+    size_t nRuns = MIN(index.nChunks, (nWorkers ? nWorkers : 1) * CRYPT_VERIFY_RUNS_PER_WORKER);
+    Crypt_VerifyRun* runs = (Crypt_VerifyRun*) calloc(nRuns ? nRuns : 1, sizeof(Crypt_VerifyRun));
+    if (err == CRYPT_E_SUCCESS && !runs) {
+        err = CRYPT_E_MEMORY_ALLOCATION;
+    }
+    size_t totalSize = 0;
+    for (size_t i = 0; i < index.nChunks; i++) {
+        totalSize += CRYPT_STORED_SIZE(index.chunks[i].hdr.dataSize) + sizeof(Crypt_ChunkHeader);
+    }
+    size_t nUsed = 0;
+    for (size_t i = 0, size = 0; err == CRYPT_E_SUCCESS && i < index.nChunks; i++) {
+        if (nUsed == 0 || size >= totalSize / nRuns * nUsed) {
+            runs[nUsed].v = &v;
+            runs[nUsed].first = i;
+            nUsed++;
+        }
+        runs[nUsed - 1].last = i + 1;
+        size += CRYPT_STORED_SIZE(index.chunks[i].hdr.dataSize) + sizeof(Crypt_ChunkHeader);
+    }
+
+    Crypt_Pool* pool = NULL;
+    if (err == CRYPT_E_SUCCESS && nUsed > 0) {
+        pthread_mutex_init(&v.lock, NULL);
+        pool = Crypt_PoolNew(MIN(nWorkers ? nWorkers : 1, nUsed));
+        if (!pool) {
+            err = CRYPT_E_MEMORY_ALLOCATION;
+        }
+        for (size_t i = 0; pool && i < nUsed; i++) {
+            if (Crypt_PoolSubmit(pool, Crypt_VerifyRunChunks, &runs[i]) != CRYPT_E_SUCCESS) {
+                // checked here instead
+                Crypt_VerifyRunChunks(&runs[i]);
+            }
+        }
+        Crypt_PoolFree(pool);
+        pthread_mutex_destroy(&v.lock);
+        if (err == CRYPT_E_SUCCESS) {
+            err = (v.err != CRYPT_E_SUCCESS) ? v.err : (v.nFailed ? CRYPT_E_INTEGRITY : CRYPT_E_SUCCESS);
+        }
+    }
+    if (nFailed) {
+        *nFailed = v.nFailed;
+    }
+
+    free(runs);
+    free(tree);
+    memset(&dataCtx, 0, sizeof(dataCtx));
+    memset(v.macKey, 0, sizeof(v.macKey));
+    Crypt_FreeIndex(&index);
+    return err;
+}
+
+Crypt_Error_t Crypt_Verify(const char* fnameIn, const char* fnameKey, size_t nWorkers, size_t* nFailed) {
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_Error_t err = Crypt_LoadKeyFile(fnameKey, key, &keySize);
+    if (err != CRYPT_E_SUCCESS) {
+        return err;
+    }
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    memset(key, 0, sizeof(key));
+
+    FILE* fileIn = fopen(fnameIn, "rb");
+    if (!fileIn) {
+        return CRYPT_E_IO;
+    }
+    err = Crypt_VerifyFile(fileIn, &ctx, keySize, nWorkers, nFailed);
+    fclose(fileIn);
+    return err;
+}
+
+#endif  // CC_VERIFY_H_
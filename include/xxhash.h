@@ -0,0 +1,111 @@
+#ifndef CC_XXHASH_H_
+#define CC_XXHASH_H_
+
+// the XXH64 hash function (https://github.com/Cyan4973/xxHash).
+// it is fast enough to run over every byte of a file at memory speed,
+// which makes it suitable for detecting changes, but it is not a
+// cryptographic hash: it must not be used where an adversary could
+// choose colliding inputs.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "common.h"
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define XXH_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+uint64_t XXH_Hash64(const byte data[], size_t nBytes, uint64_t seed);
+
+// internal helpers
+uint64_t XXH_Read64(const byte* p);
+uint32_t XXH_Read32(const byte* p);
+uint64_t XXH_Round(uint64_t acc, uint64_t input);
+uint64_t XXH_MergeRound(uint64_t acc, uint64_t val);
+
+uint64_t XXH_Read64(const byte* p) {
+    // NOTE: assumes a little-endian machine
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t XXH_Read32(const byte* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t XXH_Round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = XXH_ROTL64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+uint64_t XXH_MergeRound(uint64_t acc, uint64_t val) {
+    acc ^= XXH_Round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t XXH_Hash64(const byte data[], size_t nBytes, uint64_t seed) {
+    const byte* p = data;
+    const byte* end = data + nBytes;
+    uint64_t h;
+
+    if (nBytes >= 32) {
+        // four independent lanes over 32-byte stripes
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        const byte* limit = end - 32;
+        do {
+            v1 = XXH_Round(v1, XXH_Read64(p));
+            v2 = XXH_Round(v2, XXH_Read64(p + 8));
+            v3 = XXH_Round(v3, XXH_Read64(p + 16));
+            v4 = XXH_Round(v4, XXH_Read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = XXH_ROTL64(v1, 1) + XXH_ROTL64(v2, 7) + XXH_ROTL64(v3, 12) + XXH_ROTL64(v4, 18);
+        h = XXH_MergeRound(h, v1);
+        h = XXH_MergeRound(h, v2);
+        h = XXH_MergeRound(h, v3);
+        h = XXH_MergeRound(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += (uint64_t) nBytes;
+
+    // the remaining (at most 31) bytes
+    for (; p + 8 <= end; p += 8) {
+        h ^= XXH_Round(0, XXH_Read64(p));
+        h = XXH_ROTL64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) XXH_Read32(p) * XXH_PRIME64_1;
+        h = XXH_ROTL64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (uint64_t) (*p) * XXH_PRIME64_5;
+        h = XXH_ROTL64(h, 11) * XXH_PRIME64_1;
+    }
+
+    // final avalanche
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+#endif  // CC_XXHASH_H_
@@ -1,10 +1,26 @@
+#include <algorithm>
 #include <iostream>
 #include "clap.hpp"
 
 extern "C" {
     #include "../include/ciph.h"
+    #include "../include/container.h"
+    #include "../include/log.h"
+    #include "../include/incremental.h"
+    #include "../include/batch.h"
+    #include "../include/archive.h"
+    #include "../include/state.h"
+    #include "../include/serve.h"
+    #include "../include/keyring.h"
+    #include "../include/envelope.h"
+    #include "../include/kdf.h"
+    #include "../include/verify.h"
+    #include "../include/store.h"
 }
 
+#include <signal.h>
+#include <termios.h>
+
 // for windows compatability for access()
 #ifdef WIN32
 #include <io.h>
@@ -16,15 +32,301 @@ extern "C" {
 
 #define KEY_LEN 16
 
+// writes the timeline of the run to fname when main returns, whichever
+// operation ran (see trace.h)
+struct TraceGuard {
+    std::string fname;
+
+    ~TraceGuard() {
+        if (fname.empty()) {
+            return;
+        }
+        Crypt_TraceStop();
+        FILE* file = fopen(fname.c_str(), "w");
+        if (!file || !Crypt_TraceWrite(file) || fclose(file) != 0) {
+            std::cerr << "the trace could not be written to " << fname << ".\n";
+        }
+    }
+};
+
+// appends everything read from fnameIn ('-' for stdin) to the log
+// container fnameOut. whatever a single read returns is committed
+// together, so bursts of records cost one write and one sync
+Crypt_Error_t appendLog(const std::string& fnameIn, const std::string& fnameOut,
+                        const std::string& fnameKey, uint16_t flags) {
+    int fdIn = (fnameIn == "-") ? STDIN_FILENO : open(fnameIn.c_str(), O_RDONLY);
+    if (fdIn < 0) {
+        return CRYPT_E_IO;
+    }
+
+    Crypt_Log log;
+    Crypt_Error_t err = Crypt_LogOpen(&log, fnameOut.c_str(), fnameKey.c_str(), flags);
+    if (err != CRYPT_E_SUCCESS) {
+        if (fdIn != STDIN_FILENO) {
+            close(fdIn);
+        }
+        return err;
+    }
+    if (log.stats.tornBytes) {
+        std::cerr << "Log recovery: removed a torn final chunk of " << log.stats.tornBytes << " bytes.\n";
+    }
+
+    std::vector<byte> buf(CRYPT_CHUNK_SIZE);
+    while (err == CRYPT_E_SUCCESS) {
+        ssize_t nRead = read(fdIn, buf.data(), buf.size());
+        if (nRead < 0 && errno == EINTR) {
+            continue;
+        } else if (nRead < 0) {
+            err = CRYPT_E_IO;
+        } else if (nRead == 0) {
+            break;
+        } else {
+            err = Crypt_LogAppend(&log, buf.data(), (size_t) nRead, NULL);
+            if (err == CRYPT_E_SUCCESS) {
+                err = Crypt_LogCommit(&log, CRYPT_EOF);
+            }
+        }
+    }
+
+    Crypt_Error_t closeErr = Crypt_LogClose(&log);
+    if (fdIn != STDIN_FILENO) {
+        close(fdIn);
+    }
+    return (err != CRYPT_E_SUCCESS) ? err : closeErr;
+}
+
+// runs the jobs listed in fnameManifest and prints one result line per
+// job (see Crypt_BatchReport). if fnameState is not empty, jobs whose
+// inputs did not change since the last run are skipped (see state.h).
+// fails if the manifest is malformed or any job failed
+int runBatch(const std::string& fnameManifest, const std::string& fnameState, std::size_t nWorkers) {
+    FILE* manifest = fopen(fnameManifest.c_str(), "r");
+    if (!manifest) {
+        Crypt_PrintError(CRYPT_E_IO);
+        return EXIT_FAILURE;
+    }
+
+    Crypt_Batch batch;
+    Crypt_BatchInit(&batch);
+    size_t errLine;
+    Crypt_Error_t err = Crypt_BatchParse(&batch, manifest, &errLine);
+    fclose(manifest);
+    if (err == CRYPT_E_FORMAT) {
+        std::cerr << "manifest line " << errLine << ": ";
+    }
+
+    Crypt_State state;
+    std::vector<Crypt_StateEntry> fresh(batch.nJobs);
+    memset(&state, 0, sizeof(Crypt_State));
+    if (err == CRYPT_E_SUCCESS && !fnameState.empty()) {
+        err = Crypt_StateLoad(&state, fnameState.c_str());
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_StateSkipUnchanged(&state, &batch, fresh.data(), NULL);
+        }
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_BatchRun(&batch, nWorkers);
+    }
+    if (err == CRYPT_E_SUCCESS && !fnameState.empty()) {
+        err = Crypt_StateUpdate(&state, &batch, fresh.data());
+        if (err == CRYPT_E_SUCCESS) {
+            err = Crypt_StateSave(&state, fnameState.c_str());
+        }
+    }
+    size_t nFailed = Crypt_BatchReport(&batch, stdout);
+    Crypt_StateFree(&state);
+    Crypt_BatchFree(&batch);
+
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_PrintError(err);
+        return EXIT_FAILURE;
+    }
+    return (nFailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// reads a line from stdin, without echoing it if stdin is a terminal
+bool readPassphrase(std::string& pass) {
+    struct termios saved;
+    bool tty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (tty) {
+        struct termios quiet = saved;
+        quiet.c_lflag &= ~ECHO;
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &quiet);
+        std::cerr << "passphrase: ";
+    }
+    bool ok = (bool) std::getline(std::cin, pass);
+    if (tty) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+        std::cerr << '\n';
+    }
+    return ok && !pass.empty();
+}
+
+// derives fnameKey + ".ciphkey" from a passphrase. the salt and cost
+// are kept in fnameKey + ".ciphkdf": created on first use, and reused
+// afterwards so the same passphrase gives the same key. kdf is empty
+// unless --kdf was given, and must then match the stored parameters
+int derivePassphraseKey(const std::string& fnameKey, std::size_t keySize, const std::string& kdf, std::size_t nThreads) {
+    std::string fnameParams = fnameKey + ".ciphkdf";
+    Crypt_KdfParams params;
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    Crypt_Kdf_t kdfType = (kdf == "pbkdf2") ? CRYPT_KDF_PBKDF2 : CRYPT_KDF_SCRYPT;
+    bool create = access(fnameParams.c_str(), F_OK) != 0;
+    if (create) {
+        err = Crypt_KdfInitParams(&params, kdfType);
+    } else {
+        err = Crypt_KdfLoadParams(fnameParams.c_str(), &params);
+        if (err == CRYPT_E_SUCCESS && !kdf.empty() && params.kdf != kdfType) {
+            std::cerr << clap::ParseException("kdf " + kdf + " does not match the parameters in " + fnameParams + ".").what() << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::string pass;
+    if (err == CRYPT_E_SUCCESS && !readPassphrase(pass)) {
+        std::cerr << clap::ParseException("passphrase must not be empty.").what() << '\n';
+        return EXIT_FAILURE;
+    }
+    if (err == CRYPT_E_SUCCESS) {
+        err = Crypt_DeriveKeyFile((fnameKey + ".ciphkey").c_str(), keySize, &params, pass.data(), pass.size(), nThreads);
+    }
+    if (err == CRYPT_E_SUCCESS && create) {
+        err = Crypt_KdfSaveParams(fnameParams.c_str(), &params);
+    }
+    std::fill(pass.begin(), pass.end(), '\0');
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_PrintError(err);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+Crypt_Server* server = NULL;
+
+void stopServer(int /*sig*/) {
+    Crypt_ServeStop(server);
+}
+
+// runs the daemon on fnameSocket until SIGINT or SIGTERM
+int runServer(const std::string& fnameSocket) {
+    Crypt_Server s;
+    Crypt_Error_t err = Crypt_ServeOpen(&s, fnameSocket.c_str());
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_PrintError(err);
+        return EXIT_FAILURE;
+    }
+    server = &s;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopServer;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    err = Crypt_ServeRun(&s);
+    Crypt_ServeClose(&s);
+    server = NULL;
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_PrintError(err);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// handles keygen, encipher, decipher and rotate with a keyring instead
+// of key files. enciphering always produces a chunked container, since
+// the key id is stored in the container header
+int runKeyring(const std::string& op, clap::ArgumentMap& map) {
+    std::string fnameKeyring = map.get<std::string>("keyring");
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (op == "keygen") {
+        uint64_t keyId = map.get<std::size_t>("key-id");
+        if (map.hasValue("key-file")) {
+            err = Crypt_KeyringImport(fnameKeyring.c_str(), keyId, map.get<std::string>("key-file").c_str());
+        } else {
+            // count keys with consecutive ids
+            std::vector<uint64_t> keyIds(map.hasValue("count") ? map.get<std::size_t>("count") : 1);
+            for (std::size_t i = 0; i < keyIds.size(); i++) {
+                keyIds[i] = keyId + i;
+            }
+            err = Crypt_KeyringAdd(fnameKeyring.c_str(), keyIds.data(), keyIds.size(), map.get<std::size_t>("key-size") / 8);
+        }
+    } else {
+        Crypt_Keyring kr;
+        err = Crypt_KeyringOpen(&kr, fnameKeyring.c_str());
+        if (err == CRYPT_E_SUCCESS && op == "rotate") {
+            err = Crypt_RotateKeyring(map.get<std::string>("input-file").c_str(), &kr, map.get<std::size_t>("key-id"));
+            Crypt_KeyringClose(&kr);
+        } else if (err == CRYPT_E_SUCCESS) {
+            std::string fnameIn = map.get<std::string>("input-file");
+            std::string fnameOut = map.get<std::string>("output-file");
+            if (op == "encipher") {
+                uint16_t flags = 0;
+                if (map.hasValue("compress")) {
+                    flags |= CRYPT_HDR_COMPRESSED;
+                }
+                if (map.hasValue("sparse")) {
+                    flags |= CRYPT_HDR_SPARSE;
+                }
+                if (map.hasValue("merkle")) {
+                    flags |= CRYPT_HDR_MERKLE;
+                }
+                if (map.hasValue("envelope")) {
+                    err = Crypt_EncipherEnvelopeKeyring(fnameIn.c_str(), &kr, map.get<std::size_t>("key-id"),
+                                                        fnameOut.c_str(), flags);
+                } else {
+                    err = Crypt_EncipherChunkedKeyring(fnameIn.c_str(), &kr, map.get<std::size_t>("key-id"),
+                                                       fnameOut.c_str(), flags);
+                }
+            } else {
+                std::size_t rangeStart = 0, rangeEnd = CRYPT_EOF;
+                if (map.hasValue("range")) {
+                    std::vector<std::size_t> range = map.get<std::vector<std::size_t>>("range");
+                    rangeStart = range[0];
+                    rangeEnd = range[1];
+                }
+                err = Crypt_DecipherChunkedKeyring(fnameIn.c_str(), &kr, fnameOut.c_str(), rangeStart, rangeEnd,
+                                                   map.hasValue("merkle") ? CRYPT_HDR_MERKLE : 0,
+                                                   map.hasValue("jobs") ? map.get<std::size_t>("jobs") : (std::size_t) sysconf(_SC_NPROCESSORS_ONLN));
+            }
+            Crypt_KeyringClose(&kr);
+        }
+    }
+
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_PrintError(err);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char const *argv[]) {
     clap::ArgumentParser parser;
 
-    parser.addArg({"operation"}, "specify the type of operation to perform {encipher, decipher, or keygen}", clap::Type<std::string>({"encipher", "decipher", "keygen"}));
-    parser.addArg({"--input-file", "-i"}, "the input filename required for enciphering or deciphering (must exist)", clap::Type<std::string>());
+    parser.addArg({"operation"}, "specify the type of operation to perform {encipher, decipher, verify, update, append, batch, pack, unpack, store, restore, serve, rotate, rekey, or keygen}", clap::Type<std::string>({"encipher", "decipher", "verify", "update", "append", "batch", "pack", "unpack", "store", "restore", "serve", "rotate", "rekey", "keygen"}));
+    parser.addArg({"--input-file", "-i"}, "the input filename required for enciphering or deciphering (must exist, or '-' for append to read stdin)", clap::Type<std::string>());
     parser.addArg({"--output-file", "-o"}, "the output filename required for enciphering or deciphering (overwritten if already exists)", clap::Type<std::string>());
     parser.addArg({"--key-file", "-k"}, "the key filename", clap::Type<std::string>());
+    parser.addArg({"--new-key-file", "-K"}, "the key filename to rotate or rekey to", clap::Type<std::string>());
     parser.addArg({"--key-size", "-s"}, "the key size in bits (must be compliant with AES) {128, 192, 256}", clap::Type<std::size_t>({128, 192, 256}));
     parser.addArg({"--range", "-r"}, "range for operation {first-byte last-byte}", clap::Type<std::vector<std::size_t>>(), 2);
+    parser.addArg({"--compress", "-z"}, "compress each chunk before enciphering it into a chunked container {lz}", clap::Type<std::string>({"lz"}));
+    parser.addArg({"--sparse"}, "keep holes in the input as holes when enciphering into a chunked container", clap::Type<bool>(), 0);
+    parser.addArg({"--merkle"}, "encipher into a chunked container with a Merkle tree of chunk tags, so decipher authenticates every chunk it reads and verify can check the container; with decipher, fail unless the input has such a tree", clap::Type<bool>(), 0);
+    parser.addArg({"--envelope"}, "encipher into a chunked container under a random data key that is wrapped with the key, so the key can be rotated without re-enciphering", clap::Type<bool>(), 0);
+    parser.addArg({"--store"}, "the chunk store that store splits input-file into (created if it does not exist), writing its recipe to output-file, and that restore rebuilds the input-file recipe from; chunks already in the store are not enciphered or written again", clap::Type<std::string>());
+    parser.addArg({"--member"}, "the name of the single archive member to extract with unpack", clap::Type<std::string>());
+    parser.addArg({"--manifest", "-m"}, "the file listing the jobs of a batch operation (one 'operation input-file output-file key-file [first-byte last-byte]' per line)", clap::Type<std::string>());
+    parser.addArg({"--state"}, "the state database of a recurring batch operation; jobs whose inputs are unchanged since the last run are skipped", clap::Type<std::string>());
+    parser.addArg({"--socket"}, "the socket of the daemon to run with serve, or to send an encipher or decipher operation to", clap::Type<std::string>());
+    parser.addArg({"--keyring"}, "the keyring to add a key to with keygen, or to take the key of an encipher or decipher operation from (instead of key-file)", clap::Type<std::string>());
+    parser.addArg({"--key-id"}, "the id of a key in the keyring (keygen imports key-file under this id if given, and generates a key of key-size otherwise)", clap::Type<std::size_t>());
+    parser.addArg({"--count"}, "the number of keys to generate with keygen (key files are numbered, and keyring keys take consecutive ids from key-id)", clap::Type<std::size_t>());
+    parser.addArg({"--passphrase"}, "derive the key of keygen from a passphrase read from stdin; the salt and cost are kept in key-file.ciphkdf, so the same passphrase derives the same key again", clap::Type<bool>(), 0);
+    parser.addArg({"--kdf"}, "the key derivation function for a new passphrase key, checked against an existing one {scrypt, pbkdf2}", clap::Type<std::string>({"scrypt", "pbkdf2"}));
+    parser.addArg({"--digests"}, "also write the SHA-256 digests of the plaintext and ciphertext files of an encipher or decipher operation as JSON to this file ('-' for stdout), hashed while enciphering or deciphering", clap::Type<std::string>());
+    parser.addArg({"--stats"}, "report the bytes, wall and CPU time and throughput of each phase of an encipher or decipher operation (key loading, copying, reading, ciphering and writing the range, padding), with its read and write syscalls and peak RSS, on stderr {text, json}", clap::Type<std::string>({"text", "json"}));
+    parser.addArg({"--trace"}, "write a timeline of the read, cipher, write, copy and sync spans of each thread to this file, in the Trace Event JSON format that Perfetto loads (needs a build with CIPH_TRACE, e.g. make ciph TRACE=1)", clap::Type<std::string>());
+    parser.addArg({"--jobs", "-j"}, "the number of worker threads for a batch, rekey or verify operation, for deciphering a container, or for scrypt (defaults to the number of processors)", clap::Type<std::size_t>());
 
     clap::ArgumentMap map;
     try {
@@ -42,10 +344,65 @@ int main(int argc, char const *argv[]) {
 
     std::string op = map.get<std::string>("operation");
 
+    TraceGuard trace;
+    if (map.hasValue("trace")) {
+#ifdef CIPH_TRACE
+        trace.fname = map.get<std::string>("trace");
+        Crypt_TraceStart();
+#else
+        std::cerr << clap::ParseException("trace requires ciph to be built with CIPH_TRACE (make ciph TRACE=1).").what() << '\n';
+        std::cerr << parser.getUsage() << '\n';
+        return EXIT_FAILURE;
+#endif
+    }
+
+    if (map.hasValue("keyring")) {
+        bool keygen = op == "keygen" && map.hasValue("key-id") &&
+                      ((map.hasValue("key-file") && !map.hasValue("count")) || map.hasValue("key-size"));
+        bool encipher = op == "encipher" && map.hasValue("key-id") && !map.hasValue("range");
+        bool decipher = op == "decipher" && !map.hasValue("key-id");
+        bool rotate = op == "rotate" && map.hasValue("key-id") && map.hasValue("input-file");
+        if (!keygen && !encipher && !decipher && !rotate) {
+            std::cerr << clap::ParseException("keyring requires key-id and key-file (without count) or key-size with keygen, key-id without range with encipher, no key-id with decipher, and input-file and the new key-id with rotate.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        if ((encipher || decipher) && (!map.hasValue("input-file") || !map.hasValue("output-file"))) {
+            std::cerr << clap::ParseException("encipher and decipher operations require input-file and output-file.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        return runKeyring(op, map);
+    }
+
     if (op == "keygen") {
         if (map.hasValue("key-file") && map.hasValue("key-size")) {
             // key-size / 8 because we want to convert from bits to bytes
-            Crypt_GenerateKeyFile((map.get<std::string>("key-file") + ".ciphkey").c_str(), map.get<std::size_t>("key-size") / 8);
+            std::string fnameKey = map.get<std::string>("key-file");
+            std::size_t keySize = map.get<std::size_t>("key-size") / 8;
+            if (map.hasValue("passphrase")) {
+                if (map.hasValue("count")) {
+                    std::cerr << clap::ParseException("passphrase cannot be combined with count.").what() << '\n';
+                    std::cerr << parser.getUsage() << '\n';
+                    return EXIT_FAILURE;
+                }
+                return derivePassphraseKey(fnameKey, keySize, map.hasValue("kdf") ? map.get<std::string>("kdf") : "",
+                                           map.hasValue("jobs") ? map.get<std::size_t>("jobs") : (std::size_t) sysconf(_SC_NPROCESSORS_ONLN));
+            }
+            Crypt_Error_t err = CRYPT_E_SUCCESS;
+            if (!map.hasValue("count")) {
+                err = Crypt_GenerateKeyFile((fnameKey + ".ciphkey").c_str(), keySize);
+            } else {
+                // numbered key files
+                std::size_t count = map.get<std::size_t>("count");
+                for (std::size_t i = 0; err == CRYPT_E_SUCCESS && i < count; i++) {
+                    err = Crypt_GenerateKeyFile((fnameKey + "." + std::to_string(i) + ".ciphkey").c_str(), keySize);
+                }
+            }
+            if (err != CRYPT_E_SUCCESS) {
+                Crypt_PrintError(err);
+                return EXIT_FAILURE;
+            }
             return EXIT_SUCCESS;
         } else {
             std::cerr << clap::ParseException("keygen operation requires key-file and key-size.").what() << '\n';
@@ -54,8 +411,104 @@ int main(int argc, char const *argv[]) {
         }
     }
 
+    if (op == "batch") {
+        if (!map.hasValue("manifest")) {
+            std::cerr << clap::ParseException("batch operation requires manifest.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        return runBatch(map.get<std::string>("manifest"),
+                        map.hasValue("state") ? map.get<std::string>("state") : "",
+                        map.hasValue("jobs") ? map.get<std::size_t>("jobs") : (std::size_t) sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+    if (op == "serve") {
+        if (!map.hasValue("socket")) {
+            std::cerr << clap::ParseException("serve operation requires socket.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        return runServer(map.get<std::string>("socket"));
+    }
+
+    if (op == "rotate") {
+        if (!map.hasValue("input-file") || !map.hasValue("key-file") || !map.hasValue("new-key-file")) {
+            std::cerr << clap::ParseException("rotate operation requires input-file, key-file, and new-key-file.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        std::string fnameOldKey = map.get<std::string>("key-file");
+        std::string fnameNewKey = map.get<std::string>("new-key-file");
+        if (access(fnameOldKey.c_str(), F_OK) != 0 || access(fnameNewKey.c_str(), F_OK) != 0) {
+            std::cerr << clap::ParseException("key-file or new-key-file does not exist or is inaccessible.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        Crypt_Error_t err = Crypt_Rotate(map.get<std::string>("input-file").c_str(), fnameOldKey.c_str(), fnameNewKey.c_str());
+        if (err != CRYPT_E_SUCCESS) {
+            Crypt_PrintError(err);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (op == "rekey") {
+        if (!map.hasValue("input-file") || !map.hasValue("output-file") || !map.hasValue("key-file") || !map.hasValue("new-key-file")) {
+            std::cerr << clap::ParseException("rekey operation requires input-file, output-file, key-file, and new-key-file.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        std::string fnameOldKey = map.get<std::string>("key-file");
+        std::string fnameNewKey = map.get<std::string>("new-key-file");
+        if (access(fnameOldKey.c_str(), F_OK) != 0 || access(fnameNewKey.c_str(), F_OK) != 0) {
+            std::cerr << clap::ParseException("key-file or new-key-file does not exist or is inaccessible.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        // the range is the one the file was enciphered with, as for decipher
+        std::size_t rangeStart = 0, rangeEnd = CRYPT_EOF;
+        if (map.hasValue("range")) {
+            std::vector<std::size_t> range = map.get<std::vector<std::size_t>>("range");
+            rangeStart = range[0];
+            rangeEnd = range[1];
+        }
+        Crypt_Error_t err = Crypt_Rekey(map.get<std::string>("input-file").c_str(), fnameOldKey.c_str(), fnameNewKey.c_str(),
+                                        map.get<std::string>("output-file").c_str(), rangeStart, rangeEnd,
+                                        map.hasValue("jobs") ? map.get<std::size_t>("jobs") : (std::size_t) sysconf(_SC_NPROCESSORS_ONLN));
+        if (err != CRYPT_E_SUCCESS) {
+            Crypt_PrintError(err);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (op == "verify") {
+        if (!map.hasValue("input-file") || !map.hasValue("key-file")) {
+            std::cerr << clap::ParseException("verify operation requires input-file and key-file.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        if (access(map.get<std::string>("key-file").c_str(), F_OK) != 0) {
+            std::cerr << clap::ParseException("key-file does not exist or is inaccessible.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        std::size_t nFailed;
+        Crypt_Error_t err = Crypt_Verify(map.get<std::string>("input-file").c_str(), map.get<std::string>("key-file").c_str(),
+                                         map.hasValue("jobs") ? map.get<std::size_t>("jobs") : (std::size_t) sysconf(_SC_NPROCESSORS_ONLN),
+                                         &nFailed);
+        if (nFailed) {
+            std::cerr << nFailed << " chunks failed authentication.\n";
+        }
+        if (err != CRYPT_E_SUCCESS) {
+            Crypt_PrintError(err);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
     if (!map.hasValue("input-file") || !map.hasValue("output-file") || !map.hasValue("key-file")) {
-        std::cerr << clap::ParseException("encipher and decipher operations require input-file, output-file, and key-file.").what() << '\n';
+        std::cerr << clap::ParseException("encipher, decipher, update, append, pack, unpack, store, and restore operations require input-file, output-file, and key-file.").what() << '\n';
         std::cerr << parser.getUsage() << '\n';
         return EXIT_FAILURE;
     }
@@ -79,17 +532,148 @@ int main(int argc, char const *argv[]) {
         rangeEnd = range[1];
     }
 
+    // digests and stats are recorded by Crypt_EncipherRange and Crypt_DecipherRange
+    bool rangeOp = (op == "encipher" || op == "decipher") && !map.hasValue("socket") && !map.hasValue("compress") &&
+                   !map.hasValue("sparse") && !map.hasValue("envelope") && !map.hasValue("merkle") &&
+                   !(op == "decipher" && Crypt_IsContainer(fnameIn.c_str()));
+    if ((map.hasValue("digests") || map.hasValue("stats")) && !rangeOp) {
+        std::cerr << clap::ParseException("digests and stats can only be used with encipher and decipher, not with containers or combined with socket, compress, sparse, envelope, or merkle.").what() << '\n';
+        std::cerr << parser.getUsage() << '\n';
+        return EXIT_FAILURE;
+    }
+    Crypt_Digests digests;
+    Crypt_Digests* pDigests = map.hasValue("digests") ? &digests : NULL;
+    Crypt_Stats stats;
+    if (map.hasValue("stats")) {
+        Crypt_StatsStart(&stats);
+    }
+
     // handle op mode
-    if (op == "encipher") {
-        Crypt_EncipherRange(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), rangeStart, rangeEnd);
+    Crypt_Error_t err = CRYPT_E_SUCCESS;
+    if (op == "append") {
+        err = appendLog(fnameIn, fnameOut, fnameKey, map.hasValue("compress") ? CRYPT_HDR_COMPRESSED : 0);
+        if (err != CRYPT_E_SUCCESS) {
+            Crypt_PrintError(err);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    if (map.hasValue("socket")) {
+        if ((op != "encipher" && op != "decipher") || map.hasValue("compress") || map.hasValue("sparse") || map.hasValue("envelope") || map.hasValue("merkle")) {
+            std::cerr << clap::ParseException("socket can only be used with encipher and decipher, and cannot be combined with compress, sparse, envelope, or merkle.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        int sock = Crypt_ServeConnect(map.get<std::string>("socket").c_str());
+        if (sock < 0) {
+            err = CRYPT_E_IO;
+        } else {
+            // the range means the same as without the daemon
+            err = Crypt_ServeTransform(sock, (op == "encipher") ? CRYPT_OP_ENCIPHER : CRYPT_OP_DECIPHER,
+                                       fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), rangeStart, rangeEnd);
+            close(sock);
+        }
+    } else if (op == "pack" || op == "unpack") {
+        if (map.hasValue("range") || map.hasValue("sparse") || map.hasValue("merkle") || (op == "unpack" && map.hasValue("compress"))) {
+            std::cerr << clap::ParseException("pack and unpack cannot be combined with range, sparse, or merkle, and unpack cannot be combined with compress.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        if (op == "pack") {
+            err = Crypt_Pack(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), map.hasValue("compress") ? CRYPT_HDR_COMPRESSED : 0);
+        } else {
+            std::string member = map.hasValue("member") ? map.get<std::string>("member") : "";
+            err = Crypt_Unpack(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), map.hasValue("member") ? member.c_str() : NULL);
+        }
+    } else if (op == "store" || op == "restore") {
+        if (!map.hasValue("store") || map.hasValue("range") || map.hasValue("sparse") || map.hasValue("merkle") ||
+            map.hasValue("envelope") || (op == "restore" && map.hasValue("compress"))) {
+            std::cerr << clap::ParseException("store and restore require store, and cannot be combined with range, sparse, merkle, or envelope, and restore cannot be combined with compress.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        std::string dirStore = map.get<std::string>("store");
+        if (op == "store") {
+            Crypt_StoreStats stats;
+            err = Crypt_StorePut(fnameIn.c_str(), fnameKey.c_str(), dirStore.c_str(), fnameOut.c_str(), map.hasValue("compress"), &stats);
+            if (err == CRYPT_E_SUCCESS) {
+                std::cout << stats.nNew << " of " << stats.nChunks << " chunks (" << stats.newBytes << " of " << stats.rawBytes << " bytes) were new to the store.\n";
+            }
+        } else {
+            err = Crypt_StoreGet(fnameIn.c_str(), fnameKey.c_str(), dirStore.c_str(), fnameOut.c_str());
+        }
+    } else if (op == "update") {
+        if (map.hasValue("range") || map.hasValue("compress") || map.hasValue("sparse")) {
+            std::cerr << clap::ParseException("update cannot be combined with range, compress, or sparse.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        err = Crypt_EncipherIncremental(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), NULL);
+    } else if (op == "encipher" && (map.hasValue("compress") || map.hasValue("sparse") || map.hasValue("envelope") || map.hasValue("merkle"))) {
+        if (map.hasValue("range")) {
+            std::cerr << clap::ParseException("compress, sparse, envelope, and merkle cannot be combined with range.").what() << '\n';
+            std::cerr << parser.getUsage() << '\n';
+            return EXIT_FAILURE;
+        }
+        uint16_t flags = 0;
+        if (map.hasValue("compress")) {
+            flags |= CRYPT_HDR_COMPRESSED;
+        }
+        if (map.hasValue("sparse")) {
+            flags |= CRYPT_HDR_SPARSE;
+        }
+        if (map.hasValue("merkle")) {
+            flags |= CRYPT_HDR_MERKLE;
+        }
+        if (map.hasValue("envelope")) {
+            err = Crypt_EncipherEnvelope(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), flags);
+        } else {
+            err = Crypt_EncipherChunked(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), flags);
+        }
+    } else if (op == "encipher") {
+        err = Crypt_EncipherRangeDigests(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), rangeStart, rangeEnd, pDigests);
+    } else if (Crypt_IsContainer(fnameIn.c_str())) {
+        // chunked containers are deciphered by plaintext range, so the
+        // range is passed through unchanged
+        // with --merkle, a container without a tree is not trusted
+        err = Crypt_DecipherChunkedRequire(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), rangeStart, rangeEnd,
+                                           map.hasValue("merkle") ? CRYPT_HDR_MERKLE : 0,
+                                           map.hasValue("jobs") ? map.get<std::size_t>("jobs") : (std::size_t) sysconf(_SC_NPROCESSORS_ONLN));
+    } else if (map.hasValue("merkle")) {
+        // not a container at all, so nothing authenticates it
+        err = CRYPT_E_INTEGRITY;
     } else {
         if (rangeEnd != CRYPT_EOF) {
             // special case; if rangeEnd == CRYPT_EOF, CRYPT_CALC_ENDPT does not correctly calculate
             // the endpoint, so just pass CRYPT_EOF if this is the case
             rangeEnd = CRYPT_CALC_ENDPT(rangeStart, rangeEnd);
         }
-        Crypt_DecipherRange(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), rangeStart, rangeEnd);
+        err = Crypt_DecipherRangeDigests(fnameIn.c_str(), fnameKey.c_str(), fnameOut.c_str(), rangeStart, rangeEnd, pDigests);
     }
 
+    if (map.hasValue("stats")) {
+        Crypt_StatsStop(&stats);
+        // on stderr, so stdout stays free for digests
+        Crypt_PrintStats(stderr, &stats, map.get<std::string>("stats") == "json");
+    }
+
+    if (err == CRYPT_E_SUCCESS && pDigests) {
+        std::string fnameDigests = map.get<std::string>("digests");
+        FILE* fileDigests = (fnameDigests == "-") ? stdout : fopen(fnameDigests.c_str(), "w");
+        if (!fileDigests) {
+            err = CRYPT_E_IO;
+        } else {
+            bool encipher = op == "encipher";
+            Crypt_PrintDigests(fileDigests, (encipher ? fnameIn : fnameOut).c_str(), (encipher ? fnameOut : fnameIn).c_str(), pDigests);
+            if (fileDigests != stdout && fclose(fileDigests) != 0) {
+                err = CRYPT_E_IO;
+            }
+        }
+    }
+
+    if (err != CRYPT_E_SUCCESS) {
+        Crypt_PrintError(err);
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
@@ -375,8 +375,10 @@ namespace clap {
                 for (std::size_t i = 0; i < argInfo->nargs; i++) {
                     usage += repeatName + ' ';
                 }
-                // remove trailing space
-                usage.pop_back();
+                if (!usage.empty()) {
+                    // remove trailing space (switches take no arguments)
+                    usage.pop_back();
+                }
 
                 if (!argInfo->isRequired()) {
                     // optional argument
@@ -466,6 +468,11 @@ namespace clap {
                 argInfo->addValue(argj);
                 argi++;
             }
+            if (argInfo->nargs == 0) {
+                // a switch (an optional argument of type bool that takes
+                // no arguments) is set by its presence alone
+                argInfo->addValue("1");
+            }
         }
 
         // check if all the required arguments recieved a value
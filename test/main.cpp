@@ -14,6 +14,32 @@ extern "C" {
 
 // aes tests:
 #include "test_aes.hpp"
+// ciph tests:
+#include "test_reader.hpp"
+#include "test_lz.hpp"
+#include "test_container.hpp"
+#include "test_log.hpp"
+#include "test_xxhash.hpp"
+#include "test_drbg.hpp"
+#include "test_sha256.hpp"
+#include "test_kdf.hpp"
+#include "test_digests.hpp"
+#include "test_stats.hpp"
+#include "test_trace.hpp"
+#include "test_incremental.hpp"
+#include "test_batch.hpp"
+#include "test_archive.hpp"
+#include "test_state.hpp"
+#include "test_serve.hpp"
+#include "test_keyring.hpp"
+#include "test_envelope.hpp"
+#include "test_merkle.hpp"
+#include "test_store.hpp"
+#include "test_records.hpp"
+#include "test_iov.hpp"
+#include "test_stream.hpp"
+#include "test_ciphstream.hpp"
+#include "test_async.hpp"
 
 int main(int argc, char const *argv[]) {
     QTEST_RUN_ALL();
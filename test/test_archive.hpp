@@ -0,0 +1,90 @@
+#ifndef TEST_ARCHIVE_HPP_
+#define TEST_ARCHIVE_HPP_
+
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/archive.h"
+}
+
+std::string ArchiveTest_TempDir() {
+    char dname[] = "/tmp/ciph_test_XXXXXX";
+    return std::string(mkdtemp(dname));
+}
+
+QTEST_CASE(Archive, PackUnpack) {
+    std::string dirIn = ArchiveTest_TempDir();
+    std::string dirOut = ArchiveTest_TempDir();
+    TestFiles_Fixture files(0, 16);
+
+    // many small files that share chunks, an empty file, and one file
+    // larger than a chunk, in nested directories
+    mkdir((dirIn + "/sub").c_str(), 0755);
+    mkdir((dirIn + "/sub/deeper").c_str(), 0755);
+    std::vector<std::string> names;
+    for (int i = 0; i < 50; i++) {
+        names.push_back("small" + std::to_string(i));
+    }
+    names.push_back("sub/empty");
+    names.push_back("sub/deeper/large");
+    std::vector<std::vector<byte>> contents;
+    for (size_t i = 0; i < names.size(); i++) {
+        size_t nBytes = (names[i] == "sub/empty") ? 0 : (names[i] == "sub/deeper/large") ? 3 * CRYPT_CHUNK_SIZE + 5 : 100 + i;
+        std::vector<byte> data = TestFiles_RandomData(nBytes + i);
+        data.resize(nBytes);
+        if (!data.empty()) {
+            data[0] = (byte) i;
+        }
+        TestFiles_Write(dirIn + "/" + names[i], data);
+        contents.push_back(data);
+    }
+    chmod((dirIn + "/small3").c_str(), 0600);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Pack(dirIn.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(),
+                                                    CRYPT_HDR_COMPRESSED));
+
+    Crypt_Archive a;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ArchiveOpen(&a, files.fnameCipher.c_str(), files.fnameKey.c_str()));
+    QTEST_EXPECT_EQUALS(names.size(), a.nMembers);
+    const Crypt_Member* large = Crypt_ArchiveFind(&a, "sub/deeper/large");
+    QTEST_EXPECT(large != NULL);
+    QTEST_EXPECT_EQUALS(3 * CRYPT_CHUNK_SIZE + 5, large->entry.size);
+    QTEST_EXPECT(Crypt_ArchiveFind(&a, "missing") == NULL);
+    // the small files share chunks rather than taking one each
+    QTEST_EXPECT(a.chunks.nChunks < 10);
+    Crypt_ArchiveClose(&a);
+
+    // a single member
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Unpack(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                      dirOut.c_str(), "small7"));
+    QTEST_EXPECT(TestFiles_Read(dirOut + "/small7") == contents[7]);
+    QTEST_EXPECT(TestFiles_Read(dirOut + "/small8").empty());
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_Unpack(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                       dirOut.c_str(), "missing"));
+
+    // everything
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Unpack(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                      dirOut.c_str(), NULL));
+    for (size_t i = 0; i < names.size(); i++) {
+        QTEST_EXPECT(TestFiles_Read(dirOut + "/" + names[i]) == contents[i]);
+    }
+    struct stat st;
+    QTEST_EXPECT_EQUALS(0, stat((dirOut + "/small3").c_str(), &st));
+    QTEST_EXPECT_EQUALS(0600, st.st_mode & 0777);
+
+    // unsafe names are never extracted
+    QTEST_EXPECT(!Crypt_IsSafeName("../escape"));
+    QTEST_EXPECT(!Crypt_IsSafeName("/etc/passwd"));
+    QTEST_EXPECT(!Crypt_IsSafeName("a/./b"));
+    QTEST_EXPECT(Crypt_IsSafeName("a/b..c"));
+
+    std::string cleanup = "rm -rf " + dirIn + " " + dirOut;
+    QTEST_EXPECT_EQUALS(0, system(cleanup.c_str()));
+}
+
+#endif  // TEST_ARCHIVE_HPP_
@@ -0,0 +1,97 @@
+#ifndef TEST_ASYNC_HPP_
+#define TEST_ASYNC_HPP_
+
+// the coroutine API needs C++20 (make test20)
+
+#include "../include/ciphasync.hpp"
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+QTEST_CASE(Async, EncryptDecrypt) {
+    std::string fnameKey = TestFiles_Temp();
+    Crypt_GenerateKeyFile(fnameKey.c_str(), 32);
+
+    // more jobs than threads, and sizes around blocks and chunks
+    std::vector<size_t> sizes = {0, 15, 16, 1000, CIPH_ASYNC_CHUNK_SIZE, 3 * CIPH_ASYNC_CHUNK_SIZE + 5};
+    std::vector<std::string> fnamesPlain, fnamesCipher, fnamesOut;
+    std::vector<std::vector<byte>> plaintexts;
+    for (size_t size : sizes) {
+        fnamesPlain.push_back(TestFiles_Temp());
+        fnamesCipher.push_back(TestFiles_Temp());
+        fnamesOut.push_back(TestFiles_Temp());
+        plaintexts.push_back(TestFiles_WriteRandom(fnamesPlain.back(), size));
+    }
+
+    ciph::executor ex(2);
+    std::vector<ciph::task<Crypt_Error_t>> jobs;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        jobs.push_back(ciph::encrypt_file(ex, fnamesPlain[i], fnameKey, fnamesCipher[i]));
+    }
+    std::vector<Crypt_Error_t> errs = ciph::sync_wait(ciph::when_all(std::move(jobs)));
+    QTEST_EXPECT_EQUALS(sizes.size(), errs.size());
+
+    // the files are what encipher makes, and decipher back
+    std::string fnameExpected = TestFiles_Temp();
+    for (size_t i = 0; i < sizes.size(); i++) {
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, errs[i]);
+        Crypt_EncipherRange(fnamesPlain[i].c_str(), fnameKey.c_str(), fnameExpected.c_str(), CRYPT_SOF, CRYPT_EOF);
+        QTEST_EXPECT(TestFiles_Read(fnamesCipher[i]) == TestFiles_Read(fnameExpected));
+        jobs.push_back(ciph::decrypt_file(ex, fnamesCipher[i], fnameKey, fnamesOut[i]));
+    }
+    errs = ciph::sync_wait(ciph::when_all(std::move(jobs)));
+    for (size_t i = 0; i < sizes.size(); i++) {
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, errs[i]);
+        QTEST_EXPECT(TestFiles_Read(fnamesOut[i]) == plaintexts[i]);
+    }
+
+    // a truncated ciphertext, a missing input and a missing key
+    std::vector<byte> ciphertext = TestFiles_Read(fnamesCipher.back());
+    ciphertext.resize(ciphertext.size() - 3);
+    TestFiles_Write(fnamesCipher.back(), ciphertext);
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, ciph::sync_wait(ciph::decrypt_file(ex, fnamesCipher.back(), fnameKey, fnamesOut.back())));
+    QTEST_EXPECT_EQUALS(CRYPT_E_IO, ciph::sync_wait(ciph::encrypt_file(ex, fnamesPlain[0] + ".missing", fnameKey, fnamesOut[0])));
+    QTEST_EXPECT_EQUALS(CRYPT_E_IO, ciph::sync_wait(ciph::encrypt_file(ex, fnamesPlain[0], fnameKey + ".missing", fnamesOut[0])));
+    // an invalid key is caught before the output is truncated
+    std::vector<byte> keyFile = TestFiles_Read(fnameKey);
+    keyFile.pop_back();
+    TestFiles_Write(fnameKey, keyFile);
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, ciph::sync_wait(ciph::encrypt_file(ex, fnamesPlain[1], fnameKey, fnamesOut[1])));
+    QTEST_EXPECT(TestFiles_Read(fnamesOut[1]) == plaintexts[1]);
+
+    for (size_t i = 0; i < sizes.size(); i++) {
+        unlink(fnamesPlain[i].c_str());
+        unlink(fnamesCipher[i].c_str());
+        unlink(fnamesOut[i].c_str());
+    }
+    unlink(fnameExpected.c_str());
+    unlink(fnameKey.c_str());
+}
+
+QTEST_CASE(Async, OffloadedNotAwaited) {
+    // an operation that is never awaited waits for its function, which
+    // still uses it, when it is destroyed
+    ciph::executor ex(1);
+    std::atomic<bool> ran(false);
+    {
+        auto fn = [&ran]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            ran = true;
+            return 1;
+        };
+        ciph::detail::offloaded<decltype(fn)> op(ex, fn);
+    }
+    QTEST_EXPECT(ran);
+}
+
+#endif  // __cplusplus >= 202002L
+
+#endif  // TEST_ASYNC_HPP_
@@ -0,0 +1,181 @@
+#ifndef TEST_BATCH_HPP_
+#define TEST_BATCH_HPP_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/batch.h"
+    #include "../include/envelope.h"
+}
+
+std::atomic<int> PoolTest_count(0);
+
+void PoolTest_Leaf(void* arg) {
+    PoolTest_count++;
+}
+
+void PoolTest_Spawn(void* arg) {
+    // tasks submitted by a task run on the same pool
+    Crypt_Pool* pool = (Crypt_Pool*) arg;
+    for (int i = 0; i < 10; i++) {
+        Crypt_PoolSubmit(pool, PoolTest_Leaf, NULL);
+    }
+    PoolTest_count++;
+}
+
+QTEST_CASE(Pool, NestedTasks) {
+    Crypt_Pool* pool = Crypt_PoolNew(4);
+    QTEST_EXPECT(pool != NULL);
+    PoolTest_count = 0;
+    for (int i = 0; i < 100; i++) {
+        Crypt_PoolSubmit(pool, PoolTest_Spawn, pool);
+    }
+    Crypt_PoolWait(pool);
+    QTEST_EXPECT_EQUALS(100 * 11, PoolTest_count.load());
+    QTEST_EXPECT_EQUALS(100 * 11, pool->stats.executed);
+    Crypt_PoolFree(pool);
+}
+
+QTEST_CASE(Batch, Manifest) {
+    TestFiles_Fixture files(0, 32);
+    std::string fnameManifest = files.Temp();
+    std::string fnameMissing = files.Temp();
+    unlink(fnameMissing.c_str());
+
+    // a small file, a file that is split into several parts, and a range
+    std::vector<std::string> fnamePlain, fnameCipher, fnameExpected;
+    size_t sizes[] = {100, 3 * CRYPT_BATCH_PART_SIZE + 37, 5000};
+    size_t ranges[][2] = {{CRYPT_SOF, CRYPT_EOF}, {CRYPT_SOF, CRYPT_EOF}, {1000, 3333}};
+    std::string manifest = "# test jobs\n\n";
+    for (size_t i = 0; i < 3; i++) {
+        fnamePlain.push_back(files.Temp());
+        fnameCipher.push_back(files.Temp());
+        fnameExpected.push_back(files.Temp());
+        TestFiles_WriteRandom(fnamePlain[i], sizes[i]);
+        Crypt_EncipherRange(fnamePlain[i].c_str(), files.fnameKey.c_str(), fnameExpected[i].c_str(),
+                            ranges[i][0], ranges[i][1]);
+        manifest += "encipher " + fnamePlain[i] + " " + fnameCipher[i] + " " + files.fnameKey;
+        if (ranges[i][1] != CRYPT_EOF) {
+            manifest += " " + std::to_string(ranges[i][0]) + " " + std::to_string(ranges[i][1]);
+        }
+        manifest += "\n";
+    }
+    // jobs that fail on their own without failing the batch
+    manifest += "encipher " + fnameMissing + " " + fnameCipher[0] + ".x " + files.fnameKey + "\n";
+    manifest += "encipher " + fnamePlain[0] + " " + files.Track(fnameCipher[0] + ".y") + " " + fnameMissing + "\n";
+    TestFiles_Write(fnameManifest, std::vector<byte>(manifest.begin(), manifest.end()));
+
+    Crypt_Batch batch;
+    Crypt_BatchInit(&batch);
+    FILE* file = fopen(fnameManifest.c_str(), "r");
+    size_t errLine;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchParse(&batch, file, &errLine));
+    fclose(file);
+    QTEST_EXPECT_EQUALS(5, batch.nJobs);
+    QTEST_EXPECT_EQUALS(2, batch.nKeys);
+    QTEST_EXPECT_EQUALS(3, batch.jobs[0].line);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchRun(&batch, 3));
+    for (size_t i = 0; i < 3; i++) {
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, batch.jobs[i].err);
+        QTEST_EXPECT(TestFiles_Read(fnameCipher[i]) == TestFiles_Read(fnameExpected[i]));
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_IO, batch.jobs[3].err);
+    QTEST_EXPECT_EQUALS(CRYPT_E_IO, batch.jobs[4].err);
+    FILE* devNull = fopen("/dev/null", "w");
+    QTEST_EXPECT_EQUALS(2, Crypt_BatchReport(&batch, devNull));
+    fclose(devNull);
+    Crypt_BatchFree(&batch);
+
+    // decipher everything again, the range in plaintext bytes
+    Crypt_BatchInit(&batch);
+    for (size_t i = 0; i < 3; i++) {
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchAdd(&batch, CRYPT_OP_DECIPHER, fnameCipher[i].c_str(),
+                                                            fnameExpected[i].c_str(), files.fnameKey.c_str(),
+                                                            ranges[i][0], ranges[i][1], 0));
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchRun(&batch, 2));
+    for (size_t i = 0; i < 3; i++) {
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, batch.jobs[i].err);
+        QTEST_EXPECT(TestFiles_Read(fnameExpected[i]) == TestFiles_Read(fnamePlain[i]));
+    }
+    Crypt_BatchFree(&batch);
+
+    // a final block without padding (pad byte 0) is malformed
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    Crypt_LoadKeyFile(files.fnameKey.c_str(), key, &keySize);
+    AES_KeyCtx padCtx;
+    AES_InitKeyCtx(&padCtx, key, CRYPT_PAD_NK);
+    std::vector<byte> unpadded(2 * STATE_SIZE, 0x41);
+    unpadded[2 * STATE_SIZE - 1] = 0;
+    AES_EncipherBlock(&padCtx, &unpadded[STATE_SIZE], &unpadded[STATE_SIZE]);
+    TestFiles_Write(fnameCipher[0], unpadded);
+    Crypt_BatchInit(&batch);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchAdd(&batch, CRYPT_OP_DECIPHER, fnameCipher[0].c_str(),
+                                                        fnameExpected[0].c_str(), files.fnameKey.c_str(),
+                                                        CRYPT_SOF, CRYPT_EOF, 0));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchRun(&batch, 1));
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, batch.jobs[0].err);
+    Crypt_BatchFree(&batch);
+
+    // a malformed line is reported with its line number
+    std::string bad = "encipher a b\n";
+    TestFiles_Write(fnameManifest, std::vector<byte>(bad.begin(), bad.end()));
+    Crypt_BatchInit(&batch);
+    file = fopen(fnameManifest.c_str(), "r");
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_BatchParse(&batch, file, &errLine));
+    QTEST_EXPECT_EQUALS(1, errLine);
+    fclose(file);
+    Crypt_BatchFree(&batch);
+}
+
+QTEST_CASE(Batch, Rekey) {
+    TestFiles_Fixture files(2 * CRYPT_BATCH_PART_SIZE + 21, 32);
+    std::string fnameKeyB = files.Temp();
+    std::string fnameExpected = files.Temp();
+    Crypt_GenerateKeyFile(fnameKeyB.c_str(), 16);
+
+    // the result is what enciphering with the new key gives, padding and all
+    size_t ranges[][2] = {{CRYPT_SOF, CRYPT_EOF}, {1000, 3333}, {4096, 8192}};
+    for (size_t i = 0; i < 3; i++) {
+        Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(),
+                            ranges[i][0], ranges[i][1]);
+        Crypt_EncipherRange(files.fnamePlain.c_str(), fnameKeyB.c_str(), fnameExpected.c_str(),
+                            ranges[i][0], ranges[i][1]);
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Rekey(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                         fnameKeyB.c_str(), files.fnameOut.c_str(),
+                                                         ranges[i][0], ranges[i][1], 3));
+        QTEST_EXPECT(TestFiles_Read(files.fnameOut) == TestFiles_Read(fnameExpected));
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_Rekey(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                      fnameKeyB.c_str(), files.fnameCipher.c_str(), CRYPT_SOF, CRYPT_EOF, 1));
+
+    // containers, with and without a wrapped data key, only open with the new key
+    for (int wrapped = 0; wrapped < 2; wrapped++) {
+        if (wrapped) {
+            Crypt_EncipherEnvelope(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(),
+                                   CRYPT_HDR_COMPRESSED);
+        } else {
+            Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(),
+                                  CRYPT_HDR_COMPRESSED);
+        }
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Rekey(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                         fnameKeyB.c_str(), files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF, 2));
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameOut.c_str(), fnameKeyB.c_str(),
+                                                                   fnameExpected.c_str(), CRYPT_SOF, CRYPT_EOF));
+        QTEST_EXPECT(TestFiles_Read(fnameExpected) == files.plaintext);
+        QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_DecipherChunked(files.fnameOut.c_str(), files.fnameKey.c_str(),
+                                                                    fnameExpected.c_str(), CRYPT_SOF, CRYPT_EOF));
+    }
+    // the wrong old key is refused
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_Rekey(files.fnameOut.c_str(), files.fnameKey.c_str(), fnameKeyB.c_str(),
+                                                      files.fnameCipher.c_str(), CRYPT_SOF, CRYPT_EOF, 1));
+}
+
+#endif  // TEST_BATCH_HPP_
@@ -0,0 +1,82 @@
+#ifndef TEST_CIPHSTREAM_HPP_
+#define TEST_CIPHSTREAM_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+#include "../include/ciphstream.hpp"
+
+QTEST_CASE(CiphStream, WriteRead) {
+    TestFiles_Fixture files(0, 24);
+
+    // small buffers, so lines, overflows and writes larger than the
+    // buffer all happen, and a stream moved in between
+    std::vector<byte> blob = TestFiles_RandomData(1000);
+    {
+        ciph_ostream out(files.fnameCipher, files.fnameKey, 64);
+        QTEST_EXPECT(out.is_open());
+        out << "first line " << 42 << '\n';
+        ciph_ostream moved(std::move(out));
+        moved.write((const char*) blob.data(), blob.size());
+        for (int i = 0; i < 100; i++) {
+            moved << i << ' ';
+        }
+        moved.close();
+        QTEST_EXPECT(moved.good());
+    }
+
+    // the file is what encipher makes of the same plaintext
+    std::string text = "first line 42\n" + std::string(blob.begin(), blob.end());
+    for (int i = 0; i < 100; i++) {
+        text += std::to_string(i) + ' ';
+    }
+    TestFiles_Write(files.fnamePlain, std::vector<byte>(text.begin(), text.end()));
+    Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF);
+    QTEST_EXPECT(TestFiles_Read(files.fnameCipher) == TestFiles_Read(files.fnameOut));
+
+    {
+        ciph_istream in(files.fnameCipher, files.fnameKey, 48);
+        std::string line;
+        std::getline(in, line);
+        QTEST_EXPECT(line == "first line 42");
+        std::vector<byte> readBlob(blob.size());
+        ciph_istream moved(std::move(in));
+        moved.read((char*) readBlob.data(), readBlob.size());
+        QTEST_EXPECT(readBlob == blob);
+        int sum = 0, i;
+        while (moved >> i) {
+            sum += i;
+        }
+        QTEST_EXPECT_EQUALS(4950, sum);
+        QTEST_EXPECT(moved.eof() && !moved.bad());
+    }
+
+    // a truncated file makes the stream bad
+    std::vector<byte> ciphertext = TestFiles_Read(files.fnameCipher);
+    ciphertext.resize(ciphertext.size() - 5);
+    TestFiles_Write(files.fnameCipher, ciphertext);
+    {
+        ciph_istream in(files.fnameCipher, files.fnameKey);
+        std::vector<char> all(2 * text.size());
+        in.read(all.data(), all.size());
+        QTEST_EXPECT(in.bad());
+    }
+
+    ciph_istream missing(files.fnameCipher + ".missing", files.fnameKey);
+    QTEST_EXPECT(!missing.is_open() && missing.fail());
+
+    // an invalid key file leaves the output alone
+    std::vector<byte> keyFile = TestFiles_Read(files.fnameKey);
+    keyFile.pop_back();
+    TestFiles_Write(files.fnameKey, keyFile);
+    {
+        ciph_ostream out(files.fnameCipher, files.fnameKey);
+        QTEST_EXPECT(!out.is_open() && out.fail());
+    }
+    QTEST_EXPECT(TestFiles_Read(files.fnameCipher) == ciphertext);
+}
+
+#endif  // TEST_CIPHSTREAM_HPP_
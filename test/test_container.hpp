@@ -0,0 +1,126 @@
+#ifndef TEST_CONTAINER_HPP_
+#define TEST_CONTAINER_HPP_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/container.h"
+}
+
+QTEST_CASE(Container, CompressedRoundTrip) {
+    TestFiles_Fixture files(0, 32);
+
+    // compressible chunks followed by incompressible ones
+    std::vector<byte> plaintext;
+    while (plaintext.size() < 3 * CRYPT_CHUNK_SIZE) {
+        const char line[] = "2022-09-11 12:00:00 INFO ciph: enciphered file\n";
+        plaintext.insert(plaintext.end(), line, line + sizeof(line) - 1);
+    }
+    std::vector<byte> noise = TestFiles_RandomData(2 * CRYPT_CHUNK_SIZE + 77);
+    plaintext.insert(plaintext.end(), noise.begin(), noise.end());
+    TestFiles_Write(files.fnamePlain, plaintext);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameCipher.c_str(), CRYPT_HDR_COMPRESSED));
+    QTEST_EXPECT(Crypt_IsContainer(files.fnameCipher.c_str()));
+    QTEST_EXPECT(!Crypt_IsContainer(files.fnamePlain.c_str()));
+    // the compressible part shrinks the output below the input size
+    QTEST_EXPECT(TestFiles_Read(files.fnameCipher).size() < plaintext.size());
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == plaintext);
+
+    // decipher a range spanning a compressed and an uncompressed chunk
+    size_t firstByte = 3 * CRYPT_CHUNK_SIZE - 10, lastByte = 3 * CRYPT_CHUNK_SIZE + 500;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), firstByte, lastByte));
+    std::vector<byte> expected(plaintext.begin() + firstByte, plaintext.begin() + lastByte);
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == expected);
+
+    // the same on several threads, which write the chunks out of order
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunkedRequire(files.fnameCipher.c_str(),
+                                                                      files.fnameKey.c_str(), files.fnameOut.c_str(),
+                                                                      CRYPT_SOF, CRYPT_EOF, 0, 4));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == plaintext);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunkedRequire(files.fnameCipher.c_str(),
+                                                                      files.fnameKey.c_str(), files.fnameOut.c_str(),
+                                                                      firstByte, lastByte, 0, 4));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == expected);
+}
+
+QTEST_CASE(Container, Index) {
+    TestFiles_Fixture files(2 * CRYPT_CHUNK_SIZE + 1, 16);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameCipher.c_str(), 0));
+
+    FILE* file = fopen(files.fnameCipher.c_str(), "rb");
+    Crypt_ChunkIndex index;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_IndexChunks(file, &index));
+    QTEST_EXPECT_EQUALS(3, index.nChunks);
+    QTEST_EXPECT_EQUALS(files.plaintext.size(), index.rawSize);
+    QTEST_EXPECT_EQUALS(1, index.chunks[2].hdr.rawSize);
+    QTEST_EXPECT_EQUALS(2 * CRYPT_CHUNK_SIZE, index.chunks[2].rawOffset);
+    Crypt_FreeIndex(&index);
+    fclose(file);
+
+    // a key file whose size is not an AES key size is rejected before
+    // the output is touched
+    std::vector<byte> ciphertext = TestFiles_Read(files.fnameCipher);
+    for (size_t keySize : {(size_t) 0, (size_t) 20, (size_t) 1000}) {
+        std::vector<byte> keyFile((const byte*) &keySize, (const byte*) &keySize + sizeof(size_t));
+        keyFile.resize(sizeof(size_t) + 32);
+        TestFiles_Write(files.fnameKey, keyFile);
+        QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                  files.fnameCipher.c_str(), 0));
+        QTEST_EXPECT(TestFiles_Read(files.fnameCipher) == ciphertext);
+    }
+}
+
+QTEST_CASE(Container, Sparse) {
+    TestFiles_Fixture files(0, 16);
+
+    // 16 MiB file with data at 1 MiB and 9 MiB, and a hole at the end
+    size_t fsize = 16 * 1024 * 1024;
+    std::vector<byte> data = TestFiles_RandomData(5000);
+    std::vector<byte> plaintext(fsize, 0);
+    FILE* file = fopen(files.fnamePlain.c_str(), "wb");
+    size_t offsets[] = {1024 * 1024, 9 * 1024 * 1024};
+    for (size_t offset : offsets) {
+        fseeko(file, (off_t) offset, SEEK_SET);
+        fwrite(data.data(), sizeof(byte), data.size(), file);
+        std::copy(data.begin(), data.end(), plaintext.begin() + offset);
+    }
+    QTEST_EXPECT_EQUALS(0, ftruncate(fileno(file), (off_t) fsize));
+    fclose(file);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameCipher.c_str(), CRYPT_HDR_SPARSE));
+    // only the data regions are stored
+    QTEST_EXPECT(TestFiles_Read(files.fnameCipher).size() < 1024 * 1024);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == plaintext);
+    // the holes were recreated in the output
+    struct stat st;
+    QTEST_EXPECT_EQUALS(0, stat(files.fnameOut.c_str(), &st));
+    QTEST_EXPECT_EQUALS(fsize, (size_t) st.st_size);
+    QTEST_EXPECT((size_t) st.st_blocks * 512 < fsize / 2);
+
+    // on several threads, the output is still extended past the last hole
+    size_t firstByte = 512 * 1024;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunkedRequire(files.fnameCipher.c_str(),
+                                                                      files.fnameKey.c_str(), files.fnameOut.c_str(),
+                                                                      firstByte, CRYPT_EOF, 0, 4));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == std::vector<byte>(plaintext.begin() + firstByte, plaintext.end()));
+    QTEST_EXPECT_EQUALS(0, stat(files.fnameOut.c_str(), &st));
+    QTEST_EXPECT((size_t) st.st_blocks * 512 < fsize / 2);
+}
+
+#endif  // TEST_CONTAINER_HPP_
@@ -0,0 +1,83 @@
+#ifndef TEST_DIGESTS_HPP_
+#define TEST_DIGESTS_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/ciph.h"
+}
+
+std::vector<byte> TestDigests_Hash(const std::vector<byte>& data) {
+    std::vector<byte> digest(SHA256_DIGEST_SIZE);
+    SHA256_Hash(data.data(), data.size(), digest.data());
+    return digest;
+}
+
+// the digests computed while enciphering and deciphering equal hashes of
+// the files, for whole files and ranges with bytes copied around them
+QTEST_CASE(Digests, Range) {
+    size_t nBytes = 5000;
+    TestFiles_Fixture files(nBytes, 24);
+
+    size_t ranges[][2] = {{CRYPT_SOF, CRYPT_EOF}, {100, 1100}, {7, 4096}};
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        Crypt_Digests enc, dec;
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherRangeDigests(files.fnamePlain.c_str(),
+                                                                        files.fnameKey.c_str(), files.fnameCipher.c_str(),
+                                                                        ranges[i][0], ranges[i][1], &enc));
+        size_t rangeEnd = (ranges[i][1] == CRYPT_EOF) ? CRYPT_EOF : CRYPT_CALC_ENDPT(ranges[i][0], ranges[i][1]);
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherRangeDigests(files.fnameCipher.c_str(),
+                                                                        files.fnameKey.c_str(), files.fnameOut.c_str(),
+                                                                        ranges[i][0], rangeEnd, &dec));
+
+        std::vector<byte> plainDigest = TestDigests_Hash(TestFiles_Read(files.fnamePlain));
+        std::vector<byte> cipherDigest = TestDigests_Hash(TestFiles_Read(files.fnameCipher));
+        QTEST_EXPECT(TestFiles_Read(files.fnameOut) == TestFiles_Read(files.fnamePlain));
+        QTEST_EXPECT(std::vector<byte>(enc.plaintext, enc.plaintext + SHA256_DIGEST_SIZE) == plainDigest);
+        QTEST_EXPECT(std::vector<byte>(enc.ciphertext, enc.ciphertext + SHA256_DIGEST_SIZE) == cipherDigest);
+        QTEST_EXPECT(std::vector<byte>(dec.plaintext, dec.plaintext + SHA256_DIGEST_SIZE) == plainDigest);
+        QTEST_EXPECT(std::vector<byte>(dec.ciphertext, dec.ciphertext + SHA256_DIGEST_SIZE) == cipherDigest);
+    }
+
+    // failures are reported instead of leaving the digests unset
+    Crypt_Digests digests;
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_DecipherRangeDigests(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameOut.c_str(), 0, 100, &digests));
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_EncipherRangeDigests(files.fnamePlain.c_str(), files.fnamePlain.c_str(),
+                                                                   files.fnameCipher.c_str(),
+                                                                   CRYPT_SOF, CRYPT_EOF, &digests));
+    unlink(files.fnameOut.c_str());
+    QTEST_EXPECT_EQUALS(CRYPT_E_IO, Crypt_EncipherRangeDigests(files.fnamePlain.c_str(), files.fnameOut.c_str(),
+                                                               files.fnameCipher.c_str(),
+                                                               CRYPT_SOF, CRYPT_EOF, &digests));
+    QTEST_EXPECT_EQUALS(CRYPT_E_IO, Crypt_DecipherRangeDigests(files.fnameOut.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameCipher.c_str(),
+                                                               CRYPT_SOF, CRYPT_EOF, &digests));
+}
+
+QTEST_CASE(Digests, Json) {
+    std::string fnameJson = TestFiles_Temp();
+    Crypt_Digests digests;
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        digests.plaintext[i] = (byte) i;
+        digests.ciphertext[i] = (byte) (0xff - i);
+    }
+    FILE* file = fopen(fnameJson.c_str(), "w");
+    Crypt_PrintDigests(file, "in \"1\".txt", "out\\1", &digests);
+    fclose(file);
+
+    std::vector<byte> json = TestFiles_Read(fnameJson);
+    std::string expected =
+        "{\"plaintext\": {\"file\": \"in \\\"1\\\".txt\", "
+        "\"sha256\": \"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f\"}, "
+        "\"ciphertext\": {\"file\": \"out\\\\1\", "
+        "\"sha256\": \"fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0efeeedecebeae9e8e7e6e5e4e3e2e1e0\"}}\n";
+    QTEST_EXPECT(std::string(json.begin(), json.end()) == expected);
+    unlink(fnameJson.c_str());
+}
+
+#endif  // TEST_DIGESTS_HPP_
@@ -0,0 +1,88 @@
+#ifndef TEST_DRBG_HPP_
+#define TEST_DRBG_HPP_
+
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "qtest.hpp"
+
+extern "C" {
+    #include "../include/drbg.h"
+}
+
+// expected values from an independent implementation of CTR_DRBG over
+// OpenSSL's AES-256, in the layout of the NIST test vectors: the output
+// of the second generate call after instantiating, then the output
+// after a reseed
+QTEST_CASE(Drbg, KnownAnswer) {
+    byte seed[CRYPT_DRBG_SEED_SIZE];
+    for (size_t i = 0; i < sizeof(seed); i++) {
+        seed[i] = (byte) i;
+    }
+    byte eOut[] = {
+        0x04, 0x56, 0x2a, 0xd3, 0x5e, 0x8e, 0xca, 0xfa,
+        0xaf, 0xda, 0x16, 0x98, 0x1c, 0xda, 0xa1, 0x47,
+        0x60, 0x6b, 0xee, 0xa6, 0x28, 0x01, 0x34, 0x2a,
+        0xf1, 0x3c, 0x8b, 0x55, 0x35, 0xf7, 0x2f, 0x94,
+        0x95, 0xb7, 0x43, 0x17, 0xc7, 0x62, 0xf0, 0xad,
+        0xab, 0x7a, 0xbe, 0x71, 0x07, 0x97, 0x61, 0x21,
+        0x76, 0xb6, 0x1b, 0x0e, 0x20, 0x83, 0x98, 0x11,
+        0x3c, 0xf9, 0xc1, 0x70, 0x15, 0x7b, 0xc7, 0x5f
+    };
+    byte eReseeded[] = {
+        0x19, 0x29, 0xba, 0x17, 0x82, 0x17, 0x58, 0xc2,
+        0xe5, 0x1b, 0x89, 0xd8, 0x44, 0xa4, 0xad, 0xc9,
+        0x04, 0xbd, 0xe0, 0x8d, 0xe2, 0x4f, 0x9c, 0x1a,
+        0x1c, 0x2d, 0xc5, 0xa4, 0xa0, 0x28, 0xce, 0x3a,
+        0x2b, 0x54, 0xc7, 0xa3, 0xd1, 0x39, 0x19, 0x43
+    };
+
+    Crypt_Drbg drbg;
+    byte out[64];
+    Crypt_DrbgInstantiate(&drbg, seed);
+    Crypt_DrbgGenerate(&drbg, out, sizeof(out));
+    Crypt_DrbgGenerate(&drbg, out, sizeof(out));
+    for (size_t i = 0; i < sizeof(eOut); i++) {
+        QTEST_EXPECT_EQUALS(eOut[i], out[i]);
+    }
+    QTEST_EXPECT_EQUALS(3, drbg.reseedCounter);
+
+    // a request that does not end on a block boundary
+    for (size_t i = 0; i < sizeof(seed); i++) {
+        seed[i] = (byte) (0x80 + i);
+    }
+    Crypt_DrbgReseed(&drbg, seed);
+    Crypt_DrbgGenerate(&drbg, out, sizeof(eReseeded));
+    for (size_t i = 0; i < sizeof(eReseeded); i++) {
+        QTEST_EXPECT_EQUALS(eReseeded[i], out[i]);
+    }
+}
+
+QTEST_CASE(Drbg, RandomBytes) {
+    // larger than a single request, and not a whole number of blocks
+    std::vector<byte> a(3 * CRYPT_DRBG_MAX_REQUEST + 5), b(a.size());
+    QTEST_EXPECT(Crypt_RandomBytes(a.data(), a.size()));
+    QTEST_EXPECT(Crypt_RandomBytes(b.data(), b.size()));
+    QTEST_EXPECT(a != b);
+    QTEST_EXPECT(std::vector<byte>(a.end() - 16, a.end()) != std::vector<byte>(16, 0));
+
+    // a child process does not repeat what its parent generates next
+    int fds[2];
+    QTEST_EXPECT_EQUALS(0, pipe(fds));
+    pid_t pid = fork();
+    if (pid == 0) {
+        byte child[32];
+        Crypt_RandomBytes(child, sizeof(child));
+        _exit(write(fds[1], child, sizeof(child)) == (ssize_t) sizeof(child) ? 0 : 1);
+    }
+    byte parent[32], child[32];
+    Crypt_RandomBytes(parent, sizeof(parent));
+    QTEST_EXPECT_EQUALS((ssize_t) sizeof(child), read(fds[0], child, sizeof(child)));
+    waitpid(pid, NULL, 0);
+    close(fds[0]);
+    close(fds[1]);
+    QTEST_EXPECT(memcmp(parent, child, sizeof(parent)) != 0);
+}
+
+#endif  // TEST_DRBG_HPP_
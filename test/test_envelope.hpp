@@ -0,0 +1,145 @@
+#ifndef TEST_ENVELOPE_HPP_
+#define TEST_ENVELOPE_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/envelope.h"
+}
+
+QTEST_CASE(KeyWrap, RFC3394) {
+    // RFC 3394 4.1 (128-bit KEK, 128-bit key) and 4.6 (256-bit KEK, 256-bit key)
+    byte kek[32];
+    for (size_t i = 0; i < sizeof(kek); i++) {
+        kek[i] = (byte) i;
+    }
+    byte key[] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+        0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+        0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+    };
+    byte eWrapped128[] = {
+        0x1f, 0xa6, 0x8b, 0x0a, 0x81, 0x12, 0xb4, 0x47,
+        0xae, 0xf3, 0x4b, 0xd8, 0xfb, 0x5a, 0x7b, 0x82,
+        0x9d, 0x3e, 0x86, 0x23, 0x71, 0xd2, 0xcf, 0xe5
+    };
+    byte eWrapped256[] = {
+        0x28, 0xc9, 0xf4, 0x04, 0xc4, 0xb8, 0x10, 0xf4,
+        0xcb, 0xcc, 0xb3, 0x5c, 0xfb, 0x87, 0xf8, 0x26,
+        0x3f, 0x57, 0x86, 0xe2, 0xd8, 0x0e, 0xd3, 0x26,
+        0xcb, 0xc7, 0xf0, 0xe7, 0x1a, 0x99, 0xf4, 0x3b,
+        0xfb, 0x98, 0x8b, 0x9b, 0x7a, 0x02, 0xdd, 0x21
+    };
+
+    AES_KeyCtx kek128, kek256;
+    AES_InitKeyCtx(&kek128, kek, 4);
+    AES_InitKeyCtx(&kek256, kek, 8);
+    byte wrapped[40];
+    byte unwrapped[32];
+    Crypt_KeyWrap(&kek128, key, 16, wrapped);
+    for (size_t i = 0; i < sizeof(eWrapped128); i++) {
+        QTEST_EXPECT_EQUALS(eWrapped128[i], wrapped[i]);
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyUnwrap(&kek128, wrapped, 16, unwrapped));
+    QTEST_EXPECT(memcmp(unwrapped, key, 16) == 0);
+
+    Crypt_KeyWrap(&kek256, key, 32, wrapped);
+    for (size_t i = 0; i < sizeof(eWrapped256); i++) {
+        QTEST_EXPECT_EQUALS(eWrapped256[i], wrapped[i]);
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyUnwrap(&kek256, wrapped, 32, unwrapped));
+    QTEST_EXPECT(memcmp(unwrapped, key, 32) == 0);
+
+    // the wrong KEK, or a damaged wrapped key, fails the integrity check
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_KeyUnwrap(&kek128, wrapped, 32, unwrapped));
+    wrapped[20] ^= 1;
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_KeyUnwrap(&kek256, wrapped, 32, unwrapped));
+}
+
+QTEST_CASE(Envelope, Rotate) {
+    TestFiles_Fixture files(3 * CRYPT_CHUNK_SIZE + 11, 32);
+    std::string fnameKeyB = files.Temp();
+    Crypt_GenerateKeyFile(fnameKeyB.c_str(), 16);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherEnvelope(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                files.fnameCipher.c_str(), CRYPT_HDR_COMPRESSED));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == files.plaintext);
+
+    // rotation rewrites only the header, and then only the new key works
+    std::vector<byte> before = TestFiles_Read(files.fnameCipher);
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_Rotate(files.fnameCipher.c_str(), fnameKeyB.c_str(),
+                                                       files.fnameKey.c_str()));
+    QTEST_EXPECT(TestFiles_Read(files.fnameCipher) == before);
+    // an invalid new key is caught before anything is written
+    std::string fnameBadKey = files.Temp();
+    std::vector<byte> badKey = TestFiles_Read(fnameKeyB);
+    badKey.resize(sizeof(size_t) + 8);
+    TestFiles_Write(fnameBadKey, badKey);
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_Rotate(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                     fnameBadKey.c_str()));
+    QTEST_EXPECT(TestFiles_Read(files.fnameCipher) == before);
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_EncipherEnvelope(files.fnamePlain.c_str(), fnameBadKey.c_str(),
+                                                               files.fnameCipher.c_str(), 0));
+    QTEST_EXPECT(TestFiles_Read(files.fnameCipher) == before);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Rotate(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                      fnameKeyB.c_str()));
+    std::vector<byte> after = TestFiles_Read(files.fnameCipher);
+    QTEST_EXPECT_EQUALS(before.size(), after.size());
+    QTEST_EXPECT(before != after);
+    QTEST_EXPECT(std::equal(before.begin() + sizeof(Crypt_Header), before.end(), after.begin() + sizeof(Crypt_Header)));
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                                files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), fnameKeyB.c_str(),
+                                                               files.fnameOut.c_str(), 100, 2 * CRYPT_CHUNK_SIZE));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == std::vector<byte>(files.plaintext.begin() + 100,
+                                                                     files.plaintext.begin() + 2 * CRYPT_CHUNK_SIZE));
+
+    // containers without a wrapped key cannot be rotated
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), 0));
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_Rotate(files.fnameOut.c_str(), files.fnameKey.c_str(),
+                                                     fnameKeyB.c_str()));
+}
+
+QTEST_CASE(Envelope, RotateKeyring) {
+    std::string fnameKeyring = TestFiles_Temp();
+    std::string fnamePlain = TestFiles_Temp();
+    std::string fnameCipher = TestFiles_Temp();
+    std::string fnameOut = TestFiles_Temp();
+    unlink(fnameKeyring.c_str());
+    uint64_t ids[] = {1, 2};
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringAdd(fnameKeyring.c_str(), ids, 2, 32));
+    std::vector<byte> plain = TestFiles_WriteRandom(fnamePlain, CRYPT_CHUNK_SIZE + 3);
+    Crypt_Keyring kr;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringOpen(&kr, fnameKeyring.c_str()));
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherEnvelopeKeyring(fnamePlain.c_str(), &kr, 1,
+                                                                       fnameCipher.c_str(), 0));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_RotateKeyring(fnameCipher.c_str(), &kr, 2));
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_RotateKeyring(fnameCipher.c_str(), &kr, 3));
+    Crypt_Header hdr;
+    FILE* file = fopen(fnameCipher.c_str(), "rb");
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ReadHeader(file, &hdr));
+    fclose(file);
+    QTEST_EXPECT_EQUALS(2, hdr.keyId);
+    // the header names the new key, so deciphering finds it
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunkedKeyring(fnameCipher.c_str(), &kr, fnameOut.c_str(),
+                                                                      CRYPT_SOF, CRYPT_EOF, 0, 1));
+    QTEST_EXPECT(TestFiles_Read(fnameOut) == plain);
+    Crypt_KeyringClose(&kr);
+
+    unlink(fnameKeyring.c_str());
+    unlink((fnameKeyring + CRYPT_KEYRING_LOCK_EXT).c_str());
+    unlink(fnamePlain.c_str());
+    unlink(fnameCipher.c_str());
+    unlink(fnameOut.c_str());
+}
+
+#endif  // TEST_ENVELOPE_HPP_
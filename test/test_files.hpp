@@ -0,0 +1,102 @@
+#ifndef TEST_FILES_HPP_
+#define TEST_FILES_HPP_
+
+// helpers for tests that work on files
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>  // for close(), unlink()
+
+extern "C" {
+    #include "../include/common.h"
+    #include "../include/ciph.h"
+}
+
+// creates an empty temporary file and returns its name
+std::string TestFiles_Temp() {
+    char fname[] = "/tmp/ciph_test_XXXXXX";
+    int fd = mkstemp(fname);
+    close(fd);
+    return std::string(fname);
+}
+
+// returns nBytes of deterministic, non-repeating data
+std::vector<byte> TestFiles_RandomData(size_t nBytes) {
+    std::vector<byte> data(nBytes);
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < nBytes; i++) {
+        // xorshift32
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = (byte) x;
+    }
+    return data;
+}
+
+void TestFiles_Write(const std::string& fname, const std::vector<byte>& data) {
+    FILE* file = fopen(fname.c_str(), "wb");
+    fwrite(data.data(), sizeof(byte), data.size(), file);
+    fclose(file);
+}
+
+std::vector<byte> TestFiles_Read(const std::string& fname) {
+    std::vector<byte> data;
+    FILE* file = fopen(fname.c_str(), "rb");
+    if (!file) {
+        return data;
+    }
+    byte buf[4096];
+    size_t nRead;
+    while ((nRead = fread(buf, sizeof(byte), sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + nRead);
+    }
+    fclose(file);
+    return data;
+}
+
+// writes nBytes of deterministic, non-repeating data to fname
+std::vector<byte> TestFiles_WriteRandom(const std::string& fname, size_t nBytes) {
+    std::vector<byte> data = TestFiles_RandomData(nBytes);
+    TestFiles_Write(fname, data);
+    return data;
+}
+
+// the files most cipher tests work on: nBytes of random plaintext, a
+// new key of keySize bytes, and empty files for the ciphertext and the
+// deciphered output. they are removed when the fixture goes out of
+// scope, along with any file added by Temp() or Track()
+struct TestFiles_Fixture {
+    // declared first, so it exists when the names below are made
+    std::vector<std::string> fnames;
+    std::string fnamePlain, fnameCipher, fnameOut, fnameKey;
+    std::vector<byte> plaintext;
+
+    TestFiles_Fixture(size_t nBytes, size_t keySize)
+        : fnamePlain(Temp()), fnameCipher(Temp()), fnameOut(Temp()), fnameKey(Temp()) {
+        plaintext = TestFiles_WriteRandom(fnamePlain, nBytes);
+        Crypt_GenerateKeyFile(fnameKey.c_str(), keySize);
+    }
+
+    ~TestFiles_Fixture() {
+        for (const std::string& fname : fnames) {
+            unlink(fname.c_str());
+        }
+    }
+
+    // creates another empty temporary file
+    std::string Temp() {
+        return Track(TestFiles_Temp());
+    }
+
+    // removes fname along with the fixture, e.g. a file that the code
+    // under test creates next to one of the fixture's files
+    std::string Track(const std::string& fname) {
+        fnames.push_back(fname);
+        return fname;
+    }
+};
+
+#endif  // TEST_FILES_HPP_
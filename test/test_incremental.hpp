@@ -0,0 +1,82 @@
+#ifndef TEST_INCREMENTAL_HPP_
+#define TEST_INCREMENTAL_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/incremental.h"
+}
+
+// expects fnameCipher to match a full encipher of fnamePlain
+void IncrementalTest_ExpectFull(const std::string& fnamePlain, const std::string& fnameKey,
+                                const std::string& fnameCipher) {
+    std::string fnameFull = TestFiles_Temp();
+    Crypt_EncipherRange(fnamePlain.c_str(), fnameKey.c_str(), fnameFull.c_str(), CRYPT_SOF, CRYPT_EOF);
+    QTEST_EXPECT(TestFiles_Read(fnameCipher) == TestFiles_Read(fnameFull));
+    unlink(fnameFull.c_str());
+}
+
+QTEST_CASE(Incremental, OnlyChangedChunks) {
+    TestFiles_Fixture files(5 * CRYPT_CHUNK_SIZE + 40, 24);
+    std::string fnameManifest = files.Track(files.fnameCipher + CRYPT_MANIFEST_EXT);
+
+
+    // the first update has no manifest, so every chunk is written
+    Crypt_UpdateStats stats;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherIncremental(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameCipher.c_str(), &stats));
+    QTEST_EXPECT_EQUALS(6, stats.nChunks);
+    QTEST_EXPECT_EQUALS(6, stats.nChanged);
+    IncrementalTest_ExpectFull(files.fnamePlain, files.fnameKey, files.fnameCipher);
+
+    // nothing changed
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherIncremental(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameCipher.c_str(), &stats));
+    QTEST_EXPECT_EQUALS(0, stats.nChanged);
+
+    // change one byte in the middle of chunk 2
+    files.plaintext[2 * CRYPT_CHUNK_SIZE + 100] ^= 0xff;
+    TestFiles_Write(files.fnamePlain, files.plaintext);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherIncremental(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameCipher.c_str(), &stats));
+    QTEST_EXPECT_EQUALS(1, stats.nChanged);
+    IncrementalTest_ExpectFull(files.fnamePlain, files.fnameKey, files.fnameCipher);
+
+    // grow the file: only the old last chunk and the new ones change
+    std::vector<byte> more = TestFiles_RandomData(CRYPT_CHUNK_SIZE);
+    files.plaintext.insert(files.plaintext.end(), more.begin(), more.end());
+    TestFiles_Write(files.fnamePlain, files.plaintext);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherIncremental(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameCipher.c_str(), &stats));
+    QTEST_EXPECT_EQUALS(2, stats.nChanged);
+    IncrementalTest_ExpectFull(files.fnamePlain, files.fnameKey, files.fnameCipher);
+
+    // shrink the file to a multiple of the block size
+    files.plaintext.resize(3 * CRYPT_CHUNK_SIZE + 32);
+    TestFiles_Write(files.fnamePlain, files.plaintext);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherIncremental(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameCipher.c_str(), &stats));
+    QTEST_EXPECT_EQUALS(1, stats.nChanged);
+    IncrementalTest_ExpectFull(files.fnamePlain, files.fnameKey, files.fnameCipher);
+
+    // an update interrupted after invalidating the manifest rewrites
+    // every chunk next time
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_InvalidateManifest(fnameManifest.c_str()));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherIncremental(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameCipher.c_str(), &stats));
+    QTEST_EXPECT_EQUALS(stats.nChunks, stats.nChanged);
+    IncrementalTest_ExpectFull(files.fnamePlain, files.fnameKey, files.fnameCipher);
+
+    // a different key invalidates the manifest
+    Crypt_GenerateKeyFile(files.fnameKey.c_str(), 24);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherIncremental(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                                   files.fnameCipher.c_str(), &stats));
+    QTEST_EXPECT_EQUALS(stats.nChunks, stats.nChanged);
+    IncrementalTest_ExpectFull(files.fnamePlain, files.fnameKey, files.fnameCipher);
+}
+
+#endif  // TEST_INCREMENTAL_HPP_
@@ -0,0 +1,59 @@
+#ifndef TEST_IOV_HPP_
+#define TEST_IOV_HPP_
+
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/iov.h"
+}
+
+// splits buf into fragments of the given sizes, repeated until it is
+// covered (the last one is cut short)
+std::vector<struct iovec> TestIov_Split(std::vector<byte>& buf, const std::vector<size_t>& sizes) {
+    std::vector<struct iovec> iov;
+    for (size_t offset = 0, i = 0; offset < buf.size(); i++) {
+        size_t n = MIN(sizes[i % sizes.size()], buf.size() - offset);
+        iov.push_back({buf.data() + offset, n});
+        offset += n;
+    }
+    return iov;
+}
+
+QTEST_CASE(Iov, TransformV) {
+    byte key[16] = {7};
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, 4);
+
+    size_t nBytes = 1000 * STATE_SIZE;
+    std::vector<byte> plaintext = TestFiles_RandomData(nBytes);
+    std::vector<byte> expected(nBytes);
+    AES_EncipherBlocks(&ctx, plaintext.data(), nBytes / STATE_SIZE, expected.data());
+
+    // fragments that straddle blocks, are empty, or span many blocks,
+    // split differently on each side
+    std::vector<byte> in(plaintext), out(nBytes);
+    std::vector<struct iovec> inIov = TestIov_Split(in, {5, 0, 27, 300, 16, 1, 3000});
+    std::vector<struct iovec> outIov = TestIov_Split(out, {64, 7, 9, 1024, 0, 33});
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_TransformV(&ctx, AES_EncipherBlocks, inIov.data(), (int) inIov.size(),
+                                                          outIov.data(), (int) outIov.size()));
+    QTEST_EXPECT(out == expected);
+
+    // in place, back to the plaintext
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_TransformV(&ctx, AES_DecipherBlocks, outIov.data(), (int) outIov.size(),
+                                                          outIov.data(), (int) outIov.size()));
+    QTEST_EXPECT(out == plaintext);
+
+    // partial blocks and short outputs are rejected before anything is written
+    inIov.back().iov_len--;
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_TransformV(&ctx, AES_EncipherBlocks, inIov.data(), (int) inIov.size(),
+                                                           outIov.data(), (int) outIov.size()));
+    inIov.back().iov_len++;
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_TransformV(&ctx, AES_EncipherBlocks, inIov.data(), (int) inIov.size(),
+                                                           outIov.data(), (int) outIov.size() - 1));
+    QTEST_EXPECT(out == plaintext);
+}
+
+#endif  // TEST_IOV_HPP_
@@ -0,0 +1,86 @@
+#ifndef TEST_KDF_HPP_
+#define TEST_KDF_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+#include "test_sha256.hpp"
+
+extern "C" {
+    #include "../include/kdf.h"
+}
+
+// RFC 7914 section 11 and 12
+QTEST_CASE(Kdf, Pbkdf2) {
+    std::string pass = "passwd", salt = "salt";
+    std::vector<byte> out(64);
+    Crypt_Pbkdf2((const byte*) pass.data(), pass.size(), (const byte*) salt.data(), salt.size(), 1,
+                 out.data(), out.size());
+    QTEST_EXPECT(out == TestSHA256_FromHex("55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+                                           "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"));
+
+    pass = "Password", salt = "NaCl";
+    Crypt_Pbkdf2((const byte*) pass.data(), pass.size(), (const byte*) salt.data(), salt.size(), 80000,
+                 out.data(), out.size());
+    QTEST_EXPECT(out == TestSHA256_FromHex("4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+                                           "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d"));
+}
+
+QTEST_CASE(Kdf, Scrypt) {
+    std::vector<byte> out(64);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Scrypt(NULL, 0, NULL, 0, 16, 1, 1, out.data(), out.size(), 1));
+    QTEST_EXPECT(out == TestSHA256_FromHex("77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+                                           "fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906"));
+
+    // the lanes give the same result however many threads run them
+    std::string pass = "password", salt = "NaCl";
+    std::vector<byte> expected = TestSHA256_FromHex(
+        "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+        "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+    for (size_t nThreads = 1; nThreads <= 4; nThreads += 3) {
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Scrypt((const byte*) pass.data(), pass.size(),
+                                                          (const byte*) salt.data(), salt.size(),
+                                                          1024, 8, 16, out.data(), out.size(), nThreads));
+        QTEST_EXPECT(out == expected);
+    }
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_Scrypt(NULL, 0, NULL, 0, 1000, 1, 1, out.data(), out.size(), 1));
+}
+
+QTEST_CASE(Kdf, KeyFile) {
+    std::string fnameParams = TestFiles_Temp();
+    std::string fnameKeyA = TestFiles_Temp();
+    std::string fnameKeyB = TestFiles_Temp();
+    std::string pass = "correct horse battery staple";
+
+    // the saved salt and cost derive the same key again
+    Crypt_KdfParams params, loaded;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KdfInitParams(&params, CRYPT_KDF_SCRYPT));
+    params.cost = 1024;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KdfSaveParams(fnameParams.c_str(), &params));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DeriveKeyFile(fnameKeyA.c_str(), 32, &params,
+                                                             pass.data(), pass.size(), 2));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KdfLoadParams(fnameParams.c_str(), &loaded));
+    QTEST_EXPECT(memcmp(&params, &loaded, sizeof(params)) == 0);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DeriveKeyFile(fnameKeyB.c_str(), 32, &loaded,
+                                                             pass.data(), pass.size(), 1));
+    QTEST_EXPECT(TestFiles_Read(fnameKeyA) == TestFiles_Read(fnameKeyB));
+
+    // a new salt gives a different key
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KdfInitParams(&params, CRYPT_KDF_PBKDF2));
+    params.cost = 1000;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DeriveKeyFile(fnameKeyB.c_str(), 32, &params,
+                                                             pass.data(), pass.size(), 1));
+    QTEST_EXPECT(TestFiles_Read(fnameKeyA) != TestFiles_Read(fnameKeyB));
+
+    TestFiles_Write(fnameParams, std::vector<byte>(10, 0));
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_KdfLoadParams(fnameParams.c_str(), &loaded));
+
+    unlink(fnameParams.c_str());
+    unlink(fnameKeyA.c_str());
+    unlink(fnameKeyB.c_str());
+}
+
+#endif  // TEST_KDF_HPP_
@@ -0,0 +1,145 @@
+#ifndef TEST_KEYRING_HPP_
+#define TEST_KEYRING_HPP_
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/keyring.h"
+}
+
+QTEST_CASE(Keyring, Lookup) {
+    std::string fnameKeyring = TestFiles_Temp();
+    unlink(fnameKeyring.c_str());
+
+    // ids that are not consecutive, added in two steps
+    std::vector<uint64_t> ids;
+    for (uint64_t i = 0; i < 1000; i++) {
+        ids.push_back(i * 7919 + (i << 40));
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringAdd(fnameKeyring.c_str(), ids.data(), 600, 32));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringAdd(fnameKeyring.c_str(), ids.data() + 600, 400, 16));
+    // ids are unique
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_KeyringAdd(fnameKeyring.c_str(), ids.data() + 5, 1, 16));
+    struct stat st;
+    QTEST_EXPECT(stat(fnameKeyring.c_str(), &st) == 0 && (st.st_mode & 0777) == 0600);
+
+    Crypt_Keyring kr;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringOpen(&kr, fnameKeyring.c_str()));
+    QTEST_EXPECT_EQUALS(1000, kr.hdr->nKeys);
+    bool found = true;
+    for (size_t i = 0; i < ids.size(); i++) {
+        const Crypt_KeyringEntry* entry = Crypt_KeyringFind(&kr, ids[i]);
+        found = found && entry && entry->keyId == ids[i] && entry->keySize == ((i < 600) ? 32 : 16);
+    }
+    QTEST_EXPECT(found);
+    QTEST_EXPECT(Crypt_KeyringFind(&kr, 1) == NULL);
+
+    // schedules are expanded once
+    const Crypt_KeyringKey* key;
+    const Crypt_KeyringKey* again;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringGetKey(&kr, ids[700], &key));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringGetKey(&kr, ids[700], &again));
+    QTEST_EXPECT(key == again);
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_KeyringGetKey(&kr, 1, &key));
+    Crypt_KeyringClose(&kr);
+
+    // a damaged keyring is rejected
+    std::vector<byte> data = TestFiles_Read(fnameKeyring);
+    data.resize(data.size() - 1);
+    TestFiles_Write(fnameKeyring, data);
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_KeyringOpen(&kr, fnameKeyring.c_str()));
+    // and so is a full table, on which a lookup would never end
+    data.resize(data.size() + 1);
+    Crypt_KeyringHeader* hdr = (Crypt_KeyringHeader*) data.data();
+    uint32_t* table = (uint32_t*) (data.data() + sizeof(Crypt_KeyringHeader));
+    for (size_t i = 0; i < hdr->tableSize; i++) {
+        table[i] = 1;
+    }
+    TestFiles_Write(fnameKeyring, data);
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_KeyringOpen(&kr, fnameKeyring.c_str()));
+
+    unlink(fnameKeyring.c_str());
+    unlink((fnameKeyring + CRYPT_KEYRING_LOCK_EXT).c_str());
+}
+
+QTEST_CASE(Keyring, ConcurrentAdd) {
+    std::string fnameKeyring = TestFiles_Temp();
+    unlink(fnameKeyring.c_str());
+
+    // writers that add keys at the same time keep each other's keys
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; t++) {
+        threads.emplace_back([&fnameKeyring, t]() {
+            for (uint64_t i = 0; i < 20; i++) {
+                uint64_t id = t * 1000 + i;
+                Crypt_KeyringAdd(fnameKeyring.c_str(), &id, 1, 16);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    Crypt_Keyring kr;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringOpen(&kr, fnameKeyring.c_str()));
+    QTEST_EXPECT_EQUALS(80, kr.hdr->nKeys);
+    bool found = true;
+    for (uint64_t t = 0; t < 4; t++) {
+        for (uint64_t i = 0; i < 20; i++) {
+            found = found && Crypt_KeyringFind(&kr, t * 1000 + i) != NULL;
+        }
+    }
+    QTEST_EXPECT(found);
+    Crypt_KeyringClose(&kr);
+
+    unlink(fnameKeyring.c_str());
+    unlink((fnameKeyring + CRYPT_KEYRING_LOCK_EXT).c_str());
+}
+
+QTEST_CASE(Keyring, ContainerKeyId) {
+    TestFiles_Fixture files(3 * CRYPT_CHUNK_SIZE + 11, 24);
+    std::string fnameKeyring = files.Temp();
+    files.Track(fnameKeyring + CRYPT_KEYRING_LOCK_EXT);
+    unlink(fnameKeyring.c_str());
+
+    // an existing key file becomes key 42, next to generated keys
+    uint64_t ids[] = {41, 43};
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringAdd(fnameKeyring.c_str(), ids, 2, 16));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringImport(fnameKeyring.c_str(), 42, files.fnameKey.c_str()));
+    Crypt_Keyring kr;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_KeyringOpen(&kr, fnameKeyring.c_str()));
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunkedKeyring(files.fnamePlain.c_str(), &kr, 42,
+                                                                      files.fnameCipher.c_str(), CRYPT_HDR_COMPRESSED));
+    Crypt_Header hdr;
+    FILE* file = fopen(files.fnameCipher.c_str(), "rb");
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ReadHeader(file, &hdr));
+    fclose(file);
+    QTEST_EXPECT(hdr.flags & CRYPT_HDR_KEYID);
+    QTEST_EXPECT_EQUALS(42, hdr.keyId);
+
+    // the key is found from the header, and the key file still works
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunkedKeyring(files.fnameCipher.c_str(), &kr,
+                                                                      files.fnameOut.c_str(),
+                                                                      100, 2 * CRYPT_CHUNK_SIZE, 0, 2));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == std::vector<byte>(files.plaintext.begin() + 100,
+                                                                      files.plaintext.begin() + 2 * CRYPT_CHUNK_SIZE));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == files.plaintext);
+
+    // containers without a key id need a key file
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameCipher.c_str(), 0));
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_DecipherChunkedKeyring(files.fnameCipher.c_str(), &kr,
+                                                                       files.fnameOut.c_str(),
+                                                                       CRYPT_SOF, CRYPT_EOF, 0, 1));
+    Crypt_KeyringClose(&kr);
+}
+
+#endif  // TEST_KEYRING_HPP_
@@ -0,0 +1,132 @@
+#ifndef TEST_LOG_HPP_
+#define TEST_LOG_HPP_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/log.h"
+}
+
+QTEST_CASE(Log, GroupCommit) {
+    TestFiles_Fixture files(0, 16);
+    // start from an empty file, as if the log did not exist
+    unlink(files.fnameCipher.c_str());
+
+    Crypt_Log log;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogOpen(&log, files.fnameCipher.c_str(), files.fnameKey.c_str(), 0));
+
+    // many small records, committed once, cost one sync
+    std::string expected;
+    for (int i = 0; i < 1000; i++) {
+        std::string record = "record " + std::to_string(i) + "\n";
+        expected += record;
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogAppend(&log, (const byte*) record.data(), record.size(), NULL));
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogCommit(&log, CRYPT_EOF));
+    QTEST_EXPECT_EQUALS(1, log.stats.syncs);
+
+    // concurrent appenders, each committing its own record. in every
+    // round all records are appended before anyone commits, so the
+    // first committer's sync covers the others', and a round costs
+    // exactly one sync however many threads commit in it
+    const int nThreads = 4, nRounds = 50;
+    uint64_t syncs = log.stats.syncs;
+    uint64_t commits = log.stats.commits;
+    std::atomic<int> nAppended(0), nCommitted(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int round = 1; round <= nRounds; round++) {
+                uint64_t seq;
+                Crypt_LogAppend(&log, (const byte*) "xxxxxxxx", 8, &seq);
+                nAppended++;
+                while (nAppended < round * nThreads) {
+                    std::this_thread::yield();
+                }
+                Crypt_LogCommit(&log, seq);
+                nCommitted++;
+                while (nCommitted < round * nThreads) {
+                    std::this_thread::yield();
+                }
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    expected += std::string(nThreads * nRounds * 8, 'x');
+    QTEST_EXPECT_EQUALS(nThreads * nRounds, log.stats.commits - commits);
+    QTEST_EXPECT_EQUALS(nRounds, log.stats.syncs - syncs);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogClose(&log));
+
+    // the log is an ordinary container
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    std::vector<byte> deciphered = TestFiles_Read(files.fnameOut);
+    QTEST_EXPECT(std::string(deciphered.begin(), deciphered.end()) == expected);
+}
+
+QTEST_CASE(Log, TornChunk) {
+    TestFiles_Fixture files(0, 32);
+    unlink(files.fnameCipher.c_str());
+
+    Crypt_Log log;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogOpen(&log, files.fnameCipher.c_str(), files.fnameKey.c_str(), 0));
+    Crypt_LogAppend(&log, (const byte*) "first\n", 6, NULL);
+    Crypt_LogCommit(&log, CRYPT_EOF);
+    Crypt_LogAppend(&log, (const byte*) "second record\n", 14, NULL);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogClose(&log));
+
+    // cut the last chunk in half, as a crash during its write would
+    std::vector<byte> contents = TestFiles_Read(files.fnameCipher);
+    QTEST_EXPECT_EQUALS(0, truncate(files.fnameCipher.c_str(), (off_t) (contents.size() - 10)));
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogOpen(&log, files.fnameCipher.c_str(), files.fnameKey.c_str(), 0));
+    QTEST_EXPECT_EQUALS(contents.size() - 10 - (sizeof(Crypt_Header) + sizeof(Crypt_ChunkHeader) + STATE_SIZE),
+                        log.stats.tornBytes);
+    Crypt_LogAppend(&log, (const byte*) "third\n", 6, NULL);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogClose(&log));
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    std::vector<byte> deciphered = TestFiles_Read(files.fnameOut);
+    QTEST_EXPECT(std::string(deciphered.begin(), deciphered.end()) == "first\nthird\n");
+}
+
+QTEST_CASE(Log, TornPayload) {
+    TestFiles_Fixture files(0, 16);
+    unlink(files.fnameCipher.c_str());
+
+    Crypt_Log log;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogOpen(&log, files.fnameCipher.c_str(), files.fnameKey.c_str(), 0));
+    Crypt_LogAppend(&log, (const byte*) "first\n", 6, NULL);
+    Crypt_LogCommit(&log, CRYPT_EOF);
+    Crypt_LogAppend(&log, (const byte*) "second record\n", 14, NULL);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogClose(&log));
+
+    // the chunk header of the last write reached the disk but its payload
+    // did not: the size is intact, the payload is garbage
+    std::vector<byte> contents = TestFiles_Read(files.fnameCipher);
+    for (size_t i = contents.size() - STATE_SIZE; i < contents.size(); i++) {
+        contents[i] ^= 0x5a;
+    }
+    TestFiles_Write(files.fnameCipher, contents);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogOpen(&log, files.fnameCipher.c_str(), files.fnameKey.c_str(), 0));
+    QTEST_EXPECT_EQUALS(sizeof(Crypt_ChunkHeader) + STATE_SIZE, log.stats.tornBytes);
+    Crypt_LogAppend(&log, (const byte*) "third\n", 6, NULL);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LogClose(&log));
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    std::vector<byte> deciphered = TestFiles_Read(files.fnameOut);
+    QTEST_EXPECT(std::string(deciphered.begin(), deciphered.end()) == "first\nthird\n");
+}
+
+#endif  // TEST_LOG_HPP_
@@ -0,0 +1,77 @@
+#ifndef TEST_LZ_HPP_
+#define TEST_LZ_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/lz.h"
+}
+
+// compresses and decompresses data, expecting the original back
+void LZTest_RoundTrip(const std::vector<byte>& data) {
+    std::vector<byte> compressed(LZ_BOUND(data.size()));
+    size_t nCompressed = LZ_Compress(data.data(), data.size(), compressed.data(), compressed.size());
+    QTEST_EXPECT(nCompressed > 0);
+
+    std::vector<byte> decompressed(data.size());
+    QTEST_EXPECT_EQUALS(data.size(), LZ_Decompress(compressed.data(), nCompressed,
+                                                   decompressed.data(), decompressed.size()));
+    QTEST_EXPECT(data == decompressed);
+}
+
+QTEST_CASE(LZ, Empty) {
+    LZTest_RoundTrip(std::vector<byte>());
+}
+
+QTEST_CASE(LZ, Compressible) {
+    std::string text;
+    for (int i = 0; i < 2000; i++) {
+        text += "{\"level\": \"info\", \"msg\": \"request served\", \"id\": " + std::to_string(i) + "}\n";
+    }
+    std::vector<byte> data(text.begin(), text.end());
+    LZTest_RoundTrip(data);
+
+    // log-like data should compress several times over
+    std::vector<byte> compressed(LZ_BOUND(data.size()));
+    size_t nCompressed = LZ_Compress(data.data(), data.size(), compressed.data(), compressed.size());
+    QTEST_EXPECT(nCompressed * 4 < data.size());
+}
+
+QTEST_CASE(LZ, Incompressible) {
+    std::vector<byte> data = TestFiles_RandomData(10000);
+    LZTest_RoundTrip(data);
+
+    // the output does not fit in the input size, so compressing into
+    // a buffer of that size fails
+    std::vector<byte> compressed(data.size());
+    QTEST_EXPECT_EQUALS(0, LZ_Compress(data.data(), data.size(), compressed.data(), compressed.size()));
+}
+
+QTEST_CASE(LZ, Runs) {
+    // long runs produce overlapping matches and long length extensions
+    std::vector<byte> data(100000, 'a');
+    for (size_t i = 0; i < data.size(); i += 1000) {
+        data[i] = 'b';
+    }
+    LZTest_RoundTrip(data);
+    LZTest_RoundTrip(std::vector<byte>(13, 'x'));
+}
+
+QTEST_CASE(LZ, Malformed) {
+    byte out[64];
+    // a match offset before the start of the output
+    byte badOffset[] = { 0x10, 'a', 0x05, 0x00 };
+    QTEST_EXPECT(LZ_Decompress(badOffset, sizeof(badOffset), out, sizeof(out)) == LZ_ERROR);
+    // more literals than the input holds
+    byte truncated[] = { 0x50, 'a', 'b' };
+    QTEST_EXPECT(LZ_Decompress(truncated, sizeof(truncated), out, sizeof(out)) == LZ_ERROR);
+    // output larger than the buffer
+    byte tooLong[] = { 0x1f, 'a', 0x01, 0x00, 0xff, 0xff };
+    QTEST_EXPECT(LZ_Decompress(tooLong, sizeof(tooLong), out, sizeof(out)) == LZ_ERROR);
+}
+
+#endif  // TEST_LZ_HPP_
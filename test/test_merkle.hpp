@@ -0,0 +1,157 @@
+#ifndef TEST_MERKLE_HPP_
+#define TEST_MERKLE_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/verify.h"
+}
+
+QTEST_CASE(Merkle, Tree) {
+    byte key[16] = {0};
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, 4);
+    byte macKey[CRYPT_MERKLE_KEY_SIZE];
+    Crypt_MerkleKey(&ctx, macKey);
+    const char bound[] = "header";
+
+    // every leaf of trees of odd and even widths checks out, and no
+    // other tag does
+    for (size_t nLeaves = 0; nLeaves <= 9; nLeaves++) {
+        std::vector<byte> tree(Crypt_MerkleSize(nLeaves));
+        byte root[CRYPT_MERKLE_TAG_SIZE];
+        for (size_t i = 0; i < nLeaves; i++) {
+            byte chunk[3] = {(byte) i, 1, 2};
+            Crypt_MerkleLeaf(macKey, i, chunk, sizeof(chunk), NULL, 0, tree.data() + i * CRYPT_MERKLE_TAG_SIZE);
+        }
+        Crypt_MerkleBuild(macKey, tree.data(), nLeaves, bound, sizeof(bound), root);
+        QTEST_EXPECT(Crypt_MerkleCheckRoot(macKey, tree.data(), nLeaves, bound, sizeof(bound), root));
+        for (size_t i = 0; i < nLeaves; i++) {
+            std::vector<byte> tag(tree.begin() + i * CRYPT_MERKLE_TAG_SIZE, tree.begin() + (i + 1) * CRYPT_MERKLE_TAG_SIZE);
+            QTEST_EXPECT(Crypt_MerkleCheckLeaf(tree.data(), nLeaves, i, tag.data()));
+            tag[5] ^= 1;
+            QTEST_EXPECT(!Crypt_MerkleCheckLeaf(tree.data(), nLeaves, i, tag.data()));
+        }
+
+        // the root tag binds the number of leaves, the bound bytes and
+        // the key
+        std::vector<byte> longer(tree);
+        longer.resize(Crypt_MerkleSize(nLeaves + 1));
+        QTEST_EXPECT(!Crypt_MerkleCheckRoot(macKey, longer.data(), nLeaves + 1, bound, sizeof(bound), root));
+        QTEST_EXPECT(!Crypt_MerkleCheckRoot(macKey, tree.data(), nLeaves, bound, sizeof(bound) - 2, root));
+        macKey[0] ^= 1;
+        QTEST_EXPECT(!Crypt_MerkleCheckRoot(macKey, tree.data(), nLeaves, bound, sizeof(bound), root));
+        macKey[0] ^= 1;
+    }
+
+    // the MAC key is not the encipherment of anything under the key
+    byte block[STATE_SIZE];
+    memcpy(block, "ciph merkle key", STATE_SIZE - 1);
+    block[STATE_SIZE - 1] = 1;
+    AES_EncipherBlocks(&ctx, block, 1, block);
+    QTEST_EXPECT(memcmp(block, macKey, STATE_SIZE) != 0);
+}
+
+QTEST_CASE(Merkle, Container) {
+    size_t nBytes = 5 * CRYPT_CHUNK_SIZE + 300;
+    TestFiles_Fixture files(nBytes, 16);
+    std::string fnameRekeyed = files.Temp();
+    std::string fnameNewKey = files.Temp();
+    Crypt_GenerateKeyFile(fnameNewKey.c_str(), 32);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunked(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameCipher.c_str(),
+                                                               CRYPT_HDR_MERKLE | CRYPT_HDR_COMPRESSED));
+
+    size_t nFailed = 1;
+    for (size_t nWorkers : {1, 4}) {
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Verify(files.fnameCipher.c_str(), files.fnameKey.c_str(), nWorkers,
+                                                          &nFailed));
+        QTEST_EXPECT_EQUALS(0, nFailed);
+    }
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_Verify(files.fnameCipher.c_str(), fnameNewKey.c_str(), 1, &nFailed));
+
+    // rekeying checks the old tree and builds a new one
+    FILE* fileIn = fopen(files.fnameCipher.c_str(), "rb");
+    FILE* fileOut = fopen(fnameRekeyed.c_str(), "wb");
+    byte key[CRYPT_MAX_KEY_SIZE];
+    AES_KeyCtx oldCtx, newCtx;
+    AES_InitKeyCtx(&oldCtx, key, NK_BYTES_TO_WORDS(Crypt_KeyFromFile(files.fnameKey.c_str(), key)));
+    AES_InitKeyCtx(&newCtx, key, NK_BYTES_TO_WORDS(Crypt_KeyFromFile(fnameNewKey.c_str(), key)));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_RekeyChunkedFile(fileIn, &oldCtx, 16, &newCtx, 32, fileOut));
+    fclose(fileIn);
+    fclose(fileOut);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_Verify(fnameRekeyed.c_str(), fnameNewKey.c_str(), 2, &nFailed));
+
+    // damage the fourth chunk
+    std::vector<byte> stored = TestFiles_Read(files.fnameCipher);
+    Crypt_ChunkIndex index;
+    fileIn = fopen(files.fnameCipher.c_str(), "rb");
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_IndexChunks(fileIn, &index));
+    fclose(fileIn);
+    QTEST_EXPECT_EQUALS(6, index.nChunks);
+    stored[index.chunks[3].offset + sizeof(Crypt_ChunkHeader) + 100] ^= 1;
+    TestFiles_Write(files.fnameCipher, stored);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_Verify(files.fnameCipher.c_str(), files.fnameKey.c_str(), 3,
+                                                        &nFailed));
+    QTEST_EXPECT_EQUALS(1, nFailed);
+    // ranges that do not touch the chunk are still deciphered
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                               files.fnameOut.c_str(), 10, 2 * CRYPT_CHUNK_SIZE));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == std::vector<byte>(files.plaintext.begin() + 10,
+                                                                     files.plaintext.begin() + 2 * CRYPT_CHUNK_SIZE));
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                                 files.fnameOut.c_str(),
+                                                                 3 * CRYPT_CHUNK_SIZE, 3 * CRYPT_CHUNK_SIZE + 1));
+    // also when the chunks are deciphered on several threads
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_DecipherChunkedRequire(files.fnameCipher.c_str(),
+                                                                        files.fnameKey.c_str(), files.fnameOut.c_str(),
+                                                                        CRYPT_SOF, CRYPT_EOF, CRYPT_HDR_MERKLE, 3));
+    // the chunks before the damaged one never replace the output
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == std::vector<byte>(files.plaintext.begin() + 10,
+                                                                     files.plaintext.begin() + 2 * CRYPT_CHUNK_SIZE));
+    unlink(files.fnameOut.c_str());
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                                 files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT(access(files.fnameOut.c_str(), F_OK) != 0);
+
+    // the root tag is kept in the header
+    stored[index.chunks[3].offset + sizeof(Crypt_ChunkHeader) + 100] ^= 1;
+    Crypt_Header* hdr = (Crypt_Header*) stored.data();
+    hdr->root[7] ^= 1;
+    TestFiles_Write(files.fnameCipher, stored);
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_Verify(files.fnameCipher.c_str(), files.fnameKey.c_str(), 1,
+                                                        &nFailed));
+    QTEST_EXPECT_EQUALS(0, nFailed);
+    hdr->root[7] ^= 1;
+
+    // the tree binds the header, so its flags cannot be changed
+    hdr->flags ^= CRYPT_HDR_SPARSE;
+    TestFiles_Write(files.fnameCipher, stored);
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                                 files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_Verify(files.fnameCipher.c_str(), files.fnameKey.c_str(), 1,
+                                                        &nFailed));
+    hdr->flags ^= CRYPT_HDR_SPARSE;
+
+    // a container cut off before its tree does not decipher at all
+    stored.resize(index.treeOffset);
+    TestFiles_Write(files.fnameCipher, stored);
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_DecipherChunked(files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                                 files.fnameOut.c_str(), CRYPT_SOF, CRYPT_EOF));
+    // nor does one whose flag was cleared too, once a tree is required
+    hdr = (Crypt_Header*) stored.data();
+    hdr->flags &= (uint16_t) ~CRYPT_HDR_MERKLE;
+    TestFiles_Write(files.fnameCipher, stored);
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_DecipherChunkedRequire(files.fnameCipher.c_str(),
+                                                                        files.fnameKey.c_str(), files.fnameOut.c_str(),
+                                                                        CRYPT_SOF, CRYPT_EOF, CRYPT_HDR_MERKLE, 1));
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_Verify(files.fnameCipher.c_str(), files.fnameKey.c_str(), 1, &nFailed));
+    Crypt_FreeIndex(&index);
+}
+
+#endif  // TEST_MERKLE_HPP_
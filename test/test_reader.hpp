@@ -0,0 +1,123 @@
+#ifndef TEST_READER_HPP_
+#define TEST_READER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/reader.h"
+}
+
+QTEST_CASE(Reader, RandomReads) {
+    // a bit more than 3 chunks, not a multiple of the block size
+    size_t nBytes = 3 * CRYPT_CHUNK_SIZE + 1234;
+    TestFiles_Fixture files(nBytes, 32);
+    Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(), CRYPT_SOF,
+                        CRYPT_EOF);
+
+    Crypt_Cache* cache = Crypt_CacheNew(4, CRYPT_EVICT_LRU);
+    Crypt_Reader* reader;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ReaderOpen(files.fnameCipher.c_str(), files.fnameKey.c_str(), cache,
+                                                          CRYPT_SOF, CRYPT_EOF, &reader));
+    QTEST_EXPECT_EQUALS(nBytes, Crypt_ReaderSize(reader));
+
+    size_t offsets[] = {0, 17, CRYPT_CHUNK_SIZE - 5, 2 * CRYPT_CHUNK_SIZE + 100, nBytes - 40, 17};
+    for (size_t offset : offsets) {
+        byte buf[100];
+        size_t nRead = Crypt_ReaderRead(reader, offset, buf, sizeof(buf));
+        QTEST_EXPECT_EQUALS(MIN(sizeof(buf), nBytes - offset), nRead);
+        for (size_t i = 0; i < nRead; i++) {
+            QTEST_EXPECT_EQUALS(files.plaintext[offset + i], buf[i]);
+        }
+    }
+    // the second read at offset 17 is served from the cache
+    QTEST_EXPECT(cache->stats.hits >= 1);
+
+    Crypt_ReaderClose(reader);
+    QTEST_EXPECT_EQUALS(0, cache->nEntries);
+    Crypt_CacheFree(cache);
+}
+
+QTEST_CASE(Reader, Range) {
+    size_t nBytes = 1000;
+    size_t firstByte = 15, lastByte = 42;
+    TestFiles_Fixture files(nBytes, 16);
+    Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(), firstByte,
+                        lastByte);
+
+    Crypt_Cache* cache = Crypt_CacheNew(2, CRYPT_EVICT_FIFO);
+    Crypt_Reader* reader;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ReaderOpen(files.fnameCipher.c_str(), files.fnameKey.c_str(), cache,
+                                                          firstByte, CRYPT_CALC_ENDPT(firstByte, lastByte), &reader));
+    QTEST_EXPECT_EQUALS(nBytes, Crypt_ReaderSize(reader));
+
+    std::vector<byte> buf(nBytes);
+    QTEST_EXPECT_EQUALS(nBytes, Crypt_ReaderRead(reader, 0, buf.data(), nBytes));
+    for (size_t i = 0; i < nBytes; i++) {
+        QTEST_EXPECT_EQUALS(files.plaintext[i], buf[i]);
+    }
+
+    Crypt_ReaderClose(reader);
+    Crypt_CacheFree(cache);
+}
+
+QTEST_CASE(Reader, ReadaheadAndEviction) {
+    size_t nChunks = 12;
+    size_t nBytes = nChunks * CRYPT_CHUNK_SIZE;
+    TestFiles_Fixture files(nBytes, 24);
+    Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(), CRYPT_SOF,
+                        CRYPT_EOF);
+
+    Crypt_Cache* cache = Crypt_CacheNew(8, CRYPT_EVICT_LRU);
+    Crypt_Reader* reader;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ReaderOpen(files.fnameCipher.c_str(), files.fnameKey.c_str(), cache,
+                                                          CRYPT_SOF, CRYPT_EOF, &reader));
+
+    // read the whole file sequentially, one small piece per chunk boundary
+    std::vector<byte> buf(CRYPT_CHUNK_SIZE);
+    for (size_t chunk = 0; chunk < nChunks; chunk++) {
+        size_t offset = chunk * CRYPT_CHUNK_SIZE;
+        QTEST_EXPECT_EQUALS(CRYPT_CHUNK_SIZE, Crypt_ReaderRead(reader, offset, buf.data(), CRYPT_CHUNK_SIZE));
+        for (size_t i = 0; i < CRYPT_CHUNK_SIZE; i++) {
+            QTEST_EXPECT_EQUALS(files.plaintext[offset + i], buf[i]);
+        }
+    }
+    // sequential access loaded chunks ahead of the reads, so
+    // not every chunk was a miss
+    QTEST_EXPECT(cache->stats.readahead > 0);
+    QTEST_EXPECT(cache->stats.misses < nChunks);
+    QTEST_EXPECT_EQUALS(nChunks, cache->stats.hits + cache->stats.misses);
+    // the cache never holds more than its capacity
+    QTEST_EXPECT(cache->stats.evictions > 0);
+    QTEST_EXPECT(cache->nEntries <= cache->capacity);
+
+    Crypt_ReaderClose(reader);
+    Crypt_CacheFree(cache);
+}
+
+QTEST_CASE(Reader, OpenErrors) {
+    TestFiles_Fixture files(100, 16);
+    Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(), CRYPT_SOF,
+                        CRYPT_EOF);
+
+    Crypt_Cache* cache = Crypt_CacheNew(2, CRYPT_EVICT_LRU);
+    Crypt_Reader* reader;
+    // the plaintext is not a key file
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_ReaderOpen(files.fnameCipher.c_str(), files.fnamePlain.c_str(), cache,
+                                                         CRYPT_SOF, CRYPT_EOF, &reader));
+    QTEST_EXPECT(reader == NULL);
+    QTEST_EXPECT_EQUALS(CRYPT_E_IO, Crypt_ReaderOpen("/nonexistent/ciph_test", files.fnameKey.c_str(), cache,
+                                                     CRYPT_SOF, CRYPT_EOF, &reader));
+    QTEST_EXPECT(reader == NULL);
+    // the range is not a whole number of blocks
+    QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, Crypt_ReaderOpen(files.fnameCipher.c_str(), files.fnameKey.c_str(), cache,
+                                                         CRYPT_SOF, 20, &reader));
+    QTEST_EXPECT(reader == NULL);
+
+    Crypt_CacheFree(cache);
+}
+
+#endif  // TEST_READER_HPP_
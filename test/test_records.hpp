@@ -0,0 +1,90 @@
+#ifndef TEST_RECORDS_HPP_
+#define TEST_RECORDS_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+#include "test_sha256.hpp"
+
+extern "C" {
+    #include "../include/records.h"
+}
+
+// NIST SP 800-38A F.5.1 and F.5.5 (CTR-AES128 and CTR-AES256), with
+// each implementation the CPU has. the three records need ten blocks,
+// so they span two groups of lanes
+QTEST_CASE(Records, Vectors) {
+    std::vector<byte> key128 = TestSHA256_FromHex("2b7e151628aed2a6abf7158809cf4f3c");
+    std::vector<byte> key256 = TestSHA256_FromHex("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4");
+    std::vector<byte> iv = TestSHA256_FromHex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+    std::vector<byte> plaintext = TestSHA256_FromHex("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+                                                     "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+    std::vector<byte> cipher128 = TestSHA256_FromHex("874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+                                                     "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee");
+    std::vector<byte> cipher256 = TestSHA256_FromHex("601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+                                                     "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6");
+    AES_KeyCtx ctx128, ctx256;
+    AES_InitKeyCtx(&ctx128, key128.data(), 4);
+    AES_InitKeyCtx(&ctx256, key256.data(), 8);
+
+    for (unsigned impl : {0u, (unsigned) AES_AESNI}) {
+        if (AES_Use(impl) != impl) {
+            continue;
+        }
+        std::vector<byte> out128(64), out256(64), outShort(20);
+        Crypt_Record records[] = {
+            {&ctx128, iv.data(), plaintext.data(), out128.data(), 64},
+            {&ctx256, iv.data(), plaintext.data(), out256.data(), 64},
+            {&ctx128, iv.data(), plaintext.data(), outShort.data(), 20},
+        };
+        Crypt_TransformRecords(records, 3);
+        QTEST_EXPECT(out128 == cipher128);
+        QTEST_EXPECT(out256 == cipher256);
+        QTEST_EXPECT(outShort == std::vector<byte>(cipher128.begin(), cipher128.begin() + 20));
+
+        // deciphering in place gives the plaintext back
+        Crypt_Record back = {&ctx256, iv.data(), out256.data(), out256.data(), 64};
+        Crypt_TransformRecords(&back, 1);
+        QTEST_EXPECT(out256 == plaintext);
+    }
+    AES_Use(~0u);
+}
+
+// many records of every length up to a few blocks, under keys of every
+// size, match enciphering each record on its own
+QTEST_CASE(Records, Mixed) {
+    std::vector<byte> data = TestFiles_RandomData(64 * 1024);
+    AES_KeyCtx ctxs[3];
+    for (size_t k = 0; k < 3; k++) {
+        AES_InitKeyCtx(&ctxs[k], data.data() + 100 * k, 4 + 2 * k);
+    }
+
+    size_t nRecords = 500;
+    std::vector<Crypt_Record> records(nRecords);
+    std::vector<byte> out(data.size());
+    std::vector<byte> expected(data.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < nRecords; i++) {
+        size_t nBytes = i % 70;
+        const AES_KeyCtx* ctx = &ctxs[i % 3];
+        const byte* iv = data.data() + data.size() - STATE_SIZE - i;
+        records[i] = {ctx, iv, data.data() + offset, out.data() + offset, nBytes};
+
+        byte counter[STATE_SIZE], stream[STATE_SIZE];
+        memcpy(counter, iv, STATE_SIZE);
+        for (size_t j = 0; j < nBytes; j++) {
+            if (j % STATE_SIZE == 0) {
+                AES_EncipherBlock(ctx, counter, stream);
+                Crypt_DrbgIncrement(counter);
+            }
+            expected[offset + j] = data[offset + j] ^ stream[j % STATE_SIZE];
+        }
+        offset += nBytes;
+    }
+    Crypt_TransformRecords(records.data(), nRecords);
+    QTEST_EXPECT(std::equal(out.begin(), out.begin() + offset, expected.begin()));
+}
+
+#endif  // TEST_RECORDS_HPP_
@@ -0,0 +1,99 @@
+#ifndef TEST_SERVE_HPP_
+#define TEST_SERVE_HPP_
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/serve.h"
+}
+
+void* ServeTest_Run(void* arg) {
+    Crypt_ServeRun((Crypt_Server*) arg);
+    return NULL;
+}
+
+QTEST_CASE(Serve, Requests) {
+    std::string fnameKey = TestFiles_Temp();
+    std::string fnameSocket = TestFiles_Temp();
+    Crypt_GenerateKeyFile(fnameKey.c_str(), 32);
+    unlink(fnameSocket.c_str());
+
+    Crypt_Server server;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ServeOpen(&server, fnameSocket.c_str()));
+    struct stat st;
+    QTEST_EXPECT(stat(fnameSocket.c_str(), &st) == 0 && (st.st_mode & 0777) == 0600);
+    pthread_t thread;
+    pthread_create(&thread, NULL, ServeTest_Run, &server);
+
+    int sock = Crypt_ServeConnect(fnameSocket.c_str());
+    QTEST_EXPECT(sock >= 0);
+
+    // one file small enough to go inline, one passed as fds, and a range
+    size_t sizes[] = {1000, 3 * CRYPT_BATCH_PART_SIZE + 37, 5000};
+    size_t ranges[][2] = {{CRYPT_SOF, CRYPT_EOF}, {CRYPT_SOF, CRYPT_EOF}, {1000, 3333}};
+    for (size_t i = 0; i < 3; i++) {
+        std::string fnamePlain = TestFiles_Temp();
+        std::string fnameCipher = TestFiles_Temp();
+        std::string fnameExpected = TestFiles_Temp();
+        TestFiles_WriteRandom(fnamePlain, sizes[i]);
+        Crypt_EncipherRange(fnamePlain.c_str(), fnameKey.c_str(), fnameExpected.c_str(), ranges[i][0], ranges[i][1]);
+
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ServeTransform(sock, CRYPT_OP_ENCIPHER, fnamePlain.c_str(),
+                                                                  fnameKey.c_str(), fnameCipher.c_str(),
+                                                                  ranges[i][0], ranges[i][1]));
+        QTEST_EXPECT(TestFiles_Read(fnameCipher) == TestFiles_Read(fnameExpected));
+        QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ServeTransform(sock, CRYPT_OP_DECIPHER, fnameCipher.c_str(),
+                                                                  fnameKey.c_str(), fnameExpected.c_str(),
+                                                                  ranges[i][0], ranges[i][1]));
+        QTEST_EXPECT(TestFiles_Read(fnameExpected) == TestFiles_Read(fnamePlain));
+
+        unlink(fnamePlain.c_str());
+        unlink(fnameCipher.c_str());
+        unlink(fnameExpected.c_str());
+    }
+
+    // containers are deciphered too
+    std::string fnamePlain = TestFiles_Temp();
+    std::string fnameCipher = TestFiles_Temp();
+    std::string fnameOut = TestFiles_Temp();
+    TestFiles_WriteRandom(fnamePlain, 3 * CRYPT_CHUNK_SIZE + 5);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_EncipherChunked(fnamePlain.c_str(), fnameKey.c_str(),
+                                                               fnameCipher.c_str(), CRYPT_HDR_COMPRESSED));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ServeTransform(sock, CRYPT_OP_DECIPHER, fnameCipher.c_str(),
+                                                              fnameKey.c_str(), fnameOut.c_str(),
+                                                              CRYPT_SOF, CRYPT_EOF));
+    QTEST_EXPECT(TestFiles_Read(fnameOut) == TestFiles_Read(fnamePlain));
+
+    // the key is loaded once; key paths must be absolute
+    byte in[STATE_SIZE] = {0};
+    byte out[2 * STATE_SIZE];
+    size_t nOut;
+    QTEST_EXPECT_EQUALS(1, server.keys.nKeys);
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_ServeTransformInline(sock, CRYPT_OP_ENCIPHER, in, sizeof(in),
+                                                                     "key.ciphkey", CRYPT_SOF, CRYPT_EOF,
+                                                                     out, &nOut));
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_ServeTransformInline(sock, CRYPT_OP_ENCIPHER, in, sizeof(in),
+                                                                    fnameKey.c_str(), CRYPT_SOF, CRYPT_EOF,
+                                                                    out, &nOut));
+    QTEST_EXPECT_EQUALS(2 * STATE_SIZE, nOut);
+
+    // stopping waits for the open connection to be dropped
+    Crypt_ServeStop(&server);
+    pthread_join(thread, NULL);
+    QTEST_EXPECT_EQUALS(0, server.nConns);
+    close(sock);
+    Crypt_ServeClose(&server);
+    QTEST_EXPECT(access(fnameSocket.c_str(), F_OK) != 0);
+
+    unlink(fnamePlain.c_str());
+    unlink(fnameCipher.c_str());
+    unlink(fnameOut.c_str());
+    unlink(fnameKey.c_str());
+}
+
+#endif  // TEST_SERVE_HPP_
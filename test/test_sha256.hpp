@@ -0,0 +1,108 @@
+#ifndef TEST_SHA256_HPP_
+#define TEST_SHA256_HPP_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+
+extern "C" {
+    #include "../include/sha256.h"
+}
+
+std::vector<byte> TestSHA256_FromHex(const std::string& hex) {
+    std::vector<byte> bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back((byte) std::stoi(hex.substr(i, 2), NULL, 16));
+    }
+    return bytes;
+}
+
+std::vector<byte> TestSHA256_Hash(const std::string& msg) {
+    std::vector<byte> digest(SHA256_DIGEST_SIZE);
+    SHA256_Hash((const byte*) msg.data(), msg.size(), digest.data());
+    return digest;
+}
+
+// FIPS 180-4 example messages, with each implementation the CPU has
+QTEST_CASE(SHA256, Vectors) {
+    for (unsigned impl : {0u, (unsigned) SHA256_SHANI}) {
+        if (SHA256_Use(impl) != impl) {
+            continue;
+        }
+        QTEST_EXPECT(TestSHA256_Hash("abc") ==
+                     TestSHA256_FromHex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+        QTEST_EXPECT(TestSHA256_Hash("") ==
+                     TestSHA256_FromHex("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+        QTEST_EXPECT(TestSHA256_Hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+                     TestSHA256_FromHex("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+        QTEST_EXPECT(TestSHA256_Hash("abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+                                     "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu") ==
+                     TestSHA256_FromHex("cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"));
+
+        // one million 'a', fed in pieces that do not line up with blocks
+        std::string a(1000000, 'a');
+        SHA256_Ctx ctx;
+        SHA256_Init(&ctx);
+        for (size_t offset = 0, n = 1; offset < a.size(); offset += n, n = n * 3 % 1000 + 1) {
+            SHA256_Update(&ctx, (const byte*) a.data() + offset, MIN(n, a.size() - offset));
+        }
+        std::vector<byte> digest(SHA256_DIGEST_SIZE);
+        SHA256_Final(&ctx, digest.data());
+        QTEST_EXPECT(digest == TestSHA256_FromHex("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+    }
+    SHA256_Use(~0u);
+}
+
+// RFC 4231 test cases 2 and 6
+QTEST_CASE(SHA256, Hmac) {
+    std::string key = "Jefe";
+    std::string msg = "what do ya want for nothing?";
+    std::vector<byte> mac(SHA256_DIGEST_SIZE);
+    SHA256_Hmac((const byte*) key.data(), key.size(), (const byte*) msg.data(), msg.size(), mac.data());
+    QTEST_EXPECT(mac == TestSHA256_FromHex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"));
+
+    std::vector<byte> longKey(131, 0xaa);
+    msg = "Test Using Larger Than Block-Size Key - Hash Key First";
+    SHA256_Hmac(longKey.data(), longKey.size(), (const byte*) msg.data(), msg.size(), mac.data());
+    QTEST_EXPECT(mac == TestSHA256_FromHex("60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"));
+}
+
+// the batch agrees with hashing one message at a time, for any mix of
+// sizes and numbers of messages that do not fill the lanes
+QTEST_CASE(SHA256, Batch) {
+    std::vector<std::vector<byte>> msgs;
+    for (size_t i = 0; i < 21; i++) {
+        size_t size = (i < 12) ? 4096 : i * 131 % 1000;
+        msgs.push_back(std::vector<byte>(size));
+        for (size_t j = 0; j < size; j++) {
+            msgs[i][j] = (byte) (i * 7 + j * 13);
+        }
+    }
+    std::vector<const byte*> data;
+    std::vector<size_t> sizes;
+    for (const std::vector<byte>& msg : msgs) {
+        data.push_back(msg.data());
+        sizes.push_back(msg.size());
+    }
+
+    SHA256_Use(0);
+    std::vector<byte> expected(msgs.size() * SHA256_DIGEST_SIZE);
+    for (size_t i = 0; i < msgs.size(); i++) {
+        SHA256_Hash(data[i], sizes[i], expected.data() + i * SHA256_DIGEST_SIZE);
+    }
+    for (unsigned impl : {0u, (unsigned) SHA256_SHANI, (unsigned) SHA256_AVX2}) {
+        if (SHA256_Use(impl) != impl) {
+            continue;
+        }
+        for (size_t n : {(size_t) 1, (size_t) 3, (size_t) 8, msgs.size()}) {
+            std::vector<byte> digests(n * SHA256_DIGEST_SIZE);
+            SHA256_HashBatch(data.data(), sizes.data(), n, digests.data());
+            QTEST_EXPECT(std::equal(digests.begin(), digests.end(), expected.begin()));
+        }
+    }
+    SHA256_Use(~0u);
+}
+
+#endif  // TEST_SHA256_HPP_
@@ -0,0 +1,124 @@
+#ifndef TEST_STATE_HPP_
+#define TEST_STATE_HPP_
+
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/state.h"
+}
+
+// sets the mtime of fname to secondsAgo seconds in the past
+void StateTest_SetMtime(const std::string& fname, long secondsAgo) {
+    struct timeval times[2];
+    gettimeofday(&times[0], NULL);
+    times[0].tv_sec -= secondsAgo;
+    times[1] = times[0];
+    utimes(fname.c_str(), times);
+}
+
+// runs a batch that enciphers each input into its output, recording it
+// in the database fnameState. returns the number of skipped jobs
+size_t StateTest_Run(const std::string& fnameState, const std::vector<std::string>& fnameIns,
+                     const std::vector<std::string>& fnameOuts, const std::string& fnameKey, size_t* nHashed) {
+    Crypt_State state;
+    Crypt_StateLoad(&state, fnameState.c_str());
+    Crypt_Batch batch;
+    Crypt_BatchInit(&batch);
+    for (size_t i = 0; i < fnameIns.size(); i++) {
+        Crypt_BatchAdd(&batch, CRYPT_OP_ENCIPHER, fnameIns[i].c_str(), fnameOuts[i].c_str(),
+                       fnameKey.c_str(), CRYPT_SOF, CRYPT_EOF, 0);
+    }
+    std::vector<Crypt_StateEntry> fresh(batch.nJobs);
+    Crypt_StateSkipUnchanged(&state, &batch, fresh.data(), nHashed);
+    Crypt_BatchRun(&batch, 2);
+    Crypt_StateUpdate(&state, &batch, fresh.data());
+    Crypt_StateSave(&state, fnameState.c_str());
+
+    size_t nSkipped = 0;
+    for (size_t i = 0; i < batch.nJobs; i++) {
+        nSkipped += batch.jobs[i].skip;
+    }
+    Crypt_BatchFree(&batch);
+    Crypt_StateFree(&state);
+    return nSkipped;
+}
+
+QTEST_CASE(State, SkipUnchanged) {
+    std::string fnameState = TestFiles_Temp();
+    std::string fnameKey = TestFiles_Temp();
+    unlink(fnameState.c_str());
+    Crypt_GenerateKeyFile(fnameKey.c_str(), 16);
+
+    std::vector<std::string> fnameIns, fnameOuts;
+    for (int i = 0; i < 3; i++) {
+        fnameIns.push_back(TestFiles_Temp());
+        fnameOuts.push_back(TestFiles_Temp());
+        TestFiles_WriteRandom(fnameIns[i], 1000 + i);
+        StateTest_SetMtime(fnameIns[i], 100);
+    }
+
+    // old timestamps decide on their own, so nothing is hashed
+    size_t nHashed;
+    QTEST_EXPECT_EQUALS(0, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    QTEST_EXPECT_EQUALS(0, nHashed);
+    QTEST_EXPECT_EQUALS(3, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    QTEST_EXPECT_EQUALS(0, nHashed);
+
+    // a new size reruns without a hash. a new mtime with the same size is
+    // hashed, but with no hash recorded to compare with the job reruns
+    TestFiles_WriteRandom(fnameIns[0], 500);
+    StateTest_SetMtime(fnameIns[0], 100);
+    StateTest_SetMtime(fnameIns[1], 50);
+    QTEST_EXPECT_EQUALS(1, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    QTEST_EXPECT_EQUALS(1, nHashed);
+    std::string fnameExpected = TestFiles_Temp();
+    Crypt_EncipherRange(fnameIns[0].c_str(), fnameKey.c_str(), fnameExpected.c_str(), CRYPT_SOF, CRYPT_EOF);
+    QTEST_EXPECT(TestFiles_Read(fnameOuts[0]) == TestFiles_Read(fnameExpected));
+
+    // touching it again only costs a hash
+    StateTest_SetMtime(fnameIns[1], 40);
+    QTEST_EXPECT_EQUALS(3, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    QTEST_EXPECT_EQUALS(1, nHashed);
+
+    // a racy mtime (here ahead of the clock, so the test does not race
+    // it) is hashed when the job runs, and touching the file later is
+    // compared by hash
+    TestFiles_WriteRandom(fnameIns[2], 1500);
+    StateTest_SetMtime(fnameIns[2], -5);
+    QTEST_EXPECT_EQUALS(2, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    QTEST_EXPECT_EQUALS(1, nHashed);
+    StateTest_SetMtime(fnameIns[2], 10);
+    QTEST_EXPECT_EQUALS(3, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    QTEST_EXPECT_EQUALS(1, nHashed);
+
+    // new contents of the same size under a new mtime rerun the job
+    std::vector<byte> data = TestFiles_Read(fnameIns[2]);
+    data[0] ^= 1;
+    TestFiles_Write(fnameIns[2], data);
+    StateTest_SetMtime(fnameIns[2], 20);
+    QTEST_EXPECT_EQUALS(2, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    QTEST_EXPECT_EQUALS(1, nHashed);
+    Crypt_EncipherRange(fnameIns[2].c_str(), fnameKey.c_str(), fnameExpected.c_str(), CRYPT_SOF, CRYPT_EOF);
+    QTEST_EXPECT(TestFiles_Read(fnameOuts[2]) == TestFiles_Read(fnameExpected));
+
+    // a missing output or a different key reruns the job
+    unlink(fnameOuts[1].c_str());
+    QTEST_EXPECT_EQUALS(2, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+    Crypt_GenerateKeyFile(fnameKey.c_str(), 16);
+    QTEST_EXPECT_EQUALS(0, StateTest_Run(fnameState, fnameIns, fnameOuts, fnameKey, &nHashed));
+
+    for (int i = 0; i < 3; i++) {
+        unlink(fnameIns[i].c_str());
+        unlink(fnameOuts[i].c_str());
+    }
+    unlink(fnameExpected.c_str());
+    unlink(fnameState.c_str());
+    unlink(fnameKey.c_str());
+}
+
+#endif  // TEST_STATE_HPP_
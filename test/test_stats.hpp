@@ -0,0 +1,59 @@
+#ifndef TEST_STATS_HPP_
+#define TEST_STATS_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/ciph.h"
+}
+
+// each phase of a range operation is counted once per call, with the
+// bytes it handled, and nothing is recorded outside a run
+QTEST_CASE(Stats, Phases) {
+    TestFiles_Fixture files(5000, 24);
+
+    Crypt_Stats stats;
+    Crypt_StatsStart(&stats);
+    Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(), 100, 1100);
+    Crypt_StatsStop(&stats);
+    QTEST_EXPECT(Crypt_stats == NULL);
+
+    QTEST_EXPECT_EQUALS(1, stats.phases[CRYPT_PHASE_KEY].nCalls);
+    QTEST_EXPECT_EQUALS(24, stats.phases[CRYPT_PHASE_KEY].nBytes);
+    // before and after the range
+    QTEST_EXPECT_EQUALS(2, stats.phases[CRYPT_PHASE_COPY].nCalls);
+    QTEST_EXPECT_EQUALS(100 + 3900, stats.phases[CRYPT_PHASE_COPY].nBytes);
+    // the range fits one buffer, which is read, ciphered and written
+    for (Crypt_Phase phase : {CRYPT_PHASE_READ, CRYPT_PHASE_CIPHER, CRYPT_PHASE_WRITE}) {
+        QTEST_EXPECT_EQUALS(1, stats.phases[phase].nCalls);
+        QTEST_EXPECT_EQUALS(1000 / STATE_SIZE * STATE_SIZE, stats.phases[phase].nBytes);
+    }
+    QTEST_EXPECT_EQUALS(1, stats.phases[CRYPT_PHASE_PAD].nCalls);
+    QTEST_EXPECT(stats.wallNs >= stats.phases[CRYPT_PHASE_READ].wallNs + stats.phases[CRYPT_PHASE_CIPHER].wallNs +
+                                 stats.phases[CRYPT_PHASE_WRITE].wallNs);
+    QTEST_EXPECT(stats.peakRssKiB > 0);
+
+    Crypt_Stats unused = stats;
+    Crypt_DecipherRange(files.fnameCipher.c_str(), files.fnameKey.c_str(), files.fnameOut.c_str(), 100,
+                        CRYPT_CALC_ENDPT(100, 1100));
+    QTEST_EXPECT(memcmp(&unused, &stats, sizeof(stats)) == 0);
+
+    // the JSON report names every phase
+    FILE* file = tmpfile();
+    Crypt_PrintStats(file, &stats, true);
+    rewind(file);
+    char buf[2048] = {0};
+    fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    std::string json(buf);
+    QTEST_EXPECT(json.find("\"cipher\": {\"calls\": 1, \"bytes\": 992,") != std::string::npos);
+    // the range is counted once in the total
+    QTEST_EXPECT(json.find("\"total\": {\"bytes\": 5008,") != std::string::npos);
+    QTEST_EXPECT(json.find("\"peak_rss_kib\"") != std::string::npos);
+}
+
+#endif  // TEST_STATS_HPP_
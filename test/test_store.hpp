@@ -0,0 +1,133 @@
+#ifndef TEST_STORE_HPP_
+#define TEST_STORE_HPP_
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/store.h"
+}
+
+// returns the offsets of the cuts in data
+std::set<size_t> StoreTest_Cuts(const std::vector<byte>& data) {
+    std::set<size_t> cuts;
+    for (size_t offset = 0; offset < data.size();) {
+        size_t n = Crypt_CdcCut(data.data() + offset, data.size() - offset);
+        offset += n;
+        cuts.insert(offset);
+    }
+    return cuts;
+}
+
+QTEST_CASE(Store, Cut) {
+    std::vector<byte> data = TestFiles_RandomData(4 * 1024 * 1024);
+    std::set<size_t> cuts = StoreTest_Cuts(data);
+    size_t prev = 0;
+    for (size_t cut : cuts) {
+        QTEST_EXPECT(cut - prev <= CRYPT_CDC_MAX_SIZE);
+        QTEST_EXPECT(cut - prev > CRYPT_CDC_MIN_SIZE || cut == data.size());
+        prev = cut;
+    }
+    QTEST_EXPECT(cuts.size() > 20);
+
+    // cuts well past an insertion are where they were, shifted by it
+    std::vector<byte> inserted(data);
+    inserted.insert(inserted.begin() + 1024 * 1024, 100, 7);
+    std::set<size_t> shifted = StoreTest_Cuts(inserted);
+    size_t nSame = 0, nAfter = 0;
+    for (size_t cut : cuts) {
+        if (cut > 1024 * 1024 + CRYPT_CDC_MAX_SIZE) {
+            nAfter++;
+            nSame += shifted.count(cut + 100);
+        }
+    }
+    QTEST_EXPECT(nAfter > 0);
+    QTEST_EXPECT_EQUALS(nAfter, nSame);
+}
+
+QTEST_CASE(Store, PutGet) {
+    char dname[] = "/tmp/ciph_test_XXXXXX";
+    std::string dirStore = std::string(mkdtemp(dname)) + "/store";
+    TestFiles_Fixture files(3 * 1024 * 1024 + 77, 16);
+    std::string fnameB = files.Temp();
+    std::string fnameRecipeA = files.Temp();
+    std::string fnameRecipeB = files.Temp();
+    std::string fnameOtherKey = files.Temp();
+    Crypt_GenerateKeyFile(fnameOtherKey.c_str(), 16);
+
+    std::vector<byte> b(files.plaintext);
+    b.insert(b.begin() + 1500 * 1000, 1000, 42);
+    TestFiles_Write(fnameB, b);
+
+    Crypt_StoreStats stats;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_StorePut(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                        dirStore.c_str(), fnameRecipeA.c_str(), false, &stats));
+    QTEST_EXPECT_EQUALS(files.plaintext.size(), stats.rawBytes);
+    QTEST_EXPECT_EQUALS(stats.nChunks, stats.nNew);
+    size_t nChunksA = stats.nChunks;
+
+    // only the chunks around the insertion are new
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_StorePut(fnameB.c_str(), files.fnameKey.c_str(), dirStore.c_str(),
+                                                        fnameRecipeB.c_str(), false, &stats));
+    QTEST_EXPECT(stats.nNew >= 1 && stats.nNew <= 3);
+    QTEST_EXPECT(stats.newBytes < 4 * CRYPT_CDC_MAX_SIZE);
+    QTEST_EXPECT(stats.nChunks >= nChunksA - 1);
+
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_StoreGet(fnameRecipeA.c_str(), files.fnameKey.c_str(), dirStore.c_str(),
+                                                        files.fnameOut.c_str()));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == files.plaintext);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_StoreGet(fnameRecipeB.c_str(), files.fnameKey.c_str(), dirStore.c_str(),
+                                                        files.fnameOut.c_str()));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == b);
+    QTEST_EXPECT_EQUALS(CRYPT_E_ARGUMENT, Crypt_StoreGet(fnameRecipeA.c_str(), fnameOtherKey.c_str(), dirStore.c_str(),
+                                                         files.fnameOut.c_str()));
+
+    // repeated chunks within a file are stored once, compressed or not
+    std::vector<byte> zeros(2 * 1024 * 1024, 0);
+    TestFiles_Write(files.fnamePlain, zeros);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_StorePut(files.fnamePlain.c_str(), files.fnameKey.c_str(),
+                                                        dirStore.c_str(), fnameRecipeA.c_str(), true, &stats));
+    QTEST_EXPECT_EQUALS(zeros.size() / CRYPT_CDC_MAX_SIZE, stats.nChunks);
+    QTEST_EXPECT_EQUALS(1, stats.nNew);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_StoreGet(fnameRecipeA.c_str(), files.fnameKey.c_str(), dirStore.c_str(),
+                                                        files.fnameOut.c_str()));
+    QTEST_EXPECT(TestFiles_Read(files.fnameOut) == zeros);
+
+    // a damaged chunk fails
+    std::vector<byte> recipe = TestFiles_Read(fnameRecipeB);
+    Crypt_RecipeEntry entry;
+    memcpy(&entry, recipe.data() + sizeof(Crypt_RecipeHeader) + 2 * sizeof(Crypt_RecipeEntry), sizeof(entry));
+    char* path = Crypt_StorePath(dirStore.c_str(), entry.id);
+    std::vector<byte> chunk = TestFiles_Read(path);
+    chunk[sizeof(Crypt_ChunkHeader) + 5] ^= 1;
+    TestFiles_Write(path, chunk);
+    free(path);
+    QTEST_EXPECT_EQUALS(CRYPT_E_INTEGRITY, Crypt_StoreGet(fnameRecipeB.c_str(), files.fnameKey.c_str(),
+                                                          dirStore.c_str(), files.fnameOut.c_str()));
+
+    // the secret is not the encipherment of anything under the key, and
+    // differs from the other keys derived from it
+    byte key[CRYPT_MAX_KEY_SIZE];
+    size_t keySize;
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_LoadKeyFile(files.fnameKey.c_str(), key, &keySize));
+    AES_KeyCtx ctx;
+    AES_InitKeyCtx(&ctx, key, NK_BYTES_TO_WORDS(keySize));
+    byte secret[CRYPT_STORE_KEY_SIZE], macKey[CRYPT_MERKLE_KEY_SIZE];
+    Crypt_StoreSecret(&ctx, secret);
+    Crypt_MerkleKey(&ctx, macKey);
+    byte block[STATE_SIZE];
+    memcpy(block, "ciph store keys", STATE_SIZE - 1);
+    block[STATE_SIZE - 1] = 1;
+    AES_EncipherBlocks(&ctx, block, 1, block);
+    QTEST_EXPECT(memcmp(block, secret, STATE_SIZE) != 0);
+    QTEST_EXPECT(memcmp(macKey, secret, CRYPT_STORE_KEY_SIZE) != 0);
+
+    std::string cleanup = "rm -rf " + std::string(dname);
+    QTEST_EXPECT_EQUALS(0, system(cleanup.c_str()));
+}
+
+#endif  // TEST_STORE_HPP_
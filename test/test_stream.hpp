@@ -0,0 +1,74 @@
+#ifndef TEST_STREAM_HPP_
+#define TEST_STREAM_HPP_
+
+#include <string>
+#include <vector>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/stream.h"
+}
+
+// transforms data through a stream in pieces of the given sizes
+// (repeated), checking that every call writes whole blocks
+std::vector<byte> TestStream_Run(const byte key[], size_t keySize, bool encipher,
+                                 const std::vector<byte>& data, const std::vector<size_t>& sizes,
+                                 Crypt_Error_t* err) {
+    Crypt_StreamCtx s;
+    Crypt_Init(&s, key, keySize, encipher);
+    std::vector<byte> out;
+    std::vector<byte> buf;
+    for (size_t offset = 0, i = 0; offset < data.size(); i++) {
+        size_t n = MIN(sizes[i % sizes.size()], data.size() - offset);
+        buf.resize(n + STATE_SIZE);
+        size_t nOut = Crypt_Update(&s, data.data() + offset, n, buf.data());
+        QTEST_EXPECT_EQUALS(0, nOut % STATE_SIZE);
+        out.insert(out.end(), buf.begin(), buf.begin() + nOut);
+        offset += n;
+    }
+    buf.resize(STATE_SIZE);
+    size_t nOut;
+    *err = Crypt_Final(&s, buf.data(), &nOut);
+    out.insert(out.end(), buf.begin(), buf.begin() + nOut);
+    return out;
+}
+
+// the output matches Crypt_EncipherRange over the whole file, however
+// the input is split, and deciphers back
+QTEST_CASE(Stream, MatchesRange) {
+    TestFiles_Fixture files(0, 16);
+
+    for (size_t keySize : {16, 32}) {
+        Crypt_GenerateKeyFile(files.fnameKey.c_str(), keySize);
+        byte key[CRYPT_MAX_KEY_SIZE];
+        Crypt_KeyFromFile(files.fnameKey.c_str(), key);
+        for (size_t nBytes : {0, 15, 16, 17, 4096, 10000}) {
+            std::vector<byte> plaintext = TestFiles_WriteRandom(files.fnamePlain, nBytes);
+            Crypt_EncipherRange(files.fnamePlain.c_str(), files.fnameKey.c_str(), files.fnameCipher.c_str(), CRYPT_SOF,
+                                CRYPT_EOF);
+            std::vector<byte> expected = TestFiles_Read(files.fnameCipher);
+
+            Crypt_Error_t err;
+            for (const std::vector<size_t>& sizes : std::vector<std::vector<size_t>>{{1}, {16}, {7, 100, 0, 33}, {1 << 20}}) {
+                std::vector<byte> ciphertext = TestStream_Run(key, keySize, true, plaintext, sizes, &err);
+                QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, err);
+                QTEST_EXPECT(ciphertext == expected);
+                QTEST_EXPECT(TestStream_Run(key, keySize, false, ciphertext, sizes, &err) == plaintext);
+                QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, err);
+            }
+        }
+
+        // a ciphertext cut short or with a bad final block fails
+        std::vector<byte> ciphertext = TestFiles_Read(files.fnameCipher);
+        ciphertext.pop_back();
+        Crypt_Error_t err;
+        TestStream_Run(key, keySize, false, ciphertext, {64}, &err);
+        QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, err);
+        TestStream_Run(key, keySize, false, std::vector<byte>(), {64}, &err);
+        QTEST_EXPECT_EQUALS(CRYPT_E_FORMAT, err);
+    }
+}
+
+#endif  // TEST_STREAM_HPP_
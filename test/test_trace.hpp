@@ -0,0 +1,113 @@
+#ifndef TEST_TRACE_HPP_
+#define TEST_TRACE_HPP_
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "qtest.hpp"
+#include "test_files.hpp"
+
+extern "C" {
+    #include "../include/ciph.h"
+    #include "../include/batch.h"
+}
+
+// counts the occurrences of needle in haystack
+size_t TestTrace_Count(const std::string& haystack, const std::string& needle) {
+    size_t n = 0;
+    for (size_t i = haystack.find(needle); i != std::string::npos; i = haystack.find(needle, i + 1)) {
+        n++;
+    }
+    return n;
+}
+
+std::string TestTrace_Write() {
+    FILE* file = tmpfile();
+    QTEST_EXPECT(Crypt_TraceWrite(file));
+    std::string json;
+    rewind(file);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        json.append(buf, n);
+    }
+    fclose(file);
+    return json;
+}
+
+void* TestTrace_Thread(void* arg) {
+    for (int i = 0; i < 3; i++) {
+        Crypt_TraceRecord(CRYPT_SPAN_READ, Crypt_TraceNow());
+        Crypt_TraceRecord(CRYPT_SPAN_WRITE, Crypt_TraceNow());
+    }
+    return NULL;
+}
+
+// every thread gets its own track, spans recorded outside a trace are
+// dropped, and a full ring keeps its newest events
+QTEST_CASE(Trace, Rings) {
+    uint64_t before = Crypt_TraceNow();
+    Crypt_TraceStart();
+    // started before the trace
+    Crypt_TraceRecord(CRYPT_SPAN_SYNC, 0);
+    Crypt_TraceRecord(CRYPT_SPAN_CIPHER, before);
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, TestTrace_Thread, NULL);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Crypt_TraceStop();
+    Crypt_TraceRecord(CRYPT_SPAN_COPY, Crypt_TraceNow());
+
+    std::string json = TestTrace_Write();
+    QTEST_EXPECT(json.find("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [") == 0);
+    QTEST_EXPECT_EQUALS(1, TestTrace_Count(json, "\"name\": \"cipher\""));
+    QTEST_EXPECT_EQUALS(6, TestTrace_Count(json, "\"name\": \"read\""));
+    QTEST_EXPECT_EQUALS(6, TestTrace_Count(json, "\"name\": \"write\""));
+    QTEST_EXPECT_EQUALS(0, TestTrace_Count(json, "\"name\": \"copy\""));
+    QTEST_EXPECT_EQUALS(0, TestTrace_Count(json, "\"name\": \"sync\""));
+    QTEST_EXPECT_EQUALS(3, TestTrace_Count(json, "\"thread_name\""));
+
+    // a new trace drops the old events
+    Crypt_TraceStart();
+    for (size_t i = 0; i < CRYPT_TRACE_RING_SIZE + 10; i++) {
+        Crypt_TraceRecord((i < 10) ? CRYPT_SPAN_SYNC : CRYPT_SPAN_COPY, Crypt_TraceNow());
+    }
+    Crypt_TraceStop();
+    json = TestTrace_Write();
+    QTEST_EXPECT_EQUALS(0, TestTrace_Count(json, "\"name\": \"read\""));
+    QTEST_EXPECT_EQUALS(0, TestTrace_Count(json, "\"name\": \"sync\""));
+    QTEST_EXPECT_EQUALS(CRYPT_TRACE_RING_SIZE, TestTrace_Count(json, "\"name\": \"copy\""));
+    QTEST_EXPECT_EQUALS(1, TestTrace_Count(json, "\"thread_name\""));
+}
+
+#ifdef CIPH_TRACE
+// the hooks in the library record the spans of a real batch (built with
+// make test-trace)
+QTEST_CASE(Trace, BatchSpans) {
+    TestFiles_Fixture files(3 * CRYPT_BATCH_PART_SIZE + 37, 16);
+
+    Crypt_Batch batch;
+    Crypt_BatchInit(&batch);
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchAdd(&batch, CRYPT_OP_ENCIPHER, files.fnamePlain.c_str(),
+                                                        files.fnameCipher.c_str(), files.fnameKey.c_str(),
+                                                        CRYPT_SOF, CRYPT_EOF, 0));
+    Crypt_TraceStart();
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, Crypt_BatchRun(&batch, 2));
+    Crypt_TraceStop();
+    QTEST_EXPECT_EQUALS(CRYPT_E_SUCCESS, batch.jobs[0].err);
+    Crypt_BatchFree(&batch);
+
+    // one read, cipher and write span per part at least
+    std::string json = TestTrace_Write();
+    QTEST_EXPECT(TestTrace_Count(json, "\"name\": \"read\"") >= 3);
+    QTEST_EXPECT(TestTrace_Count(json, "\"name\": \"cipher\"") >= 3);
+    QTEST_EXPECT(TestTrace_Count(json, "\"name\": \"write\"") >= 3);
+    QTEST_EXPECT(TestTrace_Count(json, "\"thread_name\"") >= 1);
+}
+#endif
+
+#endif  // TEST_TRACE_HPP_
@@ -0,0 +1,31 @@
+#ifndef TEST_XXHASH_HPP_
+#define TEST_XXHASH_HPP_
+
+#include <string>
+
+#include "qtest.hpp"
+
+extern "C" {
+    #include "../include/xxhash.h"
+}
+
+// expected values from the reference implementation
+QTEST_CASE(XXHash, Vectors) {
+    QTEST_EXPECT(XXH_Hash64((const byte*) "", 0, 0) == 0xef46db3751d8e999ULL);
+    QTEST_EXPECT(XXH_Hash64((const byte*) "a", 1, 0) == 0xd24ec4f1a98c6e5bULL);
+    QTEST_EXPECT(XXH_Hash64((const byte*) "abc", 3, 0) == 0x44bc2cf5ad770999ULL);
+    QTEST_EXPECT(XXH_Hash64((const byte*) "abc", 3, 42) == 0x13c1d910702770e6ULL);
+
+    std::string s = "Nobody inspects the spammish repetition";
+    QTEST_EXPECT(XXH_Hash64((const byte*) s.data(), s.size(), 0) == 0xfbcea83c8a378bf1ULL);
+    QTEST_EXPECT(XXH_Hash64((const byte*) s.data(), s.size(), 42) == 0x44582824ca1018b5ULL);
+
+    byte data[100];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (byte) i;
+    }
+    QTEST_EXPECT(XXH_Hash64(data, sizeof(data), 0) == 0x6ac1e58032166597ULL);
+    QTEST_EXPECT(XXH_Hash64(data, sizeof(data), 42) == 0x819d2b726001d507ULL);
+}
+
+#endif  // TEST_XXHASH_HPP_